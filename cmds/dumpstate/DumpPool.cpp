@@ -18,9 +18,11 @@
 
 #include "DumpPool.h"
 
+#include <algorithm>
 #include <array>
 #include <thread>
 
+#include <android-base/stringprintf.h>
 #include <log/log.h>
 
 #include "dumpstate.h"
@@ -75,6 +77,10 @@ void DumpPool::shutdown() {
         thread.join();
     }
     threads_.clear();
+    sections_.clear();
+    sections_map_.clear();
+    std::fill(std::begin(running_sections_), std::end(running_sections_), 0);
+    sections_started_ = false;
     deleteTempFiles(tmp_root_);
     MYLOGI("shutdown thread pool");
 }
@@ -90,7 +96,15 @@ void DumpPool::waitForTask(const std::string& task_name, const std::string& titl
     Future future = iterator->second;
     futures_map_.erase(iterator);
 
+    auto wait_start = Clock::now();
     std::string result = future.get();
+    {
+        std::unique_lock lock(lock_);
+        auto section = sections_map_.find(task_name);
+        if (section != sections_map_.end()) {
+            section->second->wait_duration = Clock::now() - wait_start;
+        }
+    }
     if (result.empty()) {
         return;
     }
@@ -175,18 +189,187 @@ void DumpPool::setThreadName(const pthread_t thread, int id) {
     pthread_setname_np(thread, name.data());
 }
 
-void DumpPool::loop() {
+void DumpPool::addSection(const std::string& name, Resource resource, int cost_ms,
+        const std::vector<std::string>& dependencies, std::function<void(int)> dump_func) {
     std::unique_lock lock(lock_);
-    while (!shutdown_) {
-        if (tasks_.empty()) {
-            condition_variable_.wait(lock);
+    auto section = std::make_unique<Section>();
+    section->name = name;
+    section->resource = resource;
+    section->cost_ms = cost_ms;
+    section->dump_func = std::move(dump_func);
+    for (const auto& dependency : dependencies) {
+        auto iterator = sections_map_.find(dependency);
+        if (iterator == sections_map_.end()) {
+            MYLOGW("Section %s depends on unknown section %s\n", name.c_str(),
+                   dependency.c_str());
             continue;
+        }
+        section->dependencies.push_back(iterator->second);
+    }
+
+    Section* section_ptr = section.get();
+    section->task = Task([this, section_ptr]() {
+        std::unique_ptr<TmpFile> tmp_file_ptr = createTempFile();
+        if (!tmp_file_ptr) {
+            return std::string("");
+        }
+        // The deadline is only written before the threads pick up sections.
+        if (Clock::now() > sections_deadline_) {
+            section_ptr->skipped = true;
+            dprintf(tmp_file_ptr->fd.get(), "*** %s: skipped, out of time for dump sections\n",
+                    section_ptr->name.c_str());
         } else {
+            invokeTask(section_ptr->dump_func, section_ptr->name, tmp_file_ptr->fd.get());
+        }
+        fsync(tmp_file_ptr->fd.get());
+        return std::string(tmp_file_ptr->path);
+    });
+    futures_map_[name] = section->task.get_future().share();
+    sections_map_[name] = section_ptr;
+    sections_.push_back(std::move(section));
+}
+
+void DumpPool::runSections(std::chrono::steady_clock::time_point deadline) {
+    {
+        std::unique_lock lock(lock_);
+        sections_start_time_ = Clock::now();
+        sections_deadline_ = deadline;
+        sections_started_ = true;
+        condition_variable_.notify_all();
+    }
+    if (threads_.empty()) {
+        start();
+    }
+}
+
+DumpPool::Section* DumpPool::nextSectionLocked() {
+    if (!sections_started_) {
+        return nullptr;
+    }
+    Section* next = nullptr;
+    for (const auto& section : sections_) {
+        if (section->state != Section::WAITING ||
+                running_sections_[static_cast<int>(section->resource)] >=
+                MAX_RUNNING_SECTIONS[static_cast<int>(section->resource)]) {
+            continue;
+        }
+        bool ready = std::all_of(section->dependencies.begin(), section->dependencies.end(),
+                [](const Section* dependency) { return dependency->state == Section::DONE; });
+        if (ready && (next == nullptr || section->cost_ms > next->cost_ms)) {
+            next = section.get();
+        }
+    }
+    return next;
+}
+
+void DumpPool::runSection(std::unique_lock<std::mutex>& lock, Section* section) {
+    section->state = Section::RUNNING;
+    section->start_time = Clock::now();
+    running_sections_[static_cast<int>(section->resource)]++;
+    lock.unlock();
+    std::invoke(section->task);
+    lock.lock();
+    section->end_time = Clock::now();
+    section->state = Section::DONE;
+    running_sections_[static_cast<int>(section->resource)]--;
+    // Either a class slot is free, or the dependencies of other sections are met.
+    condition_variable_.notify_all();
+}
+
+static const char* resourceName(DumpPool::Resource resource) {
+    switch (resource) {
+        case DumpPool::Resource::CPU:
+            return "cpu";
+        case DumpPool::Resource::IO:
+            return "io";
+        case DumpPool::Resource::BINDER:
+            return "binder";
+        default:
+            return "?";
+    }
+}
+
+void DumpPool::dumpSectionTimings(int out_fd) {
+    std::unique_lock lock(lock_);
+    if (sections_.empty() || !sections_started_) {
+        return;
+    }
+    auto ms = [this](Clock::time_point time) {
+        return static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                time - sections_start_time_).count());
+    };
+    // A section is ready once the last of its dependencies is done.
+    auto ready_time = [this](const Section* section) {
+        Clock::time_point ready = sections_start_time_;
+        for (const Section* dependency : section->dependencies) {
+            ready = std::max(ready, dependency->end_time);
+        }
+        return ready;
+    };
+
+    dprintf(out_fd, "------ DUMP SECTION TIMINGS (ms since the sections were started) ------\n");
+    dprintf(out_fd, "%-32s %-6s %8s %8s %8s %8s %8s\n", "SECTION", "CLASS", "ESTIMATE", "READY",
+            "START", "END", "WAITED");
+    const Section* last = nullptr;
+    for (const auto& section : sections_) {
+        if (section->state != Section::DONE) {
+            dprintf(out_fd, "%-32s %-6s %8d %s\n", section->name.c_str(),
+                    resourceName(section->resource), section->cost_ms,
+                    section->state == Section::RUNNING ? "running" : "not run");
+            continue;
+        }
+        dprintf(out_fd, "%-32s %-6s %8d %8lld %8lld %8lld %8lld%s\n", section->name.c_str(),
+                resourceName(section->resource), section->cost_ms, ms(ready_time(section.get())),
+                ms(section->start_time), ms(section->end_time),
+                static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        section->wait_duration).count()),
+                section->skipped ? " (skipped)" : "");
+        if (last == nullptr || section->end_time > last->end_time) {
+            last = section.get();
+        }
+    }
+    if (last == nullptr) {
+        return;
+    }
+
+    // Walks back from the section that finished last through the dependency
+    // that held up each one the longest.
+    std::vector<const Section*> path;
+    for (const Section* section = last; section != nullptr;) {
+        path.push_back(section);
+        const Section* latest = nullptr;
+        for (const Section* dependency : section->dependencies) {
+            if (latest == nullptr || dependency->end_time > latest->end_time) {
+                latest = dependency;
+            }
+        }
+        section = latest;
+    }
+    std::string critical_path;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        const Section* section = *it;
+        critical_path += android::base::StringPrintf("%s%s (queued %lld, ran %lld)",
+                critical_path.empty() ? "" : " -> ", section->name.c_str(),
+                ms(section->start_time) - ms(ready_time(section)),
+                ms(section->end_time) - ms(section->start_time));
+    }
+    dprintf(out_fd, "Critical path: %s, done at %lld\n", critical_path.c_str(),
+            ms(last->end_time));
+}
+
+void DumpPool::loop() {
+    std::unique_lock lock(lock_);
+    while (!shutdown_) {
+        if (!tasks_.empty()) {
             std::packaged_task<std::string()> task = std::move(tasks_.front());
             tasks_.pop();
             lock.unlock();
             std::invoke(task);
             lock.lock();
+        } else if (Section* section = nextSectionLocked()) {
+            runSection(lock, section);
+        } else {
+            condition_variable_.wait(lock);
         }
     }
 }
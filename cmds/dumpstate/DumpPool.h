@@ -17,10 +17,14 @@
 #ifndef FRAMEWORK_NATIVE_CMD_DUMPPOOL_H_
 #define FRAMEWORK_NATIVE_CMD_DUMPPOOL_H_
 
+#include <chrono>
+#include <functional>
 #include <future>
 #include <map>
+#include <memory>
 #include <queue>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/macros.h>
@@ -117,6 +121,43 @@ class DumpPool {
         }
     }
 
+    /*
+     * What a dump section mostly waits on. At most MAX_RUNNING_SECTIONS of each
+     * class run at a time, so that two walks over every process don't compete
+     * for the same CPUs, while dumps from different services can overlap.
+     */
+    enum class Resource { CPU = 0, IO, BINDER, COUNT };
+
+    /*
+     * Adds a dump section to run once runSections() is called. Like the tasks
+     * of enqueueTaskWithFd, the section dumps to a temporary file, and its
+     * results are picked up with waitForTask.
+     *
+     * |name| The name of the section. It's also the title of the
+     * DurationReporter log.
+     * |resource| What the section mostly waits on.
+     * |cost_ms| The estimated duration of the section. Of the sections ready to
+     * run, the most expensive ones start first.
+     * |dependencies| The sections, added before this one, that have to finish
+     * before it starts.
+     * |dump_func| Callable function to dump the section to the given fd.
+     */
+    void addSection(const std::string& name, Resource resource, int cost_ms,
+            const std::vector<std::string>& dependencies, std::function<void(int)> dump_func);
+
+    /*
+     * Starts running the added sections on the threads of the pool, starting
+     * the pool if needed. Sections that haven't started by |deadline| are
+     * skipped, with a note in their results.
+     */
+    void runSections(std::chrono::steady_clock::time_point deadline);
+
+    /*
+     * Dumps when every section became ready, started and finished, how long
+     * waitForTask blocked on it, and the chain of sections that finished last.
+     */
+    void dumpSectionTimings(int out_fd);
+
     /*
      * Waits until the task is finished. Dumps the task results to the STDOUT_FILENO.
      */
@@ -169,6 +210,27 @@ class DumpPool {
       char path[1024];
     } TmpFile;
 
+    using Clock = std::chrono::steady_clock;
+
+    struct Section {
+        std::string name;
+        Resource resource;
+        int cost_ms;
+        std::vector<Section*> dependencies;
+        std::function<void(int)> dump_func;
+        Task task;
+        enum { WAITING, RUNNING, DONE } state = WAITING;
+        bool skipped = false;
+        Clock::time_point start_time;
+        Clock::time_point end_time;
+        // How long waitForTask blocked on the section.
+        Clock::duration wait_duration = Clock::duration::zero();
+    };
+
+    /* Returns the next section to run, or nullptr if none can start yet. */
+    Section* nextSectionLocked();
+    void runSection(std::unique_lock<std::mutex>& lock, Section* section);
+
     std::unique_ptr<TmpFile> createTempFile();
     void deleteTempFiles(const std::string& folder);
     void setThreadName(const pthread_t thread, int id);
@@ -184,6 +246,11 @@ class DumpPool {
 
   private:
     static const int MAX_THREAD_COUNT = 4;
+    static constexpr int MAX_RUNNING_SECTIONS[static_cast<int>(Resource::COUNT)] = {
+        1,  // CPU
+        1,  // IO
+        2,  // BINDER
+    };
 
     /* A path to a temporary folder for threads to create temporary files. */
     std::string tmp_root_;
@@ -196,6 +263,14 @@ class DumpPool {
     std::queue<Task> tasks_;
     std::map<std::string, Future> futures_map_;
 
+    // The dump sections, in the order they were added.
+    std::vector<std::unique_ptr<Section>> sections_;
+    std::map<std::string, Section*> sections_map_;
+    int running_sections_[static_cast<int>(Resource::COUNT)] = {};
+    bool sections_started_ = false;
+    Clock::time_point sections_start_time_;
+    Clock::time_point sections_deadline_;
+
     DISALLOW_COPY_AND_ASSIGN(DumpPool);
 };
 
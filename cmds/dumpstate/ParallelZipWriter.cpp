@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "dumpstate"
+
+#include "ParallelZipWriter.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <log/log.h>
+#include <zlib.h>
+
+#include "DumpstateInternal.h"
+
+namespace android {
+namespace os {
+namespace dumpstate {
+
+const int ParallelZipWriter::DEFAULT_THREAD_COUNT = 4;
+
+// As ZipWriter compresses.
+static const int COMPRESSION_LEVEL = Z_BEST_COMPRESSION;
+
+static const uint32_t LOCAL_FILE_HEADER_SIGNATURE = 0x04034b50;
+static const uint32_t DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+static const uint32_t CENTRAL_DIRECTORY_SIGNATURE = 0x02014b50;
+static const uint32_t END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+static const uint16_t ZIP_VERSION = 20;
+// The sizes and CRC are in the data descriptor after the data.
+static const uint16_t FLAG_DATA_DESCRIPTOR = 1 << 3;
+static const uint16_t METHOD_DEFLATED = 8;
+static const uint64_t MAX_ZIP32 = UINT32_MAX;
+
+struct ParallelZipWriter::Entry {
+    std::string name;
+    uint16_t dos_time;
+    uint16_t dos_date;
+    size_t chunks = 0;
+    // Filled in by the writer thread.
+    uint64_t offset = 0;
+    uint32_t crc = 0;
+    uint64_t compressed_size = 0;
+    uint64_t uncompressed_size = 0;
+};
+
+struct ParallelZipWriter::Chunk {
+    std::shared_ptr<Entry> entry;
+    bool first;
+    bool last;
+    size_t input_size;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> dictionary;
+    // Filled in by a compression thread.
+    bool compressed = false;
+    int32_t error = 0;
+    std::vector<uint8_t> output;
+    uint32_t crc = 0;
+};
+
+static void put16(std::vector<uint8_t>* out, uint16_t value) {
+    out->push_back(value & 0xff);
+    out->push_back(value >> 8);
+}
+
+static void put32(std::vector<uint8_t>* out, uint32_t value) {
+    put16(out, value & 0xffff);
+    put16(out, value >> 16);
+}
+
+// The MS-DOS time and date of the entries, in local time.
+static void toDosTime(time_t time, uint16_t* dos_time, uint16_t* dos_date) {
+    struct tm tm;
+    localtime_r(&time, &tm);
+    // The earliest valid time for ZIP file entries is 1980-01-01 00:00:00.
+    if (tm.tm_year < 80) {
+        tm.tm_year = 80;
+        tm.tm_mon = 0;
+        tm.tm_mday = 1;
+        tm.tm_hour = 0;
+        tm.tm_min = 0;
+        tm.tm_sec = 0;
+    }
+    *dos_time = tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec >> 1;
+    *dos_date = (tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday;
+}
+
+static uint64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+ParallelZipWriter::ParallelZipWriter(FILE* file, int thread_count)
+        : file_(file),
+          thread_count_(std::max(thread_count, 1)),
+          max_pending_chunks_(2 * thread_count_ + 1) {
+    long offset = ftell(file_);
+    offset_ = offset > 0 ? offset : 0;
+    buffer_.reserve(CHUNK_SIZE);
+}
+
+ParallelZipWriter::~ParallelZipWriter() {
+    shutdownThreads();
+}
+
+void ParallelZipWriter::startThreads() {
+    if (write_thread_.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock lock(lock_);
+        finishing_ = false;
+    }
+    for (int i = 0; i < thread_count_; i++) {
+        compress_threads_.emplace_back([this] { compressLoop(); });
+    }
+    write_thread_ = std::thread([this] { writeLoop(); });
+}
+
+void ParallelZipWriter::shutdownThreads() {
+    {
+        std::unique_lock lock(lock_);
+        finishing_ = true;
+        compress_cv_.notify_all();
+        write_cv_.notify_all();
+    }
+    for (auto& thread : compress_threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    compress_threads_.clear();
+    if (write_thread_.joinable()) {
+        write_thread_.join();
+    }
+}
+
+int32_t ParallelZipWriter::startEntry(const std::string& name, time_t time) {
+    if (finished_) {
+        return -EINVAL;
+    }
+    if (current_entry_) {
+        int32_t err = finishEntry();
+        if (err != 0) {
+            return err;
+        }
+    }
+    {
+        std::unique_lock lock(lock_);
+        if (error_ != 0) {
+            return error_;
+        }
+    }
+    if (name.empty() || name.size() > UINT16_MAX) {
+        return -EINVAL;
+    }
+    current_entry_ = std::make_shared<Entry>();
+    current_entry_->name = name;
+    toDosTime(time, &current_entry_->dos_time, &current_entry_->dos_date);
+    buffer_.clear();
+    dictionary_.clear();
+    return 0;
+}
+
+int32_t ParallelZipWriter::writeBytes(const void* data, size_t size) {
+    if (!current_entry_) {
+        return -EINVAL;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        size_t count = std::min(size, CHUNK_SIZE - buffer_.size());
+        buffer_.insert(buffer_.end(), bytes, bytes + count);
+        bytes += count;
+        size -= count;
+        if (buffer_.size() == CHUNK_SIZE) {
+            queueChunk(/* last = */ false);
+        }
+    }
+    std::unique_lock lock(lock_);
+    return error_;
+}
+
+int32_t ParallelZipWriter::finishEntry() {
+    if (!current_entry_) {
+        return -EINVAL;
+    }
+    queueChunk(/* last = */ true);
+    current_entry_ = nullptr;
+    std::unique_lock lock(lock_);
+    return error_;
+}
+
+void ParallelZipWriter::queueChunk(bool last) {
+    auto chunk = std::make_shared<Chunk>();
+    chunk->entry = current_entry_;
+    chunk->first = current_entry_->chunks++ == 0;
+    chunk->last = last;
+    chunk->dictionary = dictionary_;
+    if (!last) {
+        // The next chunk is primed with the end of this one.
+        if (buffer_.size() >= DICTIONARY_SIZE) {
+            dictionary_.assign(buffer_.end() - DICTIONARY_SIZE, buffer_.end());
+        } else {
+            dictionary_.insert(dictionary_.end(), buffer_.begin(), buffer_.end());
+            if (dictionary_.size() > DICTIONARY_SIZE) {
+                dictionary_.erase(dictionary_.begin(),
+                                  dictionary_.end() - DICTIONARY_SIZE);
+            }
+        }
+    }
+    chunk->input_size = buffer_.size();
+    chunk->input = std::move(buffer_);
+    buffer_ = std::vector<uint8_t>();
+    buffer_.reserve(CHUNK_SIZE);
+
+    startThreads();
+    std::unique_lock lock(lock_);
+    if (pending_.size() >= max_pending_chunks_) {
+        auto start = std::chrono::steady_clock::now();
+        written_cv_.wait(lock, [this] { return pending_.size() < max_pending_chunks_; });
+        stats_.stall_ns += elapsedNs(start);
+    }
+    pending_.push_back(chunk);
+    to_compress_.push_back(chunk);
+    compress_cv_.notify_one();
+}
+
+void ParallelZipWriter::compressLoop() {
+    std::unique_lock lock(lock_);
+    while (true) {
+        if (to_compress_.empty()) {
+            if (finishing_) {
+                return;
+            }
+            compress_cv_.wait(lock);
+            continue;
+        }
+        std::shared_ptr<Chunk> chunk = to_compress_.front();
+        to_compress_.pop_front();
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        chunk->crc = crc32(0, chunk->input.data(), chunk->input.size());
+        z_stream stream = {};
+        int rc = deflateInit2(&stream, COMPRESSION_LEVEL, Z_DEFLATED, -MAX_WBITS, 8,
+                              Z_DEFAULT_STRATEGY);
+        if (rc == Z_OK && !chunk->dictionary.empty()) {
+            rc = deflateSetDictionary(&stream, chunk->dictionary.data(),
+                                      chunk->dictionary.size());
+        }
+        if (rc == Z_OK) {
+            // Room for the sync flush marker on top of the worst case of deflate.
+            chunk->output.resize(deflateBound(&stream, chunk->input.size()) + 16);
+            stream.next_in = chunk->input.data();
+            stream.avail_in = chunk->input.size();
+            stream.next_out = chunk->output.data();
+            stream.avail_out = chunk->output.size();
+            // Only the last chunk ends the deflate stream; the others end on a
+            // byte boundary, so that the next one can be appended as is.
+            rc = deflate(&stream, chunk->last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (rc == (chunk->last ? Z_STREAM_END : Z_OK) && stream.avail_in == 0) {
+                chunk->output.resize(stream.total_out);
+                rc = Z_OK;
+            } else {
+                MYLOGE("deflate(%s): %d\n", chunk->entry->name.c_str(), rc);
+                rc = Z_STREAM_ERROR;
+            }
+            deflateEnd(&stream);
+        }
+        chunk->input = std::vector<uint8_t>();
+        chunk->dictionary = std::vector<uint8_t>();
+        uint64_t compress_ns = elapsedNs(start);
+
+        lock.lock();
+        chunk->error = rc == Z_OK ? 0 : -EIO;
+        chunk->compressed = true;
+        stats_.compress_ns += compress_ns;
+        write_cv_.notify_one();
+    }
+}
+
+void ParallelZipWriter::writeLoop() {
+    std::unique_lock lock(lock_);
+    while (true) {
+        if (pending_.empty() || !pending_.front()->compressed) {
+            if (pending_.empty() && finishing_) {
+                return;
+            }
+            write_cv_.wait(lock);
+            continue;
+        }
+        std::shared_ptr<Chunk> chunk = pending_.front();
+        int32_t error = error_ != 0 ? error_ : chunk->error;
+        lock.unlock();
+
+        if (error == 0) {
+            error = writeChunk(*chunk);
+        }
+
+        lock.lock();
+        if (error_ == 0) {
+            error_ = error;
+        }
+        if (error == 0) {
+            stats_.uncompressed_bytes += chunk->input_size;
+            stats_.compressed_bytes += chunk->output.size();
+            stats_.entries += chunk->last ? 1 : 0;
+        }
+        pending_.pop_front();
+        written_cv_.notify_all();
+    }
+}
+
+int32_t ParallelZipWriter::writeChunk(const Chunk& chunk) {
+    Entry& entry = *chunk.entry;
+    int32_t err;
+    if (chunk.first) {
+        entry.offset = offset_;
+        std::vector<uint8_t> header;
+        put32(&header, LOCAL_FILE_HEADER_SIGNATURE);
+        put16(&header, ZIP_VERSION);
+        put16(&header, FLAG_DATA_DESCRIPTOR);
+        put16(&header, METHOD_DEFLATED);
+        put16(&header, entry.dos_time);
+        put16(&header, entry.dos_date);
+        put32(&header, 0);  // crc, in the data descriptor
+        put32(&header, 0);  // compressed size, in the data descriptor
+        put32(&header, 0);  // uncompressed size, in the data descriptor
+        put16(&header, entry.name.size());
+        put16(&header, 0);  // extra field length
+        header.insert(header.end(), entry.name.begin(), entry.name.end());
+        if ((err = writeFully(header.data(), header.size())) != 0) {
+            return err;
+        }
+    }
+
+    if ((err = writeFully(chunk.output.data(), chunk.output.size())) != 0) {
+        return err;
+    }
+    entry.crc = crc32_combine(entry.crc, chunk.crc, chunk.input_size);
+    entry.compressed_size += chunk.output.size();
+    entry.uncompressed_size += chunk.input_size;
+    if (entry.uncompressed_size > MAX_ZIP32) {
+        return -EFBIG;
+    }
+
+    if (chunk.last) {
+        std::vector<uint8_t> descriptor;
+        put32(&descriptor, DATA_DESCRIPTOR_SIGNATURE);
+        put32(&descriptor, entry.crc);
+        put32(&descriptor, entry.compressed_size);
+        put32(&descriptor, entry.uncompressed_size);
+        if ((err = writeFully(descriptor.data(), descriptor.size())) != 0) {
+            return err;
+        }
+        entries_.push_back(chunk.entry);
+    }
+    return 0;
+}
+
+int32_t ParallelZipWriter::writeFully(const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, file_) != size) {
+        return errno != 0 ? -errno : -EIO;
+    }
+    offset_ += size;
+    return offset_ > MAX_ZIP32 ? -EFBIG : 0;
+}
+
+int32_t ParallelZipWriter::finish() {
+    if (finished_) {
+        return -EINVAL;
+    }
+    if (current_entry_) {
+        finishEntry();
+    }
+    shutdownThreads();
+    finished_ = true;
+    if (error_ != 0) {
+        return error_;
+    }
+    if (entries_.size() > UINT16_MAX) {
+        return -EFBIG;
+    }
+
+    std::vector<uint8_t> directory;
+    for (const auto& entry : entries_) {
+        put32(&directory, CENTRAL_DIRECTORY_SIGNATURE);
+        put16(&directory, ZIP_VERSION);  // version made by
+        put16(&directory, ZIP_VERSION);  // version needed to extract
+        put16(&directory, FLAG_DATA_DESCRIPTOR);
+        put16(&directory, METHOD_DEFLATED);
+        put16(&directory, entry->dos_time);
+        put16(&directory, entry->dos_date);
+        put32(&directory, entry->crc);
+        put32(&directory, entry->compressed_size);
+        put32(&directory, entry->uncompressed_size);
+        put16(&directory, entry->name.size());
+        put16(&directory, 0);  // extra field length
+        put16(&directory, 0);  // comment length
+        put16(&directory, 0);  // disk number
+        put16(&directory, 0);  // internal attributes
+        put32(&directory, 0);  // external attributes
+        put32(&directory, entry->offset);
+        directory.insert(directory.end(), entry->name.begin(), entry->name.end());
+    }
+    const uint64_t directory_offset = offset_;
+    const uint64_t directory_size = directory.size();
+    put32(&directory, END_OF_CENTRAL_DIRECTORY_SIGNATURE);
+    put16(&directory, 0);  // disk number
+    put16(&directory, 0);  // disk with the central directory
+    put16(&directory, entries_.size());
+    put16(&directory, entries_.size());
+    put32(&directory, directory_size);
+    put32(&directory, directory_offset);
+    put16(&directory, 0);  // comment length
+
+    int32_t err = writeFully(directory.data(), directory.size());
+    if (err == 0 && fflush(file_) != 0) {
+        err = -errno;
+    }
+    error_ = err;
+    return err;
+}
+
+ParallelZipWriter::Stats ParallelZipWriter::getStats() {
+    std::unique_lock lock(lock_);
+    return stats_;
+}
+
+}  // namespace dumpstate
+}  // namespace os
+}  // namespace android
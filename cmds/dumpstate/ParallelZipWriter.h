@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMEWORK_NATIVE_CMD_PARALLELZIPWRITER_H_
+#define FRAMEWORK_NATIVE_CMD_PARALLELZIPWRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace os {
+namespace dumpstate {
+
+/*
+ * Writes a zip file, compressing the entries on several threads. The data of
+ * every entry is cut into chunks that are deflated independently, each one
+ * primed with the end of the chunk before it so that little ratio is lost,
+ * and spliced into the file in order by a writer thread. Entries are added
+ * one at a time, as with ZipWriter; startEntry and writeBytes only wait for
+ * the compression when too many chunks are pending.
+ *
+ * Entries are written with data descriptors, so the output is never seeked
+ * and may be a pipe or a socket. Like ZipWriter, it doesn't write Zip64
+ * records, so the file is limited to 4GB and 65535 entries.
+ *
+ * The methods return 0 on success or a negative errno. Once a write fails,
+ * every later call fails with the same error.
+ */
+class ParallelZipWriter {
+  public:
+    /*
+     * |file| The file to write the zip to, from its current position. It's
+     * still owned by the caller, and must stay open until finish() returns.
+     * |thread_count| The number of compression threads.
+     */
+    explicit ParallelZipWriter(FILE* file, int thread_count = DEFAULT_THREAD_COUNT);
+    ~ParallelZipWriter();
+
+    /*
+     * Starts a new entry, finishing the current one if needed.
+     *
+     * |name| The path of the entry in the zip file.
+     * |time| The modification time of the entry.
+     */
+    int32_t startEntry(const std::string& name, time_t time);
+
+    /*
+     * Adds data to the current entry.
+     */
+    int32_t writeBytes(const void* data, size_t size);
+
+    /*
+     * Finishes the current entry. Its compression may still be in progress.
+     */
+    int32_t finishEntry();
+
+    /*
+     * Waits for all entries to be written, and writes the central directory.
+     * No entries can be added afterwards.
+     */
+    int32_t finish();
+
+    /*
+     * Waits for the entries added so far to be written, and stops the
+     * threads. Threads keep the credentials they were started with, so this
+     * has to be called before dropping privileges. The threads start again,
+     * with the new credentials, when the next chunk of data is ready.
+     */
+    void shutdownThreads();
+
+    struct Stats {
+        size_t entries;
+        uint64_t uncompressed_bytes;
+        uint64_t compressed_bytes;
+        // The time spent deflating, summed over all threads.
+        uint64_t compress_ns;
+        // The time startEntry, writeBytes and finishEntry waited for chunks to
+        // be written.
+        uint64_t stall_ns;
+    };
+
+    /*
+     * Returns the totals of the entries written so far.
+     */
+    Stats getStats();
+
+    static const int DEFAULT_THREAD_COUNT;
+
+  private:
+    struct Chunk;
+    struct Entry;
+
+    void startThreads();
+    void queueChunk(bool last);
+    void compressLoop();
+    void writeLoop();
+    int32_t writeChunk(const Chunk& chunk);
+    int32_t writeFully(const void* data, size_t size);
+
+    // The input of a chunk, before it's handed to the compression threads.
+    static const size_t CHUNK_SIZE = 1024 * 1024;
+    // The deflate window, which is also how much of the previous chunk primes the next one.
+    static const size_t DICTIONARY_SIZE = 32 * 1024;
+
+    FILE* file_;
+    const int thread_count_;
+    const size_t max_pending_chunks_;
+
+    std::mutex lock_;
+    std::condition_variable compress_cv_;
+    std::condition_variable write_cv_;
+    // Signalled when a chunk is written, so that producers can queue more.
+    std::condition_variable written_cv_;
+    // Chunks that are queued and not yet written, in order.
+    std::deque<std::shared_ptr<Chunk>> pending_;
+    // Chunks that no compression thread has picked up yet.
+    std::deque<std::shared_ptr<Chunk>> to_compress_;
+    bool finishing_ = false;
+    int32_t error_ = 0;
+
+    // Only used by the thread adding entries.
+    std::shared_ptr<Entry> current_entry_;
+    std::vector<uint8_t> buffer_;
+    std::vector<uint8_t> dictionary_;
+    bool finished_ = false;
+
+    // Only used by the writer thread, and read once it exits.
+    std::vector<std::shared_ptr<Entry>> entries_;
+    uint64_t offset_ = 0;
+
+    Stats stats_ = {};
+
+    // Only started and stopped by the thread adding entries.
+    std::vector<std::thread> compress_threads_;
+    std::thread write_thread_;
+
+    DISALLOW_COPY_AND_ASSIGN(ParallelZipWriter);
+};
+
+}  // namespace dumpstate
+}  // namespace os
+}  // namespace android
+
+#endif //FRAMEWORK_NATIVE_CMD_PARALLELZIPWRITER_H_
@@ -116,6 +116,7 @@ using android::os::IDumpstateListener;
 using android::os::dumpstate::CommandOptions;
 using android::os::dumpstate::DumpFileToFd;
 using android::os::dumpstate::DumpPool;
+using android::os::dumpstate::ParallelZipWriter;
 using android::os::dumpstate::PropertiesHelper;
 using android::os::dumpstate::TaskQueue;
 
@@ -216,9 +217,10 @@ static const std::string ANR_FILE_PREFIX = "anr_";
     RUN_SLOW_FUNCTION_AND_LOG(log_title, func_ptr, __VA_ARGS__);               \
     RETURN_IF_USER_DENIED_CONSENT();
 
-#define WAIT_TASK_WITH_CONSENT_CHECK(task_name, pool_ptr) \
-    RETURN_IF_USER_DENIED_CONSENT();                      \
-    pool_ptr->waitForTask(task_name);                     \
+// Dumps one of the sections of GetDumpSections(), checking user consent before and after.
+#define DUMP_SECTION_WITH_CONSENT_CHECK(section_name) \
+    RETURN_IF_USER_DENIED_CONSENT();                  \
+    DumpSection(section_name);                        \
     RETURN_IF_USER_DENIED_CONSENT();
 
 static const char* WAKE_LOCK_NAME = "dumpstate_wakelock";
@@ -230,6 +232,14 @@ static const std::string DUMP_INCIDENT_REPORT_TASK = "INCIDENT REPORT";
 static const std::string DUMP_HALS_TASK = "DUMP HALS";
 static const std::string DUMP_BOARD_TASK = "dumpstate_board()";
 static const std::string DUMP_CHECKINS_TASK = "DUMP CHECKINS";
+static const std::string DUMP_APP_INFOS_TASK = "DUMP APP INFOS";
+static const std::string PROCRANK_TASK = "PROCRANK";
+static const std::string LIBRANK_TASK = "LIBRANK";
+static const std::string LSOF_TASK = "LIST OF OPEN FILES";
+static const std::string DROPBOX_CRASHES_TASK = "DROPBOX CRASHES";
+
+// How long after the start of dumpstate() its sections may still start.
+static const auto DUMP_SECTIONS_DEADLINE = std::chrono::minutes(5);
 
 namespace android {
 namespace os {
@@ -841,11 +851,9 @@ status_t Dumpstate::AddZipEntryFromFd(const std::string& entry_name, int fd,
 
     // Logging statement  below is useful to time how long each entry takes, but it's too verbose.
     // MYLOGD("Adding zip entry %s\n", entry_name.c_str());
-    int32_t err = zip_writer_->StartEntryWithTime(valid_name.c_str(), ZipWriter::kCompress,
-                                                  get_mtime(fd, ds.now_));
+    int32_t err = zip_writer_->startEntry(valid_name, get_mtime(fd, ds.now_));
     if (err != 0) {
-        MYLOGE("zip_writer_->StartEntryWithTime(%s): %s\n", valid_name.c_str(),
-               ZipWriter::ErrorCodeString(err));
+        MYLOGE("zip_writer_->startEntry(%s): %s\n", valid_name.c_str(), strerror(-err));
         return UNKNOWN_ERROR;
     }
     bool finished_entry = false;
@@ -853,9 +861,9 @@ status_t Dumpstate::AddZipEntryFromFd(const std::string& entry_name, int fd,
         if (!finished_entry) {
             // This should only be called when we're going to return an earlier error,
             // which would've been logged. This may imply the file is already corrupt
-            // and any further logging from FinishEntry is more likely to mislead than
+            // and any further logging from finishEntry is more likely to mislead than
             // not.
-            this->zip_writer_->FinishEntry();
+            this->zip_writer_->finishEntry();
         }
     };
     auto scope_guard = android::base::make_scope_guard(finish_entry);
@@ -892,17 +900,17 @@ status_t Dumpstate::AddZipEntryFromFd(const std::string& entry_name, int fd,
             MYLOGE("read(%s): %s\n", entry_name.c_str(), strerror(errno));
             return -errno;
         }
-        err = zip_writer_->WriteBytes(buffer.data(), bytes_read);
+        err = zip_writer_->writeBytes(buffer.data(), bytes_read);
         if (err) {
-            MYLOGE("zip_writer_->WriteBytes(): %s\n", ZipWriter::ErrorCodeString(err));
+            MYLOGE("zip_writer_->writeBytes(): %s\n", strerror(-err));
             return UNKNOWN_ERROR;
         }
     }
 
-    err = zip_writer_->FinishEntry();
+    err = zip_writer_->finishEntry();
     finished_entry = true;
     if (err != 0) {
-        MYLOGE("zip_writer_->FinishEntry(): %s\n", ZipWriter::ErrorCodeString(err));
+        MYLOGE("zip_writer_->finishEntry(): %s\n", strerror(-err));
         return UNKNOWN_ERROR;
     }
 
@@ -942,23 +950,21 @@ bool Dumpstate::AddTextZipEntry(const std::string& entry_name, const std::string
         return false;
     }
     MYLOGD("Adding zip text entry %s\n", entry_name.c_str());
-    int32_t err = zip_writer_->StartEntryWithTime(entry_name.c_str(), ZipWriter::kCompress, ds.now_);
+    int32_t err = zip_writer_->startEntry(entry_name, ds.now_);
     if (err != 0) {
-        MYLOGE("zip_writer_->StartEntryWithTime(%s): %s\n", entry_name.c_str(),
-               ZipWriter::ErrorCodeString(err));
+        MYLOGE("zip_writer_->startEntry(%s): %s\n", entry_name.c_str(), strerror(-err));
         return false;
     }
 
-    err = zip_writer_->WriteBytes(content.c_str(), content.length());
+    err = zip_writer_->writeBytes(content.c_str(), content.length());
     if (err != 0) {
-        MYLOGE("zip_writer_->WriteBytes(%s): %s\n", entry_name.c_str(),
-               ZipWriter::ErrorCodeString(err));
+        MYLOGE("zip_writer_->writeBytes(%s): %s\n", entry_name.c_str(), strerror(-err));
         return false;
     }
 
-    err = zip_writer_->FinishEntry();
+    err = zip_writer_->finishEntry();
     if (err != 0) {
-        MYLOGE("zip_writer_->FinishEntry(): %s\n", ZipWriter::ErrorCodeString(err));
+        MYLOGE("zip_writer_->finishEntry(): %s\n", strerror(-err));
         return false;
     }
 
@@ -1322,8 +1328,6 @@ static Dumpstate::RunStatus RunDumpsysProto(const std::string& title, int priori
             bool dumpTerminated = (status == OK);
             dumpsys.stopDumpThread(dumpTerminated);
         }
-        ZipWriter::FileEntry file_entry;
-        ds.zip_writer_->GetLastEntry(&file_entry);
 
         auto elapsed_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::steady_clock::now() - start);
@@ -1586,6 +1590,66 @@ static void DumpAppInfos(int out_fd = STDOUT_FILENO) {
             DUMPSYS_COMPONENTS_OPTIONS, 0, out_fd);
 }
 
+static void DumpDropboxCrashes(int out_fd) {
+    RunDumpsys("DROPBOX SYSTEM SERVER CRASHES", {"dropbox", "-p", "system_server_crash"}, out_fd);
+    RunDumpsys("DROPBOX SYSTEM APP CRASHES", {"dropbox", "-p", "system_app_crash"}, out_fd);
+}
+
+// The slow sections of dumpstate() that only write to the fd they are given, so that the
+// DumpPool can dump them ahead of time while dumpstate() works through the rest. Their results
+// still land in the bugreport where dumpstate() waits for them. The costs are rough durations
+// on a typical device, used to start the longest sections first.
+struct SectionSpec {
+    std::string name;
+    DumpPool::Resource resource;
+    int cost_ms;
+    std::vector<std::string> dependencies;
+    std::function<void(int)> dump_func;
+};
+
+static const std::vector<SectionSpec>& GetDumpSections() {
+    using Resource = DumpPool::Resource;
+    static const std::vector<SectionSpec> sections = {
+        {DUMP_BOARD_TASK, Resource::BINDER, 20000, {},
+         [](int out_fd) { ds.DumpstateBoard(out_fd); }},
+        {DUMP_INCIDENT_REPORT_TASK, Resource::BINDER, 15000, {},
+         [](int) { DumpIncidentReport(); }},
+        {DUMP_APP_INFOS_TASK, Resource::BINDER, 12000, {}, DumpAppInfos},
+        {DUMP_HALS_TASK, Resource::BINDER, 10000, {}, DumpHals},
+        {DUMP_CHECKINS_TASK, Resource::BINDER, 10000, {}, DumpCheckins},
+        {DROPBOX_CRASHES_TASK, Resource::BINDER, 2000, {}, DumpDropboxCrashes},
+        {PROCRANK_TASK, Resource::CPU, 5000, {},
+         [](int out_fd) { RunCommand("PROCRANK", {"procrank"}, AS_ROOT_20, false, out_fd); }},
+        // Both walk the page maps of every process; procrank is read first so that it isn't
+        // skewed by librank.
+        {LIBRANK_TASK, Resource::CPU, 8000, {PROCRANK_TASK},
+         [](int out_fd) {
+             RunCommand("LIBRANK", {"librank"}, CommandOptions::AS_ROOT, false, out_fd);
+         }},
+        {LSOF_TASK, Resource::IO, 3000, {},
+         [](int out_fd) {
+             RunCommand("LIST OF OPEN FILES", {"lsof"}, CommandOptions::AS_ROOT, false, out_fd);
+         }},
+    };
+    return sections;
+}
+
+// Dumps the section to stdout, waiting for the DumpPool if the section runs there.
+static void DumpSection(const std::string& name) {
+    if (ds.dump_pool_) {
+        ds.dump_pool_->waitForTask(name);
+        return;
+    }
+    for (const SectionSpec& section : GetDumpSections()) {
+        if (section.name == name) {
+            DurationReporter duration_reporter(name);
+            section.dump_func(STDOUT_FILENO);
+            return;
+        }
+    }
+    MYLOGE("Unknown dump section %s\n", name.c_str());
+}
+
 // Dumps various things. Returns early with status USER_CONSENT_DENIED if user denies consent
 // via the consent they are shown. Ignores other errors that occur while running various
 // commands. The consent checking is currently done around long running tasks, which happen to
@@ -1593,16 +1657,18 @@ static void DumpAppInfos(int out_fd = STDOUT_FILENO) {
 static Dumpstate::RunStatus dumpstate() {
     DurationReporter duration_reporter("DUMPSTATE");
 
-    // Enqueue slow functions into the thread pool, if the parallel run is enabled.
+    // Schedule the slow sections on the thread pool, if the parallel run is enabled.
     if (ds.dump_pool_) {
         // Pool was shutdown in DumpstateDefaultAfterCritical method in order to
-        // drop root user. Restarts it with two threads for the parallel run.
-        ds.dump_pool_->start(/* thread_counts = */2);
+        // drop root user. Restarts it for the parallel run; how many sections
+        // run at once is bounded by their resource classes.
+        ds.dump_pool_->start();
 
-        ds.dump_pool_->enqueueTaskWithFd(DUMP_HALS_TASK, &DumpHals, _1);
-        ds.dump_pool_->enqueueTask(DUMP_INCIDENT_REPORT_TASK, &DumpIncidentReport);
-        ds.dump_pool_->enqueueTaskWithFd(DUMP_BOARD_TASK, &Dumpstate::DumpstateBoard, &ds, _1);
-        ds.dump_pool_->enqueueTaskWithFd(DUMP_CHECKINS_TASK, &DumpCheckins, _1);
+        for (const SectionSpec& section : GetDumpSections()) {
+            ds.dump_pool_->addSection(section.name, section.resource, section.cost_ms,
+                                      section.dependencies, section.dump_func);
+        }
+        ds.dump_pool_->runSections(std::chrono::steady_clock::now() + DUMP_SECTIONS_DEADLINE);
     }
 
     // Dump various things. Note that anything that takes "long" (i.e. several seconds) should
@@ -1615,7 +1681,7 @@ static Dumpstate::RunStatus dumpstate() {
     RunCommand("CPU INFO", {"top", "-b", "-n", "1", "-H", "-s", "6", "-o",
                             "pid,tid,user,pr,ni,%cpu,s,virt,res,pcy,cmd,name"});
 
-    RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK(RunCommand, "PROCRANK", {"procrank"}, AS_ROOT_20);
+    DUMP_SECTION_WITH_CONSENT_CHECK(PROCRANK_TASK);
 
     RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK(DumpVisibleWindowViews);
 
@@ -1633,14 +1699,9 @@ static Dumpstate::RunStatus dumpstate() {
     RunCommand("PROCESSES AND THREADS",
                {"ps", "-A", "-T", "-Z", "-O", "pri,nice,rtprio,sched,pcy,time"});
 
-    RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK(RunCommand, "LIBRANK", {"librank"},
-                                         CommandOptions::AS_ROOT);
+    DUMP_SECTION_WITH_CONSENT_CHECK(LIBRANK_TASK);
 
-    if (ds.dump_pool_) {
-        WAIT_TASK_WITH_CONSENT_CHECK(DUMP_HALS_TASK, ds.dump_pool_);
-    } else {
-        RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK_AND_LOG(DUMP_HALS_TASK, DumpHals);
-    }
+    DUMP_SECTION_WITH_CONSENT_CHECK(DUMP_HALS_TASK);
 
     RunCommand("PRINTENV", {"printenv"});
     RunCommand("NETSTAT", {"netstat", "-nW"});
@@ -1661,7 +1722,7 @@ static Dumpstate::RunStatus dumpstate() {
         do_dmesg();
     }
 
-    RunCommand("LIST OF OPEN FILES", {"lsof"}, CommandOptions::AS_ROOT);
+    DUMP_SECTION_WITH_CONSENT_CHECK(LSOF_TASK);
 
     RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK(for_each_pid, do_showmap, "SMAPS OF ALL PROCESSES");
 
@@ -1733,11 +1794,7 @@ static Dumpstate::RunStatus dumpstate() {
 
     ds.AddDir(SNAPSHOTCTL_LOG_DIR, false);
 
-    if (ds.dump_pool_) {
-        WAIT_TASK_WITH_CONSENT_CHECK(DUMP_BOARD_TASK, ds.dump_pool_);
-    } else {
-        RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK_AND_LOG(DUMP_BOARD_TASK, ds.DumpstateBoard);
-    }
+    DUMP_SECTION_WITH_CONSENT_CHECK(DUMP_BOARD_TASK);
 
     /* Migrate the ril_dumpstate to a device specific dumpstate? */
     int rilDumpstateTimeout = android::base::GetIntProperty("ril.dumpstate.timeout", 0);
@@ -1762,20 +1819,15 @@ static Dumpstate::RunStatus dumpstate() {
     /* Dump Bluetooth HCI logs after getting bluetooth_manager dumpsys */
     ds.AddDir("/data/misc/bluetooth/logs", true);
 
-    if (ds.dump_pool_) {
-        WAIT_TASK_WITH_CONSENT_CHECK(DUMP_CHECKINS_TASK, ds.dump_pool_);
-    } else {
-        RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK_AND_LOG(DUMP_CHECKINS_TASK, DumpCheckins);
-    }
+    DUMP_SECTION_WITH_CONSENT_CHECK(DUMP_CHECKINS_TASK);
 
-    RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK(DumpAppInfos);
+    DUMP_SECTION_WITH_CONSENT_CHECK(DUMP_APP_INFOS_TASK);
 
     printf("========================================================\n");
     printf("== Dropbox crashes\n");
     printf("========================================================\n");
 
-    RunDumpsys("DROPBOX SYSTEM SERVER CRASHES", {"dropbox", "-p", "system_server_crash"});
-    RunDumpsys("DROPBOX SYSTEM APP CRASHES", {"dropbox", "-p", "system_app_crash"});
+    DUMP_SECTION_WITH_CONSENT_CHECK(DROPBOX_CRASHES_TASK);
 
     printf("========================================================\n");
     printf("== Final progress (pid %d): %d/%d (estimated %d)\n", ds.pid_, ds.progress_->Get(),
@@ -1796,11 +1848,10 @@ static Dumpstate::RunStatus dumpstate() {
     /* Dump cgroupfs */
     ds.AddDir(CGROUPFS_DIR, true);
 
+    DUMP_SECTION_WITH_CONSENT_CHECK(DUMP_INCIDENT_REPORT_TASK);
+
     if (ds.dump_pool_) {
-        WAIT_TASK_WITH_CONSENT_CHECK(DUMP_INCIDENT_REPORT_TASK, ds.dump_pool_);
-    } else {
-        RUN_SLOW_FUNCTION_WITH_CONSENT_CHECK_AND_LOG(DUMP_INCIDENT_REPORT_TASK,
-                DumpIncidentReport);
+        ds.dump_pool_->dumpSectionTimings(STDOUT_FILENO);
     }
 
     return Dumpstate::RunStatus::OK;
@@ -1883,6 +1934,10 @@ Dumpstate::RunStatus Dumpstate::DumpstateDefaultAfterCritical() {
         // drop the root user.
         dump_pool_->shutdown();
     }
+    if (zip_writer_) {
+        // Same for the zip writer, whose threads start again with the next entry.
+        zip_writer_->shutdownThreads();
+    }
     if (!DropRootUser()) {
         return Dumpstate::RunStatus::ERROR;
     }
@@ -1951,6 +2006,9 @@ static void DumpstateTelephonyOnly(const std::string& calling_package) {
     const bool include_sensitive_info = !PropertiesHelper::IsUserBuild();
 
     DumpstateRadioAsRoot();
+    if (ds.zip_writer_) {
+        ds.zip_writer_->shutdownThreads();
+    }
     if (!DropRootUser()) {
         return;
     }
@@ -2056,6 +2114,9 @@ static void DumpstateWifiOnly() {
     DurationReporter duration_reporter("DUMPSTATE");
 
     DumpstateRadioAsRoot();
+    if (ds.zip_writer_) {
+        ds.zip_writer_->shutdownThreads();
+    }
     if (!DropRootUser()) {
         return;
     }
@@ -2408,11 +2469,16 @@ bool Dumpstate::FinishZipFile() {
     }
     fprintf(stderr, "\n");
 
-    int32_t err = zip_writer_->Finish();
+    int32_t err = zip_writer_->finish();
     if (err != 0) {
-        MYLOGE("zip_writer_->Finish(): %s\n", ZipWriter::ErrorCodeString(err));
+        MYLOGE("zip_writer_->finish(): %s\n", strerror(-err));
         return false;
     }
+    ParallelZipWriter::Stats stats = zip_writer_->getStats();
+    MYLOGI("Zipped %zu entries, %" PRIu64 " bytes into %" PRIu64 " (compressing took %" PRIu64
+           "ms of CPU time, dumpstate waited %" PRIu64 "ms for it)\n", stats.entries,
+           stats.uncompressed_bytes, stats.compressed_bytes, stats.compress_ns / 1000000,
+           stats.stall_ns / 1000000);
 
     // TODO: remove once FinishZipFile() is automatically handled by Dumpstate's destructor.
     ds.zip_file.reset(nullptr);
@@ -2460,7 +2526,7 @@ static void MaybeResolveSymlink(std::string* path) {
 }
 
 /*
- * Prepares state like filename, screenshot path, etc in Dumpstate. Also initializes ZipWriter
+ * Prepares state like filename, screenshot path, etc in Dumpstate. Also initializes the zip writer
  * and adds the version file. Return false if zip_file could not be open to write.
  */
 static bool PrepareToWriteToFile() {
@@ -2506,7 +2572,7 @@ static bool PrepareToWriteToFile() {
         MYLOGE("fopen(%s, 'wb'): %s\n", ds.path_.c_str(), strerror(errno));
         return false;
     }
-    ds.zip_writer_.reset(new ZipWriter(ds.zip_file.get()));
+    ds.zip_writer_.reset(new ParallelZipWriter(ds.zip_file.get()));
     ds.AddTextZipEntry("version.txt", ds.version_);
     return true;
 }
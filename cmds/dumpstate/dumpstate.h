@@ -32,10 +32,10 @@
 #include <android/os/IDumpstate.h>
 #include <android/os/IDumpstateListener.h>
 #include <utils/StrongPointer.h>
-#include <ziparchive/zip_writer.h>
 
 #include "DumpstateUtil.h"
 #include "DumpPool.h"
+#include "ParallelZipWriter.h"
 #include "TaskQueue.h"
 
 // Workaround for const char *args[MAX_ARGS_ARRAY_SIZE] variables until they're converted to
@@ -60,8 +60,6 @@ class ZippedBugReportStreamTest;
 }  // namespace os
 }  // namespace android
 
-class ZipWriter;
-
 // TODO: remove once moved to HAL
 #ifdef __cplusplus
 extern "C" {
@@ -502,7 +500,7 @@ class Dumpstate {
     std::unique_ptr<FILE, int (*)(FILE*)> zip_file{nullptr, fclose};
 
     // Pointer to the zip structure.
-    std::unique_ptr<ZipWriter> zip_writer_;
+    std::unique_ptr<android::os::dumpstate::ParallelZipWriter> zip_writer_;
 
     // Binder object listening to progress.
     android::sp<android::os::IDumpstateListener> listener_;
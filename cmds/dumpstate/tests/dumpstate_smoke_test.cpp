@@ -20,14 +20,21 @@
 #include <binder/IServiceManager.h>
 #include <binder/ProcessState.h>
 #include <cutils/properties.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <libgen.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <ziparchive/zip_archive.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
 #include <regex>
+#include <thread>
 
 #include "dumpstate.h"
 
@@ -133,6 +140,63 @@ void ParseSections(const std::string& zip_path, std::vector<SectionInfo>* sectio
     CloseArchive(handle);
 }
 
+// Returns the space taken by the files under |dir|.
+int64_t DiskUsage(const std::string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return 0;
+    }
+    int64_t bytes = 0;
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        std::string path = dir + "/" + de->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) continue;
+        bytes += S_ISDIR(st.st_mode) ? DiskUsage(path) : st.st_blocks * 512;
+    }
+    closedir(d);
+    return bytes;
+}
+
+// Samples the disk usage of a directory on a thread of its own, and keeps the peak above what
+// was there when it started.
+class DiskUsageMonitor {
+  public:
+    explicit DiskUsageMonitor(const std::string& dir)
+        : dir_(dir), initial_(DiskUsage(dir)), thread_([this] { Run(); }) {
+    }
+
+    // Stops sampling, and returns the peak.
+    int64_t Stop() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopped_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+        return std::max<int64_t>(peak_ - initial_, 0);
+    }
+
+  private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (!stopped_) {
+            peak_ = std::max(peak_, DiskUsage(dir_));
+            cv_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        peak_ = std::max(peak_, DiskUsage(dir_));
+    }
+
+    const std::string dir_;
+    const int64_t initial_;
+    int64_t peak_ = 0;
+    bool stopped_ = false;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::thread thread_;
+};
+
 }  // namespace
 
 /**
@@ -206,6 +270,8 @@ class ZippedBugreportGenerationTest : public Test {
     static std::shared_ptr<std::vector<SectionInfo>> sections;
     static Dumpstate& ds;
     static std::chrono::milliseconds duration;
+    // The most disk space the bugreport and its temporary files took at once.
+    static int64_t peak_disk_bytes;
     static void GenerateBugreport() {
         // clang-format off
         char* argv[] = {
@@ -214,10 +280,12 @@ class ZippedBugreportGenerationTest : public Test {
         // clang-format on
         sp<DumpstateListener> listener(new DumpstateListener(dup(fileno(stdout)), sections));
         ds.listener_ = listener;
+        DiskUsageMonitor disk_usage(ds.bugreport_internal_dir_);
         auto start = std::chrono::steady_clock::now();
         ds.ParseCommandlineAndRun(ARRAY_SIZE(argv), argv);
         auto end = std::chrono::steady_clock::now();
         duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        peak_disk_bytes = disk_usage.Stop();
     }
 
     static const std::string getZipFilePath() {
@@ -228,6 +296,7 @@ std::shared_ptr<std::vector<SectionInfo>> ZippedBugreportGenerationTest::section
     std::make_shared<std::vector<SectionInfo>>();
 Dumpstate& ZippedBugreportGenerationTest::ds = Dumpstate::GetInstance();
 std::chrono::milliseconds ZippedBugreportGenerationTest::duration = 0s;
+int64_t ZippedBugreportGenerationTest::peak_disk_bytes = 0;
 
 TEST_F(ZippedBugreportGenerationTest, IsGeneratedWithoutErrors) {
     GenerateBugreport();
@@ -247,6 +316,15 @@ TEST_F(ZippedBugreportGenerationTest, TakesBetween30And300Seconds) {
                               << duration.count() << " s.";
 }
 
+// Not a check as such: records the numbers to compare bugreports across changes to dumpstate.
+TEST_F(ZippedBugreportGenerationTest, ReportsWallTimeAndPeakDiskUsage) {
+    RecordProperty("wall_time_ms", std::to_string(duration.count()));
+    RecordProperty("peak_disk_bytes", std::to_string(peak_disk_bytes));
+    printf("Bugreport took %lldms and at most %lld bytes of disk\n",
+           static_cast<long long>(duration.count()), static_cast<long long>(peak_disk_bytes));
+    EXPECT_GT(peak_disk_bytes, 0);
+}
+
 /**
  * Run tests on contents of zipped bug report.
  */
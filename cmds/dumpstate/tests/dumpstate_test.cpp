@@ -48,6 +48,7 @@ namespace os {
 namespace dumpstate {
 
 using ::android::hardware::dumpstate::V1_1::DumpstateMode;
+using ::testing::ElementsAre;
 using ::testing::EndsWith;
 using ::testing::Eq;
 using ::testing::HasSubstr;
@@ -1055,6 +1056,117 @@ TEST_F(ZippedBugReportStreamTest, StreamLimitedOnlyReport) {
     VerifyEntry(handle_, bugreport_txt_name, &entry);
 }
 
+class ParallelZipWriterTest : public DumpstateBaseTest {
+  public:
+    void SetUp() {
+        DumpstateBaseTest::SetUp();
+        out_path_ = kTestDataPath + "ParallelZipWriterTest.zip";
+        file_ = fopen(out_path_.c_str(), "wbe");
+        ASSERT_NE(nullptr, file_);
+    }
+
+    void TearDown() {
+        if (file_ != nullptr) {
+            fclose(file_);
+        }
+        if (handle_ != nullptr) {
+            CloseArchive(handle_);
+        }
+        unlink(out_path_.c_str());
+    }
+
+    void AddEntry(ParallelZipWriter& writer, const std::string& name,
+                  const std::string& content) {
+        EXPECT_EQ(0, writer.startEntry(name, time(nullptr)));
+        // Written in uneven pieces, so that they straddle the chunks.
+        for (size_t i = 0; i < content.size(); i += 100000) {
+            EXPECT_EQ(0, writer.writeBytes(content.data() + i,
+                                           std::min<size_t>(100000, content.size() - i)));
+        }
+        EXPECT_EQ(0, writer.finishEntry());
+    }
+
+    std::string ReadEntry(const std::string& name) {
+        ZipEntry entry;
+        int32_t e = FindEntry(handle_, name, &entry);
+        EXPECT_EQ(0, e) << ErrorCodeString(e) << " entry name: " << name;
+        if (e != 0) {
+            return "";
+        }
+        std::string content(entry.uncompressed_length, '\0');
+        e = ExtractToMemory(handle_, &entry, reinterpret_cast<uint8_t*>(content.data()),
+                            content.size());
+        EXPECT_EQ(0, e) << ErrorCodeString(e) << " entry name: " << name;
+        return content;
+    }
+
+    std::string out_path_;
+    FILE* file_ = nullptr;
+    ZipArchiveHandle handle_ = nullptr;
+};
+
+TEST_F(ParallelZipWriterTest, RoundTrip) {
+    // Several chunks of text that compresses well, like most of a bugreport.
+    std::string log;
+    for (int i = 0; log.size() < 5 * 1024 * 1024; i++) {
+        log += android::base::StringPrintf("%06d I dumpstate: line %d of the log\n", i, i % 97);
+    }
+    // And some that doesn't compress at all.
+    std::string random;
+    srand(42);
+    for (int i = 0; i < 1536 * 1024; i++) {
+        random += static_cast<char>(rand());
+    }
+
+    ParallelZipWriter writer(file_, 3);
+    AddEntry(writer, "version.txt", "2.0");
+    AddEntry(writer, "empty.txt", "");
+    AddEntry(writer, "FS/proc/log", log);
+    AddEntry(writer, "random.bin", random);
+    // Left open; finish() closes it.
+    EXPECT_EQ(0, writer.startEntry("last.txt", time(nullptr)));
+    EXPECT_EQ(0, writer.writeBytes("last", 4));
+    ASSERT_EQ(0, writer.finish());
+    EXPECT_NE(0, writer.startEntry("too_late.txt", time(nullptr)));
+
+    ParallelZipWriter::Stats stats = writer.getStats();
+    EXPECT_EQ(5U, stats.entries);
+    EXPECT_EQ(3 + log.size() + random.size() + 4, stats.uncompressed_bytes);
+    EXPECT_LT(stats.compressed_bytes, stats.uncompressed_bytes / 2);
+
+    fclose(file_);
+    file_ = nullptr;
+    ASSERT_EQ(0, OpenArchive(out_path_.c_str(), &handle_));
+    EXPECT_EQ(5, GetNumEntries(handle_));
+    EXPECT_THAT(ReadEntry("version.txt"), StrEq("2.0"));
+    EXPECT_THAT(ReadEntry("empty.txt"), IsEmpty());
+    EXPECT_TRUE(ReadEntry("FS/proc/log") == log);
+    EXPECT_TRUE(ReadEntry("random.bin") == random);
+    EXPECT_THAT(ReadEntry("last.txt"), StrEq("last"));
+}
+
+TEST_F(ParallelZipWriterTest, RestartsThreadsAfterShutdown) {
+    std::string log;
+    for (int i = 0; log.size() < 3 * 1024 * 1024; i++) {
+        log += android::base::StringPrintf("%06d I dumpstate: line %d of the log\n", i, i % 97);
+    }
+
+    ParallelZipWriter writer(file_, 2);
+    AddEntry(writer, "before.txt", log);
+    // As before dropping root.
+    writer.shutdownThreads();
+    AddEntry(writer, "after.txt", log);
+    ASSERT_EQ(0, writer.finish());
+    EXPECT_EQ(2U, writer.getStats().entries);
+
+    fclose(file_);
+    file_ = nullptr;
+    ASSERT_EQ(0, OpenArchive(out_path_.c_str(), &handle_));
+    EXPECT_EQ(2, GetNumEntries(handle_));
+    EXPECT_TRUE(ReadEntry("before.txt") == log);
+    EXPECT_TRUE(ReadEntry("after.txt") == log);
+}
+
 class DumpstateServiceTest : public DumpstateBaseTest {
   public:
     DumpstateService dss;
@@ -1783,6 +1895,57 @@ TEST_F(DumpPoolTest, Shutdown_withoutCrash) {
     EXPECT_THAT(getTempFileCounts(kTestDataPath), Eq(0));
 }
 
+TEST_F(DumpPoolTest, RunSections_inDependencyAndCostOrder) {
+    std::mutex lock;
+    std::vector<std::string> started;
+    auto section = [&](const std::string& name) {
+        return [&, name](int out_fd) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                started.push_back(name);
+            }
+            usleep(100 * 1000);
+            dprintf(out_fd, "%s", name.c_str());
+        };
+    };
+    setLogDuration(/* log_duration = */false);
+    // Only one CPU section runs at a time, so they start in order of cost once
+    // their dependencies are done.
+    dump_pool_->addSection("1", DumpPool::Resource::CPU, 100, {}, section("1"));
+    dump_pool_->addSection("2", DumpPool::Resource::CPU, 300, {"1"}, section("2"));
+    dump_pool_->addSection("3", DumpPool::Resource::CPU, 200, {}, section("3"));
+    dump_pool_->runSections(std::chrono::steady_clock::now() + std::chrono::minutes(1));
+
+    dump_pool_->waitForTask("1", "", out_fd_.get());
+    dump_pool_->waitForTask("2", "", out_fd_.get());
+    dump_pool_->waitForTask("3", "", out_fd_.get());
+    dump_pool_->dumpSectionTimings(out_fd_.get());
+    dump_pool_->shutdown();
+
+    EXPECT_THAT(started, ElementsAre("3", "1", "2"));
+    std::string result;
+    ReadFileToString(out_path_, &result);
+    EXPECT_THAT(result, StartsWith("1\n2\n3\n------ DUMP SECTION TIMINGS"));
+    EXPECT_THAT(result, HasSubstr("Critical path: 1 (queued "));
+    EXPECT_THAT(getTempFileCounts(kTestDataPath), Eq(0));
+}
+
+TEST_F(DumpPoolTest, RunSections_skippedAfterDeadline) {
+    bool run_1 = false;
+    setLogDuration(/* log_duration = */false);
+    dump_pool_->addSection("1", DumpPool::Resource::IO, 100, {}, [&](int) { run_1 = true; });
+    dump_pool_->runSections(std::chrono::steady_clock::now() - std::chrono::seconds(1));
+
+    dump_pool_->waitForTask("1", "", out_fd_.get());
+    dump_pool_->shutdown();
+
+    EXPECT_FALSE(run_1);
+    std::string result;
+    ReadFileToString(out_path_, &result);
+    EXPECT_THAT(result, StrEq("*** 1: skipped, out of time for dump sections\n"));
+    EXPECT_THAT(getTempFileCounts(kTestDataPath), Eq(0));
+}
+
 class TaskQueueTest : public DumpstateBaseTest {
 public:
     void SetUp() {
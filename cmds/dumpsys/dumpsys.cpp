@@ -16,8 +16,11 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <iomanip>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
@@ -61,9 +64,8 @@ static void usage() {
             "usage: dumpsys\n"
             "         To dump all services.\n"
             "or:\n"
-            "       dumpsys [-t TIMEOUT] [--priority LEVEL] [--pid] [--thread] [--help | -l | "
-            "--skip SERVICES "
-            "| SERVICE [ARGS]]\n"
+            "       dumpsys [-t TIMEOUT] [--priority LEVEL] [--parallel N] [--pid] [--thread] "
+            "[--help | -l | --skip SERVICES | SERVICE [ARGS]]\n"
             "         --help: shows this help\n"
             "         -l: only list services, do not dump them\n"
             "         -t TIMEOUT_SEC: TIMEOUT to use in seconds instead of default 10 seconds\n"
@@ -74,6 +76,9 @@ static void usage() {
             "               will be in proto format.\n"
             "         --priority LEVEL: filter services based on specified priority\n"
             "               LEVEL must be one of CRITICAL | HIGH | NORMAL\n"
+            "         --parallel N: when dumping several services, dump up to N of them at once.\n"
+            "               The output keeps the order of the services, and TIMEOUT applies to\n"
+            "               each service from the time its dump starts.\n"
             "         --skip SERVICES: dumps all services but SERVICES (comma-separated list)\n"
             "         SERVICE [ARGS]: dumps only service SERVICE, optionally passing ARGS to it\n");
 }
@@ -128,10 +133,12 @@ int Dumpsys::main(int argc, char* const argv[]) {
     Type type = Type::DUMP;
     int timeoutArgMs = 10000;
     int priorityFlags = IServiceManager::DUMP_FLAG_PRIORITY_ALL;
+    size_t maxParallel = 1;
     static struct option longOptions[] = {{"thread", no_argument, 0, 0},
                                           {"pid", no_argument, 0, 0},
                                           {"priority", required_argument, 0, 0},
                                           {"proto", no_argument, 0, 0},
+                                          {"parallel", required_argument, 0, 0},
                                           {"skip", no_argument, 0, 0},
                                           {"help", no_argument, 0, 0},
                                           {0, 0, 0, 0}};
@@ -165,6 +172,14 @@ int Dumpsys::main(int argc, char* const argv[]) {
                     usage();
                     return -1;
                 }
+            } else if (!strcmp(longOptions[optionIndex].name, "parallel")) {
+                char* endptr;
+                long parallel = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || parallel <= 0) {
+                    fprintf(stderr, "Error: invalid parallel dump count: '%s'\n", optarg);
+                    return -1;
+                }
+                maxParallel = parallel;
             } else if (!strcmp(longOptions[optionIndex].name, "pid")) {
                 type = Type::PID;
             } else if (!strcmp(longOptions[optionIndex].name, "thread")) {
@@ -254,6 +269,18 @@ int Dumpsys::main(int argc, char* const argv[]) {
         return 0;
     }
 
+    if (N > 1 && maxParallel > 1) {
+        Vector<String16> toDump;
+        for (const String16& serviceName : services) {
+            if (!IsSkipped(skippedServices, serviceName)) {
+                toDump.add(serviceName);
+            }
+        }
+        dumpServicesInParallel(STDOUT_FILENO, type, toDump, args, priorityFlags,
+                               std::chrono::milliseconds(timeoutArgMs), asProto, maxParallel);
+        return 0;
+    }
+
     for (size_t i = 0; i < N; i++) {
         const String16& serviceName = services[i];
         if (IsSkipped(skippedServices, serviceName)) continue;
@@ -359,7 +386,12 @@ status_t Dumpsys::startDumpThread(Type type, const String16& serviceName,
         std::cerr << "Can't find service: " << serviceName << std::endl;
         return NAME_NOT_FOUND;
     }
+    return spawnDumpThread(type, service, serviceName, args, &redirectFd_, &activeThread_);
+}
 
+status_t Dumpsys::spawnDumpThread(Type type, const sp<IBinder>& service,
+                                  const String16& serviceName, const Vector<String16>& args,
+                                  unique_fd* redirectFd, std::thread* thread) {
     int sfd[2];
     if (pipe(sfd) != 0) {
         std::cerr << "Failed to create pipe to dump service info for " << serviceName << ": "
@@ -367,12 +399,12 @@ status_t Dumpsys::startDumpThread(Type type, const String16& serviceName,
         return -errno;
     }
 
-    redirectFd_ = unique_fd(sfd[0]);
+    *redirectFd = unique_fd(sfd[0]);
     unique_fd remote_end(sfd[1]);
     sfd[0] = sfd[1] = -1;
 
     // dump blocks until completion, so spawn a thread..
-    activeThread_ = std::thread([=, remote_end{std::move(remote_end)}]() mutable {
+    *thread = std::thread([=, remote_end{std::move(remote_end)}]() mutable {
         status_t err = 0;
 
         switch (type) {
@@ -424,20 +456,14 @@ void Dumpsys::writeDumpHeader(int fd, const String16& serviceName, int priorityF
     WriteStringToFd(msg, fd);
 }
 
-status_t Dumpsys::writeDump(int fd, const String16& serviceName, std::chrono::milliseconds timeout,
-                            bool asProto, std::chrono::duration<double>& elapsedDuration,
-                            size_t& bytesWritten) const {
+// Reads a service dump from |dumpFd| until EOF or |end|, handing it to |sink| as it arrives.
+// |sink| returns false when it fails to take the data, with errno set.
+template <typename Sink>
+static status_t readDump(int dumpFd, const String16& serviceName,
+                         std::chrono::steady_clock::time_point end, size_t& totalBytes,
+                         Sink sink) {
     status_t status = OK;
-    size_t totalBytes = 0;
-    auto start = std::chrono::steady_clock::now();
-    auto end = start + timeout;
-
-    int serviceDumpFd = redirectFd_.get();
-    if (serviceDumpFd == -1) {
-        return INVALID_OPERATION;
-    }
-
-    struct pollfd pfd = {.fd = serviceDumpFd, .events = POLLIN};
+    struct pollfd pfd = {.fd = dumpFd, .events = POLLIN};
 
     while (true) {
         // Wrap this in a lambda so that TEMP_FAILURE_RETRY recalculates the timeout.
@@ -459,7 +485,7 @@ status_t Dumpsys::writeDump(int fd, const String16& serviceName, std::chrono::mi
         }
 
         char buf[4096];
-        rc = TEMP_FAILURE_RETRY(read(redirectFd_.get(), buf, sizeof(buf)));
+        rc = TEMP_FAILURE_RETRY(read(dumpFd, buf, sizeof(buf)));
         if (rc < 0) {
             std::cerr << "Failed to read while dumping service " << serviceName << ": "
                  << strerror(errno) << std::endl;
@@ -470,7 +496,7 @@ status_t Dumpsys::writeDump(int fd, const String16& serviceName, std::chrono::mi
             break;
         }
 
-        if (!WriteFully(fd, buf, rc)) {
+        if (!sink(buf, rc)) {
             std::cerr << "Failed to write while dumping service " << serviceName << ": "
                  << strerror(errno) << std::endl;
             status = -errno;
@@ -478,11 +504,33 @@ status_t Dumpsys::writeDump(int fd, const String16& serviceName, std::chrono::mi
         }
         totalBytes += rc;
     }
+    return status;
+}
+
+static std::string timeoutMessage(const String16& serviceName, std::chrono::milliseconds timeout) {
+    return StringPrintf("\n*** SERVICE '%s' DUMP TIMEOUT (%llums) EXPIRED ***\n\n",
+                        String8(serviceName).string(), timeout.count());
+}
+
+status_t Dumpsys::writeDump(int fd, const String16& serviceName, std::chrono::milliseconds timeout,
+                            bool asProto, std::chrono::duration<double>& elapsedDuration,
+                            size_t& bytesWritten) const {
+    size_t totalBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + timeout;
+
+    int serviceDumpFd = redirectFd_.get();
+    if (serviceDumpFd == -1) {
+        return INVALID_OPERATION;
+    }
+
+    status_t status = readDump(serviceDumpFd, serviceName, end, totalBytes,
+                               [fd](const char* buf, size_t size) {
+                                   return WriteFully(fd, buf, size);
+                               });
 
     if ((status == TIMED_OUT) && (!asProto)) {
-        std::string msg = StringPrintf("\n*** SERVICE '%s' DUMP TIMEOUT (%llums) EXPIRED ***\n\n",
-                                       String8(serviceName).string(), timeout.count());
-        WriteStringToFd(msg, fd);
+        WriteStringToFd(timeoutMessage(serviceName, timeout), fd);
     }
 
     elapsedDuration = std::chrono::steady_clock::now() - start;
@@ -503,3 +551,101 @@ void Dumpsys::writeDumpFooter(int fd, const String16& serviceName,
                      elapsedDuration.count(), String8(serviceName).string(), oss.str().c_str());
     WriteStringToFd(msg, fd);
 }
+
+void Dumpsys::dumpServicesInParallel(int fd, Type type, const Vector<String16>& services,
+                                     const Vector<String16>& args, int priorityFlags,
+                                     std::chrono::milliseconds timeout, bool asProto,
+                                     size_t maxParallel) {
+    struct ServiceDump {
+        bool started = false;
+        bool done = false;
+        status_t status = OK;
+        std::string output;
+        std::chrono::duration<double> elapsedDuration;
+    };
+    std::vector<ServiceDump> dumps(services.size());
+    std::mutex lock;
+    std::condition_variable doneCv;
+    size_t next = 0;
+
+    // Each worker dumps one service at a time, taking them in order, so that the services
+    // written first are also the first to be dumped.
+    auto dumpNext = [&]() {
+        while (true) {
+            size_t i;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (next == dumps.size()) {
+                    return;
+                }
+                i = next++;
+            }
+            const String16& serviceName = services[i];
+            ServiceDump& dump = dumps[i];
+
+            sp<IBinder> service = sm_->checkService(serviceName);
+            unique_fd dumpFd;
+            std::thread dumpThread;
+            if (service == nullptr) {
+                std::cerr << "Can't find service: " << serviceName << std::endl;
+            } else if (spawnDumpThread(type, service, serviceName, args, &dumpFd, &dumpThread) ==
+                       OK) {
+                dump.started = true;
+                auto start = std::chrono::steady_clock::now();
+                size_t totalBytes = 0;
+                dump.status = readDump(dumpFd.get(), serviceName, start + timeout, totalBytes,
+                                       [&dump](const char* buf, size_t size) {
+                                           dump.output.append(buf, size);
+                                           return true;
+                                       });
+                dump.elapsedDuration = std::chrono::steady_clock::now() - start;
+                if (dump.status == OK) {
+                    dumpThread.join();
+                } else {
+                    dumpThread.detach();
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            dump.done = true;
+            doneCv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(maxParallel, dumps.size()); i++) {
+        workers.emplace_back(dumpNext);
+    }
+
+    for (size_t i = 0; i < dumps.size(); i++) {
+        ServiceDump& dump = dumps[i];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            doneCv.wait(guard, [&dump] { return dump.done; });
+        }
+        if (!dump.started) {
+            continue;
+        }
+        writeDumpHeader(fd, services[i], priorityFlags);
+        if (!WriteFully(fd, dump.output.data(), dump.output.size())) {
+            std::cerr << "Failed to write while dumping service " << services[i] << ": "
+                 << strerror(errno) << std::endl;
+        }
+        if (dump.status == TIMED_OUT) {
+            if (!asProto) {
+                WriteStringToFd(timeoutMessage(services[i], timeout), fd);
+            }
+            std::cout << std::endl
+                 << "*** SERVICE '" << services[i] << "' DUMP TIMEOUT (" << timeout.count()
+                 << "ms) EXPIRED ***" << std::endl
+                 << std::endl;
+        }
+        writeDumpFooter(fd, services[i], dump.elapsedDuration);
+        // Only keep the output of the services that are still waiting for their turn.
+        std::string().swap(dump.output);
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
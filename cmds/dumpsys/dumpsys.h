@@ -17,6 +17,7 @@
 #ifndef FRAMEWORK_NATIVE_CMD_DUMPSYS_H_
 #define FRAMEWORK_NATIVE_CMD_DUMPSYS_H_
 
+#include <chrono>
 #include <thread>
 
 #include <android-base/unique_fd.h>
@@ -114,6 +115,24 @@ class Dumpsys {
      */
     void stopDumpThread(bool dumpComplete);
 
+    /**
+     * Dumps several services concurrently, each over its own pipe, and writes them to a file
+     * descriptor in the order given, with the same headers, footers and timeout messages as
+     * when dumping them one at a time. The output of a service that finishes before its turn is
+     * buffered until the services before it are written.
+     * @param fd file descriptor to write data
+     * @param services services to dump, in the order they're written
+     * @param args list of arguments to pass to service dump method.
+     * @param priorityFlags dump priority specified
+     * @param timeout timeout of each service dump, counted from when it starts
+     * @param asProto used to supresses the timeout error messages
+     * @param maxParallel maximum number of services dumped at the same time
+     */
+    void dumpServicesInParallel(int fd, Type type, const Vector<String16>& services,
+                                const Vector<String16>& args, int priorityFlags,
+                                std::chrono::milliseconds timeout, bool asProto,
+                                size_t maxParallel);
+
     /**
      * Returns file descriptor of the pipe used to dump service data. This assumes
      * {@code startDumpThread} was called successfully.
@@ -123,6 +142,10 @@ class Dumpsys {
     }
 
   private:
+    static status_t spawnDumpThread(Type type, const sp<IBinder>& service,
+                                    const String16& serviceName, const Vector<String16>& args,
+                                    android::base::unique_fd* redirectFd, std::thread* thread);
+
     android::IServiceManager* sm_;
     std::thread activeThread_;
     mutable android::base::unique_fd redirectFd_;
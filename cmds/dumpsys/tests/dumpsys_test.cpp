@@ -16,6 +16,7 @@
 
 #include "../dumpsys.h"
 
+#include <chrono>
 #include <regex>
 #include <vector>
 
@@ -128,6 +129,11 @@ ACTION_P(Sleep, timeout) {
     sleep(timeout);
 }
 
+// Custom action to sleep for timeout milliseconds
+ACTION_P(SleepMs, timeout) {
+    usleep(timeout * 1000);
+}
+
 class DumpsysTest : public Test {
   public:
     DumpsysTest() : sm_(), dump_(&sm_), stdout_(), stderr_() {
@@ -179,6 +185,12 @@ class DumpsysTest : public Test {
         return binder_mock;
     }
 
+    void ExpectDumpAfterMs(const char* name, int delay_ms, const std::string& output) {
+        sp<BinderMock> binder_mock = ExpectCheckService(name);
+        EXPECT_CALL(*binder_mock, dump(_, _))
+            .WillRepeatedly(DoAll(SleepMs(delay_ms), WithArg<0>(WriteOnFd(output)), Return(0)));
+    }
+
     void CallMain(const std::vector<std::string>& args) {
         const char* argv[1024] = {"/some/virtual/dir/dumpsys"};
         int argc = (int)args.size() + 1;
@@ -243,6 +255,16 @@ class DumpsysTest : public Test {
         EXPECT_THAT(stdout_, HasSubstr("was the duration of dumpsys " + service + ", ending at: "));
     }
 
+    void AssertDumpedInOrder(const std::vector<std::string>& services) {
+        size_t last = 0;
+        for (const std::string& service : services) {
+            size_t pos = stdout_.find("DUMP OF SERVICE " + service + ":\n");
+            ASSERT_NE(std::string::npos, pos) << service << " was not dumped";
+            EXPECT_GT(pos, last) << service << " was dumped out of order";
+            last = pos;
+        }
+    }
+
     void AssertNotDumped(const std::string& dump) {
         EXPECT_THAT(stdout_, Not(HasSubstr(dump)));
     }
@@ -561,6 +583,73 @@ TEST_F(DumpsysTest, DumpWithPriorityHighAndProto) {
     AssertDumpedWithPriority("runninghigh2", "dump2", PriorityDumper::PRIORITY_ARG_HIGH);
 }
 
+// Tests 'dumpsys --parallel 3' with services that take a while to dump
+TEST_F(DumpsysTest, DumpInParallel) {
+    ExpectListServices({"slow1", "fast2", "stopped3", "slow4", "fast5", "slow6"});
+    ExpectDumpAfterMs("slow1", 800, "dump1");
+    ExpectDumpAfterMs("fast2", 100, "dump2");
+    ExpectCheckService("stopped3", false);
+    ExpectDumpAfterMs("slow4", 800, "dump4");
+    ExpectDumpAfterMs("fast5", 100, "dump5");
+    ExpectDumpAfterMs("slow6", 800, "dump6");
+
+    auto start = std::chrono::steady_clock::now();
+    CallMain({"--parallel", "3"});
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    AssertRunningServices({"slow1", "fast2", "slow4", "fast5", "slow6"});
+    AssertDumped("slow1", "dump1");
+    AssertDumped("fast2", "dump2");
+    AssertStopped("stopped3");
+    AssertDumped("slow4", "dump4");
+    AssertDumped("fast5", "dump5");
+    AssertDumped("slow6", "dump6");
+    AssertDumpedInOrder({"slow1", "fast2", "slow4", "fast5", "slow6"});
+    // About 900ms with three services at a time, against 2.6s one after the other.
+    EXPECT_LT(elapsed, std::chrono::milliseconds(1800));
+}
+
+// Tests 'dumpsys --parallel 2 -T 500 --skip skipped3' where a service times out
+TEST_F(DumpsysTest, DumpInParallelWithTimeoutAndSkip) {
+    ExpectListServices({"running1", "hung2", "skipped3", "running4"});
+    ExpectDump("running1", "dump1");
+    sp<BinderMock> binder_mock = ExpectDumpAndHang("hung2", 2, "dump2");
+    ExpectDump("skipped3", "dump3");
+    ExpectDump("running4", "dump4");
+
+    CallMain({"--parallel", "2", "-T", "500", "--skip", "skipped3"});
+
+    AssertDumpedInOrder({"running1", "hung2", "running4"});
+    AssertDumped("running1", "dump1");
+    AssertOutputContains("SERVICE 'hung2' DUMP TIMEOUT (500ms) EXPIRED");
+    AssertNotDumped("dump2");
+    AssertNotDumped("dump3");
+    AssertDumped("running4", "dump4");
+
+    // TODO(b/65056227): BinderMock is not destructed because thread is detached on dumpsys.cpp
+    Mock::AllowLeak(binder_mock.get());
+}
+
+// Tests 'dumpsys --parallel 2 -T 500 --proto' where a service times out
+TEST_F(DumpsysTest, DumpInParallelWithTimeoutAndProto) {
+    ExpectListServicesWithPriority({"running1", "hung2"},
+                                   IServiceManager::DUMP_FLAG_PRIORITY_ALL);
+    ExpectListServicesWithPriority({"running1", "hung2"}, IServiceManager::DUMP_FLAG_PROTO);
+    ExpectDump("running1", "dump1");
+    sp<BinderMock> binder_mock = ExpectDumpAndHang("hung2", 2, "dump2");
+
+    CallMain({"--parallel", "2", "-T", "500", "--proto"});
+
+    AssertDumpedInOrder({"running1", "hung2"});
+    AssertDumped("running1", "dump1");
+    // As when dumping one service at a time, the timeout is reported even for protos.
+    AssertOutputContains("SERVICE 'hung2' DUMP TIMEOUT (500ms) EXPIRED");
+    AssertNotDumped("dump2");
+
+    // TODO(b/65056227): BinderMock is not destructed because thread is detached on dumpsys.cpp
+    Mock::AllowLeak(binder_mock.get());
+}
+
 // Tests 'dumpsys --pid'
 TEST_F(DumpsysTest, ListAllServicesWithPid) {
     ExpectListServices({"Locksmith", "Valet"});
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CacheIndex.h"
+
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/xattr.h>
+
+#include <algorithm>
+
+#include <android-base/stringprintf.h>
+
+#include "utils.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace installd {
+
+static bool operator==(const struct timespec& left, const struct timespec& right) {
+    return left.tv_sec == right.tv_sec && left.tv_nsec == right.tv_nsec;
+}
+
+CacheIndex::CacheIndex() : mHits(0), mListings(0) {
+}
+
+CacheIndex::~CacheIndex() {
+}
+
+void CacheIndex::loadItems(const std::string& path,
+        std::vector<std::shared_ptr<CacheItem>>* items) {
+    std::lock_guard<std::mutex> lock(mLock);
+    struct stat s;
+    if (lstat(path.c_str(), &s) != 0) {
+        eraseLocked(path);
+        return;
+    }
+    Directory* dir = refreshLocked(path, s.st_dev);
+    if (dir != nullptr) {
+        loadItemsLocked(path, *dir, s.st_dev, nullptr, 1, items);
+    }
+}
+
+int64_t CacheIndex::getTreeSize(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mLock);
+    struct stat s;
+    if (lstat(path.c_str(), &s) != 0) {
+        eraseLocked(path);
+        return 0;
+    }
+    Directory* dir = refreshLocked(path, s.st_dev);
+    if (dir == nullptr) {
+        return s.st_blocks * 512;
+    }
+    int64_t size = dir->size;
+    time_t modified = 0;
+    measureLocked(path, *dir, s.st_dev, &size, &modified);
+    return size;
+}
+
+std::string CacheIndex::toString() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return StringPrintf("%zu directories, %" PRId64 " unchanged, %" PRId64 " listed",
+            mDirectories.size(), mHits, mListings);
+}
+
+CacheIndex::Directory* CacheIndex::refreshLocked(const std::string& path, dev_t device) {
+    struct stat s;
+    if (lstat(path.c_str(), &s) != 0 || !S_ISDIR(s.st_mode) || s.st_dev != device) {
+        eraseLocked(path);
+        return nullptr;
+    }
+
+    auto it = mDirectories.find(path);
+    if (it != mDirectories.end() && it->second.inode == s.st_ino
+            && it->second.ctime == s.st_ctim) {
+        mHits++;
+        return &it->second;
+    }
+
+    // The ctime is taken before listing, so that changes made while listing
+    // cause another listing next time.
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr) {
+        eraseLocked(path);
+        return nullptr;
+    }
+    Directory dir;
+    dir.inode = s.st_ino;
+    dir.ctime = s.st_ctim;
+    dir.size = s.st_blocks * 512;
+    dir.modified = s.st_mtime;
+    dir.group = getxattr(path.c_str(), kXattrCacheGroup, nullptr, 0) >= 0;
+    dir.tombstone = getxattr(path.c_str(), kXattrCacheTombstone, nullptr, 0) >= 0;
+    int dfd = dirfd(d);
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        const char* name = de->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, "..")
+                || fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        dir.entries.push_back(Entry{name, S_ISDIR(s.st_mode), s.st_blocks * 512, s.st_mtime});
+    }
+    closedir(d);
+    mListings++;
+
+    if (it != mDirectories.end()) {
+        // Forget the subdirectories that are gone.
+        for (const auto& old : it->second.entries) {
+            if (old.directory && std::none_of(dir.entries.begin(), dir.entries.end(),
+                    [&](const Entry& entry) { return entry.name == old.name; })) {
+                eraseLocked(path + "/" + old.name);
+            }
+        }
+        it->second = std::move(dir);
+        return &it->second;
+    }
+    return &mDirectories.emplace(path, std::move(dir)).first->second;
+}
+
+void CacheIndex::eraseLocked(const std::string& path) {
+    mDirectories.erase(path);
+    const std::string prefix = path + "/";
+    auto it = mDirectories.lower_bound(prefix);
+    while (it != mDirectories.end() && !it->first.compare(0, prefix.size(), prefix)) {
+        it = mDirectories.erase(it);
+    }
+}
+
+void CacheIndex::loadItemsLocked(const std::string& path, const Directory& dir, dev_t device,
+        CacheItem* parent, short level, std::vector<std::shared_ptr<CacheItem>>* items) {
+    for (const auto& entry : dir.entries) {
+        auto childPath = path + "/" + entry.name;
+        Directory* child = entry.directory ? refreshLocked(childPath, device) : nullptr;
+        auto item = std::make_shared<CacheItem>(parent, parent ? entry.name : childPath, level,
+                entry.directory, child ? child->size : entry.size,
+                child ? child->modified : entry.modified);
+        items->push_back(item);
+
+        if (child != nullptr) {
+            item->group |= child->group;
+            item->tombstone |= child->tombstone;
+            if (item->group) {
+                // Groups are purged as a whole, so only their totals matter.
+                measureLocked(childPath, *child, device, &item->size, &item->modified);
+            } else {
+                loadItemsLocked(childPath, *child, device, item.get(), level + 1, items);
+            }
+        }
+
+        // Bubble up modified time to parent
+        if (parent) {
+            parent->modified = std::max(parent->modified, item->modified);
+        }
+    }
+}
+
+void CacheIndex::measureLocked(const std::string& path, const Directory& dir, dev_t device,
+        int64_t* size, time_t* modified) {
+    for (const auto& entry : dir.entries) {
+        auto childPath = path + "/" + entry.name;
+        Directory* child = entry.directory ? refreshLocked(childPath, device) : nullptr;
+        if (child != nullptr) {
+            *size += child->size;
+            *modified = std::max(*modified, child->modified);
+            measureLocked(childPath, *child, device, size, modified);
+        } else {
+            *size += entry.size;
+            *modified = std::max(*modified, entry.modified);
+        }
+    }
+}
+
+}  // namespace installd
+}  // namespace android
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INSTALLD_CACHE_INDEX_H
+#define ANDROID_INSTALLD_CACHE_INDEX_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <android-base/macros.h>
+
+#include "CacheItem.h"
+
+namespace android {
+namespace installd {
+
+/**
+ * Index of the contents of app cache directories, kept across freeCache()
+ * calls so that they don't have to walk and stat every cached file.
+ *
+ * Each directory is listed once, and listed again only when its inode or
+ * ctime changes, which happens whenever an entry is added, removed or
+ * renamed, or a cache xattr is set. Files that are rewritten in place keep
+ * the size and mtime they had when their directory was last listed; callers
+ * must verify the space they actually freed, as freeCache() already does
+ * for hardlinks.
+ */
+class CacheIndex {
+public:
+    CacheIndex();
+    ~CacheIndex();
+
+    /* Appends the items under the cache directory, as an fts walk of it
+     * would find them, refreshing the directories that changed */
+    void loadItems(const std::string& path, std::vector<std::shared_ptr<CacheItem>>* items);
+    /* Returns the size of the tree, as calculate_tree_size() would */
+    int64_t getTreeSize(const std::string& path);
+
+    std::string toString();
+
+private:
+    struct Entry {
+        std::string name;
+        bool directory;
+        int64_t size;
+        time_t modified;
+    };
+
+    struct Directory {
+        ino_t inode;
+        struct timespec ctime;
+        int64_t size;
+        time_t modified;
+        bool group;
+        bool tombstone;
+        std::vector<Entry> entries;
+    };
+
+    /* Returns the up-to-date listing of the directory, or nullptr if it is
+     * gone or on another device */
+    Directory* refreshLocked(const std::string& path, dev_t device);
+    void eraseLocked(const std::string& path);
+    void loadItemsLocked(const std::string& path, const Directory& dir, dev_t device,
+            CacheItem* parent, short level, std::vector<std::shared_ptr<CacheItem>>* items);
+    /* Adds the size and newest mtime of everything below the directory */
+    void measureLocked(const std::string& path, const Directory& dir, dev_t device,
+            int64_t* size, time_t* modified);
+
+    std::mutex mLock;
+    // Ordered, so that the records below a removed directory are adjacent.
+    std::map<std::string, Directory> mDirectories;
+    int64_t mHits;
+    int64_t mListings;
+
+    DISALLOW_COPY_AND_ASSIGN(CacheIndex);
+};
+
+}  // namespace installd
+}  // namespace android
+
+#endif  // ANDROID_INSTALLD_CACHE_INDEX_H
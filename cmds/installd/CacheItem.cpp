@@ -49,6 +49,24 @@ CacheItem::CacheItem(FTSENT* p) {
     }
 }
 
+CacheItem::CacheItem(CacheItem* parent, const std::string& name, short level, bool directory,
+        int64_t size, time_t modified)
+      : level(level),
+        directory(directory),
+        size(size),
+        modified(modified),
+        mParent(parent) {
+    if (mParent) {
+        group = mParent->group;
+        tombstone = mParent->tombstone;
+        mName = "/" + name;
+    } else {
+        group = false;
+        tombstone = false;
+        mName = name;
+    }
+}
+
 CacheItem::~CacheItem() {
 }
 
@@ -37,6 +37,9 @@ namespace installd {
 class CacheItem {
 public:
     CacheItem(FTSENT* p);
+    /* For items loaded from a CacheIndex rather than an fts walk */
+    CacheItem(CacheItem* parent, const std::string& name, short level, bool directory,
+            int64_t size, time_t modified);
     ~CacheItem();
 
     std::string toString();
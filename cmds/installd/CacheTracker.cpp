@@ -33,13 +33,15 @@ using android::base::StringPrintf;
 namespace android {
 namespace installd {
 
-CacheTracker::CacheTracker(userid_t userId, appid_t appId, const std::string& uuid)
+CacheTracker::CacheTracker(userid_t userId, appid_t appId, const std::string& uuid,
+        CacheIndex* index)
       : cacheUsed(0),
         cacheQuota(0),
         mUserId(userId),
         mAppId(appId),
         mItemsLoaded(false),
-        mUuid(uuid) {
+        mUuid(uuid),
+        mIndex(index) {
 }
 
 CacheTracker::~CacheTracker() {
@@ -67,8 +69,13 @@ void CacheTracker::loadStats() {
     for (const auto& path : mDataPaths) {
         auto cachePath = read_path_inode(path, "cache", kXattrInodeCache);
         auto codeCachePath = read_path_inode(path, "code_cache", kXattrInodeCodeCache);
-        calculate_tree_size(cachePath, &cacheUsed);
-        calculate_tree_size(codeCachePath, &cacheUsed);
+        if (mIndex) {
+            cacheUsed += mIndex->getTreeSize(cachePath);
+            cacheUsed += mIndex->getTreeSize(codeCachePath);
+        } else {
+            calculate_tree_size(cachePath, &cacheUsed);
+            calculate_tree_size(codeCachePath, &cacheUsed);
+        }
     }
     ATRACE_END();
 }
@@ -95,6 +102,11 @@ bool CacheTracker::loadQuotaStats() {
 }
 
 void CacheTracker::loadItemsFrom(const std::string& path) {
+    if (mIndex) {
+        mIndex->loadItems(path, &items);
+        return;
+    }
+
     FTS *fts;
     FTSENT *p;
     char *argv[] = { (char*) path.c_str(), nullptr };
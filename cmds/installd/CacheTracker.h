@@ -27,6 +27,7 @@
 #include <android-base/macros.h>
 #include <cutils/multiuser.h>
 
+#include "CacheIndex.h"
 #include "CacheItem.h"
 
 namespace android {
@@ -39,7 +40,10 @@ namespace installd {
  */
 class CacheTracker {
 public:
-    CacheTracker(userid_t userId, appid_t appId, const std::string& uuid);
+    /* When an index is given, items are loaded from it instead of walking
+     * the cache directories */
+    CacheTracker(userid_t userId, appid_t appId, const std::string& uuid,
+            CacheIndex* index = nullptr);
     ~CacheTracker();
 
     std::string toString();
@@ -63,6 +67,7 @@ private:
     appid_t mAppId;
     bool mItemsLoaded;
     const std::string& mUuid;
+    CacheIndex* mIndex;
 
     std::vector<std::string> mDataPaths;
 
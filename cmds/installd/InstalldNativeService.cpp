@@ -24,6 +24,7 @@
 #include <fts.h>
 #include <functional>
 #include <inttypes.h>
+#include <map>
 #include <regex>
 #include <stdlib.h>
 #include <string.h>
@@ -53,7 +54,6 @@
 #include <cutils/properties.h>
 #include <cutils/sched_policy.h>
 #include <log/log.h>               // TODO: Move everything to base/logging.
-#include <logwrap/logwrap.h>
 #include <private/android_filesystem_config.h>
 #include <private/android_projectid_config.h>
 #include <selinux/android.h>
@@ -71,6 +71,8 @@
 #include "CrateManager.h"
 #include "MatchExtensionGen.h"
 #include "QuotaUtils.h"
+#include "SizeCalculator.h"
+#include "TreeCopier.h"
 
 #ifndef LOG_TAG
 #define LOG_TAG "installd"
@@ -88,7 +90,6 @@ static constexpr const char* kTestUuid = "TEST";
 
 static constexpr const mode_t kRollbackFolderMode = 0700;
 
-static constexpr const char* kCpPath = "/system/bin/cp";
 static constexpr const char* kXattrDefault = "user.default";
 
 static constexpr const char* kDataMirrorCePath = "/data_mirror/data_ce";
@@ -229,6 +230,25 @@ binder::Status checkArgumentPath(const std::optional<std::string>& path) {
     }                                                       \
 }
 
+#define LOCK_USER(userId) \
+    std::unique_lock<std::shared_mutex> userLock(getUserLock(userId))
+
+#define LOCK_USER_SHARED(userId) \
+    std::shared_lock<std::shared_mutex> userLock(getUserLock(userId))
+
+#define LOCK_PACKAGE(packageName) \
+    std::lock_guard<std::mutex> packageLock(getPackageLock(packageName))
+
+#define LOCK_PACKAGE_USER(packageName, userId) \
+    LOCK_USER_SHARED(userId);                   \
+    LOCK_PACKAGE(packageName)
+
+#define LOCK_CODE_PATH(codeDir) \
+    std::lock_guard<std::mutex> codePathLock(getCodePathLock(codeDir))
+
+#define LOCK_APK_PATH(apkPath) \
+    LOCK_CODE_PATH(android::base::Dirname(apkPath))
+
 #define CHECK_ARGUMENT_UUID(uuid) {                         \
     binder::Status status = checkArgumentUuid((uuid));      \
     if (!status.isOk()) {                                   \
@@ -280,6 +300,51 @@ status_t InstalldNativeService::start() {
     return android::OK;
 }
 
+std::shared_mutex& InstalldNativeService::getUserLock(userid_t userId) {
+    std::lock_guard<std::mutex> lock(mUserLocksLock);
+    auto& userLock = mUserLocks[userId];
+    if (!userLock) {
+        userLock = std::make_unique<std::shared_mutex>();
+    }
+    return *userLock;
+}
+
+std::mutex& InstalldNativeService::getPackageLock(const std::string& packageName) {
+    return mPackageLocks[std::hash<std::string>()(packageName) % kPackageLockStripes];
+}
+
+std::mutex& InstalldNativeService::getCodePathLock(const std::string& codeDir) {
+    std::string_view dir = codeDir;
+    while (dir.size() > 1 && dir.back() == '/') {
+        dir.remove_suffix(1);
+    }
+    return mCodePathLocks[std::hash<std::string_view>()(dir) % kPackageLockStripes];
+}
+
+static std::vector<userid_t> sortedUnique(std::vector<userid_t> userIds) {
+    std::sort(userIds.begin(), userIds.end());
+    userIds.erase(std::unique(userIds.begin(), userIds.end()), userIds.end());
+    return userIds;
+}
+
+std::vector<std::shared_lock<std::shared_mutex>> InstalldNativeService::lockUsersShared(
+        std::vector<userid_t> userIds) {
+    std::vector<std::shared_lock<std::shared_mutex>> locks;
+    for (auto userId : sortedUnique(std::move(userIds))) {
+        locks.emplace_back(getUserLock(userId));
+    }
+    return locks;
+}
+
+std::vector<std::unique_lock<std::shared_mutex>> InstalldNativeService::lockUsers(
+        std::vector<userid_t> userIds) {
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    for (auto userId : sortedUnique(std::move(userIds))) {
+        locks.emplace_back(getUserLock(userId));
+    }
+    return locks;
+}
+
 status_t InstalldNativeService::dump(int fd, const Vector<String16> & /* args */) {
     auto out = std::fstream(StringPrintf("/proc/self/fd/%d", fd));
     const binder::Status dump_permission = checkPermission(kDump);
@@ -287,7 +352,6 @@ status_t InstalldNativeService::dump(int fd, const Vector<String16> & /* args */
         out << dump_permission.toString8() << endl;
         return PERMISSION_DENIED;
     }
-    std::lock_guard<std::recursive_mutex> lock(mLock);
 
     out << "installd is happy!" << endl;
 
@@ -307,6 +371,21 @@ status_t InstalldNativeService::dump(int fd, const Vector<String16> & /* args */
         }
     }
 
+    {
+        std::lock_guard<std::mutex> lock(mSizeStatsLock);
+        out << endl << "Size calculations (" << WorkerPool::getDefault().getThreadCount()
+                << " worker threads):" << endl;
+        const auto dumpSizeStats = [&](const char* name, const SizeStats& sizeStats) {
+            out << "    " << name << ": " << sizeStats.calls << " calls, " << sizeStats.walks
+                    << " walks, " << sizeStats.totalNs / 1000000 << "ms total, "
+                    << sizeStats.maxNs / 1000000 << "ms max" << endl;
+        };
+        dumpSizeStats("getAppSize", mAppSizeStats);
+        dumpSizeStats("getUserSize", mUserSizeStats);
+    }
+
+    out << endl << "Cache index: " << mCacheIndex.toString() << endl;
+
     out << endl;
     out.flush();
 
@@ -428,9 +507,16 @@ binder::Status InstalldNativeService::createAppData(const std::optional<std::str
         const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
         const std::string& seInfo, int32_t targetSdkVersion, int64_t* _aidl_return) {
     ENFORCE_UID(AID_SYSTEM);
+    LOCK_PACKAGE_USER(packageName, userId);
+    return createAppDataLocked(uuid, packageName, userId, flags, appId, seInfo, targetSdkVersion,
+            _aidl_return);
+}
+
+binder::Status InstalldNativeService::createAppDataLocked(const std::optional<std::string>& uuid,
+        const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
+        const std::string& seInfo, int32_t targetSdkVersion, int64_t* _aidl_return) {
     CHECK_ARGUMENT_UUID(uuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     const char* pkgname = packageName.c_str();
@@ -510,30 +596,51 @@ binder::Status InstalldNativeService::createAppData(
         const android::os::CreateAppDataArgs& args,
         android::os::CreateAppDataResult* _aidl_return) {
     ENFORCE_UID(AID_SYSTEM);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(args.packageName, args.userId);
 
-    int64_t ceDataInode = -1;
-    auto status = createAppData(args.uuid, args.packageName, args.userId, args.flags, args.appId,
-                                args.seInfo, args.targetSdkVersion, &ceDataInode);
-    _aidl_return->ceDataInode = ceDataInode;
-    _aidl_return->exceptionCode = status.exceptionCode();
-    _aidl_return->exceptionMessage = status.exceptionMessage();
+    createAppDataLocked(args, _aidl_return);
     return ok();
 }
 
+void InstalldNativeService::createAppDataLocked(const android::os::CreateAppDataArgs& args,
+        android::os::CreateAppDataResult* result) {
+    int64_t ceDataInode = -1;
+    auto status = createAppDataLocked(args.uuid, args.packageName, args.userId, args.flags,
+            args.appId, args.seInfo, args.targetSdkVersion, &ceDataInode);
+    result->ceDataInode = ceDataInode;
+    result->exceptionCode = status.exceptionCode();
+    result->exceptionMessage = status.exceptionMessage();
+}
+
 binder::Status InstalldNativeService::createAppDataBatched(
         const std::vector<android::os::CreateAppDataArgs>& args,
         std::vector<android::os::CreateAppDataResult>* _aidl_return) {
     ENFORCE_UID(AID_SYSTEM);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
-
-    std::vector<android::os::CreateAppDataResult> results;
-    for (auto arg : args) {
-        android::os::CreateAppDataResult result;
-        createAppData(arg, &result);
-        results.push_back(result);
+    ATRACE_BEGIN("createAppDataBatched");
+
+    // Packages don't share any directories, so each one is set up by a task
+    // of its own; the users of a single package are done in order.
+    std::map<std::string, std::vector<size_t>> packages;
+    std::vector<userid_t> userIds;
+    for (size_t i = 0; i < args.size(); i++) {
+        packages[args[i].packageName].push_back(i);
+        userIds.push_back(args[i].userId);
+    }
+    auto userLocks = lockUsersShared(userIds);
+    std::vector<android::os::CreateAppDataResult> results(args.size());
+    WorkerPool::TaskGroup tasks(WorkerPool::getDefault());
+    for (const auto& package : packages) {
+        tasks.post([this, &args, &results, &package] {
+            LOCK_PACKAGE(package.first);
+            for (size_t i : package.second) {
+                createAppDataLocked(args[i], &results[i]);
+            }
+        });
     }
-    *_aidl_return = results;
+    tasks.wait();
+    ATRACE_END();
+
+    *_aidl_return = std::move(results);
     return ok();
 }
 
@@ -542,7 +649,7 @@ binder::Status InstalldNativeService::migrateAppData(const std::optional<std::st
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, userId);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     const char* pkgname = packageName.c_str();
@@ -586,7 +693,7 @@ binder::Status InstalldNativeService::clearAppProfiles(const std::string& packag
         const std::string& profileName) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName);
 
     binder::Status res = ok();
     if (!clear_primary_reference_profile(packageName, profileName)) {
@@ -601,9 +708,14 @@ binder::Status InstalldNativeService::clearAppProfiles(const std::string& packag
 binder::Status InstalldNativeService::clearAppData(const std::optional<std::string>& uuid,
         const std::string& packageName, int32_t userId, int32_t flags, int64_t ceDataInode) {
     ENFORCE_UID(AID_SYSTEM);
+    LOCK_PACKAGE_USER(packageName, userId);
+    return clearAppDataLocked(uuid, packageName, userId, flags, ceDataInode);
+}
+
+binder::Status InstalldNativeService::clearAppDataLocked(const std::optional<std::string>& uuid,
+        const std::string& packageName, int32_t userId, int32_t flags, int64_t ceDataInode) {
     CHECK_ARGUMENT_UUID(uuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     const char* pkgname = packageName.c_str();
@@ -703,7 +815,7 @@ static int destroy_app_current_profiles(const std::string& pkgname, userid_t use
 binder::Status InstalldNativeService::destroyAppProfiles(const std::string& packageName) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName);
 
     binder::Status res = ok();
     std::vector<userid_t> users = get_known_users(/*volume_uuid*/ nullptr);
@@ -723,7 +835,7 @@ binder::Status InstalldNativeService::destroyAppData(const std::optional<std::st
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, userId);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     const char* pkgname = packageName.c_str();
@@ -790,123 +902,149 @@ static gid_t get_cache_gid(uid_t uid) {
     return (gid != -1) ? gid : uid;
 }
 
+/**
+ * Fixes the GIDs below a single app data directory, so that cache
+ * directories and their contents belong to the app's cache GID and
+ * everything else to its UID.
+ */
+static void fixup_app_dir(const std::string& path, int32_t flags) {
+    FTS* fts;
+    FTSENT* p;
+    char *argv[] = { (char*) path.c_str(), nullptr };
+    if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, nullptr))) {
+        PLOG(WARNING) << "Failed to fts_open " << path;
+        return;
+    }
+    while ((p = fts_read(fts)) != nullptr) {
+        if (p->fts_info == FTS_D && p->fts_level == 0) {
+            // Track down inodes of cache directories
+            uint64_t raw = 0;
+            ino_t inode_cache = 0;
+            ino_t inode_code_cache = 0;
+            if (getxattr(p->fts_path, kXattrInodeCache, &raw, sizeof(raw)) == sizeof(raw)) {
+                inode_cache = raw;
+            }
+            if (getxattr(p->fts_path, kXattrInodeCodeCache, &raw, sizeof(raw)) == sizeof(raw)) {
+                inode_code_cache = raw;
+            }
+
+            // Figure out expected GID of each child
+            FTSENT* child = fts_children(fts, 0);
+            while (child != nullptr) {
+                if ((child->fts_statp->st_ino == inode_cache)
+                        || (child->fts_statp->st_ino == inode_code_cache)
+                        || !strcmp(child->fts_name, "cache")
+                        || !strcmp(child->fts_name, "code_cache")) {
+                    child->fts_number = get_cache_gid(p->fts_statp->st_uid);
+                } else {
+                    child->fts_number = p->fts_statp->st_uid;
+                }
+                child = child->fts_link;
+            }
+        } else if (p->fts_level >= 1) {
+            if (p->fts_level > 1) {
+                // Inherit GID from parent once we're deeper into tree
+                p->fts_number = p->fts_parent->fts_number;
+            }
+
+            uid_t uid = p->fts_parent->fts_statp->st_uid;
+            gid_t cache_gid = get_cache_gid(uid);
+            gid_t expected = p->fts_number;
+            gid_t actual = p->fts_statp->st_gid;
+            if (actual == expected) {
+#if FIXUP_DEBUG
+                LOG(DEBUG) << "Ignoring " << p->fts_path << " with expected GID " << expected;
+#endif
+                if (!(flags & FLAG_FORCE)) {
+                    fts_set(fts, p, FTS_SKIP);
+                }
+            } else if ((actual == uid) || (actual == cache_gid)) {
+                // Only consider fixing up when current GID belongs to app
+                if (p->fts_info != FTS_D) {
+                    LOG(INFO) << "Fixing " << p->fts_path << " with unexpected GID " << actual
+                            << " instead of " << expected;
+                }
+                switch (p->fts_info) {
+                case FTS_DP:
+                    // If we're moving towards cache GID, we need to set S_ISGID
+                    if (expected == cache_gid) {
+                        if (chmod(p->fts_path, 02771) != 0) {
+                            PLOG(WARNING) << "Failed to chmod " << p->fts_path;
+                        }
+                    }
+                    [[fallthrough]]; // also set GID
+                case FTS_F:
+                    if (chown(p->fts_path, -1, expected) != 0) {
+                        PLOG(WARNING) << "Failed to chown " << p->fts_path;
+                    }
+                    break;
+                case FTS_SL:
+                case FTS_SLNONE:
+                    if (lchown(p->fts_path, -1, expected) != 0) {
+                        PLOG(WARNING) << "Failed to chown " << p->fts_path;
+                    }
+                    break;
+                }
+            } else {
+                // Ignore all other GID transitions, since they're kinda shady
+                LOG(WARNING) << "Ignoring " << p->fts_path << " with unexpected GID " << actual
+                        << " instead of " << expected;
+                if (!(flags & FLAG_FORCE)) {
+                    fts_set(fts, p, FTS_SKIP);
+                }
+            }
+        }
+    }
+    fts_close(fts);
+}
+
 binder::Status InstalldNativeService::fixupAppData(const std::optional<std::string>& uuid,
         int32_t flags) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
 
+    // Every app directory is fixed up by a task of its own.
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
-    for (auto user : get_known_users(uuid_)) {
+    auto users = get_known_users(uuid_);
+    auto userLocks = lockUsers(users);
+    WorkerPool::TaskGroup tasks(WorkerPool::getDefault());
+    for (auto user : users) {
         ATRACE_BEGIN("fixup user");
-        FTS* fts;
-        FTSENT* p;
-        auto ce_path = create_data_user_ce_path(uuid_, user);
-        auto de_path = create_data_user_de_path(uuid_, user);
-        char *argv[] = { (char*) ce_path.c_str(), (char*) de_path.c_str(), nullptr };
-        if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, nullptr))) {
-            return error("Failed to fts_open");
-        }
-        while ((p = fts_read(fts)) != nullptr) {
-            if (p->fts_info == FTS_D && p->fts_level == 1) {
-                // Track down inodes of cache directories
-                uint64_t raw = 0;
-                ino_t inode_cache = 0;
-                ino_t inode_code_cache = 0;
-                if (getxattr(p->fts_path, kXattrInodeCache, &raw, sizeof(raw)) == sizeof(raw)) {
-                    inode_cache = raw;
-                }
-                if (getxattr(p->fts_path, kXattrInodeCodeCache, &raw, sizeof(raw)) == sizeof(raw)) {
-                    inode_code_cache = raw;
-                }
-
-                // Figure out expected GID of each child
-                FTSENT* child = fts_children(fts, 0);
-                while (child != nullptr) {
-                    if ((child->fts_statp->st_ino == inode_cache)
-                            || (child->fts_statp->st_ino == inode_code_cache)
-                            || !strcmp(child->fts_name, "cache")
-                            || !strcmp(child->fts_name, "code_cache")) {
-                        child->fts_number = get_cache_gid(p->fts_statp->st_uid);
-                    } else {
-                        child->fts_number = p->fts_statp->st_uid;
-                    }
-                    child = child->fts_link;
-                }
-            } else if (p->fts_level >= 2) {
-                if (p->fts_level > 2) {
-                    // Inherit GID from parent once we're deeper into tree
-                    p->fts_number = p->fts_parent->fts_number;
+        for (const auto& path : { create_data_user_ce_path(uuid_, user),
+                                  create_data_user_de_path(uuid_, user) }) {
+            std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(path.c_str()), closedir);
+            if (!dir) {
+                if (errno == ENOENT) {
+                    continue;
                 }
+                ATRACE_END();
+                return error("Failed to opendir " + path);
+            }
 
-                uid_t uid = p->fts_parent->fts_statp->st_uid;
-                gid_t cache_gid = get_cache_gid(uid);
-                gid_t expected = p->fts_number;
-                gid_t actual = p->fts_statp->st_gid;
-                if (actual == expected) {
-#if FIXUP_DEBUG
-                    LOG(DEBUG) << "Ignoring " << p->fts_path << " with expected GID " << expected;
-#endif
-                    if (!(flags & FLAG_FORCE)) {
-                        fts_set(fts, p, FTS_SKIP);
-                    }
-                } else if ((actual == uid) || (actual == cache_gid)) {
-                    // Only consider fixing up when current GID belongs to app
-                    if (p->fts_info != FTS_D) {
-                        LOG(INFO) << "Fixing " << p->fts_path << " with unexpected GID " << actual
-                                << " instead of " << expected;
-                    }
-                    switch (p->fts_info) {
-                    case FTS_DP:
-                        // If we're moving towards cache GID, we need to set S_ISGID
-                        if (expected == cache_gid) {
-                            if (chmod(p->fts_path, 02771) != 0) {
-                                PLOG(WARNING) << "Failed to chmod " << p->fts_path;
-                            }
-                        }
-                        [[fallthrough]]; // also set GID
-                    case FTS_F:
-                        if (chown(p->fts_path, -1, expected) != 0) {
-                            PLOG(WARNING) << "Failed to chown " << p->fts_path;
-                        }
-                        break;
-                    case FTS_SL:
-                    case FTS_SLNONE:
-                        if (lchown(p->fts_path, -1, expected) != 0) {
-                            PLOG(WARNING) << "Failed to chown " << p->fts_path;
-                        }
-                        break;
-                    }
-                } else {
-                    // Ignore all other GID transitions, since they're kinda shady
-                    LOG(WARNING) << "Ignoring " << p->fts_path << " with unexpected GID " << actual
-                            << " instead of " << expected;
-                    if (!(flags & FLAG_FORCE)) {
-                        fts_set(fts, p, FTS_SKIP);
-                    }
+            struct dirent* ent;
+            while ((ent = readdir(dir.get()))) {
+                if (ent->d_type != DT_DIR || !strcmp(ent->d_name, ".")
+                        || !strcmp(ent->d_name, "..")) {
+                    continue;
                 }
+                auto app_path = path + "/" + ent->d_name;
+                tasks.post([app_path, flags] { fixup_app_dir(app_path, flags); });
             }
         }
-        fts_close(fts);
         ATRACE_END();
     }
+    tasks.wait();
     return ok();
 }
 
 static int32_t copy_directory_recursive(const char* from, const char* to) {
-    char *argv[] = {
-        (char*) kCpPath,
-        (char*) "-F", /* delete any existing destination file first (--remove-destination) */
-        (char*) "-p", /* preserve timestamps, ownership, and permissions */
-        (char*) "-R", /* recurse into subdirectories (DEST must be a directory) */
-        (char*) "-P", /* Do not follow symlinks [default] */
-        (char*) "-d", /* don't dereference symlinks */
-        (char*) from,
-        (char*) to
-    };
-
     LOG(DEBUG) << "Copying " << from << " to " << to;
-    return logwrap_fork_execvp(ARRAY_SIZE(argv), argv, nullptr, false, LOG_ALOG, false, nullptr);
+    TreeCopier copier;
+    int32_t rc = copier.copy(from, to);
+    auto stats = copier.getStats();
+    LOG(DEBUG) << "Copied " << stats.files << " files, " << stats.bytes << " bytes ("
+            << stats.clonedBytes << " reflinked) in " << stats.elapsedNs / 1000000 << "ms";
+    return rc;
 }
 
 binder::Status InstalldNativeService::snapshotAppData(
@@ -916,7 +1054,7 @@ binder::Status InstalldNativeService::snapshotAppData(
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID_IS_TEST_OR_NULL(volumeUuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, user);
 
     const char* volume_uuid = volumeUuid ? volumeUuid->c_str() : nullptr;
     const char* package_name = packageName.c_str();
@@ -985,7 +1123,7 @@ binder::Status InstalldNativeService::snapshotAppData(
     }
 
     // ce_data_inode is not needed when FLAG_CLEAR_CACHE_ONLY is set.
-    binder::Status clear_cache_result = clearAppData(volumeUuid, packageName, user,
+    binder::Status clear_cache_result = clearAppDataLocked(volumeUuid, packageName, user,
             storageFlags | FLAG_CLEAR_CACHE_ONLY, 0);
     if (!clear_cache_result.isOk()) {
         // It should be fine to continue snapshot if we for some reason failed
@@ -994,7 +1132,7 @@ binder::Status InstalldNativeService::snapshotAppData(
     }
 
     // ce_data_inode is not needed when FLAG_CLEAR_CODE_CACHE_ONLY is set.
-    binder::Status clear_code_cache_result = clearAppData(volumeUuid, packageName, user,
+    binder::Status clear_code_cache_result = clearAppDataLocked(volumeUuid, packageName, user,
             storageFlags | FLAG_CLEAR_CODE_CACHE_ONLY, 0);
     if (!clear_code_cache_result.isOk()) {
         // It should be fine to continue snapshot if we for some reason failed
@@ -1046,7 +1184,7 @@ binder::Status InstalldNativeService::restoreAppDataSnapshot(
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID_IS_TEST_OR_NULL(volumeUuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, user);
 
     const char* volume_uuid = volumeUuid ? volumeUuid->c_str() : nullptr;
     const char* package_name = packageName.c_str();
@@ -1074,7 +1212,7 @@ binder::Status InstalldNativeService::restoreAppDataSnapshot(
     // It's fine to pass 0 as ceDataInode here, because restoreAppDataSnapshot
     // can only be called when user unlocks the phone, meaning that CE user data
     // is decrypted.
-    binder::Status res = clearAppData(volumeUuid, packageName, user, storageFlags,
+    binder::Status res = clearAppDataLocked(volumeUuid, packageName, user, storageFlags,
             0 /* ceDataInode */);
     if (!res.isOk()) {
         return res;
@@ -1108,7 +1246,7 @@ binder::Status InstalldNativeService::restoreAppDataSnapshot(
     }
 
     // Finally, restore the SELinux label on the app data.
-    return restoreconAppData(volumeUuid, packageName, user, storageFlags, appId, seInfo);
+    return restoreconAppDataLocked(volumeUuid, packageName, user, storageFlags, appId, seInfo);
 }
 
 binder::Status InstalldNativeService::destroyAppDataSnapshot(
@@ -1118,7 +1256,7 @@ binder::Status InstalldNativeService::destroyAppDataSnapshot(
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID_IS_TEST_OR_NULL(volumeUuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, user);
 
     const char* volume_uuid = volumeUuid ? volumeUuid->c_str() : nullptr;
     const char* package_name = packageName.c_str();
@@ -1149,7 +1287,7 @@ binder::Status InstalldNativeService::destroyCeSnapshotsNotSpecified(
         const std::vector<int32_t>& retainSnapshotIds) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID_IS_TEST_OR_NULL(volumeUuid);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_USER(user);
 
     const char* volume_uuid = volumeUuid ? volumeUuid->c_str() : nullptr;
 
@@ -1190,7 +1328,6 @@ binder::Status InstalldNativeService::moveCompleteApp(const std::optional<std::s
     CHECK_ARGUMENT_UUID(fromUuid);
     CHECK_ARGUMENT_UUID(toUuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
 
     const char* from_uuid = fromUuid ? fromUuid->c_str() : nullptr;
     const char* to_uuid = toUuid ? toUuid->c_str() : nullptr;
@@ -1199,6 +1336,11 @@ binder::Status InstalldNativeService::moveCompleteApp(const std::optional<std::s
     binder::Status res = ok();
     std::vector<userid_t> users = get_known_users(from_uuid);
 
+    // The app's data for every user, and its code.
+    auto userLocks = lockUsersShared(users);
+    LOCK_PACKAGE(packageName);
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+
     auto to_app_package_path_parent = create_data_app_path(to_uuid);
     auto to_app_package_path = StringPrintf("%s/%s", to_app_package_path_parent.c_str(),
                                             android::base::Basename(fromCodePath).c_str());
@@ -1227,8 +1369,8 @@ binder::Status InstalldNativeService::moveCompleteApp(const std::optional<std::s
             continue;
         }
 
-        if (!createAppData(toUuid, packageName, user, FLAG_STORAGE_CE | FLAG_STORAGE_DE, appId,
-                seInfo, targetSdkVersion, nullptr).isOk()) {
+        if (!createAppDataLocked(toUuid, packageName, user, FLAG_STORAGE_CE | FLAG_STORAGE_DE,
+                appId, seInfo, targetSdkVersion, nullptr).isOk()) {
             res = error("Failed to create package target");
             goto fail;
         }
@@ -1254,8 +1396,8 @@ binder::Status InstalldNativeService::moveCompleteApp(const std::optional<std::s
             }
         }
 
-        if (!restoreconAppData(toUuid, packageName, user, FLAG_STORAGE_CE | FLAG_STORAGE_DE,
-                appId, seInfo).isOk()) {
+        if (!restoreconAppDataLocked(toUuid, packageName, user,
+                FLAG_STORAGE_CE | FLAG_STORAGE_DE, appId, seInfo).isOk()) {
             res = error("Failed to restorecon");
             goto fail;
         }
@@ -1294,7 +1436,7 @@ binder::Status InstalldNativeService::createUserData(const std::optional<std::st
         int32_t userId, int32_t userSerial ATTRIBUTE_UNUSED, int32_t flags) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_USER(userId);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     if (flags & FLAG_STORAGE_DE) {
@@ -1312,7 +1454,7 @@ binder::Status InstalldNativeService::destroyUserData(const std::optional<std::s
         int32_t userId, int32_t flags) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_USER(userId);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     binder::Status res = ok();
@@ -1345,11 +1487,23 @@ binder::Status InstalldNativeService::destroyUserData(const std::optional<std::s
     return res;
 }
 
+/* Returns the package owning |path|, the first directory under one of |roots| */
+static std::string packageNameOfCachePath(const std::vector<std::string>& roots,
+        const std::string& path) {
+    for (const auto& root : roots) {
+        if (android::base::StartsWith(path, root)) {
+            auto name = path.substr(root.size());
+            return name.substr(0, name.find('/'));
+        }
+    }
+    return path;
+}
+
 binder::Status InstalldNativeService::freeCache(const std::optional<std::string>& uuid,
         int64_t targetFreeBytes, int64_t cacheReservedBytes, int32_t flags) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    std::lock_guard<std::mutex> lock(mFreeCacheLock);
 
     auto uuidString = uuid.value_or("");
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
@@ -1374,15 +1528,25 @@ binder::Status InstalldNativeService::freeCache(const std::optional<std::string>
         // This new cache strategy fairly removes files from UIDs by deleting
         // files from the UIDs which are most over their allocated quota
 
+        // Clearing or destroying app data deletes the same files as a purge,
+        // so hold every user shared for the whole walk, and each package's
+        // lock around purging its items
+        auto users = get_known_users(uuid_);
+        auto userLocks = lockUsersShared(users);
+        std::vector<std::string> cacheRoots;
+
         // 1. Create trackers for every known UID
         ATRACE_BEGIN("create");
         std::unordered_map<uid_t, std::shared_ptr<CacheTracker>> trackers;
-        for (auto user : get_known_users(uuid_)) {
+        for (auto user : users) {
             FTS *fts;
             FTSENT *p;
             auto ce_path = create_data_user_ce_path(uuid_, user);
             auto de_path = create_data_user_de_path(uuid_, user);
             auto media_path = findDataMediaPath(uuid, user) + "/Android/data/";
+            cacheRoots.push_back(ce_path + "/");
+            cacheRoots.push_back(de_path + "/");
+            cacheRoots.push_back(media_path);
             char *argv[] = { (char*) ce_path.c_str(), (char*) de_path.c_str(),
                     (char*) media_path.c_str(), nullptr };
             if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, nullptr))) {
@@ -1400,7 +1564,8 @@ binder::Status InstalldNativeService::freeCache(const std::optional<std::string>
                         search->second->addDataPath(p->fts_path);
                     } else {
                         auto tracker = std::shared_ptr<CacheTracker>(new CacheTracker(
-                                multiuser_get_user_id(uid), multiuser_get_app_id(uid), uuidString));
+                                multiuser_get_user_id(uid), multiuser_get_app_id(uid), uuidString,
+                                &mCacheIndex));
                         tracker->addDataPath(p->fts_path);
                         {
                             std::lock_guard<std::recursive_mutex> lock(mQuotasLock);
@@ -1480,6 +1645,7 @@ binder::Status InstalldNativeService::freeCache(const std::optional<std::string>
 
                 LOG(DEBUG) << "Purging " << item->toString() << " from " << active->toString();
                 if (!noop) {
+                    LOCK_PACKAGE(packageNameOfCachePath(cacheRoots, item->buildPath()));
                     item->purge();
                 }
                 active->cacheUsed -= item->size;
@@ -1518,6 +1684,7 @@ binder::Status InstalldNativeService::rmdex(const std::string& codePath,
         const std::string& instructionSet) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PATH(codePath);
+    LOCK_APK_PATH(codePath);
     std::lock_guard<std::recursive_mutex> lock(mLock);
 
     char dex_path[PKG_PATH_MAX];
@@ -1544,11 +1711,18 @@ binder::Status InstalldNativeService::rmdex(const std::string& codePath,
     return ok();
 }
 
-struct stats {
-    int64_t codeSize;
-    int64_t dataSize;
-    int64_t cacheSize;
-};
+// Quota queries are a few syscalls per app, so they are batched to keep
+// the worker pool's overhead small.
+static constexpr size_t kQuotaAppsPerTask = 32;
+
+void InstalldNativeService::recordSizeStats(SizeStats* sizeStats,
+        const SizeCalculator::CallStats& call) {
+    std::lock_guard<std::mutex> lock(mSizeStatsLock);
+    sizeStats->calls++;
+    sizeStats->walks += call.walks;
+    sizeStats->totalNs += call.elapsedNs;
+    sizeStats->maxNs = std::max(sizeStats->maxNs, call.elapsedNs);
+}
 
 #if MEASURE_DEBUG
 static std::string toString(std::vector<int64_t> values) {
@@ -1631,124 +1805,6 @@ static void collectQuotaStats(const std::string& uuid, int32_t userId,
     }
 }
 
-static void collectManualStats(const std::string& path, struct stats* stats) {
-    DIR *d;
-    int dfd;
-    struct dirent *de;
-    struct stat s;
-
-    d = opendir(path.c_str());
-    if (d == nullptr) {
-        if (errno != ENOENT) {
-            PLOG(WARNING) << "Failed to open " << path;
-        }
-        return;
-    }
-    dfd = dirfd(d);
-    while ((de = readdir(d))) {
-        const char *name = de->d_name;
-
-        int64_t size = 0;
-        if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) == 0) {
-            size = s.st_blocks * 512;
-        }
-
-        if (de->d_type == DT_DIR) {
-            if (!strcmp(name, ".")) {
-                // Don't recurse, but still count node size
-            } else if (!strcmp(name, "..")) {
-                // Don't recurse or count node size
-                continue;
-            } else {
-                // Measure all children nodes
-                size = 0;
-                calculate_tree_size(StringPrintf("%s/%s", path.c_str(), name), &size);
-            }
-
-            if (!strcmp(name, "cache") || !strcmp(name, "code_cache")) {
-                stats->cacheSize += size;
-            }
-        }
-
-        // Legacy symlink isn't owned by app
-        if (de->d_type == DT_LNK && !strcmp(name, "lib")) {
-            continue;
-        }
-
-        // Everything found inside is considered data
-        stats->dataSize += size;
-    }
-    closedir(d);
-}
-
-static void collectManualStatsForUser(const std::string& path, struct stats* stats,
-        bool exclude_apps = false) {
-    DIR *d;
-    int dfd;
-    struct dirent *de;
-    struct stat s;
-
-    d = opendir(path.c_str());
-    if (d == nullptr) {
-        if (errno != ENOENT) {
-            PLOG(WARNING) << "Failed to open " << path;
-        }
-        return;
-    }
-    dfd = dirfd(d);
-    while ((de = readdir(d))) {
-        if (de->d_type == DT_DIR) {
-            const char *name = de->d_name;
-            if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
-                continue;
-            }
-            int32_t user_uid = multiuser_get_app_id(s.st_uid);
-            if (!strcmp(name, ".") || !strcmp(name, "..")) {
-                continue;
-            } else if (exclude_apps && (user_uid >= AID_APP_START && user_uid <= AID_APP_END)) {
-                continue;
-            } else {
-                collectManualStats(StringPrintf("%s/%s", path.c_str(), name), stats);
-            }
-        }
-    }
-    closedir(d);
-}
-
-static void collectManualExternalStatsForUser(const std::string& path, struct stats* stats) {
-    FTS *fts;
-    FTSENT *p;
-    char *argv[] = { (char*) path.c_str(), nullptr };
-    if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, nullptr))) {
-        PLOG(ERROR) << "Failed to fts_open " << path;
-        return;
-    }
-    while ((p = fts_read(fts)) != nullptr) {
-        p->fts_number = p->fts_parent->fts_number;
-        switch (p->fts_info) {
-        case FTS_D:
-            if (p->fts_level == 4
-                    && !strcmp(p->fts_name, "cache")
-                    && !strcmp(p->fts_parent->fts_parent->fts_name, "data")
-                    && !strcmp(p->fts_parent->fts_parent->fts_parent->fts_name, "Android")) {
-                p->fts_number = 1;
-            }
-            [[fallthrough]]; // to count the directory
-        case FTS_DEFAULT:
-        case FTS_F:
-        case FTS_SL:
-        case FTS_SLNONE:
-            int64_t size = (p->fts_statp->st_blocks * 512);
-            if (p->fts_number == 1) {
-                stats->cacheSize += size;
-            }
-            stats->dataSize += size;
-            break;
-        }
-    }
-    fts_close(fts);
-}
-
 binder::Status InstalldNativeService::getAppSize(const std::optional<std::string>& uuid,
         const std::vector<std::string>& packageNames, int32_t userId, int32_t flags,
         int32_t appId, const std::vector<int64_t>& ceDataInodes,
@@ -1796,71 +1852,68 @@ binder::Status InstalldNativeService::getAppSize(const std::optional<std::string
         flags &= ~FLAG_USE_QUOTA;
     }
 
-    ATRACE_BEGIN("obb");
+    // Every walk runs on the worker pool; the quota queries are quick enough
+    // to run here in the meantime.
+    ATRACE_BEGIN("walk");
+    SizeCalculator calculator;
     for (const auto& packageName : packageNames) {
         auto obbCodePath = create_data_media_package_path(uuid_, userId,
                 "obb", packageName.c_str());
-        calculate_tree_size(obbCodePath, &extStats.codeSize);
+        calculator.addTreeSize(obbCodePath, &extStats.codeSize);
     }
-    ATRACE_END();
 
     if (flags & FLAG_USE_QUOTA && appId >= AID_APP_START) {
-        ATRACE_BEGIN("code");
         for (const auto& codePath : codePaths) {
-            calculate_tree_size(codePath, &stats.codeSize, -1,
+            calculator.addTreeSize(codePath, &stats.codeSize, -1,
                     multiuser_get_shared_gid(0, appId));
         }
-        ATRACE_END();
 
         ATRACE_BEGIN("quota");
-        collectQuotaStats(uuidString, userId, appId, &stats, &extStats);
+        struct stats quotaStats = {};
+        struct stats quotaExtStats = {};
+        collectQuotaStats(uuidString, userId, appId, &quotaStats, &quotaExtStats);
+        calculator.add(&stats, quotaStats);
+        calculator.add(&extStats, quotaExtStats);
         ATRACE_END();
     } else {
-        ATRACE_BEGIN("code");
         for (const auto& codePath : codePaths) {
-            calculate_tree_size(codePath, &stats.codeSize);
+            calculator.addTreeSize(codePath, &stats.codeSize);
         }
-        ATRACE_END();
 
         for (size_t i = 0; i < packageNames.size(); i++) {
             const char* pkgname = packageNames[i].c_str();
 
-            ATRACE_BEGIN("data");
             auto cePath = create_data_user_ce_package_path(uuid_, userId, pkgname, ceDataInodes[i]);
-            collectManualStats(cePath, &stats);
+            calculator.addAppStats(cePath, &stats);
             auto dePath = create_data_user_de_package_path(uuid_, userId, pkgname);
-            collectManualStats(dePath, &stats);
-            ATRACE_END();
+            calculator.addAppStats(dePath, &stats);
 
             if (!uuid) {
-                ATRACE_BEGIN("profiles");
-                calculate_tree_size(
+                calculator.addTreeSize(
                         create_primary_current_profile_package_dir_path(userId, pkgname),
                         &stats.dataSize);
-                calculate_tree_size(
+                calculator.addTreeSize(
                         create_primary_reference_profile_package_dir_path(pkgname),
                         &stats.codeSize);
-                ATRACE_END();
             }
 
-            ATRACE_BEGIN("external");
             auto extPath = create_data_media_package_path(uuid_, userId, "data", pkgname);
-            collectManualStats(extPath, &extStats);
+            calculator.addAppStats(extPath, &extStats);
             auto mediaPath = create_data_media_package_path(uuid_, userId, "media", pkgname);
-            calculate_tree_size(mediaPath, &extStats.dataSize);
-            ATRACE_END();
+            calculator.addTreeSize(mediaPath, &extStats.dataSize);
         }
 
         if (!uuid) {
-            ATRACE_BEGIN("dalvik");
             int32_t sharedGid = multiuser_get_shared_gid(0, appId);
             if (sharedGid != -1) {
-                calculate_tree_size(create_data_dalvik_cache_path(), &stats.codeSize,
+                calculator.addTreeSize(create_data_dalvik_cache_path(), &stats.codeSize,
                         sharedGid, -1);
             }
-            ATRACE_END();
         }
     }
+    calculator.wait();
+    recordSizeStats(&mAppSizeStats, calculator.getStats());
+    ATRACE_END();
 
     std::vector<int64_t> ret;
     ret.push_back(stats.codeSize);
@@ -2003,96 +2056,87 @@ binder::Status InstalldNativeService::getUserSize(const std::optional<std::strin
         flags &= ~FLAG_USE_QUOTA;
     }
 
+    ATRACE_BEGIN("walk");
+    SizeCalculator calculator;
     if (flags & FLAG_USE_QUOTA) {
-        ATRACE_BEGIN("code");
-        calculate_tree_size(create_data_app_path(uuid_), &stats.codeSize, -1, -1, true);
-        ATRACE_END();
+        calculator.addTreeSize(create_data_app_path(uuid_), &stats.codeSize, -1, -1, true);
 
-        ATRACE_BEGIN("data");
         auto cePath = create_data_user_ce_path(uuid_, userId);
-        collectManualStatsForUser(cePath, &stats, true);
+        calculator.addUserStats(cePath, &stats, true);
         auto dePath = create_data_user_de_path(uuid_, userId);
-        collectManualStatsForUser(dePath, &stats, true);
-        ATRACE_END();
+        calculator.addUserStats(dePath, &stats, true);
 
         if (!uuid) {
-            ATRACE_BEGIN("profile");
             auto userProfilePath = create_primary_cur_profile_dir_path(userId);
-            calculate_tree_size(userProfilePath, &stats.dataSize, -1, -1, true);
+            calculator.addTreeSize(userProfilePath, &stats.dataSize, -1, -1, true);
             auto refProfilePath = create_primary_ref_profile_dir_path();
-            calculate_tree_size(refProfilePath, &stats.codeSize, -1, -1, true);
-            ATRACE_END();
+            calculator.addTreeSize(refProfilePath, &stats.codeSize, -1, -1, true);
         }
 
         ATRACE_BEGIN("external");
         auto sizes = getExternalSizesForUserWithQuota(uuidString, userId, appIds);
-        extStats.dataSize += sizes.totalSize;
-        extStats.codeSize += sizes.obbSize;
+        calculator.add(&extStats.dataSize, sizes.totalSize);
+        calculator.add(&extStats.codeSize, sizes.obbSize);
         ATRACE_END();
 
         if (!uuid) {
-            ATRACE_BEGIN("dalvik");
-            calculate_tree_size(create_data_dalvik_cache_path(), &stats.codeSize,
+            calculator.addTreeSize(create_data_dalvik_cache_path(), &stats.codeSize,
                     -1, -1, true);
-            calculate_tree_size(create_primary_cur_profile_dir_path(userId), &stats.dataSize,
+            calculator.addTreeSize(create_primary_cur_profile_dir_path(userId), &stats.dataSize,
                     -1, -1, true);
-            ATRACE_END();
         }
-        ATRACE_BEGIN("quota");
-        int64_t dataSize = extStats.dataSize;
-        for (auto appId : appIds) {
-            if (appId >= AID_APP_START) {
-                collectQuotaStats(uuidString, userId, appId, &stats, &extStats);
-#if MEASURE_DEBUG
-                // Sleep to make sure we don't lose logs
-                usleep(1);
-#endif
-            }
+
+        // The external data size is already known from the project quotas
+        // above, so only the rest of the per-app quota stats is kept.
+        for (size_t start = 0; start < appIds.size(); start += kQuotaAppsPerTask) {
+            size_t end = std::min(appIds.size(), start + kQuotaAppsPerTask);
+            calculator.post([&, start, end] {
+                struct stats quotaStats = {};
+                struct stats quotaExtStats = {};
+                for (size_t i = start; i < end; i++) {
+                    if (appIds[i] >= AID_APP_START) {
+                        collectQuotaStats(uuidString, userId, appIds[i], &quotaStats,
+                                &quotaExtStats);
+                    }
+                }
+                quotaExtStats.dataSize = 0;
+                calculator.add(&stats, quotaStats);
+                calculator.add(&extStats, quotaExtStats);
+            });
         }
-        extStats.dataSize = dataSize;
-        ATRACE_END();
     } else {
-        ATRACE_BEGIN("obb");
         auto obbPath = create_data_path(uuid_) + "/media/obb";
-        calculate_tree_size(obbPath, &extStats.codeSize);
-        ATRACE_END();
+        calculator.addTreeSize(obbPath, &extStats.codeSize);
 
-        ATRACE_BEGIN("code");
-        calculate_tree_size(create_data_app_path(uuid_), &stats.codeSize);
-        ATRACE_END();
+        calculator.addTreeSize(create_data_app_path(uuid_), &stats.codeSize);
 
-        ATRACE_BEGIN("data");
         auto cePath = create_data_user_ce_path(uuid_, userId);
-        collectManualStatsForUser(cePath, &stats);
+        calculator.addUserStats(cePath, &stats);
         auto dePath = create_data_user_de_path(uuid_, userId);
-        collectManualStatsForUser(dePath, &stats);
-        ATRACE_END();
+        calculator.addUserStats(dePath, &stats);
 
         if (!uuid) {
-            ATRACE_BEGIN("profile");
             auto userProfilePath = create_primary_cur_profile_dir_path(userId);
-            calculate_tree_size(userProfilePath, &stats.dataSize);
+            calculator.addTreeSize(userProfilePath, &stats.dataSize);
             auto refProfilePath = create_primary_ref_profile_dir_path();
-            calculate_tree_size(refProfilePath, &stats.codeSize);
-            ATRACE_END();
+            calculator.addTreeSize(refProfilePath, &stats.codeSize);
         }
 
-        ATRACE_BEGIN("external");
         auto dataMediaPath = create_data_media_path(uuid_, userId);
-        collectManualExternalStatsForUser(dataMediaPath, &extStats);
-#if MEASURE_DEBUG
-        LOG(DEBUG) << "Measured external data " << extStats.dataSize << " cache "
-                << extStats.cacheSize;
-#endif
-        ATRACE_END();
+        calculator.addExternalUserStats(dataMediaPath, &extStats);
 
         if (!uuid) {
-            ATRACE_BEGIN("dalvik");
-            calculate_tree_size(create_data_dalvik_cache_path(), &stats.codeSize);
-            calculate_tree_size(create_primary_cur_profile_dir_path(userId), &stats.dataSize);
-            ATRACE_END();
+            calculator.addTreeSize(create_data_dalvik_cache_path(), &stats.codeSize);
+            calculator.addTreeSize(create_primary_cur_profile_dir_path(userId), &stats.dataSize);
         }
     }
+    calculator.wait();
+    recordSizeStats(&mUserSizeStats, calculator.getStats());
+    ATRACE_END();
+#if MEASURE_DEBUG
+    LOG(DEBUG) << "Measured external data " << extStats.dataSize << " cache "
+            << extStats.cacheSize;
+#endif
 
     std::vector<int64_t> ret;
     ret.push_back(stats.codeSize);
@@ -2234,7 +2278,7 @@ binder::Status InstalldNativeService::getAppCrates(
         CHECK_ARGUMENT_PACKAGE_NAME(packageName);
     }
 #ifdef ENABLE_STORAGE_CRATES
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_USER_SHARED(userId);
 
     auto retVector = std::vector<std::optional<CrateMetadata>>();
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
@@ -2280,7 +2324,7 @@ binder::Status InstalldNativeService::getUserCrates(
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
 #ifdef ENABLE_STORAGE_CRATES
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_USER_SHARED(userId);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     auto retVector = std::vector<std::optional<CrateMetadata>>();
@@ -2337,7 +2381,7 @@ binder::Status InstalldNativeService::dumpProfiles(int32_t uid, const std::strin
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
     CHECK_ARGUMENT_PATH(codePath);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName);
 
     *_aidl_return = dump_profiles(uid, packageName, profileName, codePath);
     return ok();
@@ -2349,7 +2393,7 @@ binder::Status InstalldNativeService::copySystemProfile(const std::string& syste
         bool* _aidl_return) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName);
     *_aidl_return = copy_system_profile(systemProfile, packageUid, packageName, profileName);
     return ok();
 }
@@ -2359,7 +2403,7 @@ binder::Status InstalldNativeService::mergeProfiles(int32_t uid, const std::stri
         const std::string& profileName, int* _aidl_return) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName);
 
     *_aidl_return = analyze_primary_profiles(uid, packageName, profileName);
     return ok();
@@ -2370,7 +2414,7 @@ binder::Status InstalldNativeService::createProfileSnapshot(int32_t appId,
         const std::string& classpath, bool* _aidl_return) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName);
 
     *_aidl_return = create_profile_snapshot(appId, packageName, profileName, classpath);
     return ok();
@@ -2380,7 +2424,7 @@ binder::Status InstalldNativeService::destroyProfileSnapshot(const std::string&
         const std::string& profileName) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName);
 
     std::string snapshot = create_snapshot_profile_path(packageName, profileName);
     if ((unlink(snapshot.c_str()) != 0) && (errno != ENOENT)) {
@@ -2410,7 +2454,8 @@ binder::Status InstalldNativeService::dexopt(const std::string& apkPath, int32_t
     }
     CHECK_ARGUMENT_PATH(outputPath);
     CHECK_ARGUMENT_PATH(dexMetadataPath);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE(packageName.value_or(""));
+    LOCK_APK_PATH(apkPath);
 
     const char* oat_dir = getCStr(outputPath);
     const char* instruction_set = instructionSet.c_str();
@@ -2453,7 +2498,7 @@ binder::Status InstalldNativeService::linkNativeLibraryDirectory(
     CHECK_ARGUMENT_UUID(uuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
     CHECK_ARGUMENT_PATH(nativeLibPath32);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, userId);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     const char* pkgname = packageName.c_str();
@@ -2542,9 +2587,15 @@ binder::Status InstalldNativeService::restoreconAppData(const std::optional<std:
         const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
         const std::string& seInfo) {
     ENFORCE_UID(AID_SYSTEM);
+    LOCK_PACKAGE_USER(packageName, userId);
+    return restoreconAppDataLocked(uuid, packageName, userId, flags, appId, seInfo);
+}
+
+binder::Status InstalldNativeService::restoreconAppDataLocked(
+        const std::optional<std::string>& uuid, const std::string& packageName, int32_t userId,
+        int32_t flags, int32_t appId, const std::string& seInfo) {
     CHECK_ARGUMENT_UUID(uuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
 
     binder::Status res = ok();
 
@@ -2599,6 +2650,7 @@ binder::Status InstalldNativeService::createOatDir(const std::string& oatDir,
 binder::Status InstalldNativeService::rmPackageDir(const std::string& packageDir) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PATH(packageDir);
+    LOCK_CODE_PATH(packageDir);
     std::lock_guard<std::recursive_mutex> lock(mLock);
 
     if (validate_apk_path(packageDir.c_str())) {
@@ -2645,6 +2697,7 @@ binder::Status InstalldNativeService::moveAb(const std::string& apkPath,
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PATH(apkPath);
     CHECK_ARGUMENT_PATH(outputPath);
+    LOCK_APK_PATH(apkPath);
     std::lock_guard<std::recursive_mutex> lock(mLock);
 
     const char* apk_path = apkPath.c_str();
@@ -2661,6 +2714,7 @@ binder::Status InstalldNativeService::deleteOdex(const std::string& apkPath,
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PATH(apkPath);
     CHECK_ARGUMENT_PATH(outputPath);
+    LOCK_APK_PATH(apkPath);
     std::lock_guard<std::recursive_mutex> lock(mLock);
 
     const char* apk_path = apkPath.c_str();
@@ -2815,7 +2869,7 @@ binder::Status InstalldNativeService::reconcileSecondaryDexFile(
     CHECK_ARGUMENT_UUID(volumeUuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
     CHECK_ARGUMENT_PATH(dexPath);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, multiuser_get_user_id(uid));
 
     bool result = android::installd::reconcile_secondary_dex_file(
             dexPath, packageName, uid, isas, volumeUuid, storage_flag, _aidl_return);
@@ -3015,7 +3069,7 @@ binder::Status InstalldNativeService::prepareAppProfile(const std::string& packa
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
     CHECK_ARGUMENT_PATH(codePath);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    LOCK_PACKAGE_USER(packageName, userId);
 
     *_aidl_return = prepare_app_profile(packageName, userId, appId, profileName, codePath,
         dexMetadata);
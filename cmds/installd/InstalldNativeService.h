@@ -21,6 +21,11 @@
 #include <inttypes.h>
 #include <unistd.h>
 
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <vector>
 #include <unordered_map>
 
@@ -29,7 +34,9 @@
 #include <cutils/multiuser.h>
 
 #include "android/os/BnInstalld.h"
+#include "CacheIndex.h"
 #include "installd_constants.h"
+#include "SizeCalculator.h"
 
 namespace android {
 namespace installd {
@@ -176,8 +183,35 @@ public:
     binder::Status migrateLegacyObbData();
 
 private:
+    /*
+     * Locks are taken in this order, and each binder call takes only the
+     * narrowest ones that cover what it touches:
+     *
+     *  - the lock of each user involved, in ascending user ID order: shared
+     *    by calls that work on one package's data, exclusive for calls on
+     *    the whole user;
+     *  - the stripe of mPackageLocks covering the package name;
+     *  - the stripe of mCodePathLocks covering the directory of the APKs,
+     *    taken by dexopt and by the calls removing or moving its outputs,
+     *    which only know the code path;
+     *  - mLock, for code paths, oat files and volume mirrors, which are not
+     *    tied to a package or user;
+     *  - mMountsLock and mQuotasLock, around the state they guard.
+     *
+     * freeCache() is serialized by mFreeCacheLock, taken before everything
+     * else. It holds every user shared while it walks the caches and takes
+     * each package's stripe only around purging that package's items, so a
+     * long purge doesn't hold up dexopt or app data setup of other packages.
+     */
     std::recursive_mutex mLock;
 
+    std::mutex mUserLocksLock;
+    std::map<userid_t, std::unique_ptr<std::shared_mutex>> mUserLocks;
+    static constexpr size_t kPackageLockStripes = 64;
+    std::array<std::mutex, kPackageLockStripes> mPackageLocks;
+    std::array<std::mutex, kPackageLockStripes> mCodePathLocks;
+    std::mutex mFreeCacheLock;
+
     std::recursive_mutex mMountsLock;
     std::recursive_mutex mQuotasLock;
 
@@ -187,7 +221,45 @@ private:
     /* Map from UID to cache quota size */
     std::unordered_map<uid_t, int64_t> mCacheQuotas;
 
+    /* Totals of the walks done by getAppSize() and getUserSize(), for dumpsys */
+    struct SizeStats {
+        int64_t calls;
+        int64_t walks;
+        int64_t totalNs;
+        int64_t maxNs;
+    };
+    std::mutex mSizeStatsLock;
+    SizeStats mAppSizeStats = {};
+    SizeStats mUserSizeStats = {};
+
+    /* Contents of the app cache directories as of the last freeCache() */
+    CacheIndex mCacheIndex;
+
+    std::shared_mutex& getUserLock(userid_t userId);
+    std::mutex& getPackageLock(const std::string& packageName);
+    /* Returns the lock of the package directory |codeDir|, holding its APKs */
+    std::mutex& getCodePathLock(const std::string& codeDir);
+    /* Locks the users in ascending order, shared or exclusive */
+    std::vector<std::shared_lock<std::shared_mutex>> lockUsersShared(
+            std::vector<userid_t> userIds);
+    std::vector<std::unique_lock<std::shared_mutex>> lockUsers(std::vector<userid_t> userIds);
+
     std::string findDataMediaPath(const std::optional<std::string>& uuid, userid_t userid);
+
+    /* The calls below skip the caller check, and expect their callers to
+     * hold the package and user locks; they may run on WorkerPool threads
+     * where there is no binder caller to check */
+    binder::Status createAppDataLocked(const std::optional<std::string>& uuid,
+            const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
+            const std::string& seInfo, int32_t targetSdkVersion, int64_t* _aidl_return);
+    void createAppDataLocked(const android::os::CreateAppDataArgs& args,
+            android::os::CreateAppDataResult* result);
+    binder::Status clearAppDataLocked(const std::optional<std::string>& uuid,
+            const std::string& packageName, int32_t userId, int32_t flags, int64_t ceDataInode);
+    binder::Status restoreconAppDataLocked(const std::optional<std::string>& uuid,
+            const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
+            const std::string& seInfo);
+    void recordSizeStats(SizeStats* sizeStats, const SizeCalculator::CallStats& call);
 };
 
 }  // namespace installd
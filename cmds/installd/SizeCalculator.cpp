@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_PACKAGE_MANAGER
+
+#include "SizeCalculator.h"
+
+#include <chrono>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <cutils/multiuser.h>
+#include <private/android_filesystem_config.h>
+#include <utils/Trace.h>
+
+#include "utils.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace installd {
+
+// External storage is split into one walk per directory down to
+// /data/media/<user>/Android/<dir>, where the per-app directories are.
+static constexpr size_t kExternalSplitLevels = 2;
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t blockSize(const struct stat& s) {
+    return s.st_blocks * 512;
+}
+
+/* Whether calculate_tree_size() would skip the node when excluding apps */
+static bool isOwnedByApp(const struct stat& s) {
+    int32_t user_uid = multiuser_get_app_id(s.st_uid);
+    int32_t user_gid = multiuser_get_app_id(s.st_gid);
+    return (user_uid >= AID_APP_START && user_uid <= AID_APP_END)
+            || (user_gid >= AID_CACHE_GID_START && user_gid <= AID_CACHE_GID_END)
+            || (user_gid >= AID_SHARED_GID_START && user_gid <= AID_SHARED_GID_END);
+}
+
+static bool isDotOrDotDot(const char* name) {
+    return !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+SizeCalculator::SizeCalculator(WorkerPool& pool)
+      : mTasks(pool),
+        mStartTime(nowNs()),
+        mWalks(0),
+        mElapsedNs(0) {
+}
+
+SizeCalculator::~SizeCalculator() {
+    wait();
+}
+
+void SizeCalculator::addTreeSize(const std::string& path, int64_t* size, int32_t includeGid,
+        int32_t excludeGid, bool excludeApps) {
+    post([=] { walkTree(path, size, includeGid, excludeGid, excludeApps); });
+}
+
+void SizeCalculator::addAppStats(const std::string& path, struct stats* stats) {
+    post([=] { walkApp(path, stats); });
+}
+
+void SizeCalculator::addUserStats(const std::string& path, struct stats* stats,
+        bool excludeApps) {
+    post([=] { walkUser(path, stats, excludeApps); });
+}
+
+void SizeCalculator::addExternalUserStats(const std::string& path, struct stats* stats) {
+    post([=] {
+        struct stat s;
+        if (lstat(path.c_str(), &s) != 0 || !S_ISDIR(s.st_mode)) {
+            return;
+        }
+        walkExternal(path, {}, s.st_dev, stats);
+    });
+}
+
+void SizeCalculator::post(std::function<void()> task) {
+    mTasks.post(std::move(task));
+}
+
+void SizeCalculator::add(int64_t* counter, int64_t size) {
+    std::lock_guard<std::mutex> lock(mLock);
+    *counter += size;
+}
+
+void SizeCalculator::add(struct stats* counter, const struct stats& size) {
+    std::lock_guard<std::mutex> lock(mLock);
+    counter->codeSize += size.codeSize;
+    counter->dataSize += size.dataSize;
+    counter->cacheSize += size.cacheSize;
+}
+
+void SizeCalculator::wait() {
+    mTasks.wait();
+    mElapsedNs = nowNs() - mStartTime;
+}
+
+SizeCalculator::CallStats SizeCalculator::getStats() const {
+    return CallStats{mWalks.load(), mElapsedNs};
+}
+
+void SizeCalculator::walkTree(const std::string& path, int64_t* size, int32_t includeGid,
+        int32_t excludeGid, bool excludeApps) {
+    // Measure the root here, and each subdirectory with calculate_tree_size()
+    // on its own worker.
+    const auto matches = [=](const struct stat& s) {
+        return (includeGid == -1 || (int32_t) s.st_gid == includeGid)
+                && (excludeGid == -1 || (int32_t) s.st_gid != excludeGid);
+    };
+    struct stat root;
+    if (lstat(path.c_str(), &root) != 0 || (excludeApps && isOwnedByApp(root))) {
+        return;
+    }
+    int64_t matchedSize = matches(root) ? blockSize(root) : 0;
+    DIR* d = S_ISDIR(root.st_mode) ? opendir(path.c_str()) : nullptr;
+    if (d != nullptr) {
+        int dfd = dirfd(d);
+        struct dirent* de;
+        struct stat s;
+        while ((de = readdir(d))) {
+            const char* name = de->d_name;
+            if (isDotOrDotDot(name) || fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            if (excludeApps && isOwnedByApp(s)) {
+                continue;
+            }
+            if (S_ISDIR(s.st_mode) && s.st_dev == root.st_dev) {
+                auto child = StringPrintf("%s/%s", path.c_str(), name);
+                post([=] {
+                    int64_t childSize = 0;
+                    calculate_tree_size(child, &childSize, includeGid, excludeGid, excludeApps);
+                    mWalks++;
+                    add(size, childSize);
+                });
+            } else if (matches(s)) {
+                matchedSize += blockSize(s);
+            }
+        }
+        closedir(d);
+    }
+    mWalks++;
+    add(size, matchedSize);
+}
+
+void SizeCalculator::walkApp(const std::string& path, struct stats* stats) {
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Failed to open " << path;
+        }
+        return;
+    }
+    struct stats local = {};
+    int dfd = dirfd(d);
+    struct dirent* de;
+    struct stat s;
+    while ((de = readdir(d))) {
+        const char* name = de->d_name;
+
+        int64_t size = 0;
+        if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) == 0) {
+            size = blockSize(s);
+        }
+
+        if (de->d_type == DT_DIR) {
+            if (!strcmp(name, "..")) {
+                // Don't recurse or count node size
+                continue;
+            }
+            if (strcmp(name, ".")) {
+                // Measure all children nodes on their own worker
+                auto child = StringPrintf("%s/%s", path.c_str(), name);
+                bool isCache = !strcmp(name, "cache") || !strcmp(name, "code_cache");
+                post([=] {
+                    struct stats childStats = {};
+                    calculate_tree_size(child, &childStats.dataSize);
+                    if (isCache) {
+                        childStats.cacheSize = childStats.dataSize;
+                    }
+                    mWalks++;
+                    add(stats, childStats);
+                });
+                continue;
+            }
+            // Don't recurse, but still count node size
+        }
+
+        // Legacy symlink isn't owned by app
+        if (de->d_type == DT_LNK && !strcmp(name, "lib")) {
+            continue;
+        }
+
+        // Everything found inside is considered data
+        local.dataSize += size;
+    }
+    closedir(d);
+    mWalks++;
+    add(stats, local);
+}
+
+void SizeCalculator::walkUser(const std::string& path, struct stats* stats, bool excludeApps) {
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Failed to open " << path;
+        }
+        return;
+    }
+    int dfd = dirfd(d);
+    struct dirent* de;
+    struct stat s;
+    while ((de = readdir(d))) {
+        const char* name = de->d_name;
+        if (de->d_type != DT_DIR || isDotOrDotDot(name)
+                || fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        int32_t user_uid = multiuser_get_app_id(s.st_uid);
+        if (excludeApps && (user_uid >= AID_APP_START && user_uid <= AID_APP_END)) {
+            continue;
+        }
+        addAppStats(StringPrintf("%s/%s", path.c_str(), name), stats);
+    }
+    closedir(d);
+    mWalks++;
+}
+
+void SizeCalculator::walkExternal(const std::string& path, const std::vector<std::string>& names,
+        dev_t device, struct stats* stats) {
+    // names holds the path components below the user's root, so that
+    // Android/data/<package>/cache can be recognized at any split level.
+    struct stats local = {};
+    const size_t baseLevel = names.size();
+    if (baseLevel < kExternalSplitLevels) {
+        DIR* d = opendir(path.c_str());
+        if (d == nullptr) {
+            return;
+        }
+        int dfd = dirfd(d);
+        struct stat s;
+        if (fstat(dfd, &s) == 0) {
+            local.dataSize += blockSize(s);
+        }
+        struct dirent* de;
+        while ((de = readdir(d))) {
+            const char* name = de->d_name;
+            if (isDotOrDotDot(name) || fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            if (S_ISDIR(s.st_mode) && s.st_dev == device) {
+                auto childNames = names;
+                childNames.push_back(name);
+                auto child = StringPrintf("%s/%s", path.c_str(), name);
+                post([=] { walkExternal(child, childNames, device, stats); });
+            } else {
+                // Including directories on other file systems, which aren't
+                // traversed.
+                local.dataSize += blockSize(s);
+            }
+        }
+        closedir(d);
+        mWalks++;
+        add(stats, local);
+        return;
+    }
+
+    FTS *fts;
+    FTSENT *p;
+    char *argv[] = { (char*) path.c_str(), nullptr };
+    if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, nullptr))) {
+        PLOG(ERROR) << "Failed to fts_open " << path;
+        return;
+    }
+    // The name of the directory at the given level below the user's root.
+    const auto nameAt = [&](FTSENT* entry, size_t level) -> const char* {
+        if (level <= baseLevel) {
+            return names[level - 1].c_str();
+        }
+        for (size_t i = baseLevel + entry->fts_level; i > level; i--) {
+            entry = entry->fts_parent;
+        }
+        return entry->fts_name;
+    };
+    while ((p = fts_read(fts)) != nullptr) {
+        p->fts_number = p->fts_parent->fts_number;
+        switch (p->fts_info) {
+        case FTS_D:
+            if (baseLevel + p->fts_level == 4
+                    && !strcmp(p->fts_name, "cache")
+                    && !strcmp(nameAt(p, 2), "data")
+                    && !strcmp(nameAt(p, 1), "Android")) {
+                p->fts_number = 1;
+            }
+            [[fallthrough]]; // to count the directory
+        case FTS_DEFAULT:
+        case FTS_F:
+        case FTS_SL:
+        case FTS_SLNONE:
+            int64_t size = blockSize(*p->fts_statp);
+            if (p->fts_number == 1) {
+                local.cacheSize += size;
+            }
+            local.dataSize += size;
+            break;
+        }
+    }
+    fts_close(fts);
+    mWalks++;
+    add(stats, local);
+}
+
+}  // namespace installd
+}  // namespace android
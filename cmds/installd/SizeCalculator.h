@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INSTALLD_SIZE_CALCULATOR_H
+#define ANDROID_INSTALLD_SIZE_CALCULATOR_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <android-base/macros.h>
+
+#include "WorkerPool.h"
+
+namespace android {
+namespace installd {
+
+struct stats {
+    int64_t codeSize;
+    int64_t dataSize;
+    int64_t cacheSize;
+};
+
+/**
+ * Measures app and user storage by walking directory trees on a
+ * WorkerPool. Every method queues its walk and returns immediately; the
+ * sizes are added to the given counters, and are only complete once
+ * wait() returns. Large trees are split into one walk per subdirectory, so
+ * that a few big apps don't serialize the whole measurement.
+ */
+class SizeCalculator {
+public:
+    struct CallStats {
+        /* Number of directory trees walked */
+        int64_t walks;
+        /* Time from construction until wait() returned */
+        int64_t elapsedNs;
+    };
+
+    explicit SizeCalculator(WorkerPool& pool = WorkerPool::getDefault());
+    ~SizeCalculator();
+
+    /* Adds the size of the tree to *size, as calculate_tree_size() does */
+    void addTreeSize(const std::string& path, int64_t* size, int32_t includeGid = -1,
+            int32_t excludeGid = -1, bool excludeApps = false);
+    /* Adds the data and cache sizes of a single app's data directory */
+    void addAppStats(const std::string& path, struct stats* stats);
+    /* Adds the stats of every app data directory of a user, optionally
+     * skipping the ones owned by apps */
+    void addUserStats(const std::string& path, struct stats* stats, bool excludeApps = false);
+    /* Adds the data and cache sizes of a user's external storage */
+    void addExternalUserStats(const std::string& path, struct stats* stats);
+
+    /* Runs the task alongside the walks; it reports its results through add() */
+    void post(std::function<void()> task);
+    /* Adds to a counter shared with other walks */
+    void add(int64_t* counter, int64_t size);
+    void add(struct stats* counter, const struct stats& size);
+
+    /* Waits for everything queued so far */
+    void wait();
+    CallStats getStats() const;
+
+private:
+    void walkTree(const std::string& path, int64_t* size, int32_t includeGid, int32_t excludeGid,
+            bool excludeApps);
+    void walkApp(const std::string& path, struct stats* stats);
+    void walkUser(const std::string& path, struct stats* stats, bool excludeApps);
+    void walkExternal(const std::string& path, const std::vector<std::string>& names,
+            dev_t device, struct stats* stats);
+
+    WorkerPool::TaskGroup mTasks;
+    const int64_t mStartTime;
+    std::atomic<int64_t> mWalks;
+    int64_t mElapsedNs;
+    std::mutex mLock;
+
+    DISALLOW_COPY_AND_ASSIGN(SizeCalculator);
+};
+
+}  // namespace installd
+}  // namespace android
+
+#endif  // ANDROID_INSTALLD_SIZE_CALCULATOR_H
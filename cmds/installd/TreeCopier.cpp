@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeCopier.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include "utils.h"
+
+using android::base::unique_fd;
+
+namespace android {
+namespace installd {
+
+// Files at least this big are copied by tasks of their own, so that a
+// directory holding a few large databases doesn't copy them one by one.
+static constexpr int64_t kLargeFileBytes = 1024 * 1024;
+static constexpr size_t kCopyChunkBytes = 1024 * 1024;
+static constexpr size_t kBufferBytes = 64 * 1024;
+// The cache markers are about the directory itself, so they stay valid in a
+// copy. The user.inode_* xattrs hold inode numbers of the source, and aren't
+// copied.
+static const char* const kCopiedXattrs[] = { kXattrCacheGroup, kXattrCacheTombstone };
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool isDotOrDotDot(const char* name) {
+    return !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+static bool setTimes(const std::string& path, const struct stat& st) {
+    const struct timespec times[] = { st.st_atim, st.st_mtim };
+    return utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+/* Unlinks whatever is at the path, as cp -F does before replacing it */
+static bool removeExisting(const std::string& path) {
+    return unlink(path.c_str()) == 0 || errno == ENOENT;
+}
+
+TreeCopier::TreeCopier(WorkerPool& pool)
+      : mTasks(pool),
+        mFiles(0),
+        mDirectories(0),
+        mBytes(0),
+        mClonedBytes(0),
+        mElapsedNs(0),
+        mError(0) {
+}
+
+TreeCopier::~TreeCopier() {
+    mTasks.wait();
+}
+
+int TreeCopier::copy(const std::string& from, const std::string& to) {
+    const int64_t start = nowNs();
+    struct stat st;
+    if (lstat(from.c_str(), &st) != 0) {
+        fail("Failed to lstat " + from);
+    } else {
+        copyEntry(from, to + "/" + android::base::Basename(from), st);
+    }
+    mTasks.wait();
+
+    // Deepest first, so that no directory is made read-only before the
+    // ones below it are done.
+    std::sort(mCopiedDirectories.begin(), mCopiedDirectories.end(),
+            [](const Directory& left, const Directory& right) {
+                return left.path.size() > right.path.size();
+            });
+    for (const auto& dir : mCopiedDirectories) {
+        if (chmod(dir.path.c_str(), dir.st.st_mode & 07777) != 0) {
+            fail("Failed to chmod " + dir.path);
+        } else if (!setTimes(dir.path, dir.st)) {
+            fail("Failed to set times of " + dir.path);
+        }
+    }
+    mCopiedDirectories.clear();
+    mElapsedNs += nowNs() - start;
+
+    int error = mError;
+    mError = 0;
+    return error;
+}
+
+TreeCopier::CallStats TreeCopier::getStats() const {
+    return CallStats{mFiles, mDirectories, mBytes, mClonedBytes, mElapsedNs};
+}
+
+void TreeCopier::copyDirectory(const std::string& from, const std::string& to,
+        const struct stat& st) {
+    // The directory stays writable until copy() applies its mode.
+    if (mkdir(to.c_str(), 0700) != 0) {
+        struct stat existing;
+        if (errno != EEXIST || lstat(to.c_str(), &existing) != 0) {
+            fail("Failed to mkdir " + to);
+            return;
+        }
+        if (!S_ISDIR(existing.st_mode) && (!removeExisting(to) || mkdir(to.c_str(), 0700) != 0)) {
+            fail("Failed to replace " + to);
+            return;
+        }
+    }
+    unique_fd toFd(open(to.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+    if (toFd == -1 || fchown(toFd, st.st_uid, st.st_gid) != 0) {
+        fail("Failed to chown " + to);
+        return;
+    }
+
+    int fromFd = open(from.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR* d = fromFd == -1 ? nullptr : fdopendir(fromFd);
+    if (d == nullptr) {
+        fail("Failed to opendir " + from);
+        if (fromFd != -1) close(fromFd);
+        return;
+    }
+    if (!copyXattrs(fromFd, toFd, from)) {
+        closedir(d);
+        return;
+    }
+
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        if (isDotOrDotDot(de->d_name)) continue;
+        struct stat childSt;
+        std::string childFrom = from + "/" + de->d_name;
+        std::string childTo = to + "/" + de->d_name;
+        if (fstatat(fromFd, de->d_name, &childSt, AT_SYMLINK_NOFOLLOW) != 0) {
+            fail("Failed to lstat " + childFrom);
+        } else if (S_ISDIR(childSt.st_mode)
+                || (S_ISREG(childSt.st_mode) && childSt.st_size >= kLargeFileBytes)) {
+            mTasks.post([this, childFrom, childTo, childSt] {
+                copyEntry(childFrom, childTo, childSt);
+            });
+        } else {
+            copyEntry(childFrom, childTo, childSt);
+        }
+    }
+    closedir(d);
+
+    mDirectories++;
+    std::lock_guard<std::mutex> lock(mLock);
+    mCopiedDirectories.push_back(Directory{to, st});
+}
+
+void TreeCopier::copyEntry(const std::string& from, const std::string& to,
+        const struct stat& st) {
+    if (S_ISDIR(st.st_mode)) {
+        copyDirectory(from, to, st);
+        return;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (copyFile(from, to, st)) {
+            mFiles++;
+        }
+        return;
+    }
+
+    if (!removeExisting(to)) {
+        fail("Failed to replace " + to);
+        return;
+    }
+    if (S_ISLNK(st.st_mode)) {
+        std::string target;
+        if (!android::base::Readlink(from, &target)) {
+            fail("Failed to readlink " + from);
+            return;
+        }
+        if (symlink(target.c_str(), to.c_str()) != 0) {
+            fail("Failed to symlink " + to);
+            return;
+        }
+    } else if (mknod(to.c_str(), st.st_mode, st.st_rdev) != 0
+            || chmod(to.c_str(), st.st_mode & 07777) != 0) {
+        fail("Failed to mknod " + to);
+        return;
+    }
+    if (lchown(to.c_str(), st.st_uid, st.st_gid) != 0) {
+        fail("Failed to chown " + to);
+    } else if (!setTimes(to, st)) {
+        fail("Failed to set times of " + to);
+    }
+}
+
+bool TreeCopier::copyFile(const std::string& from, const std::string& to,
+        const struct stat& st) {
+    unique_fd fromFd(open(from.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+    if (fromFd == -1) {
+        fail("Failed to open " + from);
+        return false;
+    }
+    if (!removeExisting(to)) {
+        fail("Failed to replace " + to);
+        return false;
+    }
+    unique_fd toFd(open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600));
+    if (toFd == -1) {
+        fail("Failed to create " + to);
+        return false;
+    }
+    if (!copyData(fromFd, toFd, from, st.st_size)) {
+        return false;
+    }
+    // The mode goes after the owner, which would clear setuid bits.
+    if (fchown(toFd, st.st_uid, st.st_gid) != 0 || fchmod(toFd, st.st_mode & 07777) != 0) {
+        fail("Failed to chown " + to);
+        return false;
+    }
+    if (!copyXattrs(fromFd, toFd, from)) {
+        return false;
+    }
+    const struct timespec times[] = { st.st_atim, st.st_mtim };
+    if (futimens(toFd, times) != 0) {
+        fail("Failed to set times of " + to);
+        return false;
+    }
+    return true;
+}
+
+bool TreeCopier::copyData(int fromFd, int toFd, const std::string& from, int64_t size) {
+    if (size == 0) {
+        return true;
+    }
+    if (ioctl(toFd, FICLONE, fromFd) == 0) {
+        mBytes += size;
+        mClonedBytes += size;
+        return true;
+    }
+
+    // Without reflinks, the kernel still copies without a round trip
+    // through userspace, unless the file systems can't do that either.
+    bool useCopyFileRange = true;
+    std::unique_ptr<char[]> buffer;
+    while (true) {
+        ssize_t n;
+        if (useCopyFileRange) {
+            n = syscall(__NR_copy_file_range, fromFd, nullptr, toFd, nullptr, kCopyChunkBytes, 0);
+            if (n == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                    || errno == EOPNOTSUPP)) {
+                useCopyFileRange = false;
+                buffer.reset(new char[kBufferBytes]);
+                continue;
+            }
+        } else {
+            n = TEMP_FAILURE_RETRY(read(fromFd, buffer.get(), kBufferBytes));
+            if (n > 0 && !android::base::WriteFully(toFd, buffer.get(), n)) {
+                n = -1;
+            }
+        }
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            fail("Failed to copy " + from);
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        mBytes += n;
+    }
+}
+
+bool TreeCopier::copyXattrs(int fromFd, int toFd, const std::string& from) {
+    for (const char* name : kCopiedXattrs) {
+        std::string value;
+        ssize_t size = fgetxattr(fromFd, name, nullptr, 0);
+        if (size >= 0) {
+            value.resize(size);
+            size = fgetxattr(fromFd, name, &value[0], value.size());
+        }
+        if (size < 0) {
+            if (errno == ENODATA || errno == ENOTSUP) continue;
+            fail(std::string("Failed to read xattr ") + name + " of " + from);
+            return false;
+        }
+        if (fsetxattr(toFd, name, value.data(), size, 0) != 0) {
+            fail(std::string("Failed to copy xattr ") + name + " of " + from);
+            return false;
+        }
+    }
+    return true;
+}
+
+void TreeCopier::fail(const std::string& message) {
+    const int error = errno ? errno : EIO;
+    PLOG(ERROR) << message;
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mError == 0) {
+        mError = error;
+    }
+}
+
+}  // namespace installd
+}  // namespace android
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INSTALLD_TREE_COPIER_H
+#define ANDROID_INSTALLD_TREE_COPIER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <android-base/macros.h>
+
+#include "WorkerPool.h"
+
+namespace android {
+namespace installd {
+
+/**
+ * Copies directory trees in-process on a WorkerPool, as
+ * "cp -F -p -R -P -d" used to: existing destination files are replaced,
+ * symlinks are copied as links, and modes, owners and timestamps are kept,
+ * along with the cache group and tombstone markers. The cache inode xattrs
+ * aren't copied, since they would point at inodes of the source.
+ * SELinux labels are not copied; callers restorecon the result as before.
+ *
+ * Each directory is copied by its own task. File data is shared with a
+ * FICLONE reflink where the file system supports it, and copied in the
+ * kernel with copy_file_range() otherwise.
+ */
+class TreeCopier {
+public:
+    struct CallStats {
+        int64_t files;
+        int64_t directories;
+        /* Bytes of file data in the copied tree */
+        int64_t bytes;
+        /* Of those, the bytes shared by reflinks rather than copied */
+        int64_t clonedBytes;
+        int64_t elapsedNs;
+    };
+
+    explicit TreeCopier(WorkerPool& pool = WorkerPool::getDefault());
+    ~TreeCopier();
+
+    /* Copies the tree at from into the existing directory to, as
+     * to/basename(from). Returns 0, or the errno of the first failure, in
+     * which case the copy is incomplete. */
+    int copy(const std::string& from, const std::string& to);
+
+    CallStats getStats() const;
+
+private:
+    struct Directory {
+        std::string path;
+        struct stat st;
+    };
+
+    void copyDirectory(const std::string& from, const std::string& to, const struct stat& st);
+    void copyEntry(const std::string& from, const std::string& to, const struct stat& st);
+    bool copyFile(const std::string& from, const std::string& to, const struct stat& st);
+    bool copyData(int fromFd, int toFd, const std::string& from, int64_t size);
+    bool copyXattrs(int fromFd, int toFd, const std::string& from);
+    void fail(const std::string& message);
+
+    WorkerPool::TaskGroup mTasks;
+    std::atomic<int64_t> mFiles;
+    std::atomic<int64_t> mDirectories;
+    std::atomic<int64_t> mBytes;
+    std::atomic<int64_t> mClonedBytes;
+    int64_t mElapsedNs;
+
+    std::mutex mLock;
+    int mError;
+    // Directories get their modes and timestamps once everything below
+    // them has been written.
+    std::vector<Directory> mCopiedDirectories;
+
+    DISALLOW_COPY_AND_ASSIGN(TreeCopier);
+};
+
+}  // namespace installd
+}  // namespace android
+
+#endif  // ANDROID_INSTALLD_TREE_COPIER_H
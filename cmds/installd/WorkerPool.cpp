@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+#include <android-base/properties.h>
+
+namespace android {
+namespace installd {
+
+// Beyond a handful of threads, flash storage stops getting faster and the
+// threads only contend for the same inodes.
+static constexpr size_t kDefaultThreadCount = 4;
+
+WorkerPool::WorkerPool(size_t threadCount) : mShutdown(false) {
+    for (size_t i = 0; i < threadCount; i++) {
+        mThreads.emplace_back(&WorkerPool::threadLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mShutdown = true;
+    }
+    mTaskPosted.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+WorkerPool& WorkerPool::getDefault() {
+    static WorkerPool* pool = [] {
+        size_t threadCount = android::base::GetUintProperty<size_t>(
+                "installd.worker_threads",
+                std::min<size_t>(kDefaultThreadCount, std::thread::hardware_concurrency()));
+        return new WorkerPool(threadCount);
+    }();
+    return *pool;
+}
+
+void WorkerPool::threadLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        mTaskPosted.wait(lock, [this] { return mShutdown || !mTasks.empty(); });
+        if (mTasks.empty()) {
+            return;
+        }
+        Task task = std::move(mTasks.front());
+        mTasks.pop_front();
+        runLocked(lock, std::move(task));
+    }
+}
+
+void WorkerPool::runLocked(std::unique_lock<std::mutex>& lock, Task task) {
+    lock.unlock();
+    task.run();
+    lock.lock();
+    if (--task.group->mPending == 0) {
+        mTaskDone.notify_all();
+    }
+}
+
+WorkerPool::TaskGroup::TaskGroup(WorkerPool& pool) : mPool(pool), mPending(0) {
+}
+
+WorkerPool::TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void WorkerPool::TaskGroup::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mPool.mLock);
+        mPending++;
+        mPool.mTasks.push_back({this, std::move(task)});
+    }
+    mPool.mTaskPosted.notify_one();
+}
+
+void WorkerPool::TaskGroup::wait() {
+    std::unique_lock<std::mutex> lock(mPool.mLock);
+    while (mPending > 0) {
+        auto it = std::find_if(mPool.mTasks.begin(), mPool.mTasks.end(),
+                [this](const Task& task) { return task.group == this; });
+        if (it != mPool.mTasks.end()) {
+            Task task = std::move(*it);
+            mPool.mTasks.erase(it);
+            mPool.runLocked(lock, std::move(task));
+        } else {
+            // The rest of the group is running on other threads.
+            mPool.mTaskDone.wait(lock);
+        }
+    }
+}
+
+}  // namespace installd
+}  // namespace android
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INSTALLD_WORKER_POOL_H
+#define ANDROID_INSTALLD_WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace installd {
+
+/**
+ * A fixed set of worker threads for file system work that installd fans
+ * out, such as walking app data directories. The number of threads bounds
+ * how much I/O installd keeps in flight, whatever the number of concurrent
+ * binder calls.
+ *
+ * Work is posted to a TaskGroup. Waiting on a group runs its queued tasks
+ * on the waiting thread too, so that tasks may wait on groups of their
+ * own, and a pool without threads runs everything on the caller.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threadCount);
+    ~WorkerPool();
+
+    size_t getThreadCount() const { return mThreads.size(); }
+
+    /* The pool shared by all of installd's calls */
+    static WorkerPool& getDefault();
+
+    class TaskGroup {
+    public:
+        explicit TaskGroup(WorkerPool& pool);
+        /* Waits for the tasks that are still pending */
+        ~TaskGroup();
+
+        void post(std::function<void()> task);
+        /* Runs or waits for every task posted so far */
+        void wait();
+
+    private:
+        WorkerPool& mPool;
+        // Posted tasks that have not finished yet, guarded by the pool's lock.
+        size_t mPending;
+
+        friend class WorkerPool;
+        DISALLOW_COPY_AND_ASSIGN(TaskGroup);
+    };
+
+private:
+    struct Task {
+        TaskGroup* group;
+        std::function<void()> run;
+    };
+
+    void threadLoop();
+    /* Runs the task with mLock released, then marks it done */
+    void runLocked(std::unique_lock<std::mutex>& lock, Task task);
+
+    std::mutex mLock;
+    std::condition_variable mTaskPosted;
+    std::condition_variable mTaskDone;
+    std::deque<Task> mTasks;
+    bool mShutdown;
+    std::vector<std::thread> mThreads;
+
+    DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace installd
+}  // namespace android
+
+#endif  // ANDROID_INSTALLD_WORKER_POOL_H
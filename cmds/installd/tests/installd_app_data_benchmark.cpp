@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <cutils/properties.h>
+
+#include "InstalldNativeService.h"
+#include "dexopt.h"
+#include "globals.h"
+#include "utils.h"
+
+using android::base::StringPrintf;
+using android::os::CreateAppDataArgs;
+using android::os::CreateAppDataResult;
+
+namespace android {
+namespace installd {
+
+int get_property(const char *key, char *value, const char *default_value) {
+    return property_get(key, value, default_value);
+}
+
+bool calculate_oat_file_path(char path[PKG_PATH_MAX], const char *oat_dir, const char *apk_path,
+        const char *instruction_set) {
+    return calculate_oat_file_path_default(path, oat_dir, apk_path, instruction_set);
+}
+
+bool calculate_odex_file_path(char path[PKG_PATH_MAX], const char *apk_path,
+        const char *instruction_set) {
+    return calculate_odex_file_path_default(path, apk_path, instruction_set);
+}
+
+bool create_cache_path(char path[PKG_PATH_MAX], const char *src, const char *instruction_set) {
+    return create_cache_path_default(path, src, instruction_set);
+}
+
+// Creates the CE and DE data directories of N synthetic packages for user 0,
+// as the package manager does on first boot, either with one createAppData()
+// per package or with a single createAppDataBatched(). The directories are
+// destroyed between iterations.
+
+static constexpr int32_t kUserId = 0;
+// Well above the app IDs of anything installed on the device.
+static constexpr int32_t kFirstAppId = 19000;
+static constexpr int32_t kTargetSdkVersion = 30;
+
+static InstalldNativeService* getService() {
+    static InstalldNativeService* service = [] {
+        init_globals_from_data_and_root();
+        return new InstalldNativeService();
+    }();
+    return service;
+}
+
+static std::vector<CreateAppDataArgs> makeArgs(int count) {
+    std::vector<CreateAppDataArgs> args(count);
+    for (int i = 0; i < count; i++) {
+        args[i].uuid = std::nullopt;
+        args[i].packageName = StringPrintf("com.android.installd.benchmark%d", i);
+        args[i].userId = kUserId;
+        args[i].flags = FLAG_STORAGE_CE | FLAG_STORAGE_DE;
+        args[i].appId = kFirstAppId + i;
+        args[i].seInfo = "default";
+        args[i].targetSdkVersion = kTargetSdkVersion;
+    }
+    return args;
+}
+
+static void destroyAppData(const std::vector<CreateAppDataArgs>& args) {
+    for (const auto& arg : args) {
+        getService()->destroyAppData(arg.uuid, arg.packageName, arg.userId, arg.flags, 0);
+    }
+}
+
+static bool checkResults(benchmark::State& state, const std::vector<CreateAppDataResult>& results) {
+    for (const auto& result : results) {
+        if (result.exceptionCode != binder::Status::EX_NONE || result.ceDataInode == -1) {
+            state.SkipWithError(result.exceptionMessage.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void runBenchmark(benchmark::State& state, bool batched) {
+    const auto args = makeArgs(state.range(0));
+    std::vector<CreateAppDataResult> results;
+    destroyAppData(args);
+    for (auto _ : state) {
+        if (batched) {
+            getService()->createAppDataBatched(args, &results);
+        } else {
+            results.resize(args.size());
+            for (size_t i = 0; i < args.size(); i++) {
+                getService()->createAppData(args[i], &results[i]);
+            }
+        }
+
+        state.PauseTiming();
+        bool ok = checkResults(state, results);
+        destroyAppData(args);
+        state.ResumeTiming();
+        if (!ok) {
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * args.size());
+}
+
+static void BM_createAppData(benchmark::State& state) {
+    runBenchmark(state, false);
+}
+BENCHMARK(BM_createAppData)->Arg(100)->Arg(500)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+static void BM_createAppDataBatched(benchmark::State& state) {
+    runBenchmark(state, true);
+}
+BENCHMARK(BM_createAppDataBatched)->Arg(100)->Arg(500)->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+
+// Runs create/size/clear/destroy cycles on eight packages at once while
+// another thread keeps calling freeCache() and getUserSize(), and reports the
+// p50 and p99 latency of each call. freeCache() runs with
+// FLAG_FREE_CACHE_NOOP so that it doesn't clear the caches of the device.
+
+enum { CREATE, SIZE, CLEAR, DESTROY, FREE_CACHE, USER_SIZE, NUM_CALLS };
+static const char* const kCallNames[] = {
+    "createAppData", "getAppSize", "clearAppData", "destroyAppData", "freeCache", "getUserSize",
+};
+
+static double percentileMs(const std::vector<int64_t>& sorted, int p) {
+    return sorted.empty() ? 0 : sorted[(sorted.size() - 1) * p / 100] / 1e3;
+}
+
+static void BM_concurrentMixedCalls(benchmark::State& state) {
+    constexpr int kThreads = 8;
+    constexpr int32_t kStorage = FLAG_STORAGE_CE | FLAG_STORAGE_DE;
+    const auto args = makeArgs(kThreads);
+    destroyAppData(args);
+
+    std::mutex latenciesLock;
+    std::vector<int64_t> latencies[NUM_CALLS];
+    const auto timed = [&](int call, auto fn) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(latenciesLock);
+        latencies[call].push_back(us);
+    };
+
+    for (auto _ : state) {
+        std::atomic<bool> done(false);
+        std::vector<std::thread> threads;
+        for (const auto& arg : args) {
+            threads.emplace_back([&] {
+                int64_t ceDataInode = -1;
+                timed(CREATE, [&] {
+                    getService()->createAppData(arg.uuid, arg.packageName, arg.userId, kStorage,
+                            arg.appId, arg.seInfo, arg.targetSdkVersion, &ceDataInode);
+                });
+                std::vector<int64_t> sizes;
+                timed(SIZE, [&] {
+                    getService()->getAppSize(arg.uuid, {arg.packageName}, arg.userId, kStorage,
+                            arg.appId, {ceDataInode}, {}, &sizes);
+                });
+                timed(CLEAR, [&] {
+                    getService()->clearAppData(arg.uuid, arg.packageName, arg.userId,
+                            kStorage | InstalldNativeService::FLAG_CLEAR_CACHE_ONLY, ceDataInode);
+                });
+                timed(DESTROY, [&] {
+                    getService()->destroyAppData(arg.uuid, arg.packageName, arg.userId, kStorage,
+                            ceDataInode);
+                });
+            });
+        }
+        std::thread purger([&] {
+            while (!done) {
+                timed(FREE_CACHE, [&] {
+                    getService()->freeCache(std::nullopt, INT64_MAX, 0,
+                            InstalldNativeService::FLAG_FREE_CACHE_V2
+                                    | InstalldNativeService::FLAG_FREE_CACHE_NOOP);
+                });
+                std::vector<int64_t> sizes;
+                timed(USER_SIZE, [&] {
+                    getService()->getUserSize(std::nullopt, kUserId, 0, {}, &sizes);
+                });
+            }
+        });
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        done = true;
+        purger.join();
+    }
+
+    for (int call = 0; call < NUM_CALLS; call++) {
+        auto& sorted = latencies[call];
+        std::sort(sorted.begin(), sorted.end());
+        state.counters[StringPrintf("%s_p50_ms", kCallNames[call])] = percentileMs(sorted, 50);
+        state.counters[StringPrintf("%s_p99_ms", kCallNames[call])] = percentileMs(sorted, 99);
+    }
+    state.SetItemsProcessed(state.iterations() * args.size() * 4);
+}
+BENCHMARK(BM_concurrentMixedCalls)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+}  // namespace installd
+}  // namespace android
+
+int main(int argc, char** argv) {
+    android::base::InitLogging(argv);
+    android::base::SetMinimumLogSeverity(android::base::ERROR);
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
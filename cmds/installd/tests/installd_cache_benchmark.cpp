@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "CacheIndex.h"
+#include "CacheTracker.h"
+#include "utils.h"
+
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+
+namespace android {
+namespace installd {
+
+// Loads the cache items of every app in a synthetic multi-user /data tree,
+// as freeCache() does before it starts purging, either by walking every
+// cache directory or from a CacheIndex kept across calls.
+
+static constexpr const char* kRoot = "/data/local/tmp/installd_cache_benchmark";
+static constexpr int kUsers = 2;
+static constexpr int kPackages = 100;
+static constexpr int kFilesPerDir = 16;
+
+static void makeFiles(const std::string& dir, int count) {
+    ::mkdir(dir.c_str(), 0700);
+    for (int i = 0; i < count; i++) {
+        WriteStringToFile(std::string(4096, 'x'), StringPrintf("%s/%d", dir.c_str(), i));
+    }
+}
+
+static std::string appPath(int user, int package) {
+    return StringPrintf("%s/user/%d/com.example%d", kRoot, user * 10, package);
+}
+
+static void makeTree() {
+    static bool made = [] {
+        system(StringPrintf("rm -rf %s", kRoot).c_str());
+        for (int user = 0; user < kUsers; user++) {
+            system(StringPrintf("mkdir -p %s/user/%d", kRoot, user * 10).c_str());
+            for (int i = 0; i < kPackages; i++) {
+                auto data = appPath(user, i);
+                ::mkdir(data.c_str(), 0700);
+                makeFiles(data + "/cache", kFilesPerDir);
+                makeFiles(data + "/cache/images", kFilesPerDir);
+                makeFiles(data + "/cache/images/thumbnails", kFilesPerDir);
+                makeFiles(data + "/cache/http", kFilesPerDir);
+                makeFiles(data + "/code_cache", 2);
+                if (i % 10 == 0) {
+                    // Groups are purged as a whole.
+                    auto group = data + "/cache/downloads";
+                    makeFiles(group, kFilesPerDir);
+                    makeFiles(group + "/partial", kFilesPerDir);
+                    setxattr(group.c_str(), kXattrCacheGroup, "", 0, 0);
+                }
+            }
+        }
+        atexit([] { system(StringPrintf("rm -rf %s", kRoot).c_str()); });
+        return true;
+    }();
+    (void) made;
+}
+
+// Every app's items, which are sorted the same way whichever way they were
+// loaded, and their total size.
+struct Snapshot {
+    std::vector<std::tuple<std::string, short, bool, bool, bool, int64_t, time_t>> items;
+    int64_t size;
+};
+
+static Snapshot loadItems(CacheIndex* index) {
+    static const std::string uuid;
+    Snapshot snapshot = {};
+    for (int user = 0; user < kUsers; user++) {
+        for (int i = 0; i < kPackages; i++) {
+            CacheTracker tracker(user * 10, 10000 + i, uuid, index);
+            tracker.addDataPath(appPath(user, i));
+            tracker.loadItems();
+            for (const auto& item : tracker.items) {
+                snapshot.items.emplace_back(item->buildPath(), item->level, item->directory,
+                        item->group, item->tombstone, item->size, item->modified);
+                snapshot.size += item->size;
+            }
+        }
+    }
+    return snapshot;
+}
+
+// Adds a file to every step'th cache directory, and removes the one added
+// before, so that those directories have to be listed again.
+static void churn(int step, int generation) {
+    int n = 0;
+    for (int user = 0; user < kUsers; user++) {
+        for (int i = 0; i < kPackages; i++) {
+            for (const char* dir : {"/cache", "/cache/images", "/cache/images/thumbnails",
+                                    "/cache/http"}) {
+                if (n++ % step != 0) continue;
+                auto path = appPath(user, i) + dir;
+                unlink(StringPrintf("%s/new%d", path.c_str(), generation - 1).c_str());
+                WriteStringToFile("x", StringPrintf("%s/new%d", path.c_str(), generation));
+            }
+        }
+    }
+}
+
+static bool checkParity(benchmark::State& state, CacheIndex* index) {
+    auto expected = loadItems(nullptr);
+    auto actual = loadItems(index);
+    std::sort(expected.items.begin(), expected.items.end());
+    std::sort(actual.items.begin(), actual.items.end());
+    if (actual.items != expected.items) {
+        state.SkipWithError("Indexed items differ from walking the tree");
+        return false;
+    }
+    state.counters["items"] = expected.items.size();
+    return true;
+}
+
+// Walks every cache directory, as freeCache() used to.
+static void BM_loadItemsWalk(benchmark::State& state) {
+    makeTree();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(loadItems(nullptr).size);
+    }
+}
+BENCHMARK(BM_loadItemsWalk)->Unit(benchmark::kMillisecond);
+
+// From an index, with one in every n directories changed between calls;
+// the argument is n, where 0 changes nothing.
+static void BM_loadItemsIndexed(benchmark::State& state) {
+    makeTree();
+    CacheIndex index;
+    if (!checkParity(state, &index)) {
+        return;
+    }
+    const int step = state.range(0);
+    int generation = 0;
+    for (auto _ : state) {
+        if (step > 0) {
+            state.PauseTiming();
+            churn(step, ++generation);
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(loadItems(&index).size);
+    }
+    if (step > 0 && !checkParity(state, &index)) {
+        return;
+    }
+    state.SetLabel(index.toString());
+}
+BENCHMARK(BM_loadItemsIndexed)->Arg(0)->Arg(100)->Arg(20)->Arg(4)
+        ->Unit(benchmark::kMillisecond);
+
+}  // namespace installd
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fts.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "TreeCopier.h"
+#include "WorkerPool.h"
+
+using android::base::ReadFileToString;
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+
+namespace android {
+namespace installd {
+
+// Snapshots a generated app data directory the way snapshotAppData() does,
+// either by running cp as installd used to, or with a TreeCopier; the
+// argument is the number of worker threads, where 0 copies on the calling
+// thread.
+
+static constexpr const char* kRoot = "/data/local/tmp/installd_copy_benchmark";
+static constexpr const char* kCpPath = "/system/bin/cp";
+static constexpr const char* kPackage = "com.example";
+
+static std::string sourcePath() {
+    return StringPrintf("%s/user/0/%s", kRoot, kPackage);
+}
+
+static std::string snapshotPath() {
+    return StringPrintf("%s/rollback/1", kRoot);
+}
+
+static void makeFiles(const std::string& dir, int count, size_t size) {
+    ::mkdir(dir.c_str(), 0771);
+    for (int i = 0; i < count; i++) {
+        WriteStringToFile(std::string(size, 'a' + i % 26), StringPrintf("%s/%d", dir.c_str(), i));
+    }
+}
+
+static void makeTree() {
+    static bool made = [] {
+        system(StringPrintf("rm -rf %s && mkdir -p %s/user/0 %s/rollback", kRoot, kRoot,
+                kRoot).c_str());
+        auto data = sourcePath();
+        ::mkdir(data.c_str(), 0700);
+        // Lots of small files, as in apps with many preferences or an
+        // offline content store, and a few large databases.
+        makeFiles(data + "/shared_prefs", 100, 2048);
+        makeFiles(data + "/files", 50, 16384);
+        for (int i = 0; i < 20; i++) {
+            makeFiles(StringPrintf("%s/files/store%d", data.c_str(), i), 50, 8192);
+        }
+        makeFiles(data + "/databases", 4, 8 * 1024 * 1024);
+        makeFiles(data + "/no_backup", 10, 4096);
+        symlink("/data/app/com.example/lib/arm64", (data + "/lib").c_str());
+        chmod((data + "/files/0").c_str(), 0600);
+        atexit([] { system(StringPrintf("rm -rf %s", kRoot).c_str()); });
+        return true;
+    }();
+    (void) made;
+}
+
+static void clearSnapshot() {
+    system(StringPrintf("rm -rf %s/%s", snapshotPath().c_str(), kPackage).c_str());
+    ::mkdir(snapshotPath().c_str(), 0700);
+}
+
+static int runCp(const std::string& from, const std::string& to) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(kCpPath, kCpPath, "-F", "-p", "-R", "-P", "-d", from.c_str(), to.c_str(), nullptr);
+        _exit(127);
+    }
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) != pid) {
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Every node below the path, with what a snapshot has to preserve.
+static std::map<std::string, std::string> describeTree(const std::string& path) {
+    std::map<std::string, std::string> nodes;
+    char* argv[] = { (char*) path.c_str(), nullptr };
+    FTS* fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+    FTSENT* p;
+    while (fts && (p = fts_read(fts)) != nullptr) {
+        if (p->fts_info == FTS_DP) continue;
+        const struct stat& s = *p->fts_statp;
+        std::string description = StringPrintf("mode=%o uid=%d gid=%d mtime=%ld.%09ld",
+                s.st_mode, s.st_uid, s.st_gid, (long) s.st_mtim.tv_sec,
+                (long) s.st_mtim.tv_nsec);
+        std::string contents;
+        if (S_ISREG(s.st_mode) && ReadFileToString(p->fts_path, &contents)) {
+            description += StringPrintf(" hash=%zx", std::hash<std::string>()(contents));
+        } else if (S_ISLNK(s.st_mode) && android::base::Readlink(p->fts_path, &contents)) {
+            description += " target=" + contents;
+        }
+        nodes[std::string(p->fts_path).substr(path.size())] = description;
+    }
+    if (fts) fts_close(fts);
+    return nodes;
+}
+
+static bool checkSnapshot(benchmark::State& state) {
+    if (describeTree(sourcePath()) !=
+            describeTree(StringPrintf("%s/%s", snapshotPath().c_str(), kPackage))) {
+        state.SkipWithError("Snapshot differs from the app data");
+        return false;
+    }
+    return true;
+}
+
+static void BM_snapshotCp(benchmark::State& state) {
+    makeTree();
+    if (access(kCpPath, X_OK) != 0) {
+        state.SkipWithError("No cp");
+        return;
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        clearSnapshot();
+        state.ResumeTiming();
+        if (runCp(sourcePath(), snapshotPath()) != 0) {
+            state.SkipWithError("cp failed");
+            return;
+        }
+    }
+    checkSnapshot(state);
+}
+BENCHMARK(BM_snapshotCp)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+static void BM_snapshotTreeCopier(benchmark::State& state) {
+    makeTree();
+    WorkerPool pool(state.range(0));
+    TreeCopier::CallStats stats = {};
+    for (auto _ : state) {
+        state.PauseTiming();
+        clearSnapshot();
+        state.ResumeTiming();
+        TreeCopier copier(pool);
+        if (copier.copy(sourcePath(), snapshotPath()) != 0) {
+            state.SkipWithError("Copy failed");
+            return;
+        }
+        stats = copier.getStats();
+    }
+    if (!checkSnapshot(state)) {
+        return;
+    }
+    state.SetBytesProcessed(state.iterations() * stats.bytes);
+    state.counters["files"] = stats.files;
+    state.counters["copied_mb"] = stats.bytes / (1024 * 1024);
+    state.counters["reflinked_mb"] = stats.clonedBytes / (1024 * 1024);
+}
+BENCHMARK(BM_snapshotTreeCopier)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+
+}  // namespace installd
+}  // namespace android
+
+BENCHMARK_MAIN();
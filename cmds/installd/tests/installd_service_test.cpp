@@ -14,8 +14,11 @@
  * limitations under the License.
  */
 
+#include <atomic>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <fcntl.h>
 #include <stdlib.h>
@@ -44,6 +47,7 @@ namespace android {
 namespace installd {
 
 constexpr const char* kTestUuid = "TEST";
+constexpr int64_t kTbInBytes = 1024LL * 1024 * 1024 * 1024;
 
 #define FLAG_FORCE InstalldNativeService::FLAG_FORCE
 
@@ -248,6 +252,74 @@ TEST_F(ServiceTest, CalculateCache) {
     EXPECT_EQ("/data/dalvik-cache/isa/path@to@file.apk@classes.dex", std::string(buf));
 }
 
+TEST_F(ServiceTest, ConcurrentMixedCalls) {
+    LOG(INFO) << "ConcurrentMixedCalls";
+
+    // Every thread sets up, measures, clears and destroys the data of its own
+    // package while another keeps purging the cache of all apps, the way the
+    // package manager, storage stats and the cache quota service do at once
+    // after boot. None of them may fail on files the others removed.
+    constexpr int kThreads = 8;
+    constexpr int kIterations = 50;
+    constexpr int32_t kFirstAppId = 19100;
+    constexpr int32_t kStorage = FLAG_STORAGE_CE | FLAG_STORAGE_DE;
+
+    std::atomic<int> failures(0);
+    std::atomic<bool> done(false);
+
+    const auto check = [&](const char* call, const binder::Status& status) {
+        if (!status.isOk()) {
+            LOG(ERROR) << call << " failed: " << status.toString8().c_str();
+            failures++;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t] {
+            const std::string packageName = StringPrintf("com.android.installd.concurrency%d", t);
+            const int32_t appId = kFirstAppId + t;
+            for (int i = 0; i < kIterations; i++) {
+                int64_t ceDataInode = -1;
+                check("createAppData", service->createAppData(testUuid, packageName, 0, kStorage,
+                        appId, "default", 30, &ceDataInode));
+                const std::string cePath =
+                        create_data_user_ce_package_path(kTestUuid, 0, packageName.c_str());
+                for (int f = 0; f < 4; f++) {
+                    android::base::WriteStringToFile(std::string(4096, 'x'),
+                            StringPrintf("%s/cache/%d-%d", cePath.c_str(), i, f));
+                }
+                std::vector<int64_t> sizes;
+                check("getAppSize", service->getAppSize(testUuid, {packageName}, 0, kStorage,
+                        appId, {ceDataInode}, {}, &sizes));
+                check("clearAppData", service->clearAppData(testUuid, packageName, 0,
+                        kStorage | InstalldNativeService::FLAG_CLEAR_CACHE_ONLY, ceDataInode));
+                check("destroyAppData", service->destroyAppData(testUuid, packageName, 0,
+                        kStorage, ceDataInode));
+            }
+        });
+    }
+    std::thread purger([&] {
+        while (!done) {
+            // Nothing can free a terabyte here, so this purges every cache
+            // file it finds and then reports that it fell short
+            service->freeCache(testUuid, kTbInBytes, 0,
+                    InstalldNativeService::FLAG_FREE_CACHE_V2
+                            | InstalldNativeService::FLAG_FREE_CACHE_V2_DEFY_QUOTA);
+            std::vector<int64_t> sizes;
+            check("getUserSize", service->getUserSize(testUuid, 0, 0, {}, &sizes));
+        }
+    });
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    purger.join();
+
+    EXPECT_EQ(0, failures.load());
+}
+
 static bool mkdirs(const std::string& path, mode_t mode) {
     struct stat sb;
     if (stat(path.c_str(), &sb) != -1 && S_ISDIR(sb.st_mode)) {
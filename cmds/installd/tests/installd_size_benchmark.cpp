@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "SizeCalculator.h"
+#include "WorkerPool.h"
+#include "utils.h"
+
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+
+namespace android {
+namespace installd {
+
+// Measures a synthetic /data tree the way getUserSize() does without quotas:
+// the CE data of every app, and the user's external storage. The argument is
+// the number of worker threads, where 0 runs every walk on the calling thread
+// as installd used to.
+
+static constexpr const char* kRoot = "/data/local/tmp/installd_size_benchmark";
+static constexpr int kPackages = 200;
+static constexpr int kFilesPerDir = 8;
+
+static void makeFiles(const std::string& dir, int count, size_t size) {
+    ::mkdir(dir.c_str(), 0700);
+    for (int i = 0; i < count; i++) {
+        WriteStringToFile(std::string(size, 'x'), StringPrintf("%s/%d", dir.c_str(), i));
+    }
+}
+
+static void makeTree() {
+    static bool made = [] {
+        system(StringPrintf("rm -rf %s && mkdir -p %s/user/0 %s/media/0/Android/data "
+                "%s/media/0/DCIM", kRoot, kRoot, kRoot, kRoot).c_str());
+        for (int i = 0; i < kPackages; i++) {
+            auto data = StringPrintf("%s/user/0/com.example%d", kRoot, i);
+            ::mkdir(data.c_str(), 0700);
+            // Apps vary a lot in size; a few big ones dominate the walk.
+            const int scale = i % 20 == 0 ? 16 : 1;
+            makeFiles(data + "/files", kFilesPerDir * scale, 16384);
+            makeFiles(data + "/cache", kFilesPerDir * scale, 4096);
+            makeFiles(data + "/code_cache", 2, 4096);
+            makeFiles(data + "/databases", 2, 32768);
+            makeFiles(data + "/shared_prefs", 4, 1024);
+
+            auto ext = StringPrintf("%s/media/0/Android/data/com.example%d", kRoot, i);
+            ::mkdir(ext.c_str(), 0700);
+            makeFiles(ext + "/files", kFilesPerDir, 16384);
+            makeFiles(ext + "/cache", kFilesPerDir, 4096);
+        }
+        makeFiles(StringPrintf("%s/media/0/DCIM/Camera", kRoot), 100 * kFilesPerDir, 65536);
+        atexit([] { system(StringPrintf("rm -rf %s", kRoot).c_str()); });
+        return true;
+    }();
+    (void) made;
+}
+
+// The serial walks installd used before SizeCalculator, which every thread
+// count has to agree with.
+
+static void collectManualStats(const std::string& path, struct stats* stats) {
+    DIR *d;
+    int dfd;
+    struct dirent *de;
+    struct stat s;
+
+    d = opendir(path.c_str());
+    if (d == nullptr) {
+        return;
+    }
+    dfd = dirfd(d);
+    while ((de = readdir(d))) {
+        const char *name = de->d_name;
+
+        int64_t size = 0;
+        if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) == 0) {
+            size = s.st_blocks * 512;
+        }
+
+        if (de->d_type == DT_DIR) {
+            if (!strcmp(name, ".")) {
+                // Don't recurse, but still count node size
+            } else if (!strcmp(name, "..")) {
+                // Don't recurse or count node size
+                continue;
+            } else {
+                // Measure all children nodes
+                size = 0;
+                calculate_tree_size(StringPrintf("%s/%s", path.c_str(), name), &size);
+            }
+
+            if (!strcmp(name, "cache") || !strcmp(name, "code_cache")) {
+                stats->cacheSize += size;
+            }
+        }
+
+        // Legacy symlink isn't owned by app
+        if (de->d_type == DT_LNK && !strcmp(name, "lib")) {
+            continue;
+        }
+
+        // Everything found inside is considered data
+        stats->dataSize += size;
+    }
+    closedir(d);
+}
+
+static void collectManualStatsForUser(const std::string& path, struct stats* stats) {
+    DIR *d;
+    struct dirent *de;
+
+    d = opendir(path.c_str());
+    if (d == nullptr) {
+        return;
+    }
+    while ((de = readdir(d))) {
+        if (de->d_type == DT_DIR) {
+            const char *name = de->d_name;
+            if (!strcmp(name, ".") || !strcmp(name, "..")) {
+                continue;
+            }
+            collectManualStats(StringPrintf("%s/%s", path.c_str(), name), stats);
+        }
+    }
+    closedir(d);
+}
+
+static void collectManualExternalStatsForUser(const std::string& path, struct stats* stats) {
+    FTS *fts;
+    FTSENT *p;
+    char *argv[] = { (char*) path.c_str(), nullptr };
+    if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, nullptr))) {
+        return;
+    }
+    while ((p = fts_read(fts)) != nullptr) {
+        p->fts_number = p->fts_parent->fts_number;
+        switch (p->fts_info) {
+        case FTS_D:
+            if (p->fts_level == 4
+                    && !strcmp(p->fts_name, "cache")
+                    && !strcmp(p->fts_parent->fts_parent->fts_name, "data")
+                    && !strcmp(p->fts_parent->fts_parent->fts_parent->fts_name, "Android")) {
+                p->fts_number = 1;
+            }
+            [[fallthrough]]; // to count the directory
+        case FTS_DEFAULT:
+        case FTS_F:
+        case FTS_SL:
+        case FTS_SLNONE:
+            int64_t size = (p->fts_statp->st_blocks * 512);
+            if (p->fts_number == 1) {
+                stats->cacheSize += size;
+            }
+            stats->dataSize += size;
+            break;
+        }
+    }
+    fts_close(fts);
+}
+
+static void measureReference(struct stats* stats, struct stats* extStats) {
+    *stats = {};
+    *extStats = {};
+    collectManualStatsForUser(StringPrintf("%s/user/0", kRoot), stats);
+    collectManualExternalStatsForUser(StringPrintf("%s/media/0", kRoot), extStats);
+}
+
+static void measure(WorkerPool& pool, struct stats* stats, struct stats* extStats,
+        SizeCalculator::CallStats* callStats) {
+    *stats = {};
+    *extStats = {};
+    SizeCalculator calculator(pool);
+    calculator.addUserStats(StringPrintf("%s/user/0", kRoot), stats);
+    calculator.addExternalUserStats(StringPrintf("%s/media/0", kRoot), extStats);
+    calculator.wait();
+    *callStats = calculator.getStats();
+}
+
+static bool operator==(const struct stats& a, const struct stats& b) {
+    return a.codeSize == b.codeSize && a.dataSize == b.dataSize && a.cacheSize == b.cacheSize;
+}
+
+static void runBenchmark(benchmark::State& state, bool dropCaches) {
+    makeTree();
+    WorkerPool pool(state.range(0));
+
+    struct stats expected, expectedExt, stats, extStats;
+    SizeCalculator::CallStats callStats;
+    measureReference(&expected, &expectedExt);
+    measure(pool, &stats, &extStats, &callStats);
+    if (!(stats == expected) || !(extStats == expectedExt)) {
+        state.SkipWithError("Sizes differ from the serial walk");
+        return;
+    }
+
+    for (auto _ : state) {
+        if (dropCaches) {
+            state.PauseTiming();
+            sync();
+            if (!WriteStringToFile("3", "/proc/sys/vm/drop_caches")) {
+                state.SkipWithError("Dropping caches requires root");
+                return;
+            }
+            state.ResumeTiming();
+        }
+        measure(pool, &stats, &extStats, &callStats);
+    }
+    state.counters["walks"] = callStats.walks;
+    state.counters["data_mb"] = (stats.dataSize + extStats.dataSize) / (1024 * 1024);
+}
+
+static void BM_userSizeWarm(benchmark::State& state) {
+    runBenchmark(state, false);
+}
+BENCHMARK(BM_userSizeWarm)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)
+        ->Unit(benchmark::kMillisecond);
+
+// With the dentry and inode caches dropped, as when the storage settings
+// page is opened for the first time after boot.
+static void BM_userSizeCold(benchmark::State& state) {
+    runBenchmark(state, true);
+}
+BENCHMARK(BM_userSizeCold)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)
+        ->Unit(benchmark::kMillisecond);
+
+}  // namespace installd
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -29,6 +29,7 @@
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android/hidl/manager/1.0/IServiceManager.h>
 #include <hidl-hash/Hash.h>
 #include <hidl-util/FQName.h>
@@ -209,6 +210,8 @@ bool ListCommand::getPidInfo(
 }
 
 const BinderPidInfo* ListCommand::getPidInfoCached(pid_t serverPid) {
+    // Held while reading the file, so that it's read once per PID.
+    std::lock_guard<std::mutex> lock(mCachedPidInfosMutex);
     auto pair = mCachedPidInfos.insert({serverPid, BinderPidInfo{}});
     if (pair.second /* did insertion take place? */) {
         if (!getPidInfo(serverPid, &pair.first->second)) {
@@ -466,14 +469,32 @@ void ListCommand::dumpTable(const NullableOStream<std::ostream>& out) const {
         // debug info for a service we create on the fly, so we only operate
         // on the "mServicesTable".
         std::function<std::string(const std::string&)> emitDebugInfo = nullptr;
+        std::vector<std::string> names;
+        std::vector<std::string> debugInfos;
+        std::map<std::string, size_t> debugIndices;
+        std::unique_ptr<ParallelTasks> debugTasks;
         if (mEmitDebugInfo && &table == &mServicesTable) {
-            emitDebugInfo = [this](const auto& iName) {
-                std::stringstream ss;
-                auto pair = splitFirst(iName, '/');
-                mLshal.emitDebugInfo(pair.first, pair.second, {},
-                                     ParentDebugInfoLevel::FQNAME_ONLY, ss,
-                                     NullableOStream<std::ostream>(nullptr));
-                return ss.str();
+            // Dumps are slow, so they are fetched ahead in table order while
+            // the rows are printed, each as soon as its dump is ready.
+            for (const TableEntry& entry : table) {
+                if (debugIndices.emplace(entry.interfaceName, names.size()).second) {
+                    names.push_back(entry.interfaceName);
+                }
+            }
+            debugInfos.resize(names.size());
+            debugTasks = std::make_unique<ParallelTasks>(
+                    names.size(), mJobs, [this, &names, &debugInfos](size_t i) {
+                        std::stringstream ss;
+                        auto pair = splitFirst(names[i], '/');
+                        mLshal.emitDebugInfo(pair.first, pair.second, {},
+                                             ParentDebugInfoLevel::FQNAME_ONLY, ss,
+                                             NullableOStream<std::ostream>(nullptr));
+                        debugInfos[i] = ss.str();
+                    });
+            emitDebugInfo = [&](const auto& iName) {
+                size_t i = debugIndices.at(iName);
+                debugTasks->wait(i);
+                return debugInfos[i];
             };
         }
         table.createTextTable(mNeat, emitDebugInfo).dump(out.buf());
@@ -587,14 +608,29 @@ Status ListCommand::fetchBinderized(const sp<IServiceManager> &manager) {
 
     Status status = OK;
     std::map<std::string, TableEntry> allTableEntries;
+    std::vector<TableEntry*> entries;
     for (const auto &fqInstanceName : fqInstanceNames) {
         // create entry and default assign all fields.
-        TableEntry& entry = allTableEntries[fqInstanceName];
+        auto [it, inserted] = allTableEntries.emplace(fqInstanceName, TableEntry{});
+        if (!inserted) continue;
+        TableEntry& entry = it->second;
         entry.interfaceName = fqInstanceName;
         entry.transport = mode;
         entry.serviceStatus = ServiceStatus::NON_RESPONSIVE;
+        entries.push_back(&entry);
+    }
 
-        status |= fetchBinderizedEntry(manager, &entry);
+    // Each entry takes several calls to its HAL, some of which may time out, so
+    // the entries are fetched in parallel. Warnings are kept per entry and
+    // printed in the order hwservicemanager listed them.
+    std::vector<Status> statuses(entries.size(), OK);
+    std::vector<std::stringstream> warnings(entries.size());
+    ParallelTasks(entries.size(), mJobs, [&](size_t i) {
+        statuses[i] = fetchBinderizedEntry(manager, entries[i], warnings[i]);
+    }).waitAll();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        status |= statuses[i];
+        err() << warnings[i].str();
     }
 
     for (auto& pair : allTableEntries) {
@@ -604,10 +640,10 @@ Status ListCommand::fetchBinderized(const sp<IServiceManager> &manager) {
 }
 
 Status ListCommand::fetchBinderizedEntry(const sp<IServiceManager> &manager,
-                                         TableEntry *entry) {
+                                         TableEntry *entry, std::ostream &err) {
     Status status = OK;
     const auto handleError = [&](Status additionalError, const std::string& msg) {
-        err() << "Warning: Skipping \"" << entry->interfaceName << "\": " << msg << std::endl;
+        err << "Warning: Skipping \"" << entry->interfaceName << "\": " << msg << std::endl;
         status |= DUMP_BINDERIZED_ERROR | additionalError;
     };
 
@@ -956,6 +992,15 @@ void ListCommand::registerAllOptions() {
         thiz->mNeat = true;
         return OK;
     }, "output is machine parsable (no explanatory text).\nCannot be used with --debug."});
+    mOptions.push_back({'\0', "jobs", required_argument, v++, [](ListCommand* thiz, const char* arg) {
+        size_t jobs;
+        if (!arg || !android::base::ParseUint(arg, &jobs) || jobs == 0) {
+            thiz->err() << "Invalid number of jobs: " << (arg ? arg : "") << std::endl;
+            return USAGE;
+        }
+        thiz->mJobs = jobs;
+        return OK;
+    }, "number of HALs to query at once. Default is " + std::to_string(DEFAULT_JOBS) + "."});
     mOptions.push_back(
             {'\0', "types", required_argument, v++,
              [](ListCommand* thiz, const char* arg) {
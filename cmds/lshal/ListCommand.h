@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <fstream>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -32,6 +33,7 @@
 
 #include "Command.h"
 #include "NullableOStream.h"
+#include "ParallelTasks.h"
 #include "TableEntry.h"
 #include "TextTable.h"
 #include "utils.h"
@@ -99,14 +101,15 @@ protected:
     Status fetchManifestHals();
     Status fetchLazyHals();
 
+    // Fills in |entry|, and writes warnings to |err|. Called on several threads at once.
     Status fetchBinderizedEntry(const sp<::android::hidl::manager::V1_0::IServiceManager> &manager,
-                                TableEntry *entry);
+                                TableEntry *entry, std::ostream &err);
 
     // Get relevant information for a PID by parsing files under
     // /dev/binderfs/binder_logs or /d/binder.
     // It is a virtual member function so that it can be mocked.
     virtual bool getPidInfo(pid_t serverPid, BinderPidInfo *info) const;
-    // Retrieve from mCachedPidInfos and call getPidInfo if necessary.
+    // Retrieve from mCachedPidInfos and call getPidInfo if necessary. Thread-safe.
     const BinderPidInfo* getPidInfoCached(pid_t serverPid);
 
     void dumpTable(const NullableOStream<std::ostream>& out) const;
@@ -186,6 +189,7 @@ protected:
     std::map<pid_t, std::string> mCmdlines;
 
     // Cache for getPidInfo.
+    std::mutex mCachedPidInfosMutex;
     std::map<pid_t, BinderPidInfo> mCachedPidInfos;
 
     // Cache for getPartition.
@@ -197,6 +201,9 @@ protected:
     // If true, emit cmdlines instead of PIDs
     bool mEnableCmdlines = false;
 
+    // Number of HALs queried at once, for the binderized services and their debug info.
+    size_t mJobs = DEFAULT_JOBS;
+
 private:
     DISALLOW_COPY_AND_ASSIGN(ListCommand);
 };
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace lshal {
+
+static constexpr size_t DEFAULT_JOBS = 8;
+
+// Runs task(i) for every i in [0, count) on at most |jobs| threads. Tasks are
+// started in increasing order of i, so a caller that consumes the results in
+// order with wait(i) gets the first ones while the rest are still running.
+// The destructor waits for all tasks.
+class ParallelTasks {
+public:
+    ParallelTasks(size_t count, size_t jobs, std::function<void(size_t)>&& task)
+            : mCount(count), mTask(std::move(task)), mDone(count, false) {
+        jobs = std::max<size_t>(1, std::min(jobs, count));
+        for (size_t i = 0; i < jobs; ++i) {
+            mThreads.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ParallelTasks() {
+        for (auto& thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    // Waits until task(i) has returned.
+    void wait(size_t i) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondVar.wait(lock, [this, i] { return static_cast<bool>(mDone[i]); });
+    }
+
+    void waitAll() {
+        for (size_t i = 0; i < mCount; ++i) {
+            wait(i);
+        }
+    }
+
+private:
+    void run() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mNext >= mCount) return;
+            size_t i = mNext++;
+            lock.unlock();
+
+            mTask(i);
+
+            lock.lock();
+            mDone[i] = true;
+            lock.unlock();
+            mCondVar.notify_all();
+        }
+    }
+
+    const size_t mCount;
+    const std::function<void(size_t)> mTask;
+    std::mutex mMutex;
+    std::condition_variable mCondVar;
+    size_t mNext = 0;
+    std::vector<bool> mDone;
+    std::vector<std::thread> mThreads;
+
+    DISALLOW_COPY_AND_ASSIGN(ParallelTasks);
+};
+
+}  // namespace lshal
+}  // namespace android
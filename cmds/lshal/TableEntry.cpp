@@ -167,8 +167,9 @@ TextTable Table::createTextTable(bool neat,
         textTable.add(std::move(row));
 
         if (emitDebugInfo) {
-            std::string debugInfo = emitDebugInfo(entry.interfaceName);
-            if (!debugInfo.empty()) textTable.add(debugInfo);
+            // Fetched while the table is printed, so that rows don't wait for
+            // the debug info of the rows after them.
+            textTable.add([emitDebugInfo, &entry] { return emitDebugInfo(entry.interfaceName); });
         }
     }
     return textTable;
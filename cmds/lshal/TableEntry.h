@@ -140,7 +140,8 @@ public:
 
     void setDescription(std::string&& d) { mDescription = std::move(d); }
 
-    // Write table content.
+    // Write table content. emitDebugInfo is called when the returned table is
+    // dumped, so whatever it refers to must outlive the dump.
     TextTable createTextTable(bool neat = true,
         const std::function<std::string(const std::string&)>& emitDebugInfo = nullptr) const;
 
@@ -34,6 +34,11 @@ void TextTable::computeWidth(const std::vector<std::string>& v) {
 void TextTable::dump(std::ostream& out) const {
     out << std::left;
     for (const auto& row : mTable) {
+        if (row.lazyLine()) {
+            std::string line = row.lazyLine()();
+            if (!line.empty()) out << line << std::endl;
+            continue;
+        }
         if (!row.isRow()) {
             out << row.line() << std::endl;
             continue;
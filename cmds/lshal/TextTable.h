@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <functional>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -38,6 +39,10 @@ public:
     explicit TextTableRow(std::string&& s) : mLine(std::move(s)) {}
     explicit TextTableRow(const std::string& s) : mLine(s) {}
 
+    // A comment string that is only produced when the table is printed.
+    // Nothing is printed if it's empty.
+    explicit TextTableRow(std::function<std::string()>&& f) : mLazyLine(std::move(f)) {}
+
     // Whether this row is an actual row of cells.
     bool isRow() const { return !fields().empty(); }
 
@@ -47,9 +52,13 @@ public:
     // Get the single comment string.
     const std::string& line() const { return mLine; }
 
+    // Get the function that produces the comment string, if any.
+    const std::function<std::string()>& lazyLine() const { return mLazyLine; }
+
 private:
     std::vector<std::string> mFields;
     std::string mLine;
+    std::function<std::string()> mLazyLine;
 };
 
 // A TextTable is a 2D array of strings.
@@ -64,11 +73,12 @@ public:
     }
     void add(const std::string& s) { mTable.emplace_back(s); }
     void add(std::string&& s) { mTable.emplace_back(std::move(s)); }
+    void add(std::function<std::string()>&& f) { mTable.emplace_back(std::move(f)); }
 
     void addAll(TextTable&& other);
 
     // Prints the table to out, with column widths adjusted appropriately according
-    // to the content.
+    // to the content. Every line is flushed as it's printed.
     void dump(std::ostream& out) const;
 
 private:
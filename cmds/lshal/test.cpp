@@ -17,6 +17,7 @@
 #define LOG_TAG "Lshal"
 #include <android-base/logging.h>
 
+#include <chrono>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -939,6 +940,62 @@ TEST_F(ListTest, DumpDebug) {
     EXPECT_EQ("", err.str());
 }
 
+// Fake service that takes a while to answer, like a busy HAL.
+class SlowTestService : public TestService {
+public:
+    explicit SlowTestService(pid_t id) : TestService(id) {}
+    hardware::Return<void> getDebugInfo(getDebugInfo_cb cb) override {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return TestService::getDebugInfo(cb);
+    }
+};
+
+TEST_F(ListTest, FetchInParallel) {
+    constexpr pid_t kServices = 32;
+    ON_CALL(*serviceManager, list(_)).WillByDefault(Invoke([](IServiceManager::list_cb cb) {
+        std::vector<hidl_string> ret;
+        for (pid_t id = 1; id <= kServices; ++id) {
+            ret.push_back(getFqInstanceName(id));
+        }
+        cb(ret);
+        return hardware::Void();
+    }));
+    ON_CALL(*serviceManager, get(_, _))
+            .WillByDefault(Invoke([](const hidl_string&, const hidl_string& instance) {
+                int id = getIdFromInstanceName(instance);
+                if (id == 7 || id == 20) return sp<IBase>(nullptr);
+                return sp<IBase>(new SlowTestService(id));
+            }));
+
+    const auto list = [&](const char* jobs, std::string* output, std::string* errors) {
+        out.str("");
+        err.str("");
+        initMockList();
+        optind = 1; // mimic Lshal::parseArg()
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_EQ(DUMP_BINDERIZED_ERROR | NO_INTERFACE,
+                  mockList->main(createArg({"lshal", "-itrepac", "--types=b", jobs})));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        *output = out.str();
+        *errors = err.str();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+    };
+
+    std::string serialOut, serialErr, parallelOut, parallelErr;
+    auto serial = list("--jobs=1", &serialOut, &serialErr);
+    auto parallel = list("--jobs=8", &parallelOut, &parallelErr);
+
+    EXPECT_EQ(serialOut, parallelOut);
+    EXPECT_EQ(serialErr, parallelErr);
+    EXPECT_THAT(parallelErr, HasSubstr(getFqInstanceName(7)));
+    EXPECT_THAT(parallelErr, HasSubstr(getFqInstanceName(20)));
+    EXPECT_LT(parallelErr.find(getFqInstanceName(7)), parallelErr.find(getFqInstanceName(20)))
+            << "warnings should be in the order of IServiceManager::list";
+    EXPECT_GE(serial.count(), 30 * 50);
+    EXPECT_LT(parallel.count(), serial.count() / 2)
+            << "serial: " << serial.count() << "ms, parallel: " << parallel.count() << "ms";
+}
+
 class ListVintfTest : public ListTest {
 public:
     virtual void SetUp() override {
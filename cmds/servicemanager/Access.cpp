@@ -43,14 +43,9 @@ static std::string getPidcon(pid_t pid) {
     return result;
 }
 
-static struct selabel_handle* getSehandle() {
-    static struct selabel_handle* gSehandle = nullptr;
-
-    if (gSehandle != nullptr && selinux_status_updated()) {
-        selabel_close(gSehandle);
-        gSehandle = nullptr;
-    }
+static struct selabel_handle* gSehandle = nullptr;
 
+static struct selabel_handle* getSehandle() {
     if (gSehandle == nullptr) {
         gSehandle = kIsVendor
             ? selinux_android_vendor_service_context_handle()
@@ -79,7 +74,7 @@ static int auditCallback(void *data, security_class_t /*cls*/, char *buf, size_t
     return 0;
 }
 
-Access::Access() {
+Access::Access() : mAllowedLookups([] { return selinux_status_updated() > 0; }) {
     union selinux_callback cb;
 
     cb.func_audit = auditCallback;
@@ -135,7 +130,21 @@ bool Access::actionAllowed(const CallingContext& sctx, const char* tctx, const c
         reinterpret_cast<void*>(&data));
 }
 
+void Access::checkPolicyUpdated() {
+    if (mAllowedLookups.checkPolicyUpdated() && gSehandle != nullptr) {
+        selabel_close(gSehandle);
+        gSehandle = nullptr;
+    }
+}
+
 bool Access::actionAllowedFromLookup(const CallingContext& sctx, const std::string& name, const char *perm) {
+    checkPolicyUpdated();
+
+    // Without a sid, getpidcon failed and the check below is denied anyway.
+    if (!sctx.sid.empty() && mAllowedLookups.isAllowed(perm, sctx.sid, name)) {
+        return true;
+    }
+
     char *tctx = nullptr;
     if (selabel_lookup(getSehandle(), &tctx, name.c_str(), SELABEL_CTX_ANDROID_SERVICE) != 0) {
         LOG(ERROR) << "SELinux: No match for " << name << " in service_contexts.\n";
@@ -144,7 +153,42 @@ bool Access::actionAllowedFromLookup(const CallingContext& sctx, const std::stri
 
     bool allowed = actionAllowed(sctx, tctx, perm, name);
     freecon(tctx);
+
+    if (allowed && !sctx.sid.empty()) {
+        mAllowedLookups.setAllowed(perm, sctx.sid, name);
+    }
     return allowed;
 }
 
+AllowedLookupCache::AllowedLookupCache(std::function<bool()>&& policyUpdated, size_t capacity)
+      : mPolicyUpdated(std::move(policyUpdated)), mCapacity(capacity) {}
+
+bool AllowedLookupCache::checkPolicyUpdated() {
+    if (!mPolicyUpdated()) {
+        return false;
+    }
+    mAllowed.clear();
+    return true;
+}
+
+bool AllowedLookupCache::isAllowed(const char* perm, const std::string& sid,
+                                   const std::string& name) const {
+    return mAllowed.count(key(perm, sid, name)) > 0;
+}
+
+void AllowedLookupCache::setAllowed(const char* perm, const std::string& sid,
+                                    const std::string& name) {
+    if (mAllowed.size() >= mCapacity) {
+        mAllowed.clear();
+    }
+    mAllowed.insert(key(perm, sid, name));
+}
+
+std::string AllowedLookupCache::key(const char* perm, const std::string& sid,
+                                    const std::string& name) {
+    std::string key;
+    key.append(perm).append(1, '\0').append(sid).append(1, '\0').append(name);
+    return key;
+}
+
 }  // android
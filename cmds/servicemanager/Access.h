@@ -16,11 +16,41 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <sys/types.h>
+#include <unordered_set>
 
 namespace android {
 
+// The (perm, caller sid, service name) triples already allowed by Access, which saves the
+// service_contexts lookup and the access check on repeated lookups. Denials aren't cached, so
+// that each one is still audited.
+class AllowedLookupCache {
+public:
+    // |policyUpdated| returns true after a policy reload or a change of the enforcing mode.
+    explicit AllowedLookupCache(std::function<bool()>&& policyUpdated,
+                                size_t capacity = kDefaultCapacity);
+
+    // Forgets every decision if the policy was updated, and then returns true.
+    bool checkPolicyUpdated();
+
+    bool isAllowed(const char* perm, const std::string& sid, const std::string& name) const;
+    void setAllowed(const char* perm, const std::string& sid, const std::string& name);
+
+    size_t size() const { return mAllowed.size(); }
+
+    // Enough for every caller sid to look up every service a few times over.
+    static constexpr size_t kDefaultCapacity = 4096;
+
+private:
+    static std::string key(const char* perm, const std::string& sid, const std::string& name);
+
+    std::function<bool()> mPolicyUpdated;
+    size_t mCapacity;
+    std::unordered_set<std::string> mAllowed;
+};
+
 // singleton
 class Access {
 public:
@@ -49,8 +79,12 @@ private:
             const std::string& tname);
     bool actionAllowedFromLookup(const CallingContext& sctx, const std::string& name,
             const char *perm);
+    // Forgets the cached decisions after a policy reload or a change of the enforcing mode.
+    void checkPolicyUpdated();
 
     char* mThisProcessContext = nullptr;
+
+    AllowedLookupCache mAllowedLookups;
 };
 
 };
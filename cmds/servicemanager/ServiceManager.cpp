@@ -24,6 +24,7 @@
 #include <binder/Stability.h>
 #include <cutils/android_filesystem_config.h>
 #include <cutils/multiuser.h>
+#include <algorithm>
 #include <thread>
 
 #ifndef VENDORSERVICEMANAGER
@@ -192,9 +193,24 @@ Status ServiceManager::checkService(const std::string& name, sp<IBinder>* outBin
     return Status::ok();
 }
 
-sp<IBinder> ServiceManager::tryGetService(const std::string& name, bool startIfNotFound) {
+Status ServiceManager::checkServices(const std::vector<std::string>& names,
+                                     std::optional<std::vector<sp<IBinder>>>* outBinders) {
     auto ctx = mAccess->getCallingContext();
 
+    outBinders->emplace();
+    (*outBinders)->reserve(names.size());
+    for (const std::string& name : names) {
+        (*outBinders)->push_back(tryGetService(ctx, name, false));
+    }
+    return Status::ok();
+}
+
+sp<IBinder> ServiceManager::tryGetService(const std::string& name, bool startIfNotFound) {
+    return tryGetService(mAccess->getCallingContext(), name, startIfNotFound);
+}
+
+sp<IBinder> ServiceManager::tryGetService(const Access::CallingContext& ctx,
+                                          const std::string& name, bool startIfNotFound) {
     sp<IBinder> out;
     Service* service = nullptr;
     if (auto it = mNameToService.find(name); it != mNameToService.end()) {
@@ -320,6 +336,7 @@ Status ServiceManager::listServices(int32_t dumpPriority, std::vector<std::strin
             outList->push_back(name);
         }
     }
+    std::sort(outList->begin(), outList->end());
 
     return Status::ok();
 }
@@ -694,6 +711,8 @@ Status ServiceManager::getServiceDebugInfo(std::vector<ServiceDebugInfo>* outRet
 
         outReturn->push_back(std::move(info));
     }
+    std::sort(outReturn->begin(), outReturn->end(),
+              [](const ServiceDebugInfo& a, const ServiceDebugInfo& b) { return a.name < b.name; });
 
     return Status::ok();
 }
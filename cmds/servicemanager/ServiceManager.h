@@ -16,10 +16,13 @@
 
 #pragma once
 
+#include <android/os/BnServiceLookup.h>
 #include <android/os/BnServiceManager.h>
 #include <android/os/IClientCallback.h>
 #include <android/os/IServiceCallback.h>
 
+#include <unordered_map>
+
 #include "Access.h"
 
 namespace android {
@@ -55,6 +58,10 @@ public:
     void binderDied(const wp<IBinder>& who) override;
     void handleClientCallbacks();
 
+    // Served through ServiceLookup.
+    binder::Status checkServices(const std::vector<std::string>& names,
+                                 std::optional<std::vector<sp<IBinder>>>* outBinders);
+
 protected:
     virtual void tryStartService(const std::string& name);
 
@@ -71,9 +78,11 @@ private:
         ssize_t getNodeStrongRefCount();
     };
 
-    using ServiceCallbackMap = std::map<std::string, std::vector<sp<IServiceCallback>>>;
-    using ClientCallbackMap = std::map<std::string, std::vector<sp<IClientCallback>>>;
-    using ServiceMap = std::map<std::string, Service>;
+    // Hashed, since lookups by name are by far the most frequent calls. Anything that lists the
+    // services sorts them itself.
+    using ServiceCallbackMap = std::unordered_map<std::string, std::vector<sp<IServiceCallback>>>;
+    using ClientCallbackMap = std::unordered_map<std::string, std::vector<sp<IClientCallback>>>;
+    using ServiceMap = std::unordered_map<std::string, Service>;
 
     // removes a callback from mNameToRegistrationCallback, removing it if the vector is empty
     // this updates iterator to the next location
@@ -88,6 +97,8 @@ private:
     void removeClientCallback(const wp<IBinder>& who, ClientCallbackMap::iterator* it);
 
     sp<IBinder> tryGetService(const std::string& name, bool startIfNotFound);
+    sp<IBinder> tryGetService(const Access::CallingContext& ctx, const std::string& name,
+                              bool startIfNotFound);
 
     ServiceMap mNameToService;
     ServiceCallbackMap mNameToRegistrationCallback;
@@ -96,4 +107,19 @@ private:
     std::unique_ptr<Access> mAccess;
 };
 
+// The lookups that only libbinder uses. They're served by the extension of the servicemanager
+// binder rather than by IServiceManager, which has implementations outside of libbinder.
+class ServiceLookup : public os::BnServiceLookup {
+public:
+    explicit ServiceLookup(const sp<ServiceManager>& manager) : mManager(manager) {}
+
+    binder::Status checkServices(const std::vector<std::string>& names,
+                                 std::optional<std::vector<sp<IBinder>>>* outBinders) override {
+        return mManager->checkServices(names, outBinders);
+    }
+
+private:
+    sp<ServiceManager> mManager;
+};
+
 }  // namespace android
@@ -125,6 +125,7 @@ int main(int argc, char** argv) {
     if (!manager->addService("manager", manager, false /*allowIsolated*/, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk()) {
         LOG(ERROR) << "Could not self register servicemanager";
     }
+    manager->setExtension(sp<ServiceLookup>::make(manager));
 
     IPCThreadState::self()->setTheContextObject(manager);
     ps->becomeContextManager();
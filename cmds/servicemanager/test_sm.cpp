@@ -27,8 +27,10 @@
 
 using android::sp;
 using android::Access;
+using android::AllowedLookupCache;
 using android::BBinder;
 using android::IBinder;
+using android::ServiceLookup;
 using android::ServiceManager;
 using android::binder::Status;
 using android::os::BnServiceCallback;
@@ -255,6 +257,57 @@ TEST(GetService, NotAllowedFromIsolated) {
     EXPECT_EQ(nullptr, out.get());
 }
 
+TEST(CheckServices, HappyHappy) {
+    auto sm = getPermissiveServiceManager();
+    sp<IBinder> foo = getBinder();
+    sp<IBinder> bar = getBinder();
+
+    EXPECT_TRUE(sm->addService("foo", foo, false /*allowIsolated*/,
+        IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+    EXPECT_TRUE(sm->addService("bar", bar, false /*allowIsolated*/,
+        IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+
+    std::optional<std::vector<sp<IBinder>>> out;
+    EXPECT_TRUE(sm->checkServices({"bar", "nonexistent", "foo"}, &out).isOk());
+    ASSERT_TRUE(out.has_value());
+    EXPECT_THAT(*out, ElementsAre(bar, nullptr, foo));
+}
+
+TEST(CheckServices, OnlyServicesWithPermission) {
+    std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
+
+    EXPECT_CALL(*access, getCallingContext()).WillRepeatedly(Return(Access::CallingContext{}));
+    EXPECT_CALL(*access, canAdd(_, _)).WillRepeatedly(Return(true));
+    EXPECT_CALL(*access, canFind(_, "foo")).WillOnce(Return(false));
+    EXPECT_CALL(*access, canFind(_, "bar")).WillOnce(Return(true));
+
+    sp<ServiceManager> sm = sp<NiceMock<MockServiceManager>>::make(std::move(access));
+
+    sp<IBinder> bar = getBinder();
+    EXPECT_TRUE(sm->addService("foo", getBinder(), false /*allowIsolated*/,
+        IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+    EXPECT_TRUE(sm->addService("bar", bar, false /*allowIsolated*/,
+        IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+
+    std::optional<std::vector<sp<IBinder>>> out;
+    EXPECT_TRUE(sm->checkServices({"foo", "bar"}, &out).isOk());
+    ASSERT_TRUE(out.has_value());
+    EXPECT_THAT(*out, ElementsAre(nullptr, bar));
+}
+
+TEST(CheckServices, ServedByServiceLookup) {
+    auto sm = getPermissiveServiceManager();
+    sp<IBinder> foo = getBinder();
+
+    EXPECT_TRUE(sm->addService("foo", foo, false /*allowIsolated*/,
+        IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+
+    std::optional<std::vector<sp<IBinder>>> out;
+    EXPECT_TRUE(sp<ServiceLookup>::make(sm)->checkServices({"foo", "bar"}, &out).isOk());
+    ASSERT_TRUE(out.has_value());
+    EXPECT_THAT(*out, ElementsAre(foo, nullptr));
+}
+
 TEST(ListServices, NoPermissions) {
     std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
 
@@ -447,3 +500,39 @@ TEST(ServiceNotifications, GetMultipleNotification) {
     EXPECT_THAT(cb->registrations, ElementsAre("asdfasdf", "asdfasdf"));
     EXPECT_THAT(cb->registrations, ElementsAre("asdfasdf", "asdfasdf"));
 }
+
+TEST(AllowedLookupCache, RemembersAllowedLookups) {
+    AllowedLookupCache cache([] { return false; });
+
+    EXPECT_FALSE(cache.isAllowed("find", "u:r:foo:s0", "bar"));
+    cache.setAllowed("find", "u:r:foo:s0", "bar");
+    EXPECT_TRUE(cache.isAllowed("find", "u:r:foo:s0", "bar"));
+
+    EXPECT_FALSE(cache.isAllowed("add", "u:r:foo:s0", "bar"));
+    EXPECT_FALSE(cache.isAllowed("find", "u:r:other:s0", "bar"));
+    EXPECT_FALSE(cache.isAllowed("find", "u:r:foo:s0", "baz"));
+}
+
+TEST(AllowedLookupCache, PolicyReloadClearsCache) {
+    bool updated = false;
+    AllowedLookupCache cache([&] { return updated; });
+    cache.setAllowed("find", "u:r:foo:s0", "bar");
+
+    EXPECT_FALSE(cache.checkPolicyUpdated());
+    EXPECT_TRUE(cache.isAllowed("find", "u:r:foo:s0", "bar"));
+
+    updated = true;
+    EXPECT_TRUE(cache.checkPolicyUpdated());
+    EXPECT_FALSE(cache.isAllowed("find", "u:r:foo:s0", "bar"));
+    EXPECT_EQ(0u, cache.size());
+}
+
+TEST(AllowedLookupCache, Bounded) {
+    AllowedLookupCache cache([] { return false; }, 2 /*capacity*/);
+    cache.setAllowed("find", "u:r:foo:s0", "a");
+    cache.setAllowed("find", "u:r:foo:s0", "b");
+    cache.setAllowed("find", "u:r:foo:s0", "c");
+
+    EXPECT_LE(cache.size(), 2u);
+    EXPECT_TRUE(cache.isAllowed("find", "u:r:foo:s0", "c"));
+}
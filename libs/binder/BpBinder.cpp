@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 
+#include "Utils.h"
+
 //#undef ALOGV
 //#define ALOGV(...) fprintf(stderr, __VA_ARGS__)
 
@@ -491,7 +493,11 @@ void BpBinder::onLastStrongRef(const void* /*id*/)
     mLock.lock();
     Vector<Obituary>* obits = mObituaries;
     if(obits != nullptr) {
-        if (!obits->isEmpty()) {
+        bool expected = true;
+        for (size_t i = 0; i < obits->size(); i++) {
+            expected &= (obits->itemAt(i).flags & kQuietAutoUnlink) != 0;
+        }
+        if (!expected) {
             ALOGI("onLastStrongRef automatically unlinking death recipients: %s",
                   mDescriptorCache.size() ? String8(mDescriptorCache).c_str() : "<uncached descriptor>");
         }
@@ -21,7 +21,15 @@
 #include <inttypes.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #include <android/os/BnServiceCallback.h>
+#include <android/os/IServiceLookup.h>
 #include <android/os/IServiceManager.h>
 #include <binder/IPCThreadState.h>
 #include <binder/Parcel.h>
@@ -38,6 +46,7 @@
 #endif
 
 #include "Static.h"
+#include "Utils.h"
 
 namespace android {
 
@@ -61,6 +70,236 @@ const String16& IServiceManager::getInterfaceDescriptor() const {
 IServiceManager::IServiceManager() {}
 IServiceManager::~IServiceManager() {}
 
+// Remembers the services this process looked up, so that looking one up again doesn't need a
+// call to servicemanager. An entry is only used once servicemanager has notified it of the
+// registration of the service, which guarantees that any later registration under the same name
+// reaches it too. Processes without binder threads never get the notifications, and so never
+// use the cache.
+//
+// Only services of other processes are cached. Entries hold their service weakly, so that the
+// cache doesn't keep a lazy service running: a lookup only hits while something else in the
+// process still holds the service. Entries are cleared when their service dies. BpBinder drops
+// death links along with its last strong reference, so an entry whose proxy was seen without
+// strong references isn't used again until a lookup through servicemanager links it again.
+class ServiceCache : public android::os::BnServiceCallback, public IBinder::DeathRecipient
+{
+public:
+    // Returns the cached service, or nullptr if servicemanager has to be asked.
+    sp<IBinder> lookup(const std::string& name);
+
+    // Records the result of a lookup. Returns true when the cache should now be registered for
+    // notifications about |name|. That's on its second lookup, so that names looked up once, as
+    // by dumpsys, cost no extra call. And it's for a bounded number of names, since
+    // servicemanager keeps the callbacks until the process exits.
+    bool add(const std::string& name, const sp<IBinder>& binder);
+
+    // Forgets the service registered under |name|, after this process registers a new one.
+    void invalidate(const std::string& name);
+
+    Status onRegistration(const std::string& name, const sp<IBinder>& binder) override;
+    void binderDied(const wp<IBinder>& who) override;
+
+private:
+    // Takes over |binder| for |name|. Returns true if it has to be linked to death.
+    bool setLocked(const std::string& name, const sp<IBinder>& binder);
+    // Links to the death of |binder|, replacing any earlier link, and then lets |name| use it.
+    void link(const std::string& name, const sp<IBinder>& binder);
+
+    struct Entry {
+        wp<IBinder> binder;
+        // Set by the first notification, which servicemanager sends as soon as the cache is
+        // registered for the name.
+        bool notified = false;
+        // Whether |binder| is linked to death. Cleared when the link may have been dropped.
+        bool linked = false;
+        // Lookups through servicemanager, up to the one that registers for notifications.
+        size_t lookups = 0;
+    };
+
+    static constexpr size_t kMaxRegisteredNames = 64;
+
+    std::mutex mMutex;
+    std::map<std::string, Entry> mEntries;
+    size_t mRegisteredNames = 0;
+};
+
+sp<IBinder> ServiceCache::lookup(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mEntries.find(name);
+    if (it == mEntries.end() || !it->second.notified || !it->second.linked) {
+        return nullptr;
+    }
+    // Entries are all proxies, which outlive their last strong reference. Promoting a proxy that
+    // nothing holds any more isn't supported by the driver, so don't try. That proxy has also
+    // lost its death link.
+    IBinder* proxy = it->second.binder.unsafe_get();
+    if (proxy == nullptr || proxy->getStrongCount() == 0) {
+        it->second.linked = false;
+        return nullptr;
+    }
+    sp<IBinder> binder = it->second.binder.promote();
+    // A call that failed with DEAD_OBJECT marks the binder dead even before the death
+    // notification is processed.
+    if (binder == nullptr || !binder->isBinderAlive()) {
+        return nullptr;
+    }
+    return binder;
+}
+
+bool ServiceCache::add(const std::string& name, const sp<IBinder>& binder) {
+    bool registerNow = false;
+    bool link;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        link = setLocked(name, binder);
+        Entry& entry = mEntries[name];
+        link = link && entry.notified;
+        if (entry.lookups < 2 && ++entry.lookups == 2 &&
+            mRegisteredNames < kMaxRegisteredNames) {
+            mRegisteredNames++;
+            registerNow = true;
+        }
+    }
+    if (link) {
+        this->link(name, binder);
+    }
+    return registerNow;
+}
+
+void ServiceCache::invalidate(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (auto it = mEntries.find(name); it != mEntries.end()) {
+        it->second.binder.clear();
+        it->second.linked = false;
+    }
+}
+
+Status ServiceCache::onRegistration(const std::string& name, const sp<IBinder>& binder) {
+    bool link;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        link = setLocked(name, binder);
+        mEntries[name].notified = true;
+    }
+    if (link) {
+        this->link(name, binder);
+    }
+    return Status::ok();
+}
+
+bool ServiceCache::setLocked(const std::string& name, const sp<IBinder>& binder) {
+    Entry& entry = mEntries[name];
+    entry.linked = false;
+    // Local binders are destroyed with their last strong reference, so lookup() couldn't safely
+    // check them before promoting.
+    if (binder == nullptr || binder->remoteBinder() == nullptr) {
+        entry.binder.clear();
+        return false;
+    }
+    entry.binder = binder;
+    return true;
+}
+
+void ServiceCache::link(const std::string& name, const sp<IBinder>& binder) {
+    // The proxy may still have the link from an earlier lookup, or may have dropped it with its
+    // last strong reference; either way, end up with exactly one. The flag keeps BpBinder from
+    // logging when it drops the link.
+    sp<DeathRecipient> recipient = sp<DeathRecipient>::fromExisting(this);
+    binder->unlinkToDeath(recipient, nullptr, kQuietAutoUnlink);
+    if (binder->linkToDeath(recipient, nullptr, kQuietAutoUnlink) != OK) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mEntries.find(name);
+    // Unless it was replaced, or died, in the meantime.
+    if (it != mEntries.end() && it->second.binder.unsafe_get() == binder.get()) {
+        it->second.linked = true;
+    }
+}
+
+void ServiceCache::binderDied(const wp<IBinder>& who) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& [name, entry] : mEntries) {
+        if (entry.binder == who) {
+            entry.binder.clear();
+            entry.linked = false;
+        }
+    }
+}
+
+// Receives the registration of a service that a thread is waiting for.
+class Waiter : public android::os::BnServiceCallback {
+    Status onRegistration(const std::string& /*name*/,
+                          const sp<IBinder>& binder) override {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mBinder = binder;
+        lock.unlock();
+        // Flushing here helps ensure the service's ref count remains accurate
+        IPCThreadState::self()->flushCommands();
+        mCv.notify_one();
+        return Status::ok();
+    }
+public:
+    sp<IBinder> mBinder;
+    std::mutex mMutex;
+    std::condition_variable mCv;
+};
+
+// Completes a future with the service once it's registered, and then stops listening.
+class AsyncWaiter : public android::os::BnServiceCallback {
+public:
+    AsyncWaiter(const sp<AidlServiceManager>& sm, const std::string& name)
+          : mServiceManager(sm), mName(name) {}
+
+    std::future<sp<IBinder>> getFuture() { return mPromise.get_future(); }
+    const std::string& name() const { return mName; }
+
+    bool isDone() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mDone;
+    }
+
+    // Returns false if the future was already complete.
+    bool finish(const sp<IBinder>& binder) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mDone) return false;
+        mDone = true;
+        mPromise.set_value(binder);
+        return true;
+    }
+
+    // Completes the future with nullptr, and stops listening.
+    void fail() {
+        if (finish(nullptr)) {
+            mServiceManager->unregisterForNotifications(
+                    mName, sp<AsyncWaiter>::fromExisting(this));
+        }
+    }
+
+    Status onRegistration(const std::string& /*name*/, const sp<IBinder>& binder) override {
+        if (finish(binder)) {
+            // Flushing here helps ensure the service's ref count remains accurate
+            IPCThreadState::self()->flushCommands();
+            mServiceManager->unregisterForNotifications(
+                    mName, sp<AsyncWaiter>::fromExisting(this));
+        }
+        return Status::ok();
+    }
+
+private:
+    const sp<AidlServiceManager> mServiceManager;
+    const std::string mName;
+    std::mutex mMutex;
+    bool mDone = false;
+    std::promise<sp<IBinder>> mPromise;
+};
+
+static std::future<sp<IBinder>> readyFuture(const sp<IBinder>& binder) {
+    std::promise<sp<IBinder>> promise;
+    promise.set_value(binder);
+    return promise.get_future();
+}
+
 // From the old libbinder IServiceManager interface to IServiceManager.
 class ServiceManagerShim : public IServiceManager
 {
@@ -77,6 +316,10 @@ public:
     Vector<String16> getDeclaredInstances(const String16& interface) override;
     std::optional<String16> updatableViaApex(const String16& name) override;
 
+    // Implement the free functions of the same name.
+    Vector<sp<IBinder>> checkServices(const Vector<String16>& names);
+    std::future<sp<IBinder>> waitForServiceAsync(const String16& name);
+
     // for legacy ABI
     const String16& getInterfaceDescriptor() const override {
         return mTheRealServiceManager->getInterfaceDescriptor();
@@ -85,11 +328,29 @@ public:
         return IInterface::asBinder(mTheRealServiceManager).get();
     }
 private:
+    // Caches a service that was just looked up.
+    void rememberService(const std::string& name, const sp<IBinder>& binder) const;
+    // The extension of the servicemanager binder, or nullptr if it's too old to have one.
+    sp<os::IServiceLookup> getServiceLookup();
+    // Asks servicemanager again, once a second, for the services waited for
+    // asynchronously, until their futures are complete. Runs on one thread for
+    // all of them, which exits once none are left.
+    void retryAsyncWaits();
+
     sp<AidlServiceManager> mTheRealServiceManager;
+    sp<ServiceCache> mServiceCache;
+    std::once_flag mServiceLookupOnce;
+    sp<os::IServiceLookup> mServiceLookup;
+
+    std::mutex mAsyncWaitersLock;
+    std::vector<sp<AsyncWaiter>> mAsyncWaiters;
+    bool mRetryingAsyncWaits = false;
 };
 
 [[clang::no_destroy]] static std::once_flag gSmOnce;
 [[clang::no_destroy]] static sp<IServiceManager> gDefaultServiceManager;
+// The default service manager, unless it was replaced with setDefaultServiceManager().
+[[clang::no_destroy]] static sp<ServiceManagerShim> gServiceManagerShim;
 
 sp<IServiceManager> defaultServiceManager()
 {
@@ -103,12 +364,35 @@ sp<IServiceManager> defaultServiceManager()
             }
         }
 
-        gDefaultServiceManager = sp<ServiceManagerShim>::make(sm);
+        gServiceManagerShim = sp<ServiceManagerShim>::make(sm);
+        gDefaultServiceManager = gServiceManagerShim;
     });
 
     return gDefaultServiceManager;
 }
 
+Vector<sp<IBinder>> checkServices(const Vector<String16>& names) {
+    const sp<IServiceManager> sm = defaultServiceManager();
+    if (gServiceManagerShim != nullptr) {
+        return gServiceManagerShim->checkServices(names);
+    }
+    Vector<sp<IBinder>> services;
+    services.setCapacity(names.size());
+    for (const String16& name : names) {
+        services.push(sm->checkService(name));
+    }
+    return services;
+}
+
+std::future<sp<IBinder>> waitForServiceAsync(const String16& name) {
+    const sp<IServiceManager> sm = defaultServiceManager();
+    if (gServiceManagerShim != nullptr) {
+        return gServiceManagerShim->waitForServiceAsync(name);
+    }
+    // A service manager set for testing; it can't be asked for notifications.
+    return std::async(std::launch::async, [sm, name] { return sm->waitForService(name); });
+}
+
 void setDefaultServiceManager(const sp<IServiceManager>& sm) {
     bool called = false;
     std::call_once(gSmOnce, [&]() {
@@ -206,7 +490,7 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid)
 // ----------------------------------------------------------------------
 
 ServiceManagerShim::ServiceManagerShim(const sp<AidlServiceManager>& impl)
- : mTheRealServiceManager(impl)
+ : mTheRealServiceManager(impl), mServiceCache(sp<ServiceCache>::make())
 {}
 
 // This implementation could be simplified and made more efficient by delegating
@@ -240,37 +524,134 @@ sp<IBinder> ServiceManagerShim::getService(const String16& name) const
     ALOGI("Waiting for service '%s' on '%s'...", String8(name).string(),
           ProcessState::self()->getDriverName().c_str());
 
-    int n = 0;
+    // Wake up as soon as the service is registered rather than at the next
+    // retry. The polling stays in case the notification is missed, or can't be
+    // registered for at all.
+    const std::string name8 = String8(name).c_str();
+    sp<Waiter> waiter = sp<Waiter>::make();
+    if (!mTheRealServiceManager->registerForNotifications(name8, waiter).isOk()) {
+        waiter = nullptr;
+    }
+
+    sp<IBinder> found;
     while (uptimeMillis() - startTime < timeout) {
-        n++;
-        usleep(1000*sleepTime);
+        if (waiter != nullptr) {
+            std::unique_lock<std::mutex> lock(waiter->mMutex);
+            waiter->mCv.wait_for(lock, std::chrono::milliseconds(sleepTime),
+                                 [&] { return waiter->mBinder != nullptr; });
+            // Only a new registration should cut the next wait short, in case
+            // this one is gone again by the time it's checked.
+            waiter->mBinder.clear();
+        } else {
+            usleep(1000*sleepTime);
+        }
 
-        sp<IBinder> svc = checkService(name);
-        if (svc != nullptr) {
+        found = checkService(name);
+        if (found != nullptr) {
             ALOGI("Waiting for service '%s' on '%s' successful after waiting %" PRIi64 "ms",
                   String8(name).string(), ProcessState::self()->getDriverName().c_str(),
                   uptimeMillis() - startTime);
-            return svc;
+            break;
         }
     }
-    ALOGW("Service %s didn't start. Returning NULL", String8(name).string());
-    return nullptr;
+    if (waiter != nullptr) {
+        mTheRealServiceManager->unregisterForNotifications(name8, waiter);
+    }
+    if (found == nullptr) {
+        ALOGW("Service %s didn't start. Returning NULL", String8(name).string());
+    }
+    return found;
 }
 
-sp<IBinder> ServiceManagerShim::checkService(const String16& name) const
+sp<IBinder> ServiceManagerShim::checkService(const String16& name16) const
 {
+    const std::string name = String8(name16).c_str();
+    if (sp<IBinder> cached = mServiceCache->lookup(name); cached != nullptr) {
+        return cached;
+    }
+
     sp<IBinder> ret;
-    if (!mTheRealServiceManager->checkService(String8(name).c_str(), &ret).isOk()) {
+    if (!mTheRealServiceManager->checkService(name, &ret).isOk()) {
         return nullptr;
     }
+    rememberService(name, ret);
     return ret;
 }
 
+Vector<sp<IBinder>> ServiceManagerShim::checkServices(const Vector<String16>& names16)
+{
+    Vector<sp<IBinder>> services;
+    services.setCapacity(names16.size());
+    std::vector<std::string> names;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < names16.size(); i++) {
+        const std::string name = String8(names16[i]).c_str();
+        sp<IBinder> cached = mServiceCache->lookup(name);
+        if (cached == nullptr) {
+            names.push_back(name);
+            indices.push_back(i);
+        }
+        services.push(cached);
+    }
+    if (names.empty()) {
+        return services;
+    }
+
+    sp<os::IServiceLookup> lookup = getServiceLookup();
+    if (lookup == nullptr) {
+        // An older servicemanager, one service at a time then.
+        for (size_t i : indices) {
+            services.editItemAt(i) = checkService(names16[i]);
+        }
+        return services;
+    }
+    std::optional<std::vector<sp<IBinder>>> out;
+    if (!lookup->checkServices(names, &out).isOk() || !out.has_value() ||
+        out->size() != names.size()) {
+        // Don't report every service missing over one failed call.
+        ALOGW("Batched lookup of %zu services failed, looking them up one at a time",
+              names.size());
+        for (size_t i : indices) {
+            services.editItemAt(i) = checkService(names16[i]);
+        }
+        return services;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        services.editItemAt(indices[i]) = (*out)[i];
+        rememberService(names[i], (*out)[i]);
+    }
+    return services;
+}
+
+sp<os::IServiceLookup> ServiceManagerShim::getServiceLookup()
+{
+    std::call_once(mServiceLookupOnce, [this] {
+        sp<IBinder> extension;
+        if (IInterface::asBinder(mTheRealServiceManager)->getExtension(&extension) == OK) {
+            mServiceLookup = interface_cast<os::IServiceLookup>(extension);
+        }
+    });
+    return mServiceLookup;
+}
+
+void ServiceManagerShim::rememberService(const std::string& name, const sp<IBinder>& binder) const
+{
+    if (binder != nullptr && mServiceCache->add(name, binder)) {
+        // Only tried once per name. If it fails, the entry is never notified and never used, and
+        // lookups keep going to servicemanager.
+        mTheRealServiceManager->registerForNotifications(name, mServiceCache);
+    }
+}
+
 status_t ServiceManagerShim::addService(const String16& name, const sp<IBinder>& service,
                                         bool allowIsolated, int dumpsysPriority)
 {
     Status status = mTheRealServiceManager->addService(
         String8(name).c_str(), service, allowIsolated, dumpsysPriority);
+    if (status.isOk()) {
+        // The notification of this registration is on its way, but may not be processed yet.
+        mServiceCache->invalidate(String8(name).c_str());
+    }
     return status.exceptionCode();
 }
 
@@ -291,23 +672,6 @@ Vector<String16> ServiceManagerShim::listServices(int dumpsysPriority)
 
 sp<IBinder> ServiceManagerShim::waitForService(const String16& name16)
 {
-    class Waiter : public android::os::BnServiceCallback {
-        Status onRegistration(const std::string& /*name*/,
-                              const sp<IBinder>& binder) override {
-            std::unique_lock<std::mutex> lock(mMutex);
-            mBinder = binder;
-            lock.unlock();
-            // Flushing here helps ensure the service's ref count remains accurate
-            IPCThreadState::self()->flushCommands();
-            mCv.notify_one();
-            return Status::ok();
-        }
-    public:
-        sp<IBinder> mBinder;
-        std::mutex mMutex;
-        std::condition_variable mCv;
-    };
-
     // Simple RAII object to ensure a function call immediately before going out of scope
     class Defer {
     public:
@@ -319,6 +683,10 @@ sp<IBinder> ServiceManagerShim::waitForService(const String16& name16)
 
     const std::string name = String8(name16).c_str();
 
+    if (sp<IBinder> cached = mServiceCache->lookup(name); cached != nullptr) {
+        return cached;
+    }
+
     sp<IBinder> out;
     if (!mTheRealServiceManager->getService(name, &out).isOk()) {
         return nullptr;
@@ -367,6 +735,76 @@ sp<IBinder> ServiceManagerShim::waitForService(const String16& name16)
     }
 }
 
+std::future<sp<IBinder>> ServiceManagerShim::waitForServiceAsync(const String16& name16)
+{
+    const std::string name = String8(name16).c_str();
+
+    if (sp<IBinder> cached = mServiceCache->lookup(name); cached != nullptr) {
+        return readyFuture(cached);
+    }
+
+    // Also starts the service if it's lazy.
+    sp<IBinder> out;
+    if (!mTheRealServiceManager->getService(name, &out).isOk()) {
+        return readyFuture(nullptr);
+    }
+    if (out != nullptr) return readyFuture(out);
+
+    // Notified right away if the service was registered in the meantime.
+    sp<AsyncWaiter> waiter = sp<AsyncWaiter>::make(mTheRealServiceManager, name);
+    std::future<sp<IBinder>> future = waiter->getFuture();
+    if (!mTheRealServiceManager->registerForNotifications(name, waiter).isOk()) {
+        waiter->finish(nullptr);
+        return future;
+    }
+
+    std::lock_guard<std::mutex> lock(mAsyncWaitersLock);
+    mAsyncWaiters.push_back(waiter);
+    if (!mRetryingAsyncWaits) {
+        mRetryingAsyncWaits = true;
+        // The shim is never destroyed, see defaultServiceManager().
+        std::thread(&ServiceManagerShim::retryAsyncWaits, this).detach();
+    }
+    return future;
+}
+
+void ServiceManagerShim::retryAsyncWaits()
+{
+    std::unique_lock<std::mutex> lock(mAsyncWaitersLock);
+    while (true) {
+        mAsyncWaiters.erase(std::remove_if(mAsyncWaiters.begin(), mAsyncWaiters.end(),
+                                           [](const sp<AsyncWaiter>& waiter) {
+                                               return waiter->isDone();
+                                           }),
+                            mAsyncWaiters.end());
+        if (mAsyncWaiters.empty()) {
+            mRetryingAsyncWaits = false;
+            return;
+        }
+        lock.unlock();
+
+        using std::literals::chrono_literals::operator""s;
+        std::this_thread::sleep_for(1s);
+
+        lock.lock();
+        const std::vector<sp<AsyncWaiter>> waiters = mAsyncWaiters;
+        lock.unlock();
+        for (const sp<AsyncWaiter>& waiter : waiters) {
+            if (waiter->isDone()) continue;
+            ALOGW("Waited one second for %s (is service started? are binder threads started "
+                  "and available?)", waiter->name().c_str());
+            // Handles the race condition for lazy services described in
+            // waitForService(): asking again gets init to restart the service,
+            // and its registration is then notified as usual.
+            sp<IBinder> out;
+            if (!mTheRealServiceManager->getService(waiter->name(), &out).isOk()) {
+                waiter->fail();
+            }
+        }
+        lock.lock();
+    }
+}
+
 bool ServiceManagerShim::isDeclared(const String16& name) {
     bool declared;
     if (!mTheRealServiceManager->isDeclared(String8(name).c_str(), &declared).isOk()) {
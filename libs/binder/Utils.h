@@ -22,4 +22,8 @@ namespace android {
 // avoid optimizations
 void zeroMemory(uint8_t* data, size_t size);
 
+// linkToDeath() flag for links that are expected to be dropped along with the last strong
+// reference to the proxy, so that BpBinder doesn't log it.
+constexpr uint32_t kQuietAutoUnlink = 0x80000000;
+
 }   // namespace android
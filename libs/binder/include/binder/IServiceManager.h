@@ -20,6 +20,7 @@
 #include <utils/Vector.h>
 #include <utils/String16.h>
 
+#include <future>
 #include <optional>
 
 namespace android {
@@ -119,6 +120,21 @@ sp<IServiceManager> defaultServiceManager();
  */
 void setDefaultServiceManager(const sp<IServiceManager>& sm);
 
+/**
+ * Retrieve several existing services at once, non-blocking. The result has an
+ * entry for each name, nullptr for the services that don't exist.
+ */
+Vector<sp<IBinder>> checkServices(const Vector<String16>& names);
+
+/**
+ * Wait for a service without blocking the caller. The future is ready once
+ * servicemanager notifies the registration of the service, so unlike
+ * waitForService this process needs a binder thread to receive it.
+ *
+ * The future holds nullptr only for permission problem or fatal error.
+ */
+std::future<sp<IBinder>> waitForServiceAsync(const String16& name);
+
 template<typename INTERFACE>
 sp<INTERFACE> waitForService(const String16& name) {
     const sp<IServiceManager> sm = defaultServiceManager();
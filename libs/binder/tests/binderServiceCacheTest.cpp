@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests for the cache of looked up services in the process-wide IServiceManager.
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <android-base/unique_fd.h>
+#include <binder/Binder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+#include <gtest/gtest.h>
+
+using android::BBinder;
+using android::defaultServiceManager;
+using android::IBinder;
+using android::IPCThreadState;
+using android::OK;
+using android::ProcessState;
+using android::sp;
+using android::String16;
+using android::base::unique_fd;
+using namespace std::chrono_literals;
+
+static const char* kServerArg = "--service-cache-server";
+
+// Long enough for servicemanager to deliver the first notification once the cache registers.
+static constexpr auto kNotificationDelay = 100ms;
+static constexpr auto kTimeout = 2s;
+
+static bool waitFor(const std::function<bool()>& condition) {
+    auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(10ms);
+    }
+    return true;
+}
+
+// A process that registers a new binder under |name| each time it is asked to. It has to be
+// exec'd, since binder can't be used in a child forked after its parent used it.
+class ServiceProcess {
+public:
+    explicit ServiceProcess(const std::string& name) : mName(name) {
+        int request[2], reply[2];
+        if (pipe(request) != 0 || pipe(reply) != 0) return;
+        std::string requestFd = std::to_string(request[0]);
+        std::string replyFd = std::to_string(reply[1]);
+        mPid = fork();
+        if (mPid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGHUP);
+            close(request[1]);
+            close(reply[0]);
+            execl("/proc/self/exe", "binderServiceCacheTest", kServerArg, mName.c_str(),
+                  requestFd.c_str(), replyFd.c_str(), nullptr);
+            _exit(EXIT_FAILURE);
+        }
+        close(request[0]);
+        close(reply[1]);
+        mRequest.reset(request[1]);
+        mReply.reset(reply[0]);
+    }
+
+    ~ServiceProcess() { kill(); }
+
+    // Returns once the new binder is registered.
+    bool registerService() {
+        char c = 0;
+        return write(mRequest.get(), &c, 1) == 1 && read(mReply.get(), &c, 1) == 1 && c == 1;
+    }
+
+    void kill() {
+        if (mPid <= 0) return;
+        ::kill(mPid, SIGKILL);
+        waitpid(mPid, nullptr, 0);
+        mPid = 0;
+    }
+
+    static int run(const char* name, int request, int reply) {
+        ProcessState::self()->startThreadPool();
+        char c;
+        while (read(request, &c, 1) == 1) {
+            c = defaultServiceManager()->addService(String16(name), sp<BBinder>::make()) == OK;
+            if (write(reply, &c, 1) != 1) break;
+        }
+        return EXIT_SUCCESS;
+    }
+
+private:
+    const std::string mName;
+    pid_t mPid = -1;
+    unique_fd mRequest;
+    unique_fd mReply;
+};
+
+static sp<IBinder> checkService(const std::string& name) {
+    return defaultServiceManager()->checkService(String16(name.c_str()));
+}
+
+// Looks |name| up often enough for the cache to register for it, and waits for the first
+// notification.
+static sp<IBinder> lookUpCached(const std::string& name) {
+    sp<IBinder> binder = checkService(name);
+    checkService(name);
+    std::this_thread::sleep_for(kNotificationDelay);
+    return binder;
+}
+
+TEST(ServiceCache, ReturnsRegisteredService) {
+    const std::string name = "binderServiceCacheTest.cached";
+    ServiceProcess process(name);
+    ASSERT_TRUE(process.registerService());
+
+    sp<IBinder> binder = lookUpCached(name);
+    ASSERT_NE(nullptr, binder);
+    EXPECT_EQ(binder, checkService(name));
+}
+
+TEST(ServiceCache, DeathClearsEntry) {
+    const std::string name = "binderServiceCacheTest.death";
+    ServiceProcess process(name);
+    ASSERT_TRUE(process.registerService());
+
+    sp<IBinder> binder = lookUpCached(name);
+    ASSERT_NE(nullptr, binder);
+    ASSERT_EQ(binder, checkService(name));
+
+    // |binder| is still held, so only the death notification can clear the entry.
+    process.kill();
+    EXPECT_TRUE(waitFor([&] { return checkService(name) == nullptr; }));
+}
+
+TEST(ServiceCache, ReRegistrationReplacesEntry) {
+    const std::string name = "binderServiceCacheTest.reregistration";
+    ServiceProcess process(name);
+    ASSERT_TRUE(process.registerService());
+
+    sp<IBinder> binder = lookUpCached(name);
+    ASSERT_NE(nullptr, binder);
+
+    ASSERT_TRUE(process.registerService());
+    EXPECT_TRUE(waitFor([&] {
+        sp<IBinder> current = checkService(name);
+        return current != nullptr && current != binder;
+    }));
+}
+
+TEST(ServiceCache, RefetchedProxyIsLinkedAgain) {
+    const std::string name = "binderServiceCacheTest.refetch";
+    ServiceProcess process(name);
+    ASSERT_TRUE(process.registerService());
+
+    // Dropping the last strong reference drops the death link along with it.
+    ASSERT_NE(nullptr, lookUpCached(name));
+    IPCThreadState::self()->flushCommands();
+
+    sp<IBinder> binder = lookUpCached(name);
+    ASSERT_NE(nullptr, binder);
+    ASSERT_EQ(binder, checkService(name));
+
+    process.kill();
+    EXPECT_TRUE(waitFor([&] { return checkService(name) == nullptr; }));
+}
+
+int main(int argc, char** argv) {
+    if (argc == 5 && strcmp(argv[1], kServerArg) == 0) {
+        return ServiceProcess::run(argv[2], atoi(argv[3]), atoi(argv[4]));
+    }
+
+    ::testing::InitGoogleTest(&argc, argv);
+    // The cache is only used by processes that receive its notifications.
+    ProcessState::self()->startThreadPool();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android/os/IServiceManager.h>
+#include <benchmark/benchmark.h>
+#include <binder/Binder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+
+// Usage: atest binderServiceLookupBenchmark
+//
+// Counts the lookups per second of a service registered by another process, asking
+// servicemanager every time as all lookups used to, and through the cache of
+// defaultServiceManager(). Both run on several threads at once, since servicemanager answers
+// on a single thread.
+//
+// BM_waitForServices times a client that starts before its dependencies, as at boot: another
+// process registers a dozen services one after the other, and the client waits for them one at
+// a time (0), or asks for all of them with checkServices() and waits for the missing ones with
+// waitForServiceAsync() (1).
+
+using android::BBinder;
+using android::checkServices;
+using android::defaultServiceManager;
+using android::IBinder;
+using android::interface_cast;
+using android::IPCThreadState;
+using android::ProcessState;
+using android::sp;
+using android::String16;
+using android::Vector;
+using android::waitForServiceAsync;
+using android::base::StringPrintf;
+
+static const char* kServiceName = "binderServiceLookupBenchmark";
+static constexpr int kStartupServices = 12;
+// Write end of the pipe that tells the registering process to start the next round.
+static int gStartupFd = -1;
+
+static std::string startupServiceName(int round, int i) {
+    return StringPrintf("%s.startup.%d.%d", kServiceName, round, i);
+}
+
+static void BM_checkServiceFromServiceManager(benchmark::State& state) {
+    sp<android::os::IServiceManager> sm = interface_cast<android::os::IServiceManager>(
+            ProcessState::self()->getContextObject(nullptr));
+    for (auto _ : state) {
+        sp<IBinder> binder;
+        if (!sm->checkService(kServiceName, &binder).isOk() || binder == nullptr) {
+            state.SkipWithError("checkService failed");
+            break;
+        }
+    }
+    state.counters["lookups"] =
+            benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_checkServiceFromServiceManager)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_checkServiceCached(benchmark::State& state) {
+    const String16 name(kServiceName);
+    // The cache only hits while the service is held, and once servicemanager's notification
+    // for the name came through.
+    sp<IBinder> held = defaultServiceManager()->checkService(name);
+    if (held == nullptr) {
+        state.SkipWithError("checkService failed");
+        return;
+    }
+    usleep(100000);
+
+    for (auto _ : state) {
+        if (defaultServiceManager()->checkService(name) == nullptr) {
+            state.SkipWithError("checkService failed");
+            break;
+        }
+    }
+    state.counters["lookups"] =
+            benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_checkServiceCached)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_waitForServices(benchmark::State& state) {
+    static int round = 0;
+    const bool async = state.range(0) != 0;
+    sp<android::IServiceManager> sm = defaultServiceManager();
+
+    for (auto _ : state) {
+        round++;
+        Vector<String16> names;
+        for (int i = 0; i < kStartupServices; i++) {
+            names.push(String16(startupServiceName(round, i).c_str()));
+        }
+        if (write(gStartupFd, &round, sizeof(round)) != sizeof(round)) {
+            state.SkipWithError("Couldn't start the services");
+            break;
+        }
+
+        bool found = true;
+        if (async) {
+            Vector<sp<IBinder>> services = checkServices(names);
+            std::vector<std::future<sp<IBinder>>> waits;
+            for (size_t i = 0; i < names.size(); i++) {
+                if (services[i] == nullptr) waits.push_back(waitForServiceAsync(names[i]));
+            }
+            for (auto& wait : waits) {
+                found &= wait.get() != nullptr;
+            }
+        } else {
+            for (const String16& name : names) {
+                found &= sm->waitForService(name) != nullptr;
+            }
+        }
+        if (!found) {
+            state.SkipWithError("waitForService failed");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_waitForServices)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Registers the startup services of every round written to |fd|, a little apart from each
+// other as if each one took some time to initialize.
+static void registerStartupServices(int fd) {
+    ProcessState::self()->startThreadPool();
+    int round;
+    while (read(fd, &round, sizeof(round)) == sizeof(round)) {
+        for (int i = 0; i < kStartupServices; i++) {
+            usleep(1000 * (i % 3));
+            defaultServiceManager()->addService(String16(startupServiceName(round, i).c_str()),
+                                                sp<BBinder>::make());
+        }
+    }
+    _exit(0);
+}
+
+int main(int argc, char** argv) {
+    ::benchmark::Initialize(&argc, argv);
+    if (::benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    // Binder can't be used before a fork, so the service is registered by a child process.
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (defaultServiceManager()->addService(String16(kServiceName),
+                                                sp<BBinder>::make()) != android::OK) {
+            _exit(1);
+        }
+        IPCThreadState::self()->joinThreadPool();
+        _exit(1);
+    }
+
+    int startupPipe[2];
+    if (pipe(startupPipe) != 0) {
+        kill(pid, SIGKILL);
+        return 1;
+    }
+    pid_t startupPid = fork();
+    if (startupPid == 0) {
+        close(startupPipe[1]);
+        registerStartupServices(startupPipe[0]);
+    }
+    close(startupPipe[0]);
+    gStartupFd = startupPipe[1];
+
+    // For the notifications that keep the cache up to date.
+    ProcessState::self()->startThreadPool();
+    if (defaultServiceManager()->waitForService(String16(kServiceName)) == nullptr) {
+        kill(pid, SIGKILL);
+        kill(startupPid, SIGKILL);
+        return 1;
+    }
+
+    ::benchmark::RunSpecifiedBenchmarks();
+
+    close(gStartupFd);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    kill(startupPid, SIGKILL);
+    waitpid(startupPid, nullptr, 0);
+    return 0;
+}
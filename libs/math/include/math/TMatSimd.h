@@ -0,0 +1,256 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * No user serviceable parts here.
+ *
+ * Don't use this file directly, instead include math/mat4.h
+ *
+ * 4x4 float matrix kernels written against a minimal 4-lane vector type, which
+ * maps onto SSE or NEON when the target has them and onto plain floats
+ * otherwise. Every backend rounds the same way, so the choice never changes
+ * results. The selection macros are internal and undefined at the end of this
+ * file.
+ *
+ * Matrices are column-major arrays of 16 floats, vectors are arrays of 4 floats.
+ * None of the pointers need to be 16-byte aligned.
+ */
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#define MATH_SIMD_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATH_SIMD_NEON 1
+#endif
+
+namespace android {
+namespace details {
+namespace simd {
+// -------------------------------------------------------------------------------------
+
+#if defined(MATH_SIMD_SSE)
+
+typedef __m128 f32x4;
+
+inline f32x4 load(const float* p)               { return _mm_loadu_ps(p); }
+inline void store(float* p, f32x4 v)            { _mm_storeu_ps(p, v); }
+inline f32x4 splat(float v)                     { return _mm_set1_ps(v); }
+inline f32x4 set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+inline f32x4 add(f32x4 a, f32x4 b)              { return _mm_add_ps(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b)              { return _mm_sub_ps(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b)              { return _mm_mul_ps(a, b); }
+inline f32x4 div(f32x4 a, f32x4 b)              { return _mm_div_ps(a, b); }
+
+#elif defined(MATH_SIMD_NEON)
+
+typedef float32x4_t f32x4;
+
+inline f32x4 load(const float* p)               { return vld1q_f32(p); }
+inline void store(float* p, f32x4 v)            { vst1q_f32(p, v); }
+inline f32x4 splat(float v)                     { return vdupq_n_f32(v); }
+inline f32x4 set(float x, float y, float z, float w) {
+    const float v[4] = { x, y, z, w };
+    return vld1q_f32(v);
+}
+inline f32x4 add(f32x4 a, f32x4 b)              { return vaddq_f32(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b)              { return vsubq_f32(a, b); }
+// vmlaq/vfmaq are avoided on purpose so that results round like the scalar code.
+inline f32x4 mul(f32x4 a, f32x4 b)              { return vmulq_f32(a, b); }
+#if defined(__aarch64__)
+inline f32x4 div(f32x4 a, f32x4 b)              { return vdivq_f32(a, b); }
+#else
+// ARMv7 NEON has no division, only a reciprocal estimate which isn't exact.
+inline f32x4 div(f32x4 a, f32x4 b) {
+    float x[4], y[4];
+    vst1q_f32(x, a);
+    vst1q_f32(y, b);
+    for (size_t i = 0; i < 4; i++) {
+        x[i] /= y[i];
+    }
+    return vld1q_f32(x);
+}
+#endif
+
+#else
+
+struct f32x4 {
+    float v[4];
+};
+
+inline f32x4 load(const float* p)               { return {{ p[0], p[1], p[2], p[3] }}; }
+inline void store(float* p, f32x4 a) {
+    for (size_t i = 0; i < 4; i++) {
+        p[i] = a.v[i];
+    }
+}
+inline f32x4 splat(float v)                     { return {{ v, v, v, v }}; }
+inline f32x4 set(float x, float y, float z, float w) { return {{ x, y, z, w }}; }
+
+#define MATH_SIMD_BINARY_OP(NAME, EXPR)                 \
+inline f32x4 NAME(f32x4 a, f32x4 b) {                   \
+    f32x4 r;                                            \
+    for (size_t i = 0; i < 4; i++) {                    \
+        const float x = a.v[i];                         \
+        const float y = b.v[i];                         \
+        r.v[i] = (EXPR);                                \
+    }                                                   \
+    return r;                                           \
+}
+MATH_SIMD_BINARY_OP(add, x + y)
+MATH_SIMD_BINARY_OP(sub, x - y)
+MATH_SIMD_BINARY_OP(mul, x * y)
+MATH_SIMD_BINARY_OP(div, x / y)
+#undef MATH_SIMD_BINARY_OP
+
+#endif
+
+// m * (x, y, z, w), accumulated in the same order as the generic TMat44 code.
+inline f32x4 transform(const f32x4 m[4], f32x4 x, f32x4 y, f32x4 z, f32x4 w) {
+    f32x4 r = mul(m[0], x);
+    r = add(r, mul(m[1], y));
+    r = add(r, mul(m[2], z));
+    return add(r, mul(m[3], w));
+}
+
+inline void loadMatrix(const float* m, f32x4 cols[4]) {
+    cols[0] = load(m);
+    cols[1] = load(m + 4);
+    cols[2] = load(m + 8);
+    cols[3] = load(m + 12);
+}
+
+// r = a * b
+inline void multiply(const float* a, const float* b, float* r) {
+    f32x4 cols[4];
+    loadMatrix(a, cols);
+    for (size_t c = 0; c < 4; c++) {
+        const float* bc = b + c * 4;
+        store(r + c * 4, transform(cols, splat(bc[0]), splat(bc[1]), splat(bc[2]), splat(bc[3])));
+    }
+}
+
+// dst[i] = m * src[i]. dst may be the same array as src.
+inline void transformVectors(const float* m, const float* src, float* dst, size_t count) {
+    f32x4 cols[4];
+    loadMatrix(m, cols);
+    for (size_t i = 0; i < count; i++, src += 4, dst += 4) {
+        const float x = src[0], y = src[1], z = src[2], w = src[3];
+        store(dst, transform(cols, splat(x), splat(y), splat(z), splat(w)));
+    }
+}
+
+// Maps 2D points (x, y, 0, 1) through m, followed by the perspective divide.
+// src and dst hold count (x, y) pairs and may be the same array.
+inline void transformPoints(const float* m, const float* src, float* dst, size_t count) {
+    f32x4 cols[4];
+    loadMatrix(m, cols);
+    float out[4];
+    for (size_t i = 0; i < count; i++, src += 2, dst += 2) {
+        f32x4 p = add(add(mul(cols[0], splat(src[0])), mul(cols[1], splat(src[1]))), cols[3]);
+        store(out, p);
+        dst[0] = out[0] / out[3];
+        dst[1] = out[1] / out[3];
+    }
+}
+
+// Maps rects stored as (left, top, right, bottom) through m, followed by the
+// perspective divide, and returns the bounds of the four transformed corners in
+// the same layout. dst may be the same array as src.
+inline void transformRects(const float* m, const float* src, float* dst, size_t count) {
+    const f32x4 m0 = splat(m[0]), m1 = splat(m[1]), m3 = splat(m[3]);
+    const f32x4 m4 = splat(m[4]), m5 = splat(m[5]), m7 = splat(m[7]);
+    const f32x4 m12 = splat(m[12]), m13 = splat(m[13]), m15 = splat(m[15]);
+    for (size_t i = 0; i < count; i++, src += 4, dst += 4) {
+        // One corner per lane: (l,t) (r,t) (l,b) (r,b)
+        const f32x4 x = set(src[0], src[2], src[0], src[2]);
+        const f32x4 y = set(src[1], src[1], src[3], src[3]);
+        const f32x4 w = add(add(mul(m3, x), mul(m7, y)), m15);
+        float xs[4], ys[4];
+        store(xs, div(add(add(mul(m0, x), mul(m4, y)), m12), w));
+        store(ys, div(add(add(mul(m1, x), mul(m5, y)), m13), w));
+        float l = xs[0], t = ys[0], r = xs[0], b = ys[0];
+        for (size_t c = 1; c < 4; c++) {
+            l = xs[c] < l ? xs[c] : l;
+            r = xs[c] > r ? xs[c] : r;
+            t = ys[c] < t ? ys[c] : t;
+            b = ys[c] > b ? ys[c] : b;
+        }
+        dst[0] = l;
+        dst[1] = t;
+        dst[2] = r;
+        dst[3] = b;
+    }
+}
+
+// r = inverse(m), computed from the adjugate. The result is undefined if m
+// is singular.
+inline void inverse(const float* m, float* r) {
+    // m(col, row)
+#define M(c, r) m[(c) * 4 + (r)]
+    // 2x2 sub-determinants of the two right-most columns, and so on.
+    const f32x4 fac0 = sub(mul(set(M(2,2), M(2,2), M(1,2), M(1,2)), set(M(3,3), M(3,3), M(3,3), M(2,3))),
+                           mul(set(M(3,2), M(3,2), M(3,2), M(2,2)), set(M(2,3), M(2,3), M(1,3), M(1,3))));
+    const f32x4 fac1 = sub(mul(set(M(2,1), M(2,1), M(1,1), M(1,1)), set(M(3,3), M(3,3), M(3,3), M(2,3))),
+                           mul(set(M(3,1), M(3,1), M(3,1), M(2,1)), set(M(2,3), M(2,3), M(1,3), M(1,3))));
+    const f32x4 fac2 = sub(mul(set(M(2,1), M(2,1), M(1,1), M(1,1)), set(M(3,2), M(3,2), M(3,2), M(2,2))),
+                           mul(set(M(3,1), M(3,1), M(3,1), M(2,1)), set(M(2,2), M(2,2), M(1,2), M(1,2))));
+    const f32x4 fac3 = sub(mul(set(M(2,0), M(2,0), M(1,0), M(1,0)), set(M(3,3), M(3,3), M(3,3), M(2,3))),
+                           mul(set(M(3,0), M(3,0), M(3,0), M(2,0)), set(M(2,3), M(2,3), M(1,3), M(1,3))));
+    const f32x4 fac4 = sub(mul(set(M(2,0), M(2,0), M(1,0), M(1,0)), set(M(3,2), M(3,2), M(3,2), M(2,2))),
+                           mul(set(M(3,0), M(3,0), M(3,0), M(2,0)), set(M(2,2), M(2,2), M(1,2), M(1,2))));
+    const f32x4 fac5 = sub(mul(set(M(2,0), M(2,0), M(1,0), M(1,0)), set(M(3,1), M(3,1), M(3,1), M(2,1))),
+                           mul(set(M(3,0), M(3,0), M(3,0), M(2,0)), set(M(2,1), M(2,1), M(1,1), M(1,1))));
+
+    const f32x4 vec0 = set(M(1,0), M(0,0), M(0,0), M(0,0));
+    const f32x4 vec1 = set(M(1,1), M(0,1), M(0,1), M(0,1));
+    const f32x4 vec2 = set(M(1,2), M(0,2), M(0,2), M(0,2));
+    const f32x4 vec3 = set(M(1,3), M(0,3), M(0,3), M(0,3));
+
+    const f32x4 signA = set( 1, -1,  1, -1);
+    const f32x4 signB = set(-1,  1, -1,  1);
+    const f32x4 inv0 = mul(add(sub(mul(vec1, fac0), mul(vec2, fac1)), mul(vec3, fac2)), signA);
+    const f32x4 inv1 = mul(add(sub(mul(vec0, fac0), mul(vec2, fac3)), mul(vec3, fac4)), signB);
+    const f32x4 inv2 = mul(add(sub(mul(vec0, fac1), mul(vec1, fac3)), mul(vec3, fac5)), signA);
+    const f32x4 inv3 = mul(add(sub(mul(vec0, fac2), mul(vec1, fac4)), mul(vec2, fac5)), signB);
+
+    // The determinant is the first column of m dotted with the first row of the adjugate.
+    float c0[4], c1[4], c2[4], c3[4];
+    store(c0, inv0);
+    store(c1, inv1);
+    store(c2, inv2);
+    store(c3, inv3);
+    const float det = (M(0,0) * c0[0] + M(0,1) * c1[0]) + (M(0,2) * c2[0] + M(0,3) * c3[0]);
+#undef M
+
+    const f32x4 oneOverDet = splat(1.0f / det);
+    store(r,      mul(inv0, oneOverDet));
+    store(r + 4,  mul(inv1, oneOverDet));
+    store(r + 8,  mul(inv2, oneOverDet));
+    store(r + 12, mul(inv3, oneOverDet));
+}
+
+// -------------------------------------------------------------------------------------
+}  // namespace simd
+}  // namespace details
+}  // namespace android
+
+#undef MATH_SIMD_SSE
+#undef MATH_SIMD_NEON
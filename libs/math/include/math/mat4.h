@@ -19,11 +19,13 @@
 #include <math/mat3.h>
 #include <math/quat.h>
 #include <math/TMatHelpers.h>
+#include <math/TMatSimd.h>
 #include <math/vec3.h>
 #include <math/vec4.h>
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <algorithm>
 #include <limits>
 
 #define PURE __attribute__((pure))
@@ -561,6 +563,101 @@ operator *(U lhs, const TMat44<T>& rhs) {
     return rhs * lhs;
 }
 
+// ----------------------------------------------------------------------------------------
+// SIMD specializations for float
+// ----------------------------------------------------------------------------------------
+
+/*
+ * mat4 is used per layer for transforms and color matrices, so multiply and inverse
+ * use the kernels from TMatSimd.h, on SSE / NEON when the target has them. These
+ * specializations are the same on every target and in every translation unit.
+ * Multiply accumulates in the same order as the generic code; inverse uses the
+ * adjugate rather than Gauss-Jordan elimination, so the inverse of a mat4 can differ
+ * in the last bits from that of a mat4d.
+ */
+namespace matrix {
+
+template <>
+inline TMat44<float> PURE multiply<TMat44<float>, TMat44<float>, TMat44<float>>(
+        const TMat44<float>& lhs, const TMat44<float>& rhs) {
+    TMat44<float> res(TMat44<float>::NO_INIT);
+    simd::multiply(lhs.asArray(), rhs.asArray(), &res[0][0]);
+    return res;
+}
+
+template <>
+inline TMat44<float> PURE inverse<TMat44<float>>(const TMat44<float>& matrix) {
+    TMat44<float> res(TMat44<float>::NO_INIT);
+    simd::inverse(matrix.asArray(), &res[0][0]);
+    return res;
+}
+
+}  // namespace matrix
+
+// ----------------------------------------------------------------------------------------
+// Batch transforms
+// ----------------------------------------------------------------------------------------
+
+/*
+ * These apply the same matrix to an array of vectors, points or rects in one call,
+ * which lets the float versions keep the matrix in registers. dst may be the same
+ * array as src.
+ */
+
+// dst[i] = m * src[i]
+template <typename T>
+void transformVectors(const TMat44<T>& m, const TVec4<T>* src, TVec4<T>* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = m * src[i];
+    }
+}
+
+// Maps 2D points (x, y, 0, 1) through m, then divides by w.
+template <typename T>
+void transformPoints(const TMat44<T>& m, const TVec2<T>* src, TVec2<T>* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const TVec4<T> p = m * TVec4<T>(src[i], 0, 1);
+        dst[i] = TVec2<T>(p.x / p.w, p.y / p.w);
+    }
+}
+
+// Maps rects stored as (left, top, right, bottom) through m and returns the bounds of
+// the four transformed corners, after dividing by w, in the same layout.
+template <typename T>
+void transformRects(const TMat44<T>& m, const TVec4<T>* src, TVec4<T>* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const TVec4<T> r = src[i];
+        TVec2<T> corners[4] = { { r.x, r.y }, { r.z, r.y }, { r.x, r.w }, { r.z, r.w } };
+        transformPoints(m, corners, corners, 4);
+        TVec4<T> bounds(corners[0].x, corners[0].y, corners[0].x, corners[0].y);
+        for (size_t c = 1; c < 4; c++) {
+            bounds.x = std::min(bounds.x, corners[c].x);
+            bounds.y = std::min(bounds.y, corners[c].y);
+            bounds.z = std::max(bounds.z, corners[c].x);
+            bounds.w = std::max(bounds.w, corners[c].y);
+        }
+        dst[i] = bounds;
+    }
+}
+
+inline void transformVectors(const TMat44<float>& m, const TVec4<float>* src, TVec4<float>* dst,
+                             size_t count) {
+    simd::transformVectors(m.asArray(), reinterpret_cast<const float*>(src),
+                           reinterpret_cast<float*>(dst), count);
+}
+
+inline void transformPoints(const TMat44<float>& m, const TVec2<float>* src, TVec2<float>* dst,
+                            size_t count) {
+    simd::transformPoints(m.asArray(), reinterpret_cast<const float*>(src),
+                          reinterpret_cast<float*>(dst), count);
+}
+
+inline void transformRects(const TMat44<float>& m, const TVec4<float>* src, TVec4<float>* dst,
+                           size_t count) {
+    simd::transformRects(m.asArray(), reinterpret_cast<const float*>(src),
+                         reinterpret_cast<float*>(dst), count);
+}
+
 // ----------------------------------------------------------------------------------------
 
 /* FIXME: this should go into TMatSquareFunctions<> but for some reason
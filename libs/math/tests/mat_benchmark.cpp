@@ -0,0 +1,153 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <math/mat4.h>
+
+#include <random>
+#include <vector>
+
+namespace android {
+namespace {
+
+mat4 randomMatrix(std::default_random_engine& generator) {
+    std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+    mat4 m(mat4::NO_INIT);
+    for (size_t c = 0; c < 4; c++) {
+        for (size_t r = 0; r < 4; r++) {
+            m[c][r] = distribution(generator);
+        }
+    }
+    return m;
+}
+
+// The generic TMat44 algorithms, as used for every value type other than float.
+mat4 genericMultiply(const mat4& lhs, const mat4& rhs) {
+    mat4 res(mat4::NO_INIT);
+    for (size_t col = 0; col < mat4::NUM_COLS; ++col) {
+        res[col] = lhs * rhs[col];
+    }
+    return res;
+}
+
+void BM_Multiply_Generic(benchmark::State& state) {
+    std::default_random_engine generator(1);
+    mat4 a = randomMatrix(generator);
+    const mat4 b = randomMatrix(generator);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(a = genericMultiply(a, b));
+    }
+}
+BENCHMARK(BM_Multiply_Generic);
+
+void BM_Multiply(benchmark::State& state) {
+    std::default_random_engine generator(1);
+    mat4 a = randomMatrix(generator);
+    const mat4 b = randomMatrix(generator);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(a = a * b);
+    }
+}
+BENCHMARK(BM_Multiply);
+
+void BM_Inverse_Generic(benchmark::State& state) {
+    std::default_random_engine generator(2);
+    const mat4 m = randomMatrix(generator);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(details::matrix::gaussJordanInverse(m));
+    }
+}
+BENCHMARK(BM_Inverse_Generic);
+
+void BM_Inverse(benchmark::State& state) {
+    std::default_random_engine generator(2);
+    const mat4 m = randomMatrix(generator);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(inverse(m));
+    }
+}
+BENCHMARK(BM_Inverse);
+
+std::vector<vec4> randomRects(size_t count) {
+    std::default_random_engine generator(3);
+    std::uniform_real_distribution<float> distribution(0.0f, 2000.0f);
+    std::vector<vec4> rects(count);
+    for (auto& r : rects) {
+        const float x = distribution(generator);
+        const float y = distribution(generator);
+        r = vec4(x, y, x + distribution(generator), y + distribution(generator));
+    }
+    return rects;
+}
+
+void BM_TransformVectors_Loop(benchmark::State& state) {
+    std::default_random_engine generator(4);
+    const mat4 m = randomMatrix(generator);
+    const std::vector<vec4> src = randomRects(state.range(0));
+    std::vector<vec4> dst(src.size());
+    for (auto _ : state) {
+        for (size_t i = 0; i < src.size(); i++) {
+            dst[i] = m * src[i];
+        }
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetItemsProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_TransformVectors_Loop)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_TransformVectors(benchmark::State& state) {
+    std::default_random_engine generator(4);
+    const mat4 m = randomMatrix(generator);
+    const std::vector<vec4> src = randomRects(state.range(0));
+    std::vector<vec4> dst(src.size());
+    for (auto _ : state) {
+        transformVectors(m, src.data(), dst.data(), src.size());
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetItemsProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_TransformVectors)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_TransformRects_Generic(benchmark::State& state) {
+    std::default_random_engine generator(5);
+    const mat4 m = randomMatrix(generator);
+    const std::vector<vec4> src = randomRects(state.range(0));
+    std::vector<vec4> dst(src.size());
+    for (auto _ : state) {
+        details::transformRects<float>(m, src.data(), dst.data(), src.size());
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetItemsProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_TransformRects_Generic)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_TransformRects(benchmark::State& state) {
+    std::default_random_engine generator(5);
+    const mat4 m = randomMatrix(generator);
+    const std::vector<vec4> src = randomRects(state.range(0));
+    std::vector<vec4> dst(src.size());
+    for (auto _ : state) {
+        transformRects(m, src.data(), dst.data(), src.size());
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetItemsProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_TransformRects)->Arg(16)->Arg(256)->Arg(4096);
+
+} // namespace
+} // namespace android
+
+BENCHMARK_MAIN();
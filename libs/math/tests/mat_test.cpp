@@ -21,6 +21,7 @@
 #include <limits>
 #include <random>
 #include <functional>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -688,6 +689,127 @@ TYPED_TEST(MatTestT, ToQuaternionPointTransformation44) {
     }
 }
 
+//------------------------------------------------------------------------------
+// FLOAT SPECIALIZATIONS AND BATCH TRANSFORMS
+//------------------------------------------------------------------------------
+
+class Mat4BatchTest : public testing::Test {
+protected:
+    static mat4 randomMatrix(std::default_random_engine& generator) {
+        std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+        mat4 m(mat4::NO_INIT);
+        for (size_t c = 0; c < 4; c++) {
+            for (size_t r = 0; r < 4; r++) {
+                m[c][r] = distribution(generator);
+            }
+        }
+        return m;
+    }
+
+    static mat4 referenceMultiply(const mat4& lhs, const mat4& rhs) {
+        mat4 res(mat4::NO_INIT);
+        for (size_t col = 0; col < 4; ++col) {
+            res[col] = lhs * rhs[col];
+        }
+        return res;
+    }
+};
+
+TEST_F(Mat4BatchTest, MultiplyMatchesGeneric) {
+    std::default_random_engine generator(17);
+    for (size_t i = 0; i < 100; i++) {
+        const mat4 a = randomMatrix(generator);
+        const mat4 b = randomMatrix(generator);
+        const mat4 expected = referenceMultiply(a, b);
+        const mat4 actual = a * b;
+        for (size_t c = 0; c < 4; c++) {
+            for (size_t r = 0; r < 4; r++) {
+                EXPECT_FLOAT_EQ(expected[c][r], actual[c][r]);
+            }
+        }
+    }
+}
+
+TEST_F(Mat4BatchTest, InverseMatchesGaussJordan) {
+    std::default_random_engine generator(23);
+    for (size_t i = 0; i < 100; i++) {
+        const mat4 m = randomMatrix(generator);
+        const mat4 expected = details::matrix::gaussJordanInverse(m);
+        const mat4 actual = inverse(m);
+        const mat4 identity = m * actual;
+        for (size_t c = 0; c < 4; c++) {
+            for (size_t r = 0; r < 4; r++) {
+                EXPECT_NEAR(expected[c][r], actual[c][r],
+                            1e-3f * std::max(1.0f, std::abs(expected[c][r])));
+                EXPECT_NEAR(c == r ? 1.0f : 0.0f, identity[c][r], 1e-3f);
+            }
+        }
+    }
+}
+
+TEST_F(Mat4BatchTest, TransformVectors) {
+    std::default_random_engine generator(5);
+    std::uniform_real_distribution<float> distribution(-100.0f, 100.0f);
+    const mat4 m = randomMatrix(generator);
+    std::vector<vec4> src(33);
+    for (auto& v : src) {
+        v = vec4(distribution(generator), distribution(generator), distribution(generator),
+                 distribution(generator));
+    }
+    std::vector<vec4> dst(src.size());
+    transformVectors(m, src.data(), dst.data(), src.size());
+    for (size_t i = 0; i < src.size(); i++) {
+        const vec4 expected = m * src[i];
+        for (size_t j = 0; j < 4; j++) {
+            EXPECT_FLOAT_EQ(expected[j], dst[i][j]);
+        }
+    }
+
+    // In place
+    transformVectors(m, src.data(), src.data(), src.size());
+    EXPECT_EQ(dst, src);
+}
+
+TEST_F(Mat4BatchTest, TransformPoints) {
+    const mat4 m = mat4::translate(vec4(10, 20, 0, 1)) * mat4::scale(vec4(2, 3, 1, 1));
+    const vec2 src[] = { { 0, 0 }, { 1, 1 }, { -5, 4 } };
+    vec2 dst[3];
+    transformPoints(m, src, dst, 3);
+    EXPECT_EQ(vec2(10, 20), dst[0]);
+    EXPECT_EQ(vec2(12, 23), dst[1]);
+    EXPECT_EQ(vec2(0, 32), dst[2]);
+
+    // Perspective divide
+    mat4 p;
+    p[3][3] = 2;
+    transformPoints(p, src, dst, 3);
+    EXPECT_EQ(vec2(0, 0), dst[0]);
+    EXPECT_EQ(vec2(0.5f, 0.5f), dst[1]);
+    EXPECT_EQ(vec2(-2.5f, 2), dst[2]);
+}
+
+TEST_F(Mat4BatchTest, TransformRects) {
+    // 90 degree rotation about z, then a translation
+    const mat4 m = mat4::translate(vec4(100, 0, 0, 1)) * mat4(0, 1, 0, 0,
+                                                              -1, 0, 0, 0,
+                                                              0, 0, 1, 0,
+                                                              0, 0, 0, 1);
+    const vec4 src[] = { { 0, 0, 10, 20 }, { -5, -5, 5, 5 } };
+    vec4 dst[2];
+    transformRects(m, src, dst, 2);
+    EXPECT_EQ(vec4(80, 0, 100, 10), dst[0]);
+    EXPECT_EQ(vec4(95, -5, 105, 5), dst[1]);
+
+    std::default_random_engine generator(11);
+    const mat4 r = randomMatrix(generator);
+    vec4 generic;
+    details::transformRects<float>(r, src, &generic, 1);
+    transformRects(r, src, dst, 1);
+    for (size_t j = 0; j < 4; j++) {
+        EXPECT_FLOAT_EQ(generic[j], dst[0][j]);
+    }
+}
+
 #undef TEST_MATRIX_INVERSE
 
 }; // namespace android
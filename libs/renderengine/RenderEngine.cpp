@@ -22,6 +22,7 @@
 #include "threaded/RenderEngineThreaded.h"
 
 #include "skia/SkiaGLRenderEngine.h"
+#include "skia/SkiaRasterRenderEngine.h"
 
 namespace android {
 namespace renderengine {
@@ -44,6 +45,9 @@ std::unique_ptr<RenderEngine> RenderEngine::create(const RenderEngineCreationArg
     if (strcmp(prop, "skiaglthreaded") == 0) {
         renderEngineType = RenderEngineType::SKIA_GL_THREADED;
     }
+    if (strcmp(prop, "skiaraster") == 0) {
+        renderEngineType = RenderEngineType::SKIA_RASTER;
+    }
 
     switch (renderEngineType) {
         case RenderEngineType::THREADED:
@@ -76,6 +80,9 @@ std::unique_ptr<RenderEngine> RenderEngine::create(const RenderEngineCreationArg
                     },
                     renderEngineType);
         }
+        case RenderEngineType::SKIA_RASTER:
+            ALOGD("RenderEngine with SkiaRaster Backend");
+            return renderengine::skia::SkiaRasterRenderEngine::create(args);
         case RenderEngineType::GLES:
         default:
             ALOGD("RenderEngine with GLES Backend");
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <renderengine/ExternalTexture.h>
+#include <renderengine/RenderEngine.h>
+#include <sync/sync.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/PixelFormat.h>
+
+#include <memory>
+#include <vector>
+
+#include "../skia/SkiaRasterRenderEngine.h"
+
+namespace android::renderengine {
+namespace {
+
+using RenderEngineType = RenderEngine::RenderEngineType;
+
+RenderEngineCreationArgs creationArgs(RenderEngineType type) {
+    return RenderEngineCreationArgs::Builder()
+            .setPixelFormat(static_cast<int>(ui::PixelFormat::RGBA_8888))
+            .setImageCacheSize(1)
+            .setUseColorManagerment(true)
+            .setEnableProtectedContext(false)
+            .setPrecacheToneMapperShaderOnly(false)
+            .setSupportsBackgroundBlur(true)
+            .setContextPriority(RenderEngine::ContextPriority::REALTIME)
+            .setRenderEngineType(type)
+            .build();
+}
+
+std::shared_ptr<ExternalTexture> allocateBuffer(RenderEngine& re, uint32_t width, uint32_t height,
+                                                uint64_t extraUsage, const char* name) {
+    sp<GraphicBuffer> buffer =
+            new GraphicBuffer(width, height, HAL_PIXEL_FORMAT_RGBA_8888, 1,
+                              GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
+                                      GRALLOC_USAGE_HW_TEXTURE | extraUsage,
+                              name);
+    return std::make_shared<ExternalTexture>(buffer, re,
+                                             ExternalTexture::Usage::READABLE |
+                                                     ExternalTexture::Usage::WRITEABLE);
+}
+
+// Fills the buffer with a gradient so that sampling isn't trivially uniform.
+void fillBuffer(const std::shared_ptr<ExternalTexture>& texture, uint8_t alpha) {
+    const sp<GraphicBuffer>& buffer = texture->getBuffer();
+    uint8_t* pixels;
+    buffer->lock(GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
+                 reinterpret_cast<void**>(&pixels));
+    for (uint32_t y = 0; y < buffer->getHeight(); y++) {
+        uint8_t* row = pixels + y * buffer->getStride() * 4;
+        for (uint32_t x = 0; x < buffer->getWidth(); x++) {
+            row[x * 4 + 0] = static_cast<uint8_t>(x * 255 / buffer->getWidth());
+            row[x * 4 + 1] = static_cast<uint8_t>(y * 255 / buffer->getHeight());
+            row[x * 4 + 2] = static_cast<uint8_t>((x + y) & 0xff);
+            row[x * 4 + 3] = alpha;
+        }
+    }
+    buffer->unlock();
+}
+
+// A typical home screen + app + system bars stack, optionally with a blurred dialog on top.
+struct LayerStack {
+    std::shared_ptr<ExternalTexture> wallpaperBuffer;
+    std::shared_ptr<ExternalTexture> appBuffer;
+    std::shared_ptr<ExternalTexture> statusBarBuffer;
+    LayerSettings wallpaper;
+    LayerSettings app;
+    LayerSettings statusBar;
+    LayerSettings navigationBar;
+    LayerSettings dialog;
+    std::vector<const LayerSettings*> layers;
+
+    LayerStack(RenderEngine& re, int width, int height, bool blur) {
+        const float w = static_cast<float>(width);
+        const float h = static_cast<float>(height);
+        const float density = w / 360.f;
+        const float statusBarHeight = 24.f * density;
+        const float navigationBarHeight = 48.f * density;
+
+        wallpaperBuffer = allocateBuffer(re, width, height, 0, "wallpaper");
+        fillBuffer(wallpaperBuffer, 0xff);
+        wallpaper.name = "wallpaper";
+        wallpaper.geometry.boundaries = FloatRect(0, 0, w, h);
+        wallpaper.source.buffer.buffer = wallpaperBuffer;
+        wallpaper.source.buffer.isOpaque = true;
+        wallpaper.source.buffer.useTextureFiltering = true;
+        wallpaper.alpha = 1.f;
+        wallpaper.sourceDataspace = ui::Dataspace::SRGB;
+        layers.push_back(&wallpaper);
+
+        appBuffer = allocateBuffer(re, width, height, 0, "app");
+        fillBuffer(appBuffer, 0xff);
+        app.name = "app";
+        app.geometry.boundaries = FloatRect(0, 0, w, h);
+        app.geometry.roundedCornersRadius = 16.f * density;
+        app.geometry.roundedCornersCrop = FloatRect(0, 0, w, h);
+        app.source.buffer.buffer = appBuffer;
+        app.alpha = 1.f;
+        app.sourceDataspace = ui::Dataspace::SRGB;
+        app.shadow.boundaries = app.geometry.boundaries;
+        app.shadow.length = 8.f * density;
+        app.shadow.lightPos = vec3(w / 2.f, 0.f, 600.f * density);
+        app.shadow.lightRadius = 800.f * density;
+        app.shadow.ambientColor = vec4(0.f, 0.f, 0.f, 0.05f);
+        app.shadow.spotColor = vec4(0.f, 0.f, 0.f, 0.2f);
+        layers.push_back(&app);
+
+        statusBarBuffer = allocateBuffer(re, width, static_cast<uint32_t>(statusBarHeight), 0,
+                                         "statusBar");
+        fillBuffer(statusBarBuffer, 0x80);
+        statusBar.name = "statusBar";
+        statusBar.geometry.boundaries = FloatRect(0, 0, w, statusBarHeight);
+        statusBar.source.buffer.buffer = statusBarBuffer;
+        statusBar.alpha = 1.f;
+        statusBar.sourceDataspace = ui::Dataspace::SRGB;
+        layers.push_back(&statusBar);
+
+        navigationBar.name = "navigationBar";
+        navigationBar.geometry.boundaries = FloatRect(0, h - navigationBarHeight, w, h);
+        navigationBar.source.solidColor = half3(0.1f, 0.1f, 0.1f);
+        navigationBar.alpha = 0.9f;
+        navigationBar.sourceDataspace = ui::Dataspace::SRGB;
+        layers.push_back(&navigationBar);
+
+        if (blur) {
+            dialog.name = "dialog";
+            dialog.geometry.boundaries =
+                    FloatRect(32.f * density, h / 3.f, w - 32.f * density, h * 2.f / 3.f);
+            dialog.geometry.roundedCornersRadius = 28.f * density;
+            dialog.geometry.roundedCornersCrop = dialog.geometry.boundaries;
+            dialog.source.solidColor = half3(1.f, 1.f, 1.f);
+            dialog.alpha = 0.7f;
+            dialog.backgroundBlurRadius = 40 * static_cast<int>(density);
+            dialog.sourceDataspace = ui::Dataspace::SRGB;
+            layers.push_back(&dialog);
+        }
+    }
+};
+
+// Measures a full drawLayers call, including waiting for the GPU to finish, for a typical
+// stack at the resolution given by the first two arguments. The third argument adds a dialog
+// with a background blur.
+void BM_DrawLayers(benchmark::State& state, RenderEngineType type, size_t rasterThreads) {
+    const int width = static_cast<int>(state.range(0));
+    const int height = static_cast<int>(state.range(1));
+    const bool blur = state.range(2) != 0;
+
+    std::unique_ptr<RenderEngine> re = type == RenderEngineType::SKIA_RASTER
+            ? std::make_unique<skia::SkiaRasterRenderEngine>(creationArgs(type), rasterThreads)
+            : RenderEngine::create(creationArgs(type));
+
+    const std::shared_ptr<ExternalTexture> output =
+            allocateBuffer(*re, width, height, GRALLOC_USAGE_HW_RENDER, "output");
+    const LayerStack stack(*re, width, height, blur);
+
+    DisplaySettings display;
+    display.physicalDisplay = Rect(width, height);
+    display.clip = Rect(width, height);
+    display.outputDataspace = ui::Dataspace::SRGB;
+    display.maxLuminance = 500.f;
+    display.sdrWhitePointNits = 500.f;
+
+    for (auto _ : state) {
+        base::unique_fd drawFence;
+        re->drawLayers(display, stack.layers, output, true, base::unique_fd(), &drawFence);
+        if (drawFence.ok()) {
+            sync_wait(drawFence.get(), -1);
+        }
+    }
+    state.counters["frames/s"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+
+void Resolutions(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"width", "height", "blur"});
+    for (const auto& [width, height] : {std::pair{1080, 1920}, std::pair{1440, 2560}}) {
+        b->Args({width, height, 0});
+        b->Args({width, height, 1});
+    }
+}
+
+BENCHMARK_CAPTURE(BM_DrawLayers, SkiaGL, RenderEngineType::SKIA_GL, 0)
+        ->Apply(Resolutions)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DrawLayers, SkiaRaster_1thread, RenderEngineType::SKIA_RASTER, 1)
+        ->Apply(Resolutions)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DrawLayers, SkiaRaster_2threads, RenderEngineType::SKIA_RASTER, 2)
+        ->Apply(Resolutions)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+BENCHMARK_CAPTURE(BM_DrawLayers, SkiaRaster_4threads, RenderEngineType::SKIA_RASTER, 4)
+        ->Apply(Resolutions)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+} // namespace
+} // namespace android::renderengine
+
+BENCHMARK_MAIN();
@@ -54,6 +54,25 @@
  */
 #define PROPERTY_SKIA_ATRACE_ENABLED "debug.renderengine.skia_atrace_enabled"
 
+/**
+ * Number of threads the SkiaRaster backend renders tiles on, including the calling thread.
+ * Defaults to the number of cores, capped at 4.
+ */
+#define PROPERTY_DEBUG_RENDERENGINE_RASTER_THREADS "debug.renderengine.raster_threads"
+
+/**
+ * File that SkiaGL records the shaders compiled during use to, so that they are compiled ahead of
+ * use after the next boot. Unset by default, which turns recording off. Recording makes Skia's
+ * shader cache work with SkSL rather than program binaries.
+ */
+#define PROPERTY_DEBUG_RENDERENGINE_SHADER_RECORD_FILE "debug.renderengine.shader_record_file"
+
+/**
+ * Budget in megabytes for the textures SkiaGL keeps imported for mapped buffers. By default the
+ * budget is derived from the primary display size.
+ */
+#define PROPERTY_DEBUG_RENDERENGINE_TEXTURE_CACHE_MB "debug.renderengine.texture_cache_mb"
+
 struct ANativeWindowBuffer;
 
 namespace android {
@@ -96,6 +115,7 @@ public:
         THREADED = 2,
         SKIA_GL = 3,
         SKIA_GL_THREADED = 4,
+        SKIA_RASTER = 5,
     };
 
     static std::unique_ptr<RenderEngine> create(const RenderEngineCreationArgs& args);
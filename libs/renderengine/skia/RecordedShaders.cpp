@@ -0,0 +1,235 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "RenderEngine"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include "RecordedShaders.h"
+
+#include <android-base/file.h>
+#include <log/log.h>
+#include <unistd.h>
+#include <utils/Trace.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+namespace android::renderengine::skia {
+
+namespace {
+
+// File layout, all integers little-endian uint32:
+//   magic, version, identity size, identity bytes, shader count,
+//   then per shader: key size, key bytes, data size, data bytes.
+constexpr uint32_t kMagic = 0x48534552; // "RESH"
+constexpr uint32_t kVersion = 1;
+
+void appendUint32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void appendBytes(std::string& out, const void* bytes, size_t size) {
+    appendUint32(out, static_cast<uint32_t>(size));
+    out.append(static_cast<const char*>(bytes), size);
+}
+
+// Reads from a file's contents, failing (instead of reading out of bounds) once truncated.
+class Reader {
+public:
+    explicit Reader(const std::string& contents) : mContents(contents) {}
+
+    bool readUint32(uint32_t* value) {
+        if (mContents.size() - mOffset < sizeof(*value)) {
+            return false;
+        }
+        memcpy(value, mContents.data() + mOffset, sizeof(*value));
+        mOffset += sizeof(*value);
+        return true;
+    }
+
+    bool readBytes(const char** bytes, size_t* size) {
+        uint32_t length;
+        if (!readUint32(&length) || mContents.size() - mOffset < length) {
+            return false;
+        }
+        *bytes = mContents.data() + mOffset;
+        *size = length;
+        mOffset += length;
+        return true;
+    }
+
+private:
+    const std::string& mContents;
+    size_t mOffset = 0;
+};
+
+std::string keyString(const SkData& key) {
+    return std::string(static_cast<const char*>(key.data()), key.size());
+}
+
+} // namespace
+
+RecordedShaders::RecordedShaders(std::string path, size_t maxShaders)
+      : mPath(std::move(path)), mMaxShaders(maxShaders) {}
+
+size_t RecordedShaders::load(const std::string& identity) {
+    ATRACE_CALL();
+    std::lock_guard lock(mMutex);
+    mIdentity = identity;
+    if (mPath.empty()) {
+        return 0;
+    }
+
+    std::string contents;
+    if (!base::ReadFileToString(mPath, &contents)) {
+        ALOGD("No recorded shaders in %s", mPath.c_str());
+        return 0;
+    }
+
+    Reader reader(contents);
+    uint32_t magic, version, count;
+    const char* bytes;
+    size_t size;
+    if (!reader.readUint32(&magic) || magic != kMagic || !reader.readUint32(&version) ||
+        version != kVersion || !reader.readBytes(&bytes, &size)) {
+        ALOGW("Ignoring recorded shaders in %s: unknown format", mPath.c_str());
+        return 0;
+    }
+    if (std::string(bytes, size) != identity) {
+        ALOGD("Ignoring recorded shaders in %s: recorded with a different driver", mPath.c_str());
+        return 0;
+    }
+    if (!reader.readUint32(&count)) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const char* keyBytes;
+        size_t keySize;
+        const char* dataBytes;
+        size_t dataSize;
+        if (!reader.readBytes(&keyBytes, &keySize) || !reader.readBytes(&dataBytes, &dataSize)) {
+            ALOGW("Recorded shaders in %s are truncated", mPath.c_str());
+            break;
+        }
+        addLocked(SkData::MakeWithCopy(keyBytes, keySize),
+                  SkData::MakeWithCopy(dataBytes, dataSize));
+    }
+    mDirty = false;
+    return mShaders.size();
+}
+
+bool RecordedShaders::add(const SkData& key, const SkData& data) {
+    std::lock_guard lock(mMutex);
+    if (const auto it = mKeys.find(keyString(key)); it != mKeys.end()) {
+        touchLocked(it->first);
+        return false;
+    }
+    if (!addLocked(SkData::MakeWithCopy(key.data(), key.size()),
+                   SkData::MakeWithCopy(data.data(), data.size()))) {
+        return false;
+    }
+    mDirty = true;
+    return true;
+}
+
+void RecordedShaders::touch(const SkData& key) {
+    std::lock_guard lock(mMutex);
+    touchLocked(keyString(key));
+}
+
+bool RecordedShaders::addLocked(sk_sp<SkData> key, sk_sp<SkData> data) {
+    if (mMaxShaders == 0) {
+        return false;
+    }
+    std::string keyBytes = keyString(*key);
+    if (mKeys.count(keyBytes)) {
+        return false;
+    }
+    if (mShaders.size() >= mMaxShaders) {
+        mKeys.erase(keyString(*mShaders.front().key));
+        mShaders.pop_front();
+    }
+    mShaders.push_back({std::move(key), std::move(data)});
+    mKeys.emplace(std::move(keyBytes), std::prev(mShaders.end()));
+    return true;
+}
+
+void RecordedShaders::touchLocked(const std::string& key) {
+    const auto it = mKeys.find(key);
+    if (it == mKeys.end() || it->second == std::prev(mShaders.end())) {
+        return;
+    }
+    // The order is what survives a reboot, so it's worth saving.
+    mShaders.splice(mShaders.end(), mShaders, it->second);
+    mDirty = true;
+}
+
+bool RecordedShaders::saveIfDirty() {
+    if (mPath.empty()) {
+        return false;
+    }
+
+    std::string contents;
+    {
+        std::lock_guard lock(mMutex);
+        if (!mDirty) {
+            return false;
+        }
+        // Don't retry a failed write every frame; the next recorded shader will try again.
+        mDirty = false;
+
+        appendUint32(contents, kMagic);
+        appendUint32(contents, kVersion);
+        appendBytes(contents, mIdentity.data(), mIdentity.size());
+        appendUint32(contents, static_cast<uint32_t>(mShaders.size()));
+        for (const Shader& shader : mShaders) {
+            appendBytes(contents, shader.key->data(), shader.key->size());
+            appendBytes(contents, shader.data->data(), shader.data->size());
+        }
+    }
+
+    ATRACE_CALL();
+    // Write a temporary file and rename it, so a crash mid-write never leaves a torn list.
+    const std::string tempPath = mPath + ".tmp";
+    if (!base::WriteStringToFile(contents, tempPath) ||
+        rename(tempPath.c_str(), mPath.c_str()) != 0) {
+        ALOGW("Failed to save recorded shaders to %s: %s", mPath.c_str(), strerror(errno));
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::vector<RecordedShaders::Shader> RecordedShaders::shaders() const {
+    std::lock_guard lock(mMutex);
+    return std::vector<Shader>(mShaders.begin(), mShaders.end());
+}
+
+size_t RecordedShaders::size() const {
+    std::lock_guard lock(mMutex);
+    return mShaders.size();
+}
+
+bool RecordedShaders::isDirty() const {
+    std::lock_guard lock(mMutex);
+    return mDirty;
+}
+
+} // namespace android::renderengine::skia
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <SkData.h>
+#include <android-base/thread_annotations.h>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace android::renderengine::skia {
+
+// The SkSL shaders Skia compiled while RenderEngine was in use, persisted to a file so that
+// RenderEngine can compile exactly those shaders ahead of use on the next boot.
+//
+// At most maxShaders are kept; once full, each new shader replaces the one least recently
+// recorded or used, so that shaders a device stopped using eventually age out of the file.
+//
+// The file is tagged with an identity string (the GL driver) and is ignored when it was written
+// for a different one. Thread-safe.
+class RecordedShaders {
+public:
+    struct Shader {
+        sk_sp<SkData> key;
+        sk_sp<SkData> data;
+    };
+
+    // An empty path turns persistence off; shaders are still recorded in memory.
+    RecordedShaders(std::string path, size_t maxShaders);
+
+    // Reads the shaders persisted by a previous run for the given identity. Returns the number
+    // of shaders read.
+    size_t load(const std::string& identity) EXCLUDES(mMutex);
+    // Records a shader, dropping the least recently used one if the list is full. Returns false
+    // if it was recorded already, in which case it only counts as used.
+    bool add(const SkData& key, const SkData& data) EXCLUDES(mMutex);
+    // Marks a recorded shader as used, e.g. once it was precompiled, so that it's dropped last.
+    void touch(const SkData& key) EXCLUDES(mMutex);
+    // Writes the list if shaders were added since it was last loaded or saved.
+    bool saveIfDirty() EXCLUDES(mMutex);
+
+    std::vector<Shader> shaders() const EXCLUDES(mMutex);
+    size_t size() const EXCLUDES(mMutex);
+    bool isDirty() const EXCLUDES(mMutex);
+
+private:
+    bool addLocked(sk_sp<SkData> key, sk_sp<SkData> data) REQUIRES(mMutex);
+    void touchLocked(const std::string& key) REQUIRES(mMutex);
+
+    const std::string mPath;
+    const size_t mMaxShaders;
+
+    mutable std::mutex mMutex;
+    std::string mIdentity GUARDED_BY(mMutex);
+    // Least recently used first.
+    std::list<Shader> mShaders GUARDED_BY(mMutex);
+    std::unordered_map<std::string, std::list<Shader>::iterator> mKeys GUARDED_BY(mMutex);
+    bool mDirty GUARDED_BY(mMutex) = false;
+};
+
+} // namespace android::renderengine::skia
@@ -34,6 +34,7 @@
 #include <SkRegion.h>
 #include <SkShadowUtils.h>
 #include <SkSurface.h>
+#include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <gl/GrGLInterface.h>
 #include <gui/TraceUtils.h>
@@ -43,6 +44,7 @@
 #include <ui/GraphicBuffer.h>
 #include <utils/Trace.h>
 
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <memory>
@@ -73,6 +75,38 @@ namespace renderengine {
 namespace skia {
 
 using base::StringAppendF;
+using namespace std::chrono_literals;
+
+// At most this many shaders are recorded for precompiling on the next boot.
+static constexpr size_t kMaxRecordedShaders = 256;
+// Time cleanupPostRender spends precompiling recorded shaders, past a first one, per frame.
+static constexpr nsecs_t kPrecompileTimePerFrame =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(2ms).count();
+// Recorded shaders are written out at most this often.
+static constexpr nsecs_t kRecordedShadersSaveInterval =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(10s).count();
+// Frames that compile shaders this early after boot are the ones users notice the most.
+static constexpr int kEarlyFrames = 300;
+// Texture cache budget until the primary display size is known.
+static constexpr size_t kDefaultTextureCacheBytes = 256 * 1024 * 1024;
+// Otherwise the texture cache may hold this many buffers of the primary display's size.
+static constexpr size_t kTextureCacheDisplayBuffers = 24;
+
+static size_t textureCacheBudgetFromProperty() {
+    return static_cast<size_t>(
+                   base::GetUintProperty<uint64_t>(PROPERTY_DEBUG_RENDERENGINE_TEXTURE_CACHE_MB,
+                                                   0)) *
+            1024 * 1024;
+}
+
+// Estimates the memory an imported buffer keeps alive.
+static size_t textureBytes(const sp<GraphicBuffer>& buffer) {
+    const size_t pixels = static_cast<size_t>(buffer->getStride()) * buffer->getHeight() *
+            buffer->getLayerCount();
+    const uint32_t bpp = bytesPerPixel(buffer->getPixelFormat());
+    // YUV formats report 0 bytes per pixel; assume 4:2:0 subsampling for them.
+    return bpp != 0 ? pixels * bpp : pixels * 3 / 2;
+}
 
 static status_t selectConfigForAttribute(EGLDisplay dpy, EGLint const* attrs, EGLint attribute,
                                          EGLint wanted, EGLConfig* outConfig) {
@@ -236,7 +270,9 @@ std::unique_ptr<SkiaGLRenderEngine> SkiaGLRenderEngine::create(
 }
 
 std::future<void> SkiaGLRenderEngine::primeCache() {
+    mSkSLCacheMonitor.setPrimingCache(true);
     Cache::primeShaderCache(this);
+    mSkSLCacheMonitor.setPrimingCache(false);
     return {};
 }
 
@@ -288,6 +324,10 @@ sk_sp<SkData> SkiaGLRenderEngine::SkSLCacheMonitor::load(const SkData& key) {
 void SkiaGLRenderEngine::SkSLCacheMonitor::store(const SkData& key, const SkData& data,
                                                  const SkString& description) {
     mShadersCachedSinceLastCall++;
+    mTotalShadersCached++;
+    if (mRecording && !mPrimingCache) {
+        mRecordedShaders.add(key, data);
+    }
 }
 
 void SkiaGLRenderEngine::assertShadersCompiled(int numShaders) {
@@ -300,17 +340,66 @@ int SkiaGLRenderEngine::reportShadersCompiled() {
     return mSkSLCacheMonitor.shadersCachedSinceLastCall();
 }
 
+void SkiaGLRenderEngine::precompileRecordedShaders(nsecs_t deadline) {
+    ATRACE_CALL();
+    const nsecs_t timeBefore = systemTime();
+    do {
+        const RecordedShaders::Shader& shader = mShadersToPrecompile[mNextShaderToPrecompile++];
+        // Fails if the SkSL no longer compiles, e.g. after a Skia update; the shader is simply
+        // compiled on first use again.
+        if (mGrContext->precompileShader(*shader.key, *shader.data)) {
+            mShaderCompileStats.precompiledShaders++;
+            mRecordedShaders.touch(*shader.key);
+        }
+    } while (mNextShaderToPrecompile < mShadersToPrecompile.size() && systemTime() < deadline);
+    mShaderCompileStats.precompileTime += systemTime() - timeBefore;
+
+    if (mNextShaderToPrecompile == mShadersToPrecompile.size()) {
+        ALOGD("Precompiled %zu of %zu recorded shaders in %f ms",
+              mShaderCompileStats.precompiledShaders, mShadersToPrecompile.size(),
+              mShaderCompileStats.precompileTime / 1e6);
+        mShadersToPrecompile.clear();
+        mNextShaderToPrecompile = 0;
+    }
+}
+
+void SkiaGLRenderEngine::updateShaderCompileStats(nsecs_t frameStart, int shadersCachedBefore) {
+    if (mSkSLCacheMonitor.isPrimingCache()) {
+        // Frames drawn by primeCache are expected to compile shaders.
+        return;
+    }
+    mShaderCompileStats.frames++;
+    if (mSkSLCacheMonitor.totalShadersCached() == shadersCachedBefore) {
+        return;
+    }
+    mShaderCompileStats.framesCompilingShaders++;
+    mShaderCompileStats.timeInFramesCompilingShaders += systemTime() - frameStart;
+    if (mShaderCompileStats.frames <= kEarlyFrames) {
+        mShaderCompileStats.earlyFramesCompilingShaders++;
+    }
+}
+
+bool SkiaGLRenderEngine::shouldSaveRecordedShaders() const {
+    return mRecordedShaders.isDirty() &&
+            systemTime() - mLastRecordedShadersSave >= kRecordedShadersSaveInterval;
+}
+
 SkiaGLRenderEngine::SkiaGLRenderEngine(const RenderEngineCreationArgs& args, EGLDisplay display,
                                        EGLContext ctxt, EGLSurface placeholder,
                                        EGLContext protectedContext, EGLSurface protectedPlaceholder)
-      : SkiaRenderEngine(args.renderEngineType),
+      : SkiaRenderEngine(args.renderEngineType, args.useColorManagement),
         mEGLDisplay(display),
         mEGLContext(ctxt),
         mPlaceholderSurface(placeholder),
         mProtectedEGLContext(protectedContext),
         mProtectedPlaceholderSurface(protectedPlaceholder),
         mDefaultPixelFormat(static_cast<PixelFormat>(args.pixelFormat)),
-        mUseColorManagement(args.useColorManagement) {
+        mTextureCache(textureCacheBudgetFromProperty() ?: kDefaultTextureCacheBytes),
+        mHasFixedTextureCacheBudget(textureCacheBudgetFromProperty() != 0),
+        mRecordShaders(!base::GetProperty(PROPERTY_DEBUG_RENDERENGINE_SHADER_RECORD_FILE, "")
+                                .empty()),
+        mRecordedShaders(base::GetProperty(PROPERTY_DEBUG_RENDERENGINE_SHADER_RECORD_FILE, ""),
+                         kMaxRecordedShaders) {
     sk_sp<const GrGLInterface> glInterface(GrGLCreateNativeInterface());
     LOG_ALWAYS_FATAL_IF(!glInterface.get());
 
@@ -319,6 +408,11 @@ SkiaGLRenderEngine::SkiaGLRenderEngine(const RenderEngineCreationArgs& args, EGL
     options.fDisableDistanceFieldPaths = true;
     options.fReducedShaderVariations = true;
     options.fPersistentCache = &mSkSLCacheMonitor;
+    if (mRecordShaders) {
+        // Recorded shaders can only be precompiled from SkSL, so have Skia hand over SkSL
+        // rather than program binaries. Only done when recording was asked for.
+        options.fShaderCacheStrategy = GrContextOptions::ShaderCacheStrategy::kSkSL;
+    }
     mGrContext = GrDirectContext::MakeGL(glInterface, options);
     if (supportsProtectedContent()) {
         useProtectedContext(true);
@@ -331,6 +425,15 @@ SkiaGLRenderEngine::SkiaGLRenderEngine(const RenderEngineCreationArgs& args, EGL
         mBlurFilter = new BlurFilter();
     }
     mCapture = std::make_unique<SkiaCapture>();
+
+    if (mRecordShaders) {
+        const gl::GLExtensions& extensions = gl::GLExtensions::getInstance();
+        mRecordedShaders.load(base::StringPrintf("%s|%s|%s", extensions.getVendor(),
+                                                 extensions.getRenderer(),
+                                                 extensions.getVersion()));
+        std::lock_guard<std::mutex> lock(mRenderingMutex);
+        mShadersToPrecompile = mRecordedShaders.shaders();
+    }
 }
 
 SkiaGLRenderEngine::~SkiaGLRenderEngine() {
@@ -452,52 +555,6 @@ bool SkiaGLRenderEngine::waitFence(base::unique_fd fenceFd) {
     return true;
 }
 
-static float toDegrees(uint32_t transform) {
-    switch (transform) {
-        case ui::Transform::ROT_90:
-            return 90.0;
-        case ui::Transform::ROT_180:
-            return 180.0;
-        case ui::Transform::ROT_270:
-            return 270.0;
-        default:
-            return 0.0;
-    }
-}
-
-static SkColorMatrix toSkColorMatrix(const mat4& matrix) {
-    return SkColorMatrix(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0], 0, matrix[0][1],
-                         matrix[1][1], matrix[2][1], matrix[3][1], 0, matrix[0][2], matrix[1][2],
-                         matrix[2][2], matrix[3][2], 0, matrix[0][3], matrix[1][3], matrix[2][3],
-                         matrix[3][3], 0);
-}
-
-static bool needsToneMapping(ui::Dataspace sourceDataspace, ui::Dataspace destinationDataspace) {
-    int64_t sourceTransfer = sourceDataspace & HAL_DATASPACE_TRANSFER_MASK;
-    int64_t destTransfer = destinationDataspace & HAL_DATASPACE_TRANSFER_MASK;
-
-    // Treat unsupported dataspaces as srgb
-    if (destTransfer != HAL_DATASPACE_TRANSFER_LINEAR &&
-        destTransfer != HAL_DATASPACE_TRANSFER_HLG &&
-        destTransfer != HAL_DATASPACE_TRANSFER_ST2084) {
-        destTransfer = HAL_DATASPACE_TRANSFER_SRGB;
-    }
-
-    if (sourceTransfer != HAL_DATASPACE_TRANSFER_LINEAR &&
-        sourceTransfer != HAL_DATASPACE_TRANSFER_HLG &&
-        sourceTransfer != HAL_DATASPACE_TRANSFER_ST2084) {
-        sourceTransfer = HAL_DATASPACE_TRANSFER_SRGB;
-    }
-
-    const bool isSourceLinear = sourceTransfer == HAL_DATASPACE_TRANSFER_LINEAR;
-    const bool isSourceSRGB = sourceTransfer == HAL_DATASPACE_TRANSFER_SRGB;
-    const bool isDestLinear = destTransfer == HAL_DATASPACE_TRANSFER_LINEAR;
-    const bool isDestSRGB = destTransfer == HAL_DATASPACE_TRANSFER_SRGB;
-
-    return !(isSourceLinear && isDestSRGB) && !(isSourceSRGB && isDestLinear) &&
-            sourceTransfer != destTransfer;
-}
-
 void SkiaGLRenderEngine::mapExternalTextureBuffer(const sp<GraphicBuffer>& buffer,
                                                   bool isRenderable) {
     // Only run this if RE is running on its own thread. This way the access to GL
@@ -519,17 +576,22 @@ void SkiaGLRenderEngine::mapExternalTextureBuffer(const sp<GraphicBuffer>& buffe
     // the texture in either GL context because they are initialized with the same share_context
     // which allows the texture state to be shared between them.
     auto grContext = getActiveGrContext();
-    auto& cache = mTextureCache;
 
     std::lock_guard<std::mutex> lock(mRenderingMutex);
-    mGraphicBufferExternalRefs[buffer->getId()]++;
+    ExternalRefs& refs = mGraphicBufferExternalRefs[buffer->getId()];
+    if (refs.count++ == 0) {
+        refs.isRenderable = isRenderable;
+    }
 
-    if (const auto& iter = cache.find(buffer->getId()); iter == cache.end()) {
+    if (!mTextureCache.contains(buffer->getId())) {
         std::shared_ptr<AutoBackendTexture::LocalRef> imageTextureRef =
                 std::make_shared<AutoBackendTexture::LocalRef>(grContext,
                                                                buffer->toAHardwareBuffer(),
-                                                               isRenderable, mTextureCleanupMgr);
-        cache.insert({buffer->getId(), imageTextureRef});
+                                                               refs.isRenderable,
+                                                               mTextureCleanupMgr);
+        mTextureCache.insert(buffer->getId(), imageTextureRef, textureBytes(buffer),
+                             /*usedInFrame=*/false);
+        releaseEvictedTextures();
     }
 }
 
@@ -538,7 +600,7 @@ void SkiaGLRenderEngine::unmapExternalTextureBuffer(const sp<GraphicBuffer>& buf
     std::lock_guard<std::mutex> lock(mRenderingMutex);
     if (const auto& iter = mGraphicBufferExternalRefs.find(buffer->getId());
         iter != mGraphicBufferExternalRefs.end()) {
-        if (iter->second == 0) {
+        if (iter->second.count == 0) {
             ALOGW("Attempted to unmap GraphicBuffer <id: %" PRId64
                   "> from RenderEngine texture, but the "
                   "ref count was already zero!",
@@ -547,7 +609,7 @@ void SkiaGLRenderEngine::unmapExternalTextureBuffer(const sp<GraphicBuffer>& buf
             return;
         }
 
-        iter->second--;
+        iter->second.count--;
 
         // Swap contexts if needed prior to deleting this buffer
         // See Issue 1 of
@@ -558,7 +620,7 @@ void SkiaGLRenderEngine::unmapExternalTextureBuffer(const sp<GraphicBuffer>& buf
         const bool inProtected = mInProtectedContext;
         useProtectedContext(buffer->getUsage() & GRALLOC_USAGE_PROTECTED);
 
-        if (iter->second == 0) {
+        if (iter->second.count == 0) {
             mTextureCache.erase(buffer->getId());
             mGraphicBufferExternalRefs.erase(buffer->getId());
         }
@@ -571,15 +633,75 @@ void SkiaGLRenderEngine::unmapExternalTextureBuffer(const sp<GraphicBuffer>& buf
     }
 }
 
+void SkiaGLRenderEngine::releaseEvictedTextures() {
+    std::vector<std::shared_ptr<AutoBackendTexture::LocalRef>> evicted =
+            mTextureCache.takeEvicted();
+    if (evicted.empty()) {
+        return;
+    }
+
+    // Protected buffers are never cached, so like unmapExternalTextureBuffer does for them, free
+    // the evicted textures in the unprotected context and swap back afterwards.
+    const bool inProtected = mInProtectedContext;
+    useProtectedContext(false);
+    evicted.clear();
+    if (inProtected != mInProtectedContext) {
+        useProtectedContext(inProtected);
+    }
+}
+
+std::shared_ptr<AutoBackendTexture::LocalRef> SkiaGLRenderEngine::getTextureForFrame(
+        GrDirectContext* grContext, const sp<GraphicBuffer>& buffer, bool isRenderable) {
+    if (auto texture = mTextureCache.get(buffer->getId())) {
+        return texture;
+    }
+
+    // If we didn't find the image in the cache, then create a local ref but don't cache it. If
+    // we're using skia, we're guaranteed to run on a dedicated GPU thread so if we didn't find
+    // anything in the cache then we intentionally did not cache this buffer's resources.
+    // The exception is a buffer that is still mapped: it was evicted to stay within the cache
+    // budget, and is imported the way it was mapped and cached again now that it is being drawn.
+    const auto refs = mGraphicBufferExternalRefs.find(buffer->getId());
+    const bool isMapped = refs != mGraphicBufferExternalRefs.end();
+    auto texture = std::make_shared<
+            AutoBackendTexture::LocalRef>(grContext, buffer->toAHardwareBuffer(),
+                                          isMapped ? refs->second.isRenderable : isRenderable,
+                                          mTextureCleanupMgr);
+    if (isMapped) {
+        mTextureCache.insert(buffer->getId(), texture, textureBytes(buffer),
+                             /*usedInFrame=*/true);
+        // Only reached from drawLayers, which defers deleting them until cleanupPostRender.
+        mTextureCache.takeEvicted();
+    }
+    return texture;
+}
+
 bool SkiaGLRenderEngine::canSkipPostRenderCleanup() const {
     std::lock_guard<std::mutex> lock(mRenderingMutex);
-    return mTextureCleanupMgr.isEmpty();
+    return mTextureCleanupMgr.isEmpty() && !shouldSaveRecordedShaders() &&
+            mShadersToPrecompile.empty();
 }
 
 void SkiaGLRenderEngine::cleanupPostRender() {
     ATRACE_CALL();
-    std::lock_guard<std::mutex> lock(mRenderingMutex);
-    mTextureCleanupMgr.cleanup();
+    bool saveRecordedShaders;
+    {
+        std::lock_guard<std::mutex> lock(mRenderingMutex);
+        mTextureCleanupMgr.cleanup();
+        // Recorded shaders are compiled for the unprotected context, so only make progress while
+        // it is current.
+        if (!mShadersToPrecompile.empty() && !mInProtectedContext) {
+            precompileRecordedShaders(systemTime() + kPrecompileTimePerFrame);
+        }
+        saveRecordedShaders = shouldSaveRecordedShaders();
+        if (saveRecordedShaders) {
+            mLastRecordedShadersSave = systemTime();
+        }
+    }
+    // Written outside the lock so that the next frame doesn't wait on the file system.
+    if (saveRecordedShaders) {
+        mRecordedShaders.saveIfDirty();
+    }
 }
 
 // Helper class intended to be used on the stack to ensure that texture cleanup
@@ -596,53 +718,6 @@ private:
     AutoBackendTexture::CleanupManager& mMgr;
 };
 
-sk_sp<SkShader> SkiaGLRenderEngine::createRuntimeEffectShader(
-        sk_sp<SkShader> shader,
-        const LayerSettings* layer, const DisplaySettings& display, bool undoPremultipliedAlpha,
-        bool requiresLinearEffect) {
-    const auto stretchEffect = layer->stretchEffect;
-    // The given surface will be stretched by HWUI via matrix transformation
-    // which gets similar results for most surfaces
-    // Determine later on if we need to leverage the stertch shader within
-    // surface flinger
-    if (stretchEffect.hasEffect()) {
-        const auto targetBuffer = layer->source.buffer.buffer;
-        const auto graphicBuffer = targetBuffer ? targetBuffer->getBuffer() : nullptr;
-        if (graphicBuffer && shader) {
-            shader = mStretchShaderFactory.createSkShader(shader, stretchEffect);
-        }
-    }
-
-    if (requiresLinearEffect) {
-        const ui::Dataspace inputDataspace =
-                mUseColorManagement ? layer->sourceDataspace : ui::Dataspace::V0_SRGB_LINEAR;
-        const ui::Dataspace outputDataspace =
-                mUseColorManagement ? display.outputDataspace : ui::Dataspace::V0_SRGB_LINEAR;
-
-        LinearEffect effect = LinearEffect{.inputDataspace = inputDataspace,
-                                           .outputDataspace = outputDataspace,
-                                           .undoPremultipliedAlpha = undoPremultipliedAlpha};
-
-        auto effectIter = mRuntimeEffects.find(effect);
-        sk_sp<SkRuntimeEffect> runtimeEffect = nullptr;
-        if (effectIter == mRuntimeEffects.end()) {
-            runtimeEffect = buildRuntimeEffect(effect);
-            mRuntimeEffects.insert({effect, runtimeEffect});
-        } else {
-            runtimeEffect = effectIter->second;
-        }
-        float maxLuminance = layer->source.buffer.maxLuminanceNits;
-        // If the buffer doesn't have a max luminance, treat it as SDR & use the display's SDR
-        // white point
-        if (maxLuminance <= 0.f) {
-            maxLuminance = display.sdrWhitePointNits;
-        }
-        return createLinearEffectShader(shader, effect, runtimeEffect, layer->colorTransform,
-                                        display.maxLuminance, maxLuminance);
-    }
-    return shader;
-}
-
 void SkiaGLRenderEngine::initCanvas(SkCanvas* canvas, const DisplaySettings& display) {
     if (CC_UNLIKELY(mCapture->isCaptureRunning())) {
         // Record display settings when capture is running.
@@ -653,33 +728,7 @@ void SkiaGLRenderEngine::initCanvas(SkCanvas* canvas, const DisplaySettings& dis
                                SkData::MakeWithCString(displaySettings.str().c_str()));
     }
 
-    // Before doing any drawing, let's make sure that we'll start at the origin of the display.
-    // Some displays don't start at 0,0 for example when we're mirroring the screen. Also, virtual
-    // displays might have different scaling when compared to the physical screen.
-
-    canvas->clipRect(getSkRect(display.physicalDisplay));
-    canvas->translate(display.physicalDisplay.left, display.physicalDisplay.top);
-
-    const auto clipWidth = display.clip.width();
-    const auto clipHeight = display.clip.height();
-    auto rotatedClipWidth = clipWidth;
-    auto rotatedClipHeight = clipHeight;
-    // Scale is contingent on the rotation result.
-    if (display.orientation & ui::Transform::ROT_90) {
-        std::swap(rotatedClipWidth, rotatedClipHeight);
-    }
-    const auto scaleX = static_cast<SkScalar>(display.physicalDisplay.width()) /
-            static_cast<SkScalar>(rotatedClipWidth);
-    const auto scaleY = static_cast<SkScalar>(display.physicalDisplay.height()) /
-            static_cast<SkScalar>(rotatedClipHeight);
-    canvas->scale(scaleX, scaleY);
-
-    // Canvas rotation is done by centering the clip window at the origin, rotating, translating
-    // back so that the top left corner of the clip is at (0, 0).
-    canvas->translate(rotatedClipWidth / 2, rotatedClipHeight / 2);
-    canvas->rotate(toDegrees(display.orientation));
-    canvas->translate(-clipWidth / 2, -clipHeight / 2);
-    canvas->translate(-display.clip.left, -display.clip.top);
+    transformCanvasToDisplay(canvas, display);
 }
 
 class AutoSaveRestore {
@@ -702,17 +751,6 @@ private:
     int mSaveCount;
 };
 
-static SkRRect getBlurRRect(const BlurRegion& region) {
-    const auto rect = SkRect::MakeLTRB(region.left, region.top, region.right, region.bottom);
-    const SkVector radii[4] = {SkVector::Make(region.cornerRadiusTL, region.cornerRadiusTL),
-                               SkVector::Make(region.cornerRadiusTR, region.cornerRadiusTR),
-                               SkVector::Make(region.cornerRadiusBR, region.cornerRadiusBR),
-                               SkVector::Make(region.cornerRadiusBL, region.cornerRadiusBL)};
-    SkRRect roundedRect;
-    roundedRect.setRectRadii(rect, radii);
-    return roundedRect;
-}
-
 status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
                                         const std::vector<const LayerSettings*>& layers,
                                         const std::shared_ptr<ExternalTexture>& buffer,
@@ -725,6 +763,8 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
         ALOGV("Drawing empty layer stack");
         return NO_ERROR;
     }
+    const nsecs_t frameStart = systemTime();
+    const int shadersCachedBefore = mSkSLCacheMonitor.totalShadersCached();
 
     if (bufferFence.get() >= 0) {
         // Duplicate the fence for passing to waitFence.
@@ -742,21 +782,17 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
     validateOutputBufferUsage(buffer->getBuffer());
 
     auto grContext = getActiveGrContext();
-    auto& cache = mTextureCache;
 
     // any AutoBackendTexture deletions will now be deferred until cleanupPostRender is called
     DeferTextureCleanup dtc(mTextureCleanupMgr);
 
-    std::shared_ptr<AutoBackendTexture::LocalRef> surfaceTextureRef;
-    if (const auto& it = cache.find(buffer->getBuffer()->getId()); it != cache.end()) {
-        surfaceTextureRef = it->second;
-    } else {
-        surfaceTextureRef =
-                std::make_shared<AutoBackendTexture::LocalRef>(grContext,
-                                                               buffer->getBuffer()
-                                                                       ->toAHardwareBuffer(),
-                                                               true, mTextureCleanupMgr);
-    }
+    // Textures used from here on are kept cached until the next frame. Evicted textures are
+    // handed to mTextureCleanupMgr, so they are only deleted by cleanupPostRender.
+    mTextureCache.startFrame();
+    mTextureCache.takeEvicted();
+
+    std::shared_ptr<AutoBackendTexture::LocalRef> surfaceTextureRef =
+            getTextureForFrame(grContext, buffer->getBuffer(), /*isRenderable=*/true);
 
     const ui::Dataspace dstDataspace =
             mUseColorManagement ? display.outputDataspace : ui::Dataspace::V0_SRGB_LINEAR;
@@ -807,6 +843,10 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
         }
     }
 
+    if (mBlurFilter) {
+        mBlurFilter->startFrame();
+    }
+
     AutoSaveRestore surfaceAutoSaveRestore(canvas);
     // Clear the entire canvas with a transparent black to prevent ghost images.
     canvas->clear(SK_ColorTRANSPARENT);
@@ -909,6 +949,9 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
             }
             // rect to be blurred in the coordinate space of blurInput
             const auto blurRect = canvas->getTotalMatrix().mapRect(bounds.rect());
+            // blurInput holds exactly what layers before this one drew, which is what cached
+            // blurs are matched against.
+            const size_t layerIndex = &layer - layers.data();
 
             // if the clip needs to be applied then apply it now and make sure
             // it is restored before we attempt to draw any shadows.
@@ -922,8 +965,9 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
                 if (layer->backgroundBlurRadius > 0) {
                     ATRACE_NAME("BackgroundBlur");
                     auto blurredImage =
-                            mBlurFilter->generate(grContext, layer->backgroundBlurRadius, blurInput,
-                                                  blurRect);
+                            mBlurFilter->generateCached(grContext, layer->backgroundBlurRadius,
+                                                        blurInput, blurRect, display, layers,
+                                                        layerIndex);
 
                     cachedBlurs[layer->backgroundBlurRadius] = blurredImage;
 
@@ -936,8 +980,9 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
                     if (cachedBlurs[region.blurRadius] == nullptr) {
                         ATRACE_NAME("BlurRegion");
                         cachedBlurs[region.blurRadius] =
-                                mBlurFilter->generate(grContext, region.blurRadius, blurInput,
-                                                      blurRect);
+                                mBlurFilter->generateCached(grContext, region.blurRadius,
+                                                            blurInput, blurRect, display, layers,
+                                                            layerIndex);
                     }
 
                     mBlurFilter->drawBlurRegion(canvas, getBlurRRect(region), region.blurRadius,
@@ -998,21 +1043,9 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
             ATRACE_NAME("DrawImage");
             validateInputBufferUsage(layer->source.buffer.buffer->getBuffer());
             const auto& item = layer->source.buffer;
-            std::shared_ptr<AutoBackendTexture::LocalRef> imageTextureRef = nullptr;
-
-            if (const auto& iter = cache.find(item.buffer->getBuffer()->getId());
-                iter != cache.end()) {
-                imageTextureRef = iter->second;
-            } else {
-                // If we didn't find the image in the cache, then create a local ref but don't cache
-                // it. If we're using skia, we're guaranteed to run on a dedicated GPU thread so if
-                // we didn't find anything in the cache then we intentionally did not cache this
-                // buffer's resources.
-                imageTextureRef = std::make_shared<
-                        AutoBackendTexture::LocalRef>(grContext,
-                                                      item.buffer->getBuffer()->toAHardwareBuffer(),
-                                                      false, mTextureCleanupMgr);
-            }
+            const sp<GraphicBuffer>& graphicBuffer = item.buffer->getBuffer();
+            std::shared_ptr<AutoBackendTexture::LocalRef> imageTextureRef =
+                    getTextureForFrame(grContext, graphicBuffer, /*isRenderable=*/false);
 
             // isOpaque means we need to ignore the alpha in the image,
             // replacing it with the alpha specified by the LayerSettings. See
@@ -1137,129 +1170,11 @@ status_t SkiaGLRenderEngine::drawLayers(const DisplaySettings& display,
         return INVALID_OPERATION;
     }
 
+    updateShaderCompileStats(frameStart, shadersCachedBefore);
     // checkErrors();
     return NO_ERROR;
 }
 
-inline SkRect SkiaGLRenderEngine::getSkRect(const FloatRect& rect) {
-    return SkRect::MakeLTRB(rect.left, rect.top, rect.right, rect.bottom);
-}
-
-inline SkRect SkiaGLRenderEngine::getSkRect(const Rect& rect) {
-    return SkRect::MakeLTRB(rect.left, rect.top, rect.right, rect.bottom);
-}
-
-inline std::pair<SkRRect, SkRRect> SkiaGLRenderEngine::getBoundsAndClip(const FloatRect& boundsRect,
-                                                                        const FloatRect& cropRect,
-                                                                        const float cornerRadius) {
-    const SkRect bounds = getSkRect(boundsRect);
-    const SkRect crop = getSkRect(cropRect);
-
-    SkRRect clip;
-    if (cornerRadius > 0) {
-        // it the crop and the bounds are equivalent or there is no crop then we don't need a clip
-        if (bounds == crop || crop.isEmpty()) {
-            return {SkRRect::MakeRectXY(bounds, cornerRadius, cornerRadius), clip};
-        }
-
-        // This makes an effort to speed up common, simple bounds + clip combinations by
-        // converting them to a single RRect draw. It is possible there are other cases
-        // that can be converted.
-        if (crop.contains(bounds)) {
-            bool intersectionIsRoundRect = true;
-            // check each cropped corner to ensure that it exactly matches the crop or is full
-            SkVector radii[4];
-
-            const auto insetCrop = crop.makeInset(cornerRadius, cornerRadius);
-
-            const bool leftEqual = bounds.fLeft == crop.fLeft;
-            const bool topEqual = bounds.fTop == crop.fTop;
-            const bool rightEqual = bounds.fRight == crop.fRight;
-            const bool bottomEqual = bounds.fBottom == crop.fBottom;
-
-            // compute the UpperLeft corner radius
-            if (leftEqual && topEqual) {
-                radii[0].set(cornerRadius, cornerRadius);
-            } else if ((leftEqual && bounds.fTop >= insetCrop.fTop) ||
-                       (topEqual && bounds.fLeft >= insetCrop.fLeft) ||
-                       insetCrop.contains(bounds.fLeft, bounds.fTop)) {
-                radii[0].set(0, 0);
-            } else {
-                intersectionIsRoundRect = false;
-            }
-            // compute the UpperRight corner radius
-            if (rightEqual && topEqual) {
-                radii[1].set(cornerRadius, cornerRadius);
-            } else if ((rightEqual && bounds.fTop >= insetCrop.fTop) ||
-                       (topEqual && bounds.fRight <= insetCrop.fRight) ||
-                       insetCrop.contains(bounds.fRight, bounds.fTop)) {
-                radii[1].set(0, 0);
-            } else {
-                intersectionIsRoundRect = false;
-            }
-            // compute the BottomRight corner radius
-            if (rightEqual && bottomEqual) {
-                radii[2].set(cornerRadius, cornerRadius);
-            } else if ((rightEqual && bounds.fBottom <= insetCrop.fBottom) ||
-                       (bottomEqual && bounds.fRight <= insetCrop.fRight) ||
-                       insetCrop.contains(bounds.fRight, bounds.fBottom)) {
-                radii[2].set(0, 0);
-            } else {
-                intersectionIsRoundRect = false;
-            }
-            // compute the BottomLeft corner radius
-            if (leftEqual && bottomEqual) {
-                radii[3].set(cornerRadius, cornerRadius);
-            } else if ((leftEqual && bounds.fBottom <= insetCrop.fBottom) ||
-                       (bottomEqual && bounds.fLeft >= insetCrop.fLeft) ||
-                       insetCrop.contains(bounds.fLeft, bounds.fBottom)) {
-                radii[3].set(0, 0);
-            } else {
-                intersectionIsRoundRect = false;
-            }
-
-            if (intersectionIsRoundRect) {
-                SkRRect intersectionBounds;
-                intersectionBounds.setRectRadii(bounds, radii);
-                return {intersectionBounds, clip};
-            }
-        }
-
-        // we didn't it any of our fast paths so set the clip to the cropRect
-        clip.setRectXY(crop, cornerRadius, cornerRadius);
-    }
-
-    // if we hit this point then we either don't have rounded corners or we are going to rely
-    // on the clip to round the corners for us
-    return {SkRRect::MakeRect(bounds), clip};
-}
-
-inline bool SkiaGLRenderEngine::layerHasBlur(const LayerSettings* layer,
-                                             bool colorTransformModifiesAlpha) {
-    if (layer->backgroundBlurRadius > 0 || layer->blurRegions.size()) {
-        // return false if the content is opaque and would therefore occlude the blur
-        const bool opaqueContent = !layer->source.buffer.buffer || layer->source.buffer.isOpaque;
-        const bool opaqueAlpha = layer->alpha == 1.0f && !colorTransformModifiesAlpha;
-        return layer->skipContentDraw || !(opaqueContent && opaqueAlpha);
-    }
-    return false;
-}
-
-inline SkColor SkiaGLRenderEngine::getSkColor(const vec4& color) {
-    return SkColorSetARGB(color.a * 255, color.r * 255, color.g * 255, color.b * 255);
-}
-
-inline SkM44 SkiaGLRenderEngine::getSkM44(const mat4& matrix) {
-    return SkM44(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0],
-                 matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1],
-                 matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2],
-                 matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
-}
-
-inline SkPoint3 SkiaGLRenderEngine::getSkPoint3(const vec3& vector) {
-    return SkPoint3::Make(vector.x, vector.y, vector.z);
-}
-
 size_t SkiaGLRenderEngine::getMaxTextureSize() const {
     return mGrContext->maxTextureSize();
 }
@@ -1268,19 +1183,6 @@ size_t SkiaGLRenderEngine::getMaxViewportDims() const {
     return mGrContext->maxRenderTargetSize();
 }
 
-void SkiaGLRenderEngine::drawShadow(SkCanvas* canvas, const SkRRect& casterRRect,
-                                    const ShadowSettings& settings) {
-    ATRACE_CALL();
-    const float casterZ = settings.length / 2.0f;
-    const auto flags =
-            settings.casterIsTranslucent ? kTransparentOccluder_ShadowFlag : kNone_ShadowFlag;
-
-    SkShadowUtils::DrawShadow(canvas, SkPath::RRect(casterRRect), SkPoint3::Make(0, 0, casterZ),
-                              getSkPoint3(settings.lightPos), settings.lightRadius,
-                              getSkColor(settings.ambientColor), getSkColor(settings.spotColor),
-                              flags);
-}
-
 EGLContext SkiaGLRenderEngine::createEglContext(EGLDisplay display, EGLConfig config,
                                                 EGLContext shareContext,
                                                 std::optional<ContextPriority> contextPriority,
@@ -1399,6 +1301,13 @@ int SkiaGLRenderEngine::getContextPriority() {
 }
 
 void SkiaGLRenderEngine::onPrimaryDisplaySizeChanged(ui::Size size) {
+    if (!mHasFixedTextureCacheBudget) {
+        std::lock_guard<std::mutex> lock(mRenderingMutex);
+        mTextureCache.setBudget(static_cast<size_t>(size.width) * size.height *
+                                bytesPerPixel(mDefaultPixelFormat) * kTextureCacheDisplayBuffers);
+        releaseEvictedTextures();
+    }
+
     // This cache multiplier was selected based on review of cache sizes relative
     // to the screen resolution. Looking at the worst case memory needed by blur (~1.5x),
     // shadows (~1x), and general data structures (e.g. vertex buffers) we selected this as a
@@ -1433,6 +1342,25 @@ void SkiaGLRenderEngine::dump(std::string& result) {
     StringAppendF(&result, "RenderEngine is in protected context: %d\n", mInProtectedContext);
     StringAppendF(&result, "RenderEngine shaders cached since last dump/primeCache: %d\n",
                   mSkSLCacheMonitor.shadersCachedSinceLastCall());
+    {
+        std::lock_guard<std::mutex> lock(mRenderingMutex);
+        const ShaderCompileStats& stats = mShaderCompileStats;
+        StringAppendF(&result,
+                      "RenderEngine recorded shaders: %zu (%zu precompiled in %.1f ms, %zu left)\n",
+                      mRecordedShaders.size(), stats.precompiledShaders,
+                      stats.precompileTime / 1e6,
+                      mShadersToPrecompile.size() - mNextShaderToPrecompile);
+        StringAppendF(&result,
+                      "RenderEngine frames compiling shaders: %d of %d (%d of the first %d), "
+                      "%.1f ms total\n",
+                      stats.framesCompilingShaders, stats.frames,
+                      stats.earlyFramesCompilingShaders, kEarlyFrames,
+                      stats.timeInFramesCompilingShaders / 1e6);
+        if (mBlurFilter) {
+            StringAppendF(&result, "RenderEngine blur cache: %zu hits, %zu misses\n",
+                          mBlurFilter->cacheHits(), mBlurFilter->cacheMisses());
+        }
+    }
 
     std::vector<ResourcePair> cpuResourceMap = {
             {"skia/sk_resource_cache/bitmap_", "Bitmaps"},
@@ -1467,17 +1395,24 @@ void SkiaGLRenderEngine::dump(std::string& result) {
         StringAppendF(&result, "RenderEngine tracked buffers: %zu\n",
                       mGraphicBufferExternalRefs.size());
         StringAppendF(&result, "Dumping buffer ids...\n");
-        for (const auto& [id, refCounts] : mGraphicBufferExternalRefs) {
-            StringAppendF(&result, "- 0x%" PRIx64 " - %d refs \n", id, refCounts);
+        for (const auto& [id, refs] : mGraphicBufferExternalRefs) {
+            StringAppendF(&result, "- 0x%" PRIx64 " - %d refs \n", id, refs.count);
         }
-        StringAppendF(&result, "RenderEngine AHB/BackendTexture cache size: %zu\n",
-                      mTextureCache.size());
-        StringAppendF(&result, "Dumping buffer ids...\n");
-        // TODO(178539829): It would be nice to know which layer these are coming from and what
-        // the texture sizes are.
-        for (const auto& [id, unused] : mTextureCache) {
-            StringAppendF(&result, "- 0x%" PRIx64 "\n", id);
+        StringAppendF(&result,
+                      "RenderEngine AHB/BackendTexture cache size: %zu (%.2f of %.2f MB, %zu "
+                      "evictions)\n",
+                      mTextureCache.size(), mTextureCache.bytes() / (1024.0 * 1024.0),
+                      mTextureCache.budget() / (1024.0 * 1024.0), mTextureCache.evictions());
+        StringAppendF(&result, "Dumping usage by owner pid...\n");
+        for (const auto& [pid, usage] : mTextureCache.usageByOwner()) {
+            StringAppendF(&result, "- %d: %zu buffers, %.2f MB\n", pid, usage.buffers,
+                          usage.bytes / (1024.0 * 1024.0));
         }
+        StringAppendF(&result, "Dumping buffer ids, most recently used first...\n");
+        // TODO(178539829): It would be nice to know which layer these are coming from.
+        mTextureCache.forEach([&result](uint64_t id, size_t bytes) {
+            StringAppendF(&result, "- 0x%" PRIx64 " - %zu KB\n", id, bytes / 1024);
+        });
         StringAppendF(&result, "\n");
 
         SkiaMemoryReporter gpuProtectedReporter(gpuResourceMap, true);
@@ -31,6 +31,8 @@
 #include <unordered_map>
 
 #include "AutoBackendTexture.h"
+#include "RecordedShaders.h"
+#include "TextureCache.h"
 #include "EGL/egl.h"
 #include "GrContextOptions.h"
 #include "SkImageInfo.h"
@@ -88,28 +90,25 @@ private:
             const RenderEngineCreationArgs& args);
     static EGLSurface createPlaceholderEglPbufferSurface(EGLDisplay display, EGLConfig config,
                                                          int hwcFormat, Protection protection);
-    inline SkRect getSkRect(const FloatRect& layer);
-    inline SkRect getSkRect(const Rect& layer);
-    inline std::pair<SkRRect, SkRRect> getBoundsAndClip(const FloatRect& bounds,
-                                                        const FloatRect& crop, float cornerRadius);
-    inline bool layerHasBlur(const LayerSettings* layer, bool colorTransformModifiesAlpha);
-    inline SkColor getSkColor(const vec4& color);
-    inline SkM44 getSkM44(const mat4& matrix);
-    inline SkPoint3 getSkPoint3(const vec3& vector);
     inline GrDirectContext* getActiveGrContext() const;
 
     base::unique_fd flush();
     bool waitFence(base::unique_fd fenceFd);
     void initCanvas(SkCanvas* canvas, const DisplaySettings& display);
-    void drawShadow(SkCanvas* canvas, const SkRRect& casterRRect,
-                    const ShadowSettings& shadowSettings);
-    // If requiresLinearEffect is true or the layer has a stretchEffect a new shader is returned.
-    // Otherwise it returns the input shader.
-    sk_sp<SkShader> createRuntimeEffectShader(sk_sp<SkShader> shader,
-                                              const LayerSettings* layer,
-                                              const DisplaySettings& display,
-                                              bool undoPremultipliedAlpha,
-                                              bool requiresLinearEffect);
+    void updateShaderCompileStats(nsecs_t frameStart, int shadersCachedBefore)
+            REQUIRES(mRenderingMutex);
+    bool shouldSaveRecordedShaders() const REQUIRES(mRenderingMutex);
+    // Compiles the next shaders recorded during a previous run, stopping once the deadline has
+    // passed. Needs the unprotected context to be current.
+    void precompileRecordedShaders(nsecs_t deadline) REQUIRES(mRenderingMutex);
+    // Releases the textures evicted from mTextureCache outside of drawLayers.
+    void releaseEvictedTextures() REQUIRES(mRenderingMutex);
+    // Returns the texture for a buffer drawn by the current frame. A buffer that is not cached is
+    // imported for this frame only, unless it is still mapped: then it was only evicted to stay
+    // within the budget, and is cached again.
+    std::shared_ptr<AutoBackendTexture::LocalRef> getTextureForFrame(
+            GrDirectContext* grContext, const sp<GraphicBuffer>& buffer, bool isRenderable)
+            REQUIRES(mRenderingMutex);
 
     EGLDisplay mEGLDisplay;
     EGLContext mEGLContext;
@@ -119,22 +118,28 @@ private:
     BlurFilter* mBlurFilter = nullptr;
 
     const PixelFormat mDefaultPixelFormat;
-    const bool mUseColorManagement;
 
     // Identifier used or various mappings of layers to various
     // textures or shaders
     using GraphicBufferId = uint64_t;
 
-    // Number of external holders of ExternalTexture references, per GraphicBuffer ID.
-    std::unordered_map<GraphicBufferId, int32_t> mGraphicBufferExternalRefs
+    struct ExternalRefs {
+        // Number of external holders of ExternalTexture references.
+        int32_t count = 0;
+        // As passed to the mapExternalTextureBuffer call that first imported the buffer, for
+        // importing it again after it was evicted from mTextureCache.
+        bool isRenderable = false;
+    };
+    std::unordered_map<GraphicBufferId, ExternalRefs> mGraphicBufferExternalRefs
             GUARDED_BY(mRenderingMutex);
     // Cache of GL textures that we'll store per GraphicBuffer ID, shared between GPU contexts.
-    std::unordered_map<GraphicBufferId, std::shared_ptr<AutoBackendTexture::LocalRef>> mTextureCache
-            GUARDED_BY(mRenderingMutex);
-    std::unordered_map<LinearEffect, sk_sp<SkRuntimeEffect>, LinearEffectHasher> mRuntimeEffects;
+    // Textures evicted to stay within the budget are imported again when next drawn.
+    TextureCache<AutoBackendTexture::LocalRef> mTextureCache GUARDED_BY(mRenderingMutex);
+    // Set from PROPERTY_DEBUG_RENDERENGINE_TEXTURE_CACHE_MB; otherwise the budget follows the
+    // primary display size.
+    const bool mHasFixedTextureCacheBudget;
     AutoBackendTexture::CleanupManager mTextureCleanupMgr GUARDED_BY(mRenderingMutex);
 
-    StretchShaderFactory mStretchShaderFactory;
     // Mutex guarding rendering operations, so that:
     // 1. GL operations aren't interleaved, and
     // 2. Internal state related to rendering that is potentially modified by
@@ -153,10 +158,11 @@ private:
     std::unique_ptr<SkiaCapture> mCapture;
 
     // Implements PersistentCache as a way to monitor what SkSL shaders Skia has
-    // cached.
+    // cached, and to record them so that they can be precompiled on the next boot.
     class SkSLCacheMonitor : public GrContextOptions::PersistentCache {
     public:
-        SkSLCacheMonitor() = default;
+        SkSLCacheMonitor(RecordedShaders& recordedShaders, bool recording)
+              : mRecordedShaders(recordedShaders), mRecording(recording) {}
         ~SkSLCacheMonitor() override = default;
 
         sk_sp<SkData> load(const SkData& key) override;
@@ -169,11 +175,44 @@ private:
             return shadersCachedSinceLastCall;
         }
 
+        int totalShadersCached() const { return mTotalShadersCached; }
+
+        // Shaders compiled while priming the cache are covered by Cache already, so they are
+        // not recorded.
+        void setPrimingCache(bool primingCache) { mPrimingCache = primingCache; }
+        bool isPrimingCache() const { return mPrimingCache; }
+
     private:
+        RecordedShaders& mRecordedShaders;
+        const bool mRecording;
         int mShadersCachedSinceLastCall = 0;
+        int mTotalShadersCached = 0;
+        bool mPrimingCache = false;
     };
 
-    SkSLCacheMonitor mSkSLCacheMonitor;
+    // Only set when PROPERTY_DEBUG_RENDERENGINE_SHADER_RECORD_FILE is.
+    const bool mRecordShaders;
+    // Shaders compiled while in use, persisted to be precompiled on the next boot.
+    RecordedShaders mRecordedShaders;
+    nsecs_t mLastRecordedShadersSave GUARDED_BY(mRenderingMutex) = 0;
+    SkSLCacheMonitor mSkSLCacheMonitor{mRecordedShaders, mRecordShaders};
+    // The shaders recorded during the previous run, compiled a few at a time by
+    // cleanupPostRender so that neither boot nor any single frame waits for all of them.
+    std::vector<RecordedShaders::Shader> mShadersToPrecompile GUARDED_BY(mRenderingMutex);
+    size_t mNextShaderToPrecompile GUARDED_BY(mRenderingMutex) = 0;
+
+    // Frames that had to compile shaders outside of primeCache, i.e. the jank that priming the
+    // cache is meant to avoid.
+    struct ShaderCompileStats {
+        int frames = 0;
+        int framesCompilingShaders = 0;
+        // Of those, how many were among the first kEarlyFrames frames.
+        int earlyFramesCompilingShaders = 0;
+        nsecs_t timeInFramesCompilingShaders = 0;
+        size_t precompiledShaders = 0;
+        nsecs_t precompileTime = 0;
+    };
+    ShaderCompileStats mShaderCompileStats GUARDED_BY(mRenderingMutex);
 };
 
 } // namespace skia
@@ -0,0 +1,610 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#undef LOG_TAG
+#define LOG_TAG "RenderEngine"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include "SkiaRasterRenderEngine.h"
+
+#include <SkCanvas.h>
+#include <SkColorFilter.h>
+#include <SkGraphics.h>
+#include <SkPictureRecorder.h>
+#include <SkRegion.h>
+#include <SkShader.h>
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <gui/TraceUtils.h>
+#include <pthread.h>
+#include <ui/DebugUtils.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/PixelFormat.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "ColorSpaces.h"
+#include "log/log_main.h"
+#include "skia/debug/SkiaMemoryReporter.h"
+
+namespace android {
+namespace renderengine {
+namespace skia {
+
+using base::StringAppendF;
+
+namespace {
+// Raster surfaces are only bounded by memory, but keep the limits reported to SurfaceFlinger in
+// line with what a GPU backend would advertise.
+constexpr size_t kMaxRasterDimension = 16384;
+// Rendering is split into a few more tiles than threads so that a thread that finishes an
+// empty band early can pick up work from a busy one.
+constexpr size_t kTilesPerThread = 2;
+constexpr int kMinTileRows = 64;
+constexpr uint32_t kDefaultMaxThreads = 4;
+
+SkColorType toSkColorType(PixelFormat format) {
+    switch (format) {
+        case PIXEL_FORMAT_RGBA_8888:
+            return kRGBA_8888_SkColorType;
+        case PIXEL_FORMAT_RGBX_8888:
+            return kRGB_888x_SkColorType;
+        case PIXEL_FORMAT_BGRA_8888:
+            return kBGRA_8888_SkColorType;
+        case PIXEL_FORMAT_RGB_565:
+            return kRGB_565_SkColorType;
+        case PIXEL_FORMAT_RGBA_FP16:
+            return kRGBA_F16_SkColorType;
+        case PIXEL_FORMAT_RGBA_1010102:
+            return kRGBA_1010102_SkColorType;
+        default:
+            return kUnknown_SkColorType;
+    }
+}
+} // namespace
+
+std::unique_ptr<SkiaRasterRenderEngine> SkiaRasterRenderEngine::create(
+        const RenderEngineCreationArgs& args) {
+    const uint32_t defaultThreads =
+            std::clamp(std::thread::hardware_concurrency(), 1u, kDefaultMaxThreads);
+    const uint32_t threadCount =
+            std::max(base::GetUintProperty(PROPERTY_DEBUG_RENDERENGINE_RASTER_THREADS,
+                                           defaultThreads),
+                     1u);
+    ALOGD("Skia raster rendering on %u threads", threadCount);
+    return std::make_unique<SkiaRasterRenderEngine>(args, threadCount);
+}
+
+SkiaRasterRenderEngine::SkiaRasterRenderEngine(const RenderEngineCreationArgs& args,
+                                               size_t threadCount)
+      : SkiaRenderEngine(args.renderEngineType, args.useColorManagement),
+        mTileWorkers(threadCount) {
+    if (args.supportsBackgroundBlur) {
+        ALOGD("Background Blurs Enabled");
+        mBlurFilter = new BlurFilter();
+    }
+}
+
+SkiaRasterRenderEngine::~SkiaRasterRenderEngine() {
+    if (mBlurFilter) {
+        delete mBlurFilter;
+    }
+}
+
+SkiaRasterRenderEngine::TileWorkers::TileWorkers(size_t threadCount) {
+    for (size_t i = 1; i < threadCount; i++) {
+        mThreads.emplace_back(&TileWorkers::threadMain, this);
+    }
+}
+
+SkiaRasterRenderEngine::TileWorkers::~TileWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExiting = true;
+    }
+    mWorkCondition.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void SkiaRasterRenderEngine::TileWorkers::run(size_t count,
+                                              const std::function<void(size_t)>& job) {
+    if (mThreads.empty() || count <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            job(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJob = &job;
+        mJobCount = count;
+        mNextIndex = 0;
+        mPendingThreads = mThreads.size();
+        mGeneration++;
+    }
+    mWorkCondition.notify_all();
+
+    drain(job, count);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDoneCondition.wait(lock, [this] { return mPendingThreads == 0; });
+    mJob = nullptr;
+}
+
+void SkiaRasterRenderEngine::TileWorkers::drain(const std::function<void(size_t)>& job,
+                                                size_t count) {
+    for (size_t i = mNextIndex++; i < count; i = mNextIndex++) {
+        job(i);
+    }
+}
+
+void SkiaRasterRenderEngine::TileWorkers::threadMain() {
+    pthread_setname_np(pthread_self(), "RasterTile");
+
+    uint64_t seenGeneration = 0;
+    while (true) {
+        const std::function<void(size_t)>* job;
+        size_t count;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWorkCondition.wait(lock, [&] { return mExiting || mGeneration != seenGeneration; });
+            if (mExiting) {
+                return;
+            }
+            seenGeneration = mGeneration;
+            job = mJob;
+            count = mJobCount;
+        }
+
+        drain(*job, count);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mPendingThreads == 0) {
+            mDoneCondition.notify_one();
+        }
+    }
+}
+
+SkiaRasterRenderEngine::LockedBuffer::LockedBuffer(const sp<GraphicBuffer>& buffer,
+                                                   uint32_t usage, base::unique_fd fence)
+      : mBuffer(buffer), mColorType(toSkColorType(buffer->getPixelFormat())) {
+    if (mColorType == kUnknown_SkColorType) {
+        ALOGE("Pixel format %d is not supported by raster composition",
+              buffer->getPixelFormat());
+        return;
+    }
+    // lockAsync takes ownership of the fence and waits for it before mapping the buffer.
+    const status_t err = mBuffer->lockAsync(usage, &mPixels, fence.release());
+    if (err != NO_ERROR) {
+        ALOGE("Failed to lock buffer 0x%" PRIx64 " for CPU access: %d", mBuffer->getId(), err);
+        mPixels = nullptr;
+    }
+}
+
+SkiaRasterRenderEngine::LockedBuffer::~LockedBuffer() {
+    if (mPixels) {
+        mBuffer->unlock();
+    }
+}
+
+SkPixmap SkiaRasterRenderEngine::LockedBuffer::pixmap(SkAlphaType alphaType,
+                                                      sk_sp<SkColorSpace> colorSpace) const {
+    // Match AutoBackendTexture: opaque 8888 content ignores the alpha channel.
+    const SkColorType colorType =
+            alphaType == kOpaque_SkAlphaType && mColorType == kRGBA_8888_SkColorType
+            ? kRGB_888x_SkColorType
+            : mColorType;
+    const SkImageInfo info = SkImageInfo::Make(mBuffer->getWidth(), mBuffer->getHeight(),
+                                               colorType, alphaType, std::move(colorSpace));
+    return SkPixmap(info, mPixels, mBuffer->getStride() * info.bytesPerPixel());
+}
+
+status_t SkiaRasterRenderEngine::drawLayers(const DisplaySettings& display,
+                                            const std::vector<const LayerSettings*>& layers,
+                                            const std::shared_ptr<ExternalTexture>& buffer,
+                                            const bool /*useFramebufferCache*/,
+                                            base::unique_fd&& bufferFence,
+                                            base::unique_fd* drawFence) {
+    ATRACE_NAME("SkiaRaster::drawLayers");
+
+    std::lock_guard<std::mutex> lock(mRenderingMutex);
+    if (layers.empty()) {
+        ALOGV("Drawing empty layer stack");
+        return NO_ERROR;
+    }
+
+    if (buffer == nullptr) {
+        ALOGE("No output buffer provided. Aborting raster composition.");
+        return BAD_VALUE;
+    }
+
+    LockedBuffer dst(buffer->getBuffer(), GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
+                     std::move(bufferFence));
+    if (!dst.isValid()) {
+        ALOGE("Output buffer is not CPU writeable. Aborting raster composition.");
+        return BAD_VALUE;
+    }
+
+    const ui::Dataspace dstDataspace =
+            mUseColorManagement ? display.outputDataspace : ui::Dataspace::V0_SRGB_LINEAR;
+    const SkPixmap dstPixmap = dst.pixmap(kPremul_SkAlphaType, toSkColorSpace(dstDataspace));
+
+    {
+        ATRACE_NAME("LockInputBuffers");
+        for (const auto& layer : layers) {
+            const auto& item = layer->source.buffer;
+            if (!item.buffer) {
+                continue;
+            }
+            const auto& graphicBuffer = item.buffer->getBuffer();
+            if (mLockedBuffers.count(graphicBuffer->getId())) {
+                continue;
+            }
+            base::unique_fd fence(item.fence ? item.fence->dup() : -1);
+            mLockedBuffers.emplace(graphicBuffer->getId(),
+                                   std::make_unique<LockedBuffer>(graphicBuffer,
+                                                                  GRALLOC_USAGE_SW_READ_OFTEN,
+                                                                  std::move(fence)));
+        }
+    }
+
+    // setup color filter if necessary
+    sk_sp<SkColorFilter> displayColorTransform;
+    if (display.colorTransform != mat4()) {
+        displayColorTransform = SkColorFilters::Matrix(toSkColorMatrix(display.colorTransform));
+    }
+    const bool ctModifiesAlpha =
+            displayColorTransform && !displayColorTransform->isAlphaUnchanged();
+
+    // Every layer that blurs what is beneath it starts a new pass, since it needs the output of
+    // all of the layers below it to be complete. A blur on the bottom layer gets an empty first
+    // pass that only clears the buffer.
+    std::vector<size_t> passBoundaries = {0};
+    for (size_t i = 0; i < layers.size(); i++) {
+        if (mBlurFilter && layerHasBlur(layers[i], ctModifiesAlpha)) {
+            passBoundaries.push_back(i);
+        }
+    }
+    passBoundaries.push_back(layers.size());
+
+    for (size_t pass = 0; pass + 1 < passBoundaries.size(); pass++) {
+        sk_sp<SkImage> blurInput;
+        if (pass > 0) {
+            ATRACE_NAME("SnapshotBlurInput");
+            blurInput = SkImage::MakeRasterCopy(dstPixmap);
+        }
+        const sk_sp<SkPicture> picture =
+                recordPass(display, layers, passBoundaries[pass], passBoundaries[pass + 1],
+                           dstPixmap.info(), dstDataspace, displayColorTransform, blurInput);
+        playbackInTiles(picture, dstPixmap);
+    }
+
+    mLockedBuffers.clear();
+
+    // Everything has been written to the buffer by the time we return, so there is nothing for
+    // the caller to wait on.
+    if (drawFence != nullptr) {
+        drawFence->reset();
+    }
+    return NO_ERROR;
+}
+
+sk_sp<SkPicture> SkiaRasterRenderEngine::recordPass(
+        const DisplaySettings& display, const std::vector<const LayerSettings*>& layers,
+        size_t begin, size_t end, const SkImageInfo& dstInfo, ui::Dataspace dstDataspace,
+        sk_sp<SkColorFilter> displayColorTransform, sk_sp<SkImage> blurInput) {
+    ATRACE_NAME("RecordPass");
+    SkPictureRecorder recorder;
+    SkCanvas* canvas = recorder.beginRecording(SkRect::Make(dstInfo.dimensions()));
+
+    SkAutoCanvasRestore surfaceAutoSaveRestore(canvas, true);
+    const bool firstPass = blurInput == nullptr;
+    if (firstPass) {
+        // Clear the entire canvas with a transparent black to prevent ghost images.
+        canvas->clear(SK_ColorTRANSPARENT);
+    }
+    transformCanvasToDisplay(canvas, display);
+
+    if (firstPass && !display.clearRegion.isEmpty()) {
+        ATRACE_NAME("ClearRegion");
+        size_t numRects = 0;
+        Rect const* rects = display.clearRegion.getArray(&numRects);
+        std::vector<SkIRect> skRects(numRects);
+        for (size_t i = 0; i < numRects; ++i) {
+            skRects[i] =
+                    SkIRect::MakeLTRB(rects[i].left, rects[i].top, rects[i].right, rects[i].bottom);
+        }
+        SkRegion clearRegion;
+        SkPaint paint;
+        sk_sp<SkShader> shader =
+                SkShaders::Color(SkColor4f{.fR = 0., .fG = 0., .fB = 0., .fA = 1.0},
+                                 toSkColorSpace(dstDataspace));
+        paint.setShader(shader);
+        clearRegion.setRects(skRects.data(), numRects);
+        canvas->drawRegion(clearRegion, paint);
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        drawLayer(canvas, display, layers[i], dstDataspace, displayColorTransform,
+                  i == begin ? blurInput : nullptr);
+    }
+    surfaceAutoSaveRestore.restore();
+    return recorder.finishRecordingAsPicture();
+}
+
+void SkiaRasterRenderEngine::drawLayer(SkCanvas* canvas, const DisplaySettings& display,
+                                       const LayerSettings* layer, ui::Dataspace dstDataspace,
+                                       const sk_sp<SkColorFilter>& displayColorTransform,
+                                       const sk_sp<SkImage>& blurInput) {
+    ATRACE_FORMAT("DrawLayer: %s", layer->name.c_str());
+
+    SkAutoCanvasRestore layerAutoSaveRestore(canvas, true);
+    // Layers have a local transform that should be applied to them
+    canvas->concat(getSkM44(layer->geometry.positionTransform).asM33());
+
+    const auto [bounds, roundRectClip] =
+            getBoundsAndClip(layer->geometry.boundaries, layer->geometry.roundedCornersCrop,
+                             layer->geometry.roundedCornersRadius);
+    if (blurInput) {
+        std::unordered_map<uint32_t, sk_sp<SkImage>> cachedBlurs;
+
+        // rect to be blurred in the coordinate space of blurInput. The recording canvas covers
+        // the whole buffer, so its matrix maps straight into the snapshot.
+        const auto blurRect = canvas->getTotalMatrix().mapRect(bounds.rect());
+
+        // if the clip needs to be applied then apply it now and make sure
+        // it is restored before we attempt to draw any shadows.
+        SkAutoCanvasRestore acr(canvas, true);
+        if (!roundRectClip.isEmpty()) {
+            canvas->clipRRect(roundRectClip, true);
+        }
+
+        if (blurRect.width() > 0 && blurRect.height() > 0) {
+            if (layer->backgroundBlurRadius > 0) {
+                ATRACE_NAME("BackgroundBlur");
+                auto blurredImage = mBlurFilter->generate(nullptr, layer->backgroundBlurRadius,
+                                                          blurInput, blurRect);
+
+                cachedBlurs[layer->backgroundBlurRadius] = blurredImage;
+
+                mBlurFilter->drawBlurRegion(canvas, bounds, layer->backgroundBlurRadius, 1.0f,
+                                            blurRect, blurredImage, blurInput);
+            }
+
+            canvas->concat(getSkM44(layer->blurRegionTransform).asM33());
+            for (auto region : layer->blurRegions) {
+                if (cachedBlurs[region.blurRadius] == nullptr) {
+                    ATRACE_NAME("BlurRegion");
+                    cachedBlurs[region.blurRadius] =
+                            mBlurFilter->generate(nullptr, region.blurRadius, blurInput, blurRect);
+                }
+
+                mBlurFilter->drawBlurRegion(canvas, getBlurRRect(region), region.blurRadius,
+                                            region.alpha, blurRect, cachedBlurs[region.blurRadius],
+                                            blurInput);
+            }
+        }
+    }
+
+    if (layer->shadow.length > 0) {
+        // This would require a new parameter/flag to SkShadowUtils::DrawShadow
+        LOG_ALWAYS_FATAL_IF(layer->disableBlending, "Cannot disableBlending with a shadow");
+
+        SkRRect shadowBounds, shadowClip;
+        if (layer->geometry.boundaries == layer->shadow.boundaries) {
+            shadowBounds = bounds;
+            shadowClip = roundRectClip;
+        } else {
+            std::tie(shadowBounds, shadowClip) =
+                    getBoundsAndClip(layer->shadow.boundaries, layer->geometry.roundedCornersCrop,
+                                     layer->geometry.roundedCornersRadius);
+        }
+
+        // See SkiaGLRenderEngine::drawLayers: prefer the rounded version when the bounds and the
+        // crop only differ by rounding errors.
+        const auto& rrect =
+                shadowBounds.isRect() && !shadowClip.isEmpty() ? shadowClip : shadowBounds;
+        drawShadow(canvas, rrect, layer->shadow);
+    }
+
+    const bool requiresLinearEffect = layer->colorTransform != mat4() ||
+            (mUseColorManagement &&
+             needsToneMapping(layer->sourceDataspace, display.outputDataspace)) ||
+            (display.sdrWhitePointNits > 0.f && display.sdrWhitePointNits != display.maxLuminance);
+
+    // quick abort from drawing the remaining portion of the layer
+    if (layer->skipContentDraw ||
+        (layer->alpha == 0 && !requiresLinearEffect && !layer->disableBlending &&
+         (!displayColorTransform || displayColorTransform->isAlphaUnchanged()))) {
+        return;
+    }
+
+    // If we need to map to linear space or color management is disabled, then mark the source
+    // image with the same colorspace as the destination surface so that Skia's color
+    // management is a no-op.
+    const ui::Dataspace layerDataspace =
+            (!mUseColorManagement || requiresLinearEffect) ? dstDataspace : layer->sourceDataspace;
+
+    SkPaint paint;
+    if (layer->source.buffer.buffer) {
+        ATRACE_NAME("DrawImage");
+        const auto& item = layer->source.buffer;
+        const auto iter = mLockedBuffers.find(item.buffer->getBuffer()->getId());
+        if (iter == mLockedBuffers.end() || !iter->second->isValid()) {
+            ALOGE("Skipping layer %s: its buffer is not CPU readable", layer->name.c_str());
+            return;
+        }
+        const LockedBuffer& source = *iter->second;
+
+        // See SkiaGLRenderEngine::drawLayers for why 1010102 and F16 need this workaround to
+        // honor isOpaque.
+        const bool useIsOpaqueWorkaround = item.isOpaque &&
+                (source.colorType() == kRGBA_1010102_SkColorType ||
+                 source.colorType() == kRGBA_F16_SkColorType);
+        const auto alphaType = useIsOpaqueWorkaround ? kPremul_SkAlphaType
+                : item.isOpaque                      ? kOpaque_SkAlphaType
+                : item.usePremultipliedAlpha         ? kPremul_SkAlphaType
+                                                     : kUnpremul_SkAlphaType;
+        // The image aliases the locked pixels, which stay mapped until the frame is finished.
+        sk_sp<SkImage> image =
+                SkImage::MakeFromRaster(source.pixmap(alphaType, toSkColorSpace(layerDataspace)),
+                                        nullptr, nullptr);
+
+        auto texMatrix = getSkM44(item.textureTransform).asM33();
+        // textureTansform was intended to be passed directly into a shader, so when
+        // building the total matrix with the textureTransform we need to first
+        // normalize it, then apply the textureTransform, then scale back up.
+        texMatrix.preScale(1.0f / bounds.width(), 1.0f / bounds.height());
+        texMatrix.postScale(image->width(), image->height());
+
+        SkMatrix matrix;
+        if (!texMatrix.invert(&matrix)) {
+            matrix = texMatrix;
+        }
+        // The shader does not respect the translation, so we add it to the texture
+        // transform for the SkImage. This will make sure that the correct layer contents
+        // are drawn in the correct part of the screen.
+        matrix.postTranslate(bounds.rect().fLeft, bounds.rect().fTop);
+
+        sk_sp<SkShader> shader;
+
+        if (layer->source.buffer.useTextureFiltering) {
+            shader = image->makeShader(SkTileMode::kClamp, SkTileMode::kClamp,
+                                       SkSamplingOptions(
+                                               {SkFilterMode::kLinear, SkMipmapMode::kNone}),
+                                       &matrix);
+        } else {
+            shader = image->makeShader(SkSamplingOptions(), matrix);
+        }
+
+        if (useIsOpaqueWorkaround) {
+            shader = SkShaders::Blend(SkBlendMode::kPlus, shader,
+                                      SkShaders::Color(SkColors::kBlack,
+                                                       toSkColorSpace(layerDataspace)));
+        }
+
+        paint.setShader(createRuntimeEffectShader(shader, layer, display,
+                                                  !item.isOpaque && item.usePremultipliedAlpha,
+                                                  requiresLinearEffect));
+        paint.setAlphaf(layer->alpha);
+    } else {
+        ATRACE_NAME("DrawColor");
+        const auto color = layer->source.solidColor;
+        sk_sp<SkShader> shader = SkShaders::Color(SkColor4f{.fR = color.r,
+                                                            .fG = color.g,
+                                                            .fB = color.b,
+                                                            .fA = layer->alpha},
+                                                  toSkColorSpace(layerDataspace));
+        paint.setShader(createRuntimeEffectShader(shader, layer, display,
+                                                  /* undoPremultipliedAlpha */ false,
+                                                  requiresLinearEffect));
+    }
+
+    if (layer->disableBlending) {
+        paint.setBlendMode(SkBlendMode::kSrc);
+    }
+
+    paint.setColorFilter(displayColorTransform);
+
+    if (!roundRectClip.isEmpty()) {
+        canvas->clipRRect(roundRectClip, true);
+    }
+
+    if (!bounds.isRect()) {
+        paint.setAntiAlias(true);
+        canvas->drawRRect(bounds, paint);
+    } else {
+        canvas->drawRect(bounds.rect(), paint);
+    }
+}
+
+void SkiaRasterRenderEngine::playbackInTiles(const sk_sp<SkPicture>& picture,
+                                             const SkPixmap& dst) {
+    ATRACE_NAME("PlaybackTiles");
+    const int height = dst.height();
+    const size_t tileCount = std::clamp<size_t>(height / kMinTileRows, 1,
+                                                mTileWorkers.threadCount() * kTilesPerThread);
+    const int rowsPerTile = (height + tileCount - 1) / tileCount;
+
+    mTileWorkers.run(tileCount, [&](size_t tile) {
+        const int top = static_cast<int>(tile) * rowsPerTile;
+        const int bottom = std::min(height, top + rowsPerTile);
+        if (top >= bottom) {
+            return;
+        }
+        // Each tile draws into its own band of rows, so the tiles never touch the same pixels.
+        std::unique_ptr<SkCanvas> canvas =
+                SkCanvas::MakeRasterDirect(dst.info().makeWH(dst.width(), bottom - top),
+                                           dst.writable_addr(0, top), dst.rowBytes());
+        canvas->translate(0, -top);
+        picture->playback(canvas.get());
+    });
+}
+
+size_t SkiaRasterRenderEngine::getMaxTextureSize() const {
+    return kMaxRasterDimension;
+}
+
+size_t SkiaRasterRenderEngine::getMaxViewportDims() const {
+    return kMaxRasterDimension;
+}
+
+void SkiaRasterRenderEngine::dump(std::string& result) {
+    StringAppendF(&result, "\n ------------RE-----------------\n");
+    StringAppendF(&result, "Skia raster RenderEngine, tile threads: %zu\n",
+                  mTileWorkers.threadCount());
+
+    std::vector<ResourcePair> cpuResourceMap = {
+            {"skia/sk_resource_cache/bitmap_", "Bitmaps"},
+            {"skia/sk_resource_cache/rrect-blur_", "Masks"},
+            {"skia/sk_resource_cache/rects-blur_", "Masks"},
+            {"skia/sk_resource_cache/tessellated", "Shadows"},
+            {"skia", "Other"},
+    };
+    SkiaMemoryReporter cpuReporter(cpuResourceMap, false);
+    SkGraphics::DumpMemoryStatistics(&cpuReporter);
+    StringAppendF(&result, "Skia CPU Caches: ");
+    cpuReporter.logTotals(result);
+    cpuReporter.logOutput(result);
+
+    {
+        std::lock_guard<std::mutex> lock(mRenderingMutex);
+        StringAppendF(&result, "RenderEngine runtime effects: %zu\n", mRuntimeEffects.size());
+        for (const auto& [linearEffect, unused] : mRuntimeEffects) {
+            StringAppendF(&result, "- inputDataspace: %s\n",
+                          dataspaceDetails(
+                                  static_cast<android_dataspace>(linearEffect.inputDataspace))
+                                  .c_str());
+            StringAppendF(&result, "- outputDataspace: %s\n",
+                          dataspaceDetails(
+                                  static_cast<android_dataspace>(linearEffect.outputDataspace))
+                                  .c_str());
+            StringAppendF(&result, "undoPremultipliedAlpha: %s\n",
+                          linearEffect.undoPremultipliedAlpha ? "true" : "false");
+        }
+    }
+    StringAppendF(&result, "\n");
+}
+
+} // namespace skia
+} // namespace renderengine
+} // namespace android
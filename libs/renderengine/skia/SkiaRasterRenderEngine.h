@@ -0,0 +1,159 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SF_SKIARASTERRENDERENGINE_H_
+#define SF_SKIARASTERRENDERENGINE_H_
+
+#include <SkColorFilter.h>
+#include <SkImage.h>
+#include <SkPicture.h>
+#include <SkPixmap.h>
+#include <android-base/macros.h>
+#include <android-base/thread_annotations.h>
+#include <renderengine/ExternalTexture.h>
+#include <renderengine/RenderEngine.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "SkiaRenderEngine.h"
+#include "filters/BlurFilter.h"
+
+namespace android {
+namespace renderengine {
+namespace skia {
+
+// RenderEngine backend that composites on the CPU with Skia's raster backend, for devices and
+// test hosts without a usable GPU. Buffers are locked for CPU access rather than imported as
+// textures, so they must be allocated with the SW_READ/SW_WRITE usage bits.
+//
+// Each frame is split into passes at the layers that blur what is beneath them. A pass is
+// recorded once into an SkPicture and then played back into horizontal tiles of the output
+// buffer in parallel; blurs are generated between passes from the pixels drawn so far.
+class SkiaRasterRenderEngine : public skia::SkiaRenderEngine {
+public:
+    static std::unique_ptr<SkiaRasterRenderEngine> create(const RenderEngineCreationArgs& args);
+    SkiaRasterRenderEngine(const RenderEngineCreationArgs& args, size_t threadCount);
+    ~SkiaRasterRenderEngine() override;
+
+    status_t drawLayers(const DisplaySettings& display,
+                        const std::vector<const LayerSettings*>& layers,
+                        const std::shared_ptr<ExternalTexture>& buffer,
+                        const bool useFramebufferCache, base::unique_fd&& bufferFence,
+                        base::unique_fd* drawFence) override;
+    void cleanupPostRender() override {}
+    void cleanFramebufferCache() override {}
+    void useProtectedContext(bool /*useProtectedContext*/) override {}
+    bool supportsBackgroundBlur() override { return mBlurFilter != nullptr; }
+    void onPrimaryDisplaySizeChanged(ui::Size /*size*/) override {}
+
+protected:
+    void dump(std::string& result) override;
+    size_t getMaxTextureSize() const override;
+    size_t getMaxViewportDims() const override;
+    // Buffers are locked per frame, so there is nothing to map ahead of time.
+    void mapExternalTextureBuffer(const sp<GraphicBuffer>& /*buffer*/,
+                                  bool /*isRenderable*/) override {}
+    void unmapExternalTextureBuffer(const sp<GraphicBuffer>& /*buffer*/) override {}
+    bool canSkipPostRenderCleanup() const override { return true; }
+
+private:
+    // Runs a batch of tile jobs on a fixed set of worker threads plus the calling thread.
+    class TileWorkers {
+    public:
+        explicit TileWorkers(size_t threadCount);
+        ~TileWorkers();
+
+        // Calls job(i) for every i in [0, count) and returns once all calls have finished.
+        void run(size_t count, const std::function<void(size_t)>& job);
+        size_t threadCount() const { return mThreads.size() + 1; }
+
+    private:
+        void threadMain();
+        void drain(const std::function<void(size_t)>& job, size_t count);
+
+        std::mutex mMutex;
+        std::condition_variable mWorkCondition;
+        std::condition_variable mDoneCondition;
+        // The current job, guarded by mMutex. Each worker joins a job once, when it sees
+        // mGeneration change, and run() waits until every worker has left it again.
+        const std::function<void(size_t)>* mJob = nullptr;
+        size_t mJobCount = 0;
+        uint64_t mGeneration = 0;
+        size_t mPendingThreads = 0;
+        bool mExiting = false;
+        // Next job index to hand out; shared lock-free between the threads working on a job.
+        std::atomic<size_t> mNextIndex = 0;
+        std::vector<std::thread> mThreads;
+    };
+
+    // A GraphicBuffer locked for CPU access for the duration of one drawLayers call.
+    class LockedBuffer {
+    public:
+        LockedBuffer(const sp<GraphicBuffer>& buffer, uint32_t usage, base::unique_fd fence);
+        ~LockedBuffer();
+
+        bool isValid() const { return mPixels != nullptr && mColorType != kUnknown_SkColorType; }
+        SkColorType colorType() const { return mColorType; }
+        SkPixmap pixmap(SkAlphaType alphaType, sk_sp<SkColorSpace> colorSpace) const;
+
+    private:
+        DISALLOW_COPY_AND_ASSIGN(LockedBuffer);
+        const sp<GraphicBuffer> mBuffer;
+        void* mPixels = nullptr;
+        SkColorType mColorType = kUnknown_SkColorType;
+    };
+
+    // Records layers [begin, end) into a picture covering the whole output buffer. The first pass
+    // has no blurInput and also clears the buffer; every later pass starts with a layer that
+    // blurs blurInput, a snapshot of the buffer after the previous passes.
+    sk_sp<SkPicture> recordPass(const DisplaySettings& display,
+                                const std::vector<const LayerSettings*>& layers, size_t begin,
+                                size_t end, const SkImageInfo& dstInfo, ui::Dataspace dstDataspace,
+                                sk_sp<SkColorFilter> displayColorTransform,
+                                sk_sp<SkImage> blurInput) REQUIRES(mRenderingMutex);
+    void drawLayer(SkCanvas* canvas, const DisplaySettings& display, const LayerSettings* layer,
+                   ui::Dataspace dstDataspace, const sk_sp<SkColorFilter>& displayColorTransform,
+                   const sk_sp<SkImage>& blurInput) REQUIRES(mRenderingMutex);
+    // Plays the picture back into the output pixels, one horizontal band per tile job.
+    void playbackInTiles(const sk_sp<SkPicture>& picture, const SkPixmap& dst)
+            REQUIRES(mRenderingMutex);
+
+    BlurFilter* mBlurFilter = nullptr;
+
+    // Mutex guarding rendering operations, so that the runtime effect cache and the locked
+    // buffers of a frame aren't touched by concurrent drawLayers calls.
+    mutable std::mutex mRenderingMutex;
+
+    // Input buffers locked for the frame currently being drawn, keyed by GraphicBuffer ID.
+    std::unordered_map<uint64_t, std::unique_ptr<LockedBuffer>> mLockedBuffers
+            GUARDED_BY(mRenderingMutex);
+
+    TileWorkers mTileWorkers;
+};
+
+} // namespace skia
+} // namespace renderengine
+} // namespace android
+
+#endif /* SF_SKIARASTERRENDERENGINE_H_ */
@@ -17,9 +17,20 @@
 #ifndef SF_SKIARENDERENGINE_H_
 #define SF_SKIARENDERENGINE_H_
 
+#include <SkCanvas.h>
+#include <SkColorMatrix.h>
+#include <SkM44.h>
+#include <SkPoint3.h>
+#include <SkRRect.h>
+#include <SkShader.h>
 #include <renderengine/RenderEngine.h>
 #include <sys/types.h>
 
+#include <unordered_map>
+
+#include "filters/LinearEffect.h"
+#include "filters/StretchShaderFactory.h"
+
 namespace android {
 
 namespace renderengine {
@@ -31,12 +42,12 @@ namespace skia {
 
 class BlurFilter;
 
-// TODO: Put common skia stuff here that can be shared between the GL & Vulkan backends
-// Currently mostly just handles all the no-op / missing APIs
+// Common skia code shared between the GL & raster backends: the no-op / missing APIs, plus the
+// helpers that turn DisplaySettings and LayerSettings into SkCanvas state and shaders.
 class SkiaRenderEngine : public RenderEngine {
 public:
     static std::unique_ptr<SkiaRenderEngine> create(const RenderEngineCreationArgs& args);
-    SkiaRenderEngine(RenderEngineType type);
+    SkiaRenderEngine(RenderEngineType type, bool useColorManagement);
     ~SkiaRenderEngine() override {}
 
     virtual std::future<void> primeCache() override { return {}; };
@@ -60,6 +71,36 @@ protected:
     virtual void mapExternalTextureBuffer(const sp<GraphicBuffer>& /*buffer*/,
                                           bool /*isRenderable*/) override = 0;
     virtual void unmapExternalTextureBuffer(const sp<GraphicBuffer>& /*buffer*/) override = 0;
+
+    static float toDegrees(uint32_t transform);
+    static SkColorMatrix toSkColorMatrix(const mat4& matrix);
+    static bool needsToneMapping(ui::Dataspace sourceDataspace, ui::Dataspace destinationDataspace);
+    static SkRRect getBlurRRect(const BlurRegion& region);
+    static SkRect getSkRect(const FloatRect& layer);
+    static SkRect getSkRect(const Rect& layer);
+    static std::pair<SkRRect, SkRRect> getBoundsAndClip(const FloatRect& bounds,
+                                                        const FloatRect& crop, float cornerRadius);
+    static bool layerHasBlur(const LayerSettings* layer, bool colorTransformModifiesAlpha);
+    static SkColor getSkColor(const vec4& color);
+    static SkM44 getSkM44(const mat4& matrix);
+    static SkPoint3 getSkPoint3(const vec3& vector);
+    static void drawShadow(SkCanvas* canvas, const SkRRect& casterRRect,
+                           const ShadowSettings& shadowSettings);
+    // Maps the canvas from the layer stack space given by display.clip onto the physical display,
+    // applying the display's offset, scale and orientation.
+    static void transformCanvasToDisplay(SkCanvas* canvas, const DisplaySettings& display);
+
+    // If requiresLinearEffect is true or the layer has a stretchEffect a new shader is returned.
+    // Otherwise it returns the input shader.
+    sk_sp<SkShader> createRuntimeEffectShader(sk_sp<SkShader> shader,
+                                              const LayerSettings* layer,
+                                              const DisplaySettings& display,
+                                              bool undoPremultipliedAlpha,
+                                              bool requiresLinearEffect);
+
+    const bool mUseColorManagement;
+    std::unordered_map<LinearEffect, sk_sp<SkRuntimeEffect>, LinearEffectHasher> mRuntimeEffects;
+    StretchShaderFactory mStretchShaderFactory;
 };
 
 } // namespace skia
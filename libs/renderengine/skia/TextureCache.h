@@ -0,0 +1,175 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace renderengine {
+namespace skia {
+
+/**
+ * Byte-budgeted LRU cache of imported buffer textures, keyed by GraphicBuffer ID.
+ *
+ * Entries used since the last startFrame() are never evicted, so that textures in the frame
+ * being drawn stay cached even if that takes the cache over budget. Byte counts are also kept
+ * per owner, i.e. the pid that allocated the buffer, which GraphicBuffer encodes in the upper
+ * 32 bits of the ID.
+ *
+ * Evicted textures aren't released by the cache, since whatever GPU context happens to be current
+ * at that point may not be the right one to free them in. They are held until the caller takes
+ * them with takeEvicted().
+ *
+ * Not thread-safe; callers provide their own locking.
+ */
+template <typename Texture>
+class TextureCache {
+public:
+    using Id = uint64_t;
+
+    struct OwnerUsage {
+        size_t buffers = 0;
+        size_t bytes = 0;
+    };
+
+    explicit TextureCache(size_t budgetBytes) : mBudgetBytes(budgetBytes) {}
+
+    // Returns the cached texture and marks it as used in the current frame, or returns nullptr.
+    std::shared_ptr<Texture> get(Id id) {
+        const auto it = mEntries.find(id);
+        if (it == mEntries.end()) {
+            return nullptr;
+        }
+        it->second->lastUsedFrame = mFrame;
+        mLru.splice(mLru.begin(), mLru, it->second);
+        return it->second->texture;
+    }
+
+    bool contains(Id id) const { return mEntries.count(id) != 0; }
+
+    // Adds a texture as the most recently used entry, then evicts down to the budget. Only
+    // textures the current frame draws with should be marked usedInFrame; anything else, such as
+    // buffers mapped ahead of time, remains evictable.
+    void insert(Id id, std::shared_ptr<Texture> texture, size_t bytes, bool usedInFrame) {
+        erase(id);
+        mLru.push_front(Entry{id, std::move(texture), bytes, usedInFrame ? mFrame : kNeverUsed});
+        mEntries[id] = mLru.begin();
+        account(id, bytes, true);
+        evictToBudget();
+    }
+
+    void erase(Id id) {
+        if (const auto it = mEntries.find(id); it != mEntries.end()) {
+            account(id, it->second->bytes, false);
+            mLru.erase(it->second);
+            mEntries.erase(it);
+        }
+    }
+
+    // Starts a new frame: entries used in earlier frames become evictable.
+    void startFrame() {
+        mFrame++;
+        evictToBudget();
+    }
+
+    void setBudget(size_t budgetBytes) {
+        mBudgetBytes = budgetBytes;
+        evictToBudget();
+    }
+
+    size_t size() const { return mEntries.size(); }
+    size_t bytes() const { return mBytes; }
+    size_t budget() const { return mBudgetBytes; }
+    size_t evictions() const { return mEvictions; }
+    const std::unordered_map<pid_t, OwnerUsage>& usageByOwner() const { return mOwners; }
+
+    // Calls f(id, bytes) for every entry, most recently used first.
+    template <typename F>
+    void forEach(F f) const {
+        for (const Entry& entry : mLru) {
+            f(entry.id, entry.bytes);
+        }
+    }
+
+    // Returns the textures evicted since the last call, handing over their release to the caller.
+    std::vector<std::shared_ptr<Texture>> takeEvicted() { return std::exchange(mEvicted, {}); }
+
+    static pid_t ownerOf(Id id) { return static_cast<pid_t>(id >> 32); }
+
+private:
+    struct Entry {
+        Id id;
+        std::shared_ptr<Texture> texture;
+        size_t bytes;
+        uint64_t lastUsedFrame;
+    };
+
+    void account(Id id, size_t bytes, bool added) {
+        OwnerUsage& owner = mOwners[ownerOf(id)];
+        if (added) {
+            mBytes += bytes;
+            owner.buffers++;
+            owner.bytes += bytes;
+        } else {
+            mBytes -= bytes;
+            owner.buffers--;
+            owner.bytes -= bytes;
+            if (owner.buffers == 0) {
+                mOwners.erase(ownerOf(id));
+            }
+        }
+    }
+
+    void evictToBudget() {
+        // Walk from the least recently used end, skipping the entries of the current frame.
+        auto it = mLru.end();
+        while (mBytes > mBudgetBytes && it != mLru.begin()) {
+            --it;
+            if (it->lastUsedFrame == mFrame) {
+                continue;
+            }
+            account(it->id, it->bytes, false);
+            mEntries.erase(it->id);
+            mEvicted.push_back(std::move(it->texture));
+            it = mLru.erase(it);
+            mEvictions++;
+        }
+    }
+
+    static constexpr uint64_t kNeverUsed = UINT64_MAX;
+
+    size_t mBudgetBytes;
+    size_t mBytes = 0;
+    size_t mEvictions = 0;
+    uint64_t mFrame = 0;
+    // Most recently used first.
+    std::list<Entry> mLru;
+    std::unordered_map<Id, typename std::list<Entry>::iterator> mEntries;
+    std::unordered_map<pid_t, OwnerUsage> mOwners;
+    std::vector<std::shared_ptr<Texture>> mEvicted;
+};
+
+} // namespace skia
+} // namespace renderengine
+} // namespace android
@@ -28,6 +28,8 @@
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
+
 namespace android {
 namespace renderengine {
 namespace skia {
@@ -123,6 +125,111 @@ sk_sp<SkImage> BlurFilter::generate(GrRecordingContext* context, const uint32_t
     return tmpBlur;
 }
 
+BlurFilter::BackdropLayer BlurFilter::makeBackdropLayer(const LayerSettings& layer) {
+    BackdropLayer backdropLayer{.settings = layer,
+                                .buffer = layer.source.buffer.buffer,
+                                .hasBuffer = layer.source.buffer.buffer != nullptr};
+    backdropLayer.settings.source.buffer.buffer = nullptr;
+    return backdropLayer;
+}
+
+// Keep in sync with operator== in LayerSettings.h
+bool BlurFilter::layerMatches(const LayerSettings& cached, const LayerSettings& layer) {
+    const Buffer& lhs = cached.source.buffer;
+    const Buffer& rhs = layer.source.buffer;
+    return lhs.fence == rhs.fence && lhs.textureName == rhs.textureName &&
+            lhs.useTextureFiltering == rhs.useTextureFiltering &&
+            lhs.textureTransform == rhs.textureTransform &&
+            lhs.usePremultipliedAlpha == rhs.usePremultipliedAlpha &&
+            lhs.isOpaque == rhs.isOpaque && lhs.isY410BT2020 == rhs.isY410BT2020 &&
+            lhs.maxLuminanceNits == rhs.maxLuminanceNits &&
+            cached.source.solidColor == layer.source.solidColor &&
+            cached.geometry == layer.geometry && cached.alpha == layer.alpha &&
+            cached.sourceDataspace == layer.sourceDataspace &&
+            cached.colorTransform == layer.colorTransform &&
+            cached.disableBlending == layer.disableBlending &&
+            cached.skipContentDraw == layer.skipContentDraw && cached.shadow == layer.shadow &&
+            cached.backgroundBlurRadius == layer.backgroundBlurRadius &&
+            cached.blurRegions == layer.blurRegions &&
+            cached.blurRegionTransform == layer.blurRegionTransform &&
+            cached.stretchEffect == layer.stretchEffect;
+}
+
+bool BlurFilter::backdropMatches(const std::vector<BackdropLayer>& backdrop,
+                                 const std::vector<const LayerSettings*>& layers,
+                                 size_t layerIndex) {
+    if (backdrop.size() != layerIndex) {
+        return false;
+    }
+    for (size_t i = 0; i < layerIndex; i++) {
+        const BackdropLayer& cached = backdrop[i];
+        const LayerSettings& layer = *layers[i];
+        const std::shared_ptr<ExternalTexture>& buffer = layer.source.buffer.buffer;
+        if (cached.hasBuffer != (buffer != nullptr) ||
+            (buffer != nullptr && cached.buffer.lock() != buffer)) {
+            return false;
+        }
+        if (!layerMatches(cached.settings, layer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+sk_sp<SkImage> BlurFilter::generateCached(GrRecordingContext* context, const uint32_t blurRadius,
+                                          const sk_sp<SkImage> input, const SkRect& blurRect,
+                                          const DisplaySettings& display,
+                                          const std::vector<const LayerSettings*>& layers,
+                                          size_t layerIndex) {
+    for (CachedBlur& cached : mCachedBlurs) {
+        if (cached.context == context && cached.radius == blurRadius &&
+            cached.blurRect == blurRect && cached.inputInfo == input->imageInfo() &&
+            cached.display == display && backdropMatches(cached.backdrop, layers, layerIndex)) {
+            ATRACE_NAME("BlurFilter::cacheHit");
+            cached.lastUsedFrame = mFrame;
+            mCacheHits++;
+            return cached.image;
+        }
+    }
+
+    mCacheMisses++;
+    sk_sp<SkImage> image = generate(context, blurRadius, input, blurRect);
+
+    if (mCachedBlurs.size() >= kMaxCachedBlurs) {
+        const auto leastRecentlyUsed =
+                std::min_element(mCachedBlurs.begin(), mCachedBlurs.end(),
+                                 [](const CachedBlur& lhs, const CachedBlur& rhs) {
+                                     return lhs.lastUsedFrame < rhs.lastUsedFrame;
+                                 });
+        mCachedBlurs.erase(leastRecentlyUsed);
+    }
+    std::vector<BackdropLayer> backdrop;
+    backdrop.reserve(layerIndex);
+    for (size_t i = 0; i < layerIndex; i++) {
+        backdrop.push_back(makeBackdropLayer(*layers[i]));
+    }
+    mCachedBlurs.push_back(CachedBlur{
+            .context = context,
+            .radius = blurRadius,
+            .blurRect = blurRect,
+            .inputInfo = input->imageInfo(),
+            .display = display,
+            .backdrop = std::move(backdrop),
+            .image = image,
+            .lastUsedFrame = mFrame,
+    });
+    return image;
+}
+
+void BlurFilter::startFrame() {
+    mFrame++;
+    mCachedBlurs.erase(std::remove_if(mCachedBlurs.begin(), mCachedBlurs.end(),
+                                      [this](const CachedBlur& cached) {
+                                          return mFrame - cached.lastUsedFrame > kMaxUnusedFrames;
+                                      }),
+                       mCachedBlurs.end());
+}
+
 static SkMatrix getShaderTransform(const SkCanvas* canvas, const SkRect& blurRect, float scale) {
     // 1. Apply the blur shader matrix, which scales up the blured surface to its real size
     auto matrix = SkMatrix::Scale(scale, scale);
@@ -20,6 +20,12 @@
 #include <SkImage.h>
 #include <SkRuntimeEffect.h>
 #include <SkSurface.h>
+#include <renderengine/DisplaySettings.h>
+#include <renderengine/ExternalTexture.h>
+#include <renderengine/LayerSettings.h>
+
+#include <memory>
+#include <vector>
 
 using namespace std;
 
@@ -47,10 +53,34 @@ public:
     explicit BlurFilter();
     virtual ~BlurFilter(){};
 
+    // Maximum number of blurred images kept across frames
+    static constexpr size_t kMaxCachedBlurs = 8;
+    // Cached blurs not used for this many frames are dropped
+    static constexpr uint64_t kMaxUnusedFrames = 4;
+
     // Execute blur, saving it to a texture
     sk_sp<SkImage> generate(GrRecordingContext* context, const uint32_t radius,
                             const sk_sp<SkImage> blurInput, const SkRect& blurRect) const;
 
+    /**
+     * Same as generate(), but reuses the image generated in an earlier frame if nothing that
+     * went into it changed. The blur input is described by the display and by layers
+     * [0, layerIndex), i.e. everything drawn beneath layers[layerIndex]; layers are compared by
+     * value, and buffers by ExternalTexture and acquire fence, as ClientCompositionRequestCache
+     * does.
+     */
+    sk_sp<SkImage> generateCached(GrRecordingContext* context, const uint32_t radius,
+                                  const sk_sp<SkImage> blurInput, const SkRect& blurRect,
+                                  const DisplaySettings& display,
+                                  const std::vector<const LayerSettings*>& layers,
+                                  size_t layerIndex);
+
+    // Starts a new frame for the purpose of aging out cached blurs.
+    void startFrame();
+
+    size_t cacheHits() const { return mCacheHits; }
+    size_t cacheMisses() const { return mCacheMisses; }
+
     /**
      * Draw the blurred content (from the generate method) into the canvas.
      * @param canvas is the destination/output for the blur
@@ -66,8 +96,40 @@ public:
                         sk_sp<SkImage> input);
 
 private:
+    // A layer beneath a cached blur. The buffer is only weakly referenced, so that the cache
+    // doesn't keep buffers alive that would otherwise have been released.
+    struct BackdropLayer {
+        // Copy of the layer with source.buffer.buffer cleared.
+        LayerSettings settings;
+        std::weak_ptr<ExternalTexture> buffer;
+        bool hasBuffer = false;
+    };
+
+    struct CachedBlur {
+        GrRecordingContext* context;
+        uint32_t radius;
+        SkRect blurRect;
+        SkImageInfo inputInfo;
+        DisplaySettings display;
+        std::vector<BackdropLayer> backdrop;
+        sk_sp<SkImage> image;
+        uint64_t lastUsedFrame;
+    };
+
+    static BackdropLayer makeBackdropLayer(const LayerSettings& layer);
+    // Compares everything but source.buffer.buffer.
+    static bool layerMatches(const LayerSettings& cached, const LayerSettings& layer);
+    static bool backdropMatches(const std::vector<BackdropLayer>& backdrop,
+                                const std::vector<const LayerSettings*>& layers,
+                                size_t layerIndex);
+
     sk_sp<SkRuntimeEffect> mBlurEffect;
     sk_sp<SkRuntimeEffect> mMixEffect;
+
+    std::vector<CachedBlur> mCachedBlurs;
+    uint64_t mFrame = 0;
+    size_t mCacheHits = 0;
+    size_t mCacheMisses = 0;
 };
 
 } // namespace skia
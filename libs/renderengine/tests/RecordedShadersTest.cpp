@@ -0,0 +1,180 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "../skia/RecordedShaders.h"
+
+namespace android {
+
+using renderengine::skia::RecordedShaders;
+
+constexpr char kIdentity[] = "vendor|renderer|version";
+
+sk_sp<SkData> makeData(const std::string& contents) {
+    return SkData::MakeWithCopy(contents.data(), contents.size());
+}
+
+std::string toString(const sk_sp<SkData>& data) {
+    return std::string(static_cast<const char*>(data->data()), data->size());
+}
+
+struct RecordedShadersTest : public ::testing::Test {
+    // Records and saves shaders "key0".."key<count - 1>" to mFile.
+    void saveShaders(size_t count) {
+        RecordedShaders shaders(mFile.path, 16);
+        shaders.load(kIdentity);
+        for (size_t i = 0; i < count; i++) {
+            const std::string index = std::to_string(i);
+            ASSERT_TRUE(shaders.add(*makeData("key" + index), *makeData("sksl" + index)));
+        }
+        ASSERT_TRUE(shaders.saveIfDirty());
+    }
+
+    void truncateFile(size_t bytes) {
+        std::string contents;
+        ASSERT_TRUE(base::ReadFileToString(mFile.path, &contents));
+        ASSERT_LE(bytes, contents.size());
+        ASSERT_TRUE(base::WriteStringToFile(contents.substr(0, contents.size() - bytes),
+                                            mFile.path));
+    }
+
+    TemporaryFile mFile;
+};
+
+TEST_F(RecordedShadersTest, loadsSavedShaders) {
+    saveShaders(3);
+
+    RecordedShaders shaders(mFile.path, 16);
+    EXPECT_EQ(3u, shaders.load(kIdentity));
+    EXPECT_FALSE(shaders.isDirty());
+    const std::vector<RecordedShaders::Shader> loaded = shaders.shaders();
+    ASSERT_EQ(3u, loaded.size());
+    for (size_t i = 0; i < loaded.size(); i++) {
+        EXPECT_EQ("key" + std::to_string(i), toString(loaded[i].key));
+        EXPECT_EQ("sksl" + std::to_string(i), toString(loaded[i].data));
+    }
+}
+
+TEST_F(RecordedShadersTest, savesOnlyWhenDirty) {
+    RecordedShaders shaders(mFile.path, 16);
+    shaders.load(kIdentity);
+    EXPECT_FALSE(shaders.saveIfDirty());
+
+    EXPECT_TRUE(shaders.add(*makeData("key"), *makeData("sksl")));
+    EXPECT_FALSE(shaders.add(*makeData("key"), *makeData("sksl")));
+    EXPECT_TRUE(shaders.isDirty());
+    EXPECT_TRUE(shaders.saveIfDirty());
+    EXPECT_FALSE(shaders.saveIfDirty());
+}
+
+TEST_F(RecordedShadersTest, ignoresShadersOfOtherDriver) {
+    saveShaders(3);
+
+    RecordedShaders shaders(mFile.path, 16);
+    EXPECT_EQ(0u, shaders.load("other vendor|renderer|version"));
+    EXPECT_EQ(0u, shaders.size());
+}
+
+TEST_F(RecordedShadersTest, keepsShadersBeforeTruncation) {
+    saveShaders(3);
+    // Cuts into the SkSL of the last shader.
+    truncateFile(1);
+
+    RecordedShaders shaders(mFile.path, 16);
+    EXPECT_EQ(2u, shaders.load(kIdentity));
+}
+
+TEST_F(RecordedShadersTest, ignoresTruncatedHeader) {
+    saveShaders(3);
+    std::string contents;
+    ASSERT_TRUE(base::ReadFileToString(mFile.path, &contents));
+    for (size_t size : {size_t(0), size_t(3), size_t(8), size_t(12)}) {
+        ASSERT_TRUE(base::WriteStringToFile(contents.substr(0, size), mFile.path));
+        RecordedShaders shaders(mFile.path, 16);
+        EXPECT_EQ(0u, shaders.load(kIdentity)) << "file of " << size << " bytes";
+    }
+}
+
+TEST_F(RecordedShadersTest, ignoresGarbage) {
+    ASSERT_TRUE(base::WriteStringToFile(std::string(64, '\xff'), mFile.path));
+
+    RecordedShaders shaders(mFile.path, 16);
+    EXPECT_EQ(0u, shaders.load(kIdentity));
+}
+
+TEST_F(RecordedShadersTest, replacesOldestShaderWhenFull) {
+    RecordedShaders shaders(mFile.path, 2);
+    shaders.load(kIdentity);
+    EXPECT_TRUE(shaders.add(*makeData("key0"), *makeData("sksl0")));
+    EXPECT_TRUE(shaders.add(*makeData("key1"), *makeData("sksl1")));
+    EXPECT_TRUE(shaders.add(*makeData("key2"), *makeData("sksl2")));
+
+    std::vector<RecordedShaders::Shader> recorded = shaders.shaders();
+    ASSERT_EQ(2u, recorded.size());
+    EXPECT_EQ("key1", toString(recorded[0].key));
+    EXPECT_EQ("key2", toString(recorded[1].key));
+
+    // The dropped shader can be recorded again.
+    EXPECT_TRUE(shaders.add(*makeData("key0"), *makeData("sksl0")));
+    recorded = shaders.shaders();
+    ASSERT_EQ(2u, recorded.size());
+    EXPECT_EQ("key2", toString(recorded[0].key));
+    EXPECT_EQ("key0", toString(recorded[1].key));
+}
+
+TEST_F(RecordedShadersTest, replacesLeastRecentlyUsedShaderWhenFull) {
+    saveShaders(3);
+
+    RecordedShaders shaders(mFile.path, 3);
+    EXPECT_EQ(3u, shaders.load(kIdentity));
+    // Precompiling key0 and Skia storing key1 again both count as uses.
+    shaders.touch(*makeData("key0"));
+    EXPECT_FALSE(shaders.add(*makeData("key1"), *makeData("sksl1")));
+    EXPECT_TRUE(shaders.isDirty());
+    EXPECT_TRUE(shaders.add(*makeData("key3"), *makeData("sksl3")));
+
+    const std::vector<RecordedShaders::Shader> recorded = shaders.shaders();
+    ASSERT_EQ(3u, recorded.size());
+    EXPECT_EQ("key0", toString(recorded[0].key));
+    EXPECT_EQ("key1", toString(recorded[1].key));
+    EXPECT_EQ("key3", toString(recorded[2].key));
+}
+
+TEST_F(RecordedShadersTest, touchingNewestShaderKeepsListClean) {
+    saveShaders(2);
+
+    RecordedShaders shaders(mFile.path, 16);
+    shaders.load(kIdentity);
+    shaders.touch(*makeData("key1"));
+    shaders.touch(*makeData("unknown"));
+    EXPECT_FALSE(shaders.isDirty());
+}
+
+TEST_F(RecordedShadersTest, loadKeepsNewestShadersWhenFull) {
+    saveShaders(3);
+
+    RecordedShaders shaders(mFile.path, 2);
+    EXPECT_EQ(2u, shaders.load(kIdentity));
+    const std::vector<RecordedShaders::Shader> loaded = shaders.shaders();
+    EXPECT_EQ("key1", toString(loaded[0].key));
+    EXPECT_EQ("key2", toString(loaded[1].key));
+}
+
+} // namespace android
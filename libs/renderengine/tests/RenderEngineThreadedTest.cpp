@@ -18,6 +18,12 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <renderengine/mock/RenderEngine.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
 #include "../threaded/RenderEngineThreaded.h"
 
 namespace android {
@@ -26,6 +32,18 @@ using testing::_;
 using testing::Eq;
 using testing::Mock;
 using testing::Return;
+using namespace std::chrono_literals;
+
+// Counts the buffer maps and unmaps that reach the wrapped RenderEngine.
+class BufferCountingRenderEngine : public renderengine::mock::RenderEngine {
+public:
+    std::atomic<int> mapCount = 0;
+    std::atomic<int> unmapCount = 0;
+
+protected:
+    void mapExternalTextureBuffer(const sp<GraphicBuffer>&, bool) override { mapCount++; }
+    void unmapExternalTextureBuffer(const sp<GraphicBuffer>&) override { unmapCount++; }
+};
 
 struct RenderEngineThreadedTest : public ::testing::Test {
     ~RenderEngineThreadedTest() {}
@@ -36,8 +54,49 @@ struct RenderEngineThreadedTest : public ::testing::Test {
                 renderengine::RenderEngine::RenderEngineType::THREADED);
     }
 
+    // Keeps the RenderEngine thread busy until the returned promise is set, so that the calls
+    // made in the meantime are still queued.
+    std::promise<void> blockRenderEngineThread() {
+        std::promise<void> unblock;
+        std::shared_future<void> unblocked = unblock.get_future().share();
+        EXPECT_CALL(*mRenderEngine, primeCache()).WillOnce([unblocked]() {
+            unblocked.wait();
+            return std::future<void>();
+        });
+        mThreadedRE->primeCache();
+        return unblock;
+    }
+
+    // Calls drawLayers from another thread, and returns the number of buffer maps and unmaps
+    // that had reached the wrapped RenderEngine when the frame was drawn.
+    std::future<std::pair<int, int>> drawLayersAsync(
+            const std::shared_ptr<renderengine::ExternalTexture>& buffer) {
+        EXPECT_CALL(*mRenderEngine, drawLayers)
+                .WillOnce([this](const renderengine::DisplaySettings&,
+                                 const std::vector<const renderengine::LayerSettings*>&,
+                                 const std::shared_ptr<renderengine::ExternalTexture>&,
+                                 const bool, base::unique_fd&&, base::unique_fd*) -> status_t {
+                    mDrawMapCount = mRenderEngine->mapCount;
+                    mDrawUnmapCount = mRenderEngine->unmapCount;
+                    return NO_ERROR;
+                });
+        auto result = std::async(std::launch::async, [this, buffer]() {
+            renderengine::DisplaySettings settings;
+            std::vector<const renderengine::LayerSettings*> layers;
+            base::unique_fd drawFence;
+            mThreadedRE->drawLayers(settings, layers, buffer, false, base::unique_fd(),
+                                    &drawFence);
+            return std::make_pair(mDrawMapCount.load(), mDrawUnmapCount.load());
+        });
+        // There is no way to tell when the frame has been queued, so give it plenty of time.
+        std::this_thread::sleep_for(100ms);
+        return result;
+    }
+
     std::unique_ptr<renderengine::threaded::RenderEngineThreaded> mThreadedRE;
-    renderengine::mock::RenderEngine* mRenderEngine = new renderengine::mock::RenderEngine();
+    BufferCountingRenderEngine* mRenderEngine = new BufferCountingRenderEngine();
+    std::atomic<int> mDrawMapCount = -1;
+    std::atomic<int> mDrawUnmapCount = -1;
 };
 
 TEST_F(RenderEngineThreadedTest, dump) {
@@ -190,4 +249,114 @@ TEST_F(RenderEngineThreadedTest, drawLayers) {
     ASSERT_EQ(NO_ERROR, result);
 }
 
+TEST_F(RenderEngineThreadedTest, mapThenUnmapOfQueuedBuffer_isCoalesced) {
+    std::promise<void> unblock = blockRenderEngineThread();
+
+    const auto usage = renderengine::ExternalTexture::Usage::READABLE;
+    auto kept = std::make_shared<renderengine::ExternalTexture>(new GraphicBuffer(), *mThreadedRE,
+                                                                usage);
+    auto dropped = std::make_shared<renderengine::ExternalTexture>(new GraphicBuffer(),
+                                                                   *mThreadedRE, usage);
+    dropped.reset();
+    unblock.set_value();
+
+    // call ANY synchronous function to ensure that the queued calls have completed.
+    mThreadedRE->getContextPriority();
+    EXPECT_EQ(1, mRenderEngine->mapCount);
+    EXPECT_EQ(0, mRenderEngine->unmapCount);
+
+    kept.reset();
+    mThreadedRE->getContextPriority();
+    EXPECT_EQ(1, mRenderEngine->unmapCount);
+}
+
+TEST_F(RenderEngineThreadedTest, mapMapUnmapOfQueuedBuffer_leavesOneMap) {
+    std::promise<void> unblock = blockRenderEngineThread();
+
+    const auto usage = renderengine::ExternalTexture::Usage::READABLE;
+    sp<GraphicBuffer> graphicBuffer = new GraphicBuffer();
+    auto kept = std::make_shared<renderengine::ExternalTexture>(graphicBuffer, *mThreadedRE, usage);
+    auto dropped =
+            std::make_shared<renderengine::ExternalTexture>(graphicBuffer, *mThreadedRE, usage);
+    dropped.reset();
+    unblock.set_value();
+
+    mThreadedRE->getContextPriority();
+    EXPECT_EQ(1, mRenderEngine->mapCount);
+    EXPECT_EQ(0, mRenderEngine->unmapCount);
+
+    kept.reset();
+    mThreadedRE->getContextPriority();
+    EXPECT_EQ(1, mRenderEngine->unmapCount);
+}
+
+TEST_F(RenderEngineThreadedTest, mapMapUnmapUnmapOfQueuedBuffer_isCoalesced) {
+    std::promise<void> unblock = blockRenderEngineThread();
+
+    const auto usage = renderengine::ExternalTexture::Usage::READABLE;
+    sp<GraphicBuffer> graphicBuffer = new GraphicBuffer();
+    auto first = std::make_shared<renderengine::ExternalTexture>(graphicBuffer, *mThreadedRE, usage);
+    auto second =
+            std::make_shared<renderengine::ExternalTexture>(graphicBuffer, *mThreadedRE, usage);
+    second.reset();
+    first.reset();
+    unblock.set_value();
+
+    mThreadedRE->getContextPriority();
+    EXPECT_EQ(0, mRenderEngine->mapCount);
+    EXPECT_EQ(0, mRenderEngine->unmapCount);
+}
+
+TEST_F(RenderEngineThreadedTest, drawLayers_runsAheadOfQueuedUnmap) {
+    const auto usage = renderengine::ExternalTexture::Usage::READABLE |
+            renderengine::ExternalTexture::Usage::WRITEABLE;
+    auto output = std::make_shared<renderengine::ExternalTexture>(new GraphicBuffer(),
+                                                                  *mThreadedRE, usage);
+    auto dropped = std::make_shared<renderengine::ExternalTexture>(new GraphicBuffer(),
+                                                                   *mThreadedRE, usage);
+    mThreadedRE->getContextPriority();
+    ASSERT_EQ(2, mRenderEngine->mapCount);
+
+    std::promise<void> unblock = blockRenderEngineThread();
+    dropped.reset();
+    auto drawn = drawLayersAsync(output);
+    unblock.set_value();
+
+    EXPECT_EQ(std::make_pair(2, 0), drawn.get());
+    mThreadedRE->getContextPriority();
+    EXPECT_EQ(1, mRenderEngine->unmapCount);
+}
+
+TEST_F(RenderEngineThreadedTest, drawLayers_doesNotRunAheadOfQueuedMap) {
+    std::promise<void> unblock = blockRenderEngineThread();
+
+    const auto usage = renderengine::ExternalTexture::Usage::READABLE |
+            renderengine::ExternalTexture::Usage::WRITEABLE;
+    auto output = std::make_shared<renderengine::ExternalTexture>(new GraphicBuffer(),
+                                                                  *mThreadedRE, usage);
+    auto drawn = drawLayersAsync(output);
+    unblock.set_value();
+
+    EXPECT_EQ(std::make_pair(1, 0), drawn.get());
+}
+
+TEST_F(RenderEngineThreadedTest, drawLayers_doesNotRunAheadOfUnmapQueuedBeforeMap) {
+    const auto usage = renderengine::ExternalTexture::Usage::READABLE |
+            renderengine::ExternalTexture::Usage::WRITEABLE;
+    auto dropped = std::make_shared<renderengine::ExternalTexture>(new GraphicBuffer(),
+                                                                   *mThreadedRE, usage);
+    mThreadedRE->getContextPriority();
+    ASSERT_EQ(1, mRenderEngine->mapCount);
+
+    std::promise<void> unblock = blockRenderEngineThread();
+    dropped.reset();
+    auto output = std::make_shared<renderengine::ExternalTexture>(new GraphicBuffer(),
+                                                                  *mThreadedRE, usage);
+    auto drawn = drawLayersAsync(output);
+    unblock.set_value();
+
+    // The map can't be overtaken, and the unmap queued before it runs before it.
+    EXPECT_EQ(std::make_pair(2, 1), drawn.get());
+}
+
 } // namespace android
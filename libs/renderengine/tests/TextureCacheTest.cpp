@@ -0,0 +1,157 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "../skia/TextureCache.h"
+
+namespace android {
+
+using renderengine::skia::TextureCache;
+
+// Stands in for AutoBackendTexture::LocalRef, counting live instances.
+struct FakeTexture {
+    static int sLiveCount;
+    FakeTexture() { sLiveCount++; }
+    ~FakeTexture() { sLiveCount--; }
+};
+int FakeTexture::sLiveCount = 0;
+
+constexpr size_t kTextureBytes = 1024;
+
+uint64_t bufferId(pid_t pid, uint32_t index) {
+    return (static_cast<uint64_t>(pid) << 32) | index;
+}
+
+struct TextureCacheTest : public ::testing::Test {
+    void TearDown() override { EXPECT_EQ(0, FakeTexture::sLiveCount); }
+};
+
+TEST_F(TextureCacheTest, evictsLeastRecentlyUsedFirst) {
+    TextureCache<FakeTexture> cache(3 * kTextureBytes);
+    for (uint32_t i = 0; i < 3; i++) {
+        cache.insert(bufferId(1, i), std::make_shared<FakeTexture>(), kTextureBytes, false);
+    }
+    ASSERT_NE(nullptr, cache.get(bufferId(1, 0)));
+
+    cache.insert(bufferId(1, 3), std::make_shared<FakeTexture>(), kTextureBytes, false);
+    EXPECT_TRUE(cache.contains(bufferId(1, 0)));
+    EXPECT_FALSE(cache.contains(bufferId(1, 1)));
+    EXPECT_TRUE(cache.contains(bufferId(1, 2)));
+    EXPECT_TRUE(cache.contains(bufferId(1, 3)));
+    EXPECT_EQ(1u, cache.evictions());
+}
+
+TEST_F(TextureCacheTest, keepsEvictedTexturesUntilTaken) {
+    TextureCache<FakeTexture> cache(kTextureBytes);
+    cache.insert(bufferId(1, 0), std::make_shared<FakeTexture>(), kTextureBytes, false);
+    cache.insert(bufferId(1, 1), std::make_shared<FakeTexture>(), kTextureBytes, false);
+    EXPECT_FALSE(cache.contains(bufferId(1, 0)));
+    EXPECT_EQ(2, FakeTexture::sLiveCount);
+
+    EXPECT_EQ(1u, cache.takeEvicted().size());
+    EXPECT_EQ(1, FakeTexture::sLiveCount);
+    EXPECT_TRUE(cache.takeEvicted().empty());
+}
+
+TEST_F(TextureCacheTest, neverEvictsTexturesOfCurrentFrame) {
+    TextureCache<FakeTexture> cache(2 * kTextureBytes);
+    cache.startFrame();
+    for (uint32_t i = 0; i < 4; i++) {
+        cache.insert(bufferId(1, i), std::make_shared<FakeTexture>(), kTextureBytes, true);
+    }
+    EXPECT_EQ(4u, cache.size());
+    EXPECT_EQ(4 * kTextureBytes, cache.bytes());
+
+    // Once the frame is over, the cache shrinks back to its budget.
+    cache.startFrame();
+    EXPECT_EQ(2 * kTextureBytes, cache.bytes());
+}
+
+TEST_F(TextureCacheTest, accountsBytesPerOwner) {
+    TextureCache<FakeTexture> cache(100 * kTextureBytes);
+    cache.insert(bufferId(100, 0), std::make_shared<FakeTexture>(), kTextureBytes, false);
+    cache.insert(bufferId(100, 1), std::make_shared<FakeTexture>(), 2 * kTextureBytes, false);
+    cache.insert(bufferId(200, 0), std::make_shared<FakeTexture>(), 4 * kTextureBytes, false);
+
+    const auto& owners = cache.usageByOwner();
+    ASSERT_EQ(2u, owners.size());
+    EXPECT_EQ(2u, owners.at(100).buffers);
+    EXPECT_EQ(3 * kTextureBytes, owners.at(100).bytes);
+    EXPECT_EQ(4 * kTextureBytes, owners.at(200).bytes);
+
+    cache.erase(bufferId(200, 0));
+    EXPECT_EQ(0u, cache.usageByOwner().count(200));
+    EXPECT_EQ(3 * kTextureBytes, cache.bytes());
+}
+
+// Maps thousands of buffers from a handful of apps while frames draw a few of them, checking
+// that the cache stays within budget between frames and keeps everything the frame uses.
+TEST_F(TextureCacheTest, stressMapThousandsOfBuffers) {
+    constexpr size_t kBudget = 64 * kTextureBytes;
+    constexpr uint32_t kBuffers = 5000;
+    constexpr size_t kLayersPerFrame = 8;
+    TextureCache<FakeTexture> cache(kBudget);
+    std::mt19937 random(42);
+
+    std::vector<uint64_t> mapped;
+    for (uint32_t i = 0; i < kBuffers; i++) {
+        const uint64_t id = bufferId(1000 + i % 5, i);
+        cache.insert(id, std::make_shared<FakeTexture>(), kTextureBytes * (1 + i % 3), false);
+        cache.takeEvicted();
+        mapped.push_back(id);
+        EXPECT_LE(cache.bytes(), kBudget);
+
+        if (i % 16 == 0) {
+            cache.startFrame();
+            std::vector<uint64_t> frame;
+            for (size_t j = 0; j < kLayersPerFrame; j++) {
+                const uint64_t id = mapped[random() % mapped.size()];
+                if (cache.get(id) == nullptr) {
+                    cache.insert(id, std::make_shared<FakeTexture>(), kTextureBytes, true);
+                }
+                cache.takeEvicted();
+                frame.push_back(id);
+            }
+            for (uint64_t id : frame) {
+                EXPECT_TRUE(cache.contains(id));
+            }
+        }
+
+        // Apps release some of their older buffers along the way.
+        if (i % 7 == 0) {
+            cache.erase(mapped[random() % mapped.size()]);
+        }
+    }
+
+    size_t ownerBytes = 0;
+    for (const auto& [pid, usage] : cache.usageByOwner()) {
+        ownerBytes += usage.bytes;
+    }
+    EXPECT_EQ(cache.bytes(), ownerBytes);
+    EXPECT_EQ(static_cast<int>(cache.size()), FakeTexture::sLiveCount);
+
+    for (uint64_t id : mapped) {
+        cache.erase(id);
+    }
+    EXPECT_EQ(0u, cache.size());
+    EXPECT_EQ(0u, cache.bytes());
+}
+
+} // namespace android
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace android {
+namespace renderengine {
+namespace threaded {
+
+/**
+ * Intrusive multi-producer single-consumer queue, after Dmitry Vyukov's non-blocking MPSC
+ * queue. push() is wait-free and may be called from any thread; pop() may only be called from
+ * the one consumer thread. The queue does not own its nodes.
+ */
+class MpscQueue {
+public:
+    struct Node {
+        std::atomic<Node*> next = nullptr;
+    };
+
+    MpscQueue() : mHead(&mStub), mTail(&mStub) {}
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(Node* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = mHead.exchange(node, std::memory_order_acq_rel);
+        // Until this store, the node is reachable from mHead but not from mTail, so pop() will
+        // report the queue as empty. Producers signal the consumer after push() returns.
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // Returns the oldest node, or nullptr if the queue is empty or the oldest node is still being
+    // linked in by a concurrent push().
+    Node* pop() {
+        Node* tail = mTail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &mStub) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+            mTail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr) {
+            mTail = next;
+            return tail;
+        }
+        if (tail != mHead.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        // tail is the last node: put the stub back behind it so that tail can be handed out.
+        push(&mStub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            mTail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    // Most recently pushed node, shared by the producers.
+    std::atomic<Node*> mHead;
+    // Oldest node, only touched by the consumer.
+    Node* mTail;
+    Node mStub;
+};
+
+} // namespace threaded
+} // namespace renderengine
+} // namespace android
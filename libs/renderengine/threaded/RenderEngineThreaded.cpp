@@ -19,6 +19,7 @@
 #include "RenderEngineThreaded.h"
 
 #include <sched.h>
+#include <algorithm>
 #include <chrono>
 #include <future>
 
@@ -30,6 +31,7 @@
 #include "gl/GLESRenderEngine.h"
 
 using namespace std::chrono_literals;
+using android::base::StringAppendF;
 
 namespace android {
 namespace renderengine {
@@ -50,11 +52,23 @@ RenderEngineThreaded::RenderEngineThreaded(CreateInstanceFactory factory, Render
 
 RenderEngineThreaded::~RenderEngineThreaded() {
     mRunning = false;
+    {
+        std::lock_guard lock(mWakeMutex);
+    }
     mCondition.notify_one();
 
     if (mThread.joinable()) {
         mThread.join();
     }
+
+    // The RenderEngine thread is gone, so it is safe to consume whatever is left in the queues.
+    drainQueues();
+    for (Task* task : mHighPriorityTasks) {
+        delete task;
+    }
+    for (Task* task : mTasks) {
+        delete task;
+    }
 }
 
 status_t RenderEngineThreaded::setSchedFifo(bool enabled) {
@@ -101,26 +115,15 @@ void RenderEngineThreaded::threadMain(CreateInstanceFactory factory) NO_THREAD_S
     mInitializedCondition.notify_all();
 
     while (mRunning) {
-        const auto getNextTask = [this]() -> std::optional<Work> {
-            std::scoped_lock lock(mThreadMutex);
-            if (!mFunctionCalls.empty()) {
-                Work task = mFunctionCalls.front();
-                mFunctionCalls.pop();
-                return std::make_optional<Work>(task);
-            }
-            return std::nullopt;
-        };
-
-        const auto task = getNextTask();
-
-        if (task) {
-            (*task)(*mRenderEngine);
+        // Read before draining, so that a task linked in after drainQueues() looked is still
+        // newer than what waitForTasks() waits for.
+        const uint64_t pushedTasks = mPushedTasks;
+        drainQueues();
+        if (Task* task = nextTask()) {
+            executeTask(task);
+        } else {
+            waitForTasks(pushedTasks);
         }
-
-        std::unique_lock<std::mutex> lock(mThreadMutex);
-        mCondition.wait(lock, [this]() REQUIRES(mThreadMutex) {
-            return !mRunning || !mFunctionCalls.empty();
-        });
     }
 
     // we must release the RenderEngine on the thread that created it
@@ -132,80 +135,213 @@ void RenderEngineThreaded::waitUntilInitialized() const {
     mInitializedCondition.wait(lock, [=] { return mIsInitialized; });
 }
 
+void RenderEngineThreaded::Completion::signal() {
+    // Notify with the lock held: the waiting thread may return and reuse or destroy this
+    // Completion as soon as it can reacquire the lock.
+    std::lock_guard lock(mMutex);
+    mDone = true;
+    mCondition.notify_one();
+}
+
+// NO_THREAD_SAFETY_ANALYSIS is because std::unique_lock presently lacks thread safety annotations.
+void RenderEngineThreaded::Completion::wait() NO_THREAD_SAFETY_ANALYSIS {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this]() REQUIRES(mMutex) { return mDone; });
+    mDone = false;
+}
+
+void RenderEngineThreaded::pushTask(Task* task) {
+    // Count ordered tasks before they get a sequence number, so that a frame queued after one
+    // always sees it as pending.
+    if (task->type == TaskType::DEFAULT || task->type == TaskType::MAP_BUFFER) {
+        mPendingOrderedTasks++;
+    }
+    task->sequence = mNextSequence++;
+    task->queueTime = systemTime();
+    (task->type == TaskType::DRAW ? mHighPriorityTaskQueue : mTaskQueue).push(task);
+    mPushedTasks++;
+
+    const size_t queuedTasks = ++mQueuedTasks;
+    ATRACE_INT("REThreaded::queueDepth", static_cast<int32_t>(queuedTasks));
+    if (mThreadSleeping) {
+        // Taking the lock orders the notification after the RenderEngine thread has either seen
+        // the new task or started waiting.
+        {
+            std::lock_guard lock(mWakeMutex);
+        }
+        mCondition.notify_one();
+    }
+}
+
+void RenderEngineThreaded::queueTask(TaskType type, Work work) {
+    pushTask(new Task(type, std::move(work)));
+}
+
+void RenderEngineThreaded::runTask(TaskType type, Work work) {
+    static thread_local Completion completion;
+    Task* task = new Task(type, std::move(work));
+    task->completion = &completion;
+    pushTask(task);
+    completion.wait();
+}
+
+void RenderEngineThreaded::queueBufferTask(TaskType type, const sp<GraphicBuffer>& buffer,
+                                           Work work) {
+    const uint64_t bufferId = buffer->getId();
+    Task* task;
+    {
+        std::lock_guard lock(mBufferTasksMutex);
+        std::vector<Task*>& pendingTasks = mPendingBufferTasks[bufferId];
+        if (!pendingTasks.empty() && pendingTasks.back()->type != type) {
+            // The buffer was mapped and unmapped again (or the reverse) before the RenderEngine
+            // thread got to it. The two calls cancel out, so neither needs to run. Any earlier
+            // calls for the buffer are of the same type as the cancelled one and still run.
+            pendingTasks.back()->cancelled = true;
+            pendingTasks.pop_back();
+            if (pendingTasks.empty()) {
+                mPendingBufferTasks.erase(bufferId);
+            }
+            mCoalescedBufferTasks++;
+            return;
+        }
+        task = new Task(type, std::move(work));
+        task->bufferId = bufferId;
+        pendingTasks.push_back(task);
+    }
+    pushTask(task);
+}
+
+void RenderEngineThreaded::drainQueues() {
+    while (MpscQueue::Node* node = mHighPriorityTaskQueue.pop()) {
+        mHighPriorityTasks.push_back(static_cast<Task*>(node));
+    }
+    while (MpscQueue::Node* node = mTaskQueue.pop()) {
+        mTasks.push_back(static_cast<Task*>(node));
+    }
+}
+
+RenderEngineThreaded::Task* RenderEngineThreaded::nextTask() {
+    Task* draw = mHighPriorityTasks.empty() ? nullptr : mHighPriorityTasks.front();
+    Task* task = mTasks.empty() ? nullptr : mTasks.front();
+    if (draw != nullptr) {
+        // A frame may only run ahead of queued buffer unmaps. Running ahead of a map would make
+        // it import the buffer uncached, and running ahead of any other call would let it miss a
+        // RenderEngine state change.
+        if (task == nullptr || draw->sequence < task->sequence) {
+            mHighPriorityTasks.pop_front();
+            return draw;
+        }
+        if (mPendingOrderedTasks == 0) {
+            mReorderedDraws++;
+            mHighPriorityTasks.pop_front();
+            return draw;
+        }
+    }
+    if (task != nullptr) {
+        mTasks.pop_front();
+    }
+    return task;
+}
+
+void RenderEngineThreaded::executeTask(Task* task) {
+    bool cancelled = false;
+    if (task->type == TaskType::MAP_BUFFER || task->type == TaskType::UNMAP_BUFFER) {
+        std::lock_guard lock(mBufferTasksMutex);
+        cancelled = task->cancelled;
+        if (const auto it = mPendingBufferTasks.find(task->bufferId);
+            it != mPendingBufferTasks.end()) {
+            std::vector<Task*>& pendingTasks = it->second;
+            pendingTasks.erase(std::remove(pendingTasks.begin(), pendingTasks.end(), task),
+                               pendingTasks.end());
+            if (pendingTasks.empty()) {
+                mPendingBufferTasks.erase(it);
+            }
+        }
+    }
+
+    const size_t queuedTasks = --mQueuedTasks;
+    ATRACE_INT("REThreaded::queueDepth", static_cast<int32_t>(queuedTasks));
+    if (!cancelled) {
+        ATRACE_INT64(task->type == TaskType::DRAW ? "REThreaded::drawWaitNs"
+                                                  : "REThreaded::taskWaitNs",
+                     systemTime() - task->queueTime);
+        task->work(*mRenderEngine);
+    }
+    if (task->type == TaskType::DEFAULT || task->type == TaskType::MAP_BUFFER) {
+        mPendingOrderedTasks--;
+    }
+
+    // Release the work's captures before waking up a synchronous caller, since they may
+    // reference the caller's stack.
+    Completion* completion = task->completion;
+    delete task;
+    if (completion != nullptr) {
+        completion->signal();
+    }
+}
+
+void RenderEngineThreaded::waitForTasks(uint64_t pushedTasks) {
+    // Queues that look empty while tasks are outstanding only mean a caller is still linking its
+    // task in. That caller bumps mPushedTasks and wakes us up once it is done, so block rather
+    // than spin: a spinning SCHED_FIFO thread could keep a preempted caller from ever finishing.
+    std::unique_lock<std::mutex> lock(mWakeMutex);
+    mThreadSleeping = true;
+    mCondition.wait(lock, [this, pushedTasks]() {
+        return !mRunning || mPushedTasks != pushedTasks;
+    });
+    mThreadSleeping = false;
+}
+
 std::future<void> RenderEngineThreaded::primeCache() {
     const auto resultPromise = std::make_shared<std::promise<void>>();
     std::future<void> resultFuture = resultPromise->get_future();
     ATRACE_CALL();
     // This function is designed so it can run asynchronously, so we do not need to wait
     // for the futures.
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([resultPromise](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::primeCache");
-            if (setSchedFifo(false) != NO_ERROR) {
-                ALOGW("Couldn't set SCHED_OTHER for primeCache");
-            }
+    queueTask(TaskType::DEFAULT, [resultPromise](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::primeCache");
+        if (setSchedFifo(false) != NO_ERROR) {
+            ALOGW("Couldn't set SCHED_OTHER for primeCache");
+        }
 
-            instance.primeCache();
-            resultPromise->set_value();
+        instance.primeCache();
+        resultPromise->set_value();
 
-            if (setSchedFifo(true) != NO_ERROR) {
-                ALOGW("Couldn't set SCHED_FIFO for primeCache");
-            }
-        });
-    }
-    mCondition.notify_one();
+        if (setSchedFifo(true) != NO_ERROR) {
+            ALOGW("Couldn't set SCHED_FIFO for primeCache");
+        }
+    });
 
     return resultFuture;
 }
 
 void RenderEngineThreaded::dump(std::string& result) {
-    std::promise<std::string> resultPromise;
-    std::future<std::string> resultFuture = resultPromise.get_future();
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([&resultPromise, &result](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::dump");
-            std::string localResult = result;
-            instance.dump(localResult);
-            resultPromise.set_value(std::move(localResult));
-        });
-    }
-    mCondition.notify_one();
-    // Note: This is an rvalue.
-    result.assign(resultFuture.get());
+    std::string localResult = result;
+    runTask(TaskType::DEFAULT, [&localResult](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::dump");
+        instance.dump(localResult);
+    });
+    StringAppendF(&localResult,
+                  "RenderEngineThreaded: %zu buffer map/unmap calls coalesced, %zu frames drawn "
+                  "ahead of buffer map/unmap calls\n",
+                  mCoalescedBufferTasks.load(), mReorderedDraws.load());
+    result.assign(std::move(localResult));
 }
 
 void RenderEngineThreaded::genTextures(size_t count, uint32_t* names) {
     ATRACE_CALL();
-    std::promise<void> resultPromise;
-    std::future<void> resultFuture = resultPromise.get_future();
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([&resultPromise, count, names](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::genTextures");
-            instance.genTextures(count, names);
-            resultPromise.set_value();
-        });
-    }
-    mCondition.notify_one();
-    resultFuture.wait();
+    runTask(TaskType::DEFAULT, [count, names](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::genTextures");
+        instance.genTextures(count, names);
+    });
 }
 
 void RenderEngineThreaded::deleteTextures(size_t count, uint32_t const* names) {
     ATRACE_CALL();
-    std::promise<void> resultPromise;
-    std::future<void> resultFuture = resultPromise.get_future();
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([&resultPromise, count, &names](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::deleteTextures");
-            instance.deleteTextures(count, names);
-            resultPromise.set_value();
-        });
-    }
-    mCondition.notify_one();
-    resultFuture.wait();
+    runTask(TaskType::DEFAULT, [count, names](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::deleteTextures");
+        instance.deleteTextures(count, names);
+    });
 }
 
 void RenderEngineThreaded::mapExternalTextureBuffer(const sp<GraphicBuffer>& buffer,
@@ -213,28 +349,21 @@ void RenderEngineThreaded::mapExternalTextureBuffer(const sp<GraphicBuffer>& buf
     ATRACE_CALL();
     // This function is designed so it can run asynchronously, so we do not need to wait
     // for the futures.
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([=](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::mapExternalTextureBuffer");
-            instance.mapExternalTextureBuffer(buffer, isRenderable);
-        });
-    }
-    mCondition.notify_one();
+    queueBufferTask(TaskType::MAP_BUFFER, buffer,
+                    [=](renderengine::RenderEngine& instance) {
+                        ATRACE_NAME("REThreaded::mapExternalTextureBuffer");
+                        instance.mapExternalTextureBuffer(buffer, isRenderable);
+                    });
 }
 
 void RenderEngineThreaded::unmapExternalTextureBuffer(const sp<GraphicBuffer>& buffer) {
     ATRACE_CALL();
     // This function is designed so it can run asynchronously, so we do not need to wait
     // for the futures.
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([=](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::unmapExternalTextureBuffer");
-            instance.unmapExternalTextureBuffer(buffer);
-        });
-    }
-    mCondition.notify_one();
+    queueBufferTask(TaskType::UNMAP_BUFFER, buffer, [=](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::unmapExternalTextureBuffer");
+        instance.unmapExternalTextureBuffer(buffer);
+    });
 }
 
 size_t RenderEngineThreaded::getMaxTextureSize() const {
@@ -264,22 +393,19 @@ void RenderEngineThreaded::useProtectedContext(bool useProtectedContext) {
         return;
     }
 
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([useProtectedContext, this](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::useProtectedContext");
-            instance.useProtectedContext(useProtectedContext);
-            if (instance.isProtected() != useProtectedContext) {
-                ALOGE("Failed to switch RenderEngine context.");
-                // reset the cached mIsProtected value to a good state, but this does not
-                // prevent other callers of this method and isProtected from reading the
-                // invalid cached value.
-                mIsProtected = instance.isProtected();
-            }
-        });
-        mIsProtected = useProtectedContext;
-    }
-    mCondition.notify_one();
+    std::lock_guard lock(mThreadMutex);
+    queueTask(TaskType::DEFAULT, [useProtectedContext, this](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::useProtectedContext");
+        instance.useProtectedContext(useProtectedContext);
+        if (instance.isProtected() != useProtectedContext) {
+            ALOGE("Failed to switch RenderEngine context.");
+            // reset the cached mIsProtected value to a good state, but this does not
+            // prevent other callers of this method and isProtected from reading the
+            // invalid cached value.
+            mIsProtected = instance.isProtected();
+        }
+    });
+    mIsProtected = useProtectedContext;
 }
 
 void RenderEngineThreaded::cleanupPostRender() {
@@ -289,14 +415,10 @@ void RenderEngineThreaded::cleanupPostRender() {
 
     // This function is designed so it can run asynchronously, so we do not need to wait
     // for the futures.
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([=](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::unmapExternalTextureBuffer");
-            instance.cleanupPostRender();
-        });
-    }
-    mCondition.notify_one();
+    queueTask(TaskType::DEFAULT, [=](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::cleanupPostRender");
+        instance.cleanupPostRender();
+    });
 }
 
 bool RenderEngineThreaded::canSkipPostRenderCleanup() const {
@@ -311,49 +433,34 @@ status_t RenderEngineThreaded::drawLayers(const DisplaySettings& display,
                                           base::unique_fd&& bufferFence,
                                           base::unique_fd* drawFence) {
     ATRACE_CALL();
-    std::promise<status_t> resultPromise;
-    std::future<status_t> resultFuture = resultPromise.get_future();
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([&resultPromise, &display, &layers, &buffer, useFramebufferCache,
-                             &bufferFence, &drawFence](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::drawLayers");
-            status_t status = instance.drawLayers(display, layers, buffer, useFramebufferCache,
-                                                  std::move(bufferFence), drawFence);
-            resultPromise.set_value(status);
-        });
-    }
-    mCondition.notify_one();
-    return resultFuture.get();
+    status_t status = NO_ERROR;
+    runTask(TaskType::DRAW,
+            [&status, &display, &layers, &buffer, useFramebufferCache, &bufferFence,
+             &drawFence](renderengine::RenderEngine& instance) {
+                ATRACE_NAME("REThreaded::drawLayers");
+                status = instance.drawLayers(display, layers, buffer, useFramebufferCache,
+                                             std::move(bufferFence), drawFence);
+            });
+    return status;
 }
 
 void RenderEngineThreaded::cleanFramebufferCache() {
     ATRACE_CALL();
     // This function is designed so it can run asynchronously, so we do not need to wait
     // for the futures.
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::cleanFramebufferCache");
-            instance.cleanFramebufferCache();
-        });
-    }
-    mCondition.notify_one();
+    queueTask(TaskType::DEFAULT, [](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::cleanFramebufferCache");
+        instance.cleanFramebufferCache();
+    });
 }
 
 int RenderEngineThreaded::getContextPriority() {
-    std::promise<int> resultPromise;
-    std::future<int> resultFuture = resultPromise.get_future();
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([&resultPromise](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::getContextPriority");
-            int priority = instance.getContextPriority();
-            resultPromise.set_value(priority);
-        });
-    }
-    mCondition.notify_one();
-    return resultFuture.get();
+    int priority = 0;
+    runTask(TaskType::DEFAULT, [&priority](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::getContextPriority");
+        priority = instance.getContextPriority();
+    });
+    return priority;
 }
 
 bool RenderEngineThreaded::supportsBackgroundBlur() {
@@ -364,14 +471,10 @@ bool RenderEngineThreaded::supportsBackgroundBlur() {
 void RenderEngineThreaded::onPrimaryDisplaySizeChanged(ui::Size size) {
     // This function is designed so it can run asynchronously, so we do not need to wait
     // for the futures.
-    {
-        std::lock_guard lock(mThreadMutex);
-        mFunctionCalls.push([size](renderengine::RenderEngine& instance) {
-            ATRACE_NAME("REThreaded::onPrimaryDisplaySizeChanged");
-            instance.onPrimaryDisplaySizeChanged(size);
-        });
-    }
-    mCondition.notify_one();
+    queueTask(TaskType::DEFAULT, [size](renderengine::RenderEngine& instance) {
+        ATRACE_NAME("REThreaded::onPrimaryDisplaySizeChanged");
+        instance.onPrimaryDisplaySizeChanged(size);
+    });
 }
 
 } // namespace threaded
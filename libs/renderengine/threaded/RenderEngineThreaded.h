@@ -17,11 +17,15 @@
 #pragma once
 
 #include <android-base/thread_annotations.h>
+#include <utils/Timers.h>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "MpscQueue.h"
 #include "renderengine/RenderEngine.h"
 
 namespace android {
@@ -34,6 +38,11 @@ using CreateInstanceFactory = std::function<std::unique_ptr<renderengine::Render
  * This class extends a basic RenderEngine class. It contains a thread. Each time a function of
  * this class is called, we create a lambda function that is put on a queue. The main thread then
  * executes the functions in order.
+ *
+ * drawLayers is queued on a separate high priority lane, which lets a frame run ahead of buffer
+ * unmap calls that were queued before it. It never overtakes any other call: a map queued before
+ * it may be for one of its buffers, and state changes such as useProtectedContext still have to
+ * apply to the frames queued after them.
  */
 class RenderEngineThreaded : public RenderEngine {
 public:
@@ -73,10 +82,66 @@ protected:
     bool canSkipPostRenderCleanup() const override;
 
 private:
+    using Work = std::function<void(renderengine::RenderEngine&)>;
+
+    // Lets a caller block until its task has run. Each calling thread reuses a single instance,
+    // so synchronous calls don't allocate a promise/future shared state per call.
+    class Completion {
+    public:
+        void signal();
+        void wait();
+
+    private:
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        bool mDone GUARDED_BY(mMutex) = false;
+    };
+
+    enum class TaskType {
+        // Runs in queue order; frames may not overtake it.
+        DEFAULT,
+        DRAW,
+        // Also ordered, so that a frame using the buffer doesn't import it again uncached.
+        MAP_BUFFER,
+        // The only task frames may overtake.
+        UNMAP_BUFFER,
+    };
+
+    struct Task : public MpscQueue::Node {
+        Task(TaskType type, Work work) : type(type), work(std::move(work)) {}
+
+        const TaskType type;
+        Work work;
+        // Signalled once the task has run, for synchronous calls.
+        Completion* completion = nullptr;
+        uint64_t sequence = 0;
+        nsecs_t queueTime = 0;
+        // For MAP_BUFFER and UNMAP_BUFFER.
+        uint64_t bufferId = 0;
+        // Set under mBufferTasksMutex when a map/unmap pair was coalesced before the task ran.
+        bool cancelled = false;
+    };
+
     void threadMain(CreateInstanceFactory factory);
     void waitUntilInitialized() const;
     static status_t setSchedFifo(bool enabled);
 
+    // Queues work to run asynchronously on the RenderEngine thread.
+    void queueTask(TaskType type, Work work);
+    // Queues work and blocks until the RenderEngine thread has run it.
+    void runTask(TaskType type, Work work);
+    // Queues a buffer map or unmap, unless it cancels out a still-pending opposite call for the
+    // same buffer, in which case neither runs.
+    void queueBufferTask(TaskType type, const sp<GraphicBuffer>& buffer, Work work);
+    void pushTask(Task* task);
+
+    // RenderEngine thread only.
+    void drainQueues();
+    Task* nextTask();
+    void executeTask(Task* task);
+    // Sleeps until a task is pushed after |pushedTasks| were.
+    void waitForTasks(uint64_t pushedTasks);
+
     /* ------------------------------------------------------------------------
      * Threading
      */
@@ -86,9 +151,39 @@ private:
     std::thread mThread GUARDED_BY(mThreadMutex);
     std::atomic<bool> mRunning = true;
 
-    using Work = std::function<void(renderengine::RenderEngine&)>;
-    mutable std::queue<Work> mFunctionCalls GUARDED_BY(mThreadMutex);
-    mutable std::condition_variable mCondition;
+    // Lock-free handoff from callers to the RenderEngine thread: DRAW tasks go to the high
+    // priority queue, everything else to mTaskQueue.
+    MpscQueue mHighPriorityTaskQueue;
+    MpscQueue mTaskQueue;
+    // Tasks the RenderEngine thread has taken off the queues but not run yet, in queue order.
+    // Only accessed on the RenderEngine thread.
+    std::deque<Task*> mHighPriorityTasks;
+    std::deque<Task*> mTasks;
+    // Tasks that were pushed and have not been run or dropped yet.
+    std::atomic<size_t> mQueuedTasks = 0;
+    // Tasks that were ever pushed. Only bumped once a task is linked into its queue, so the
+    // RenderEngine thread sleeps on it rather than spinning while a caller is mid-push.
+    std::atomic<uint64_t> mPushedTasks = 0;
+    // DEFAULT and MAP_BUFFER tasks that were pushed and have not run yet. While any are pending,
+    // frames only run in queue order.
+    std::atomic<size_t> mPendingOrderedTasks = 0;
+    std::atomic<uint64_t> mNextSequence = 0;
+
+    // Only used to put the RenderEngine thread to sleep when both queues are empty.
+    std::mutex mWakeMutex;
+    std::condition_variable mCondition;
+    std::atomic<bool> mThreadSleeping = false;
+
+    // Map/unmap tasks that have been queued but not started and not cancelled, by buffer ID, in
+    // queue order. A new call cancels the last one if it is the opposite, so the tasks pending for
+    // a buffer are always of a single type and their count is the net number of maps or unmaps.
+    std::mutex mBufferTasksMutex;
+    std::unordered_map<uint64_t, std::vector<Task*>> mPendingBufferTasks
+            GUARDED_BY(mBufferTasksMutex);
+
+    // Statistics reported by dump().
+    std::atomic<size_t> mCoalescedBufferTasks = 0;
+    std::atomic<size_t> mReorderedDraws = 0;
 
     // Used to allow select thread safe methods to be accessed without requiring the
     // method to be invoked on the RenderEngine thread
@@ -113,6 +113,19 @@ ssize_t BitTube::write(void const* vaddr, size_t size)
     return err == 0 ? len : -err;
 }
 
+ssize_t BitTube::writev(struct iovec const* iov, size_t iovcnt)
+{
+    struct msghdr msg = {};
+    msg.msg_iov = const_cast<struct iovec*>(iov);
+    msg.msg_iovlen = iovcnt;
+    ssize_t err, len;
+    do {
+        len = ::sendmsg(mSendFd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        err = len < 0 ? errno : 0;
+    } while (err == EINTR);
+    return err == 0 ? len : -err;
+}
+
 ssize_t BitTube::read(void* vaddr, size_t size)
 {
     ssize_t err, len;
@@ -155,6 +168,19 @@ ssize_t BitTube::sendObjects(const sp<BitTube>& tube,
     return size < 0 ? size : size / static_cast<ssize_t>(objSize);
 }
 
+ssize_t BitTube::sendObjects(const sp<BitTube>& tube,
+        struct iovec const* iov, size_t iovcnt, size_t objSize)
+{
+    ssize_t size = tube->writev(iov, iovcnt);
+
+    // should never happen because of SOCK_SEQPACKET
+    LOG_ALWAYS_FATAL_IF((size >= 0) && (size % static_cast<ssize_t>(objSize)),
+            "BitTube::sendObjects(iovcnt=%zu, size=%zu), res=%zd (partial events were sent!)",
+            iovcnt, objSize, size);
+
+    return size < 0 ? size : size / static_cast<ssize_t>(objSize);
+}
+
 ssize_t BitTube::recvObjects(const sp<BitTube>& tube,
         void* events, size_t count, size_t objSize)
 {
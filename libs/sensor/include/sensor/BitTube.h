@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
@@ -55,6 +56,11 @@ public:
         return sendObjects(tube, events, count, sizeof(T));
     }
 
+    // send objects gathered from several buffers as a single message. Each buffer must hold whole
+    // objects. All objects are guaranteed to be written or the call fails.
+    static ssize_t sendObjects(const sp<BitTube>& tube,
+            struct iovec const* iov, size_t iovcnt, size_t objSize);
+
     // receive objects (sized blobs). If the receiving buffer isn't large enough,
     // excess messages are silently discarded.
     template <typename T>
@@ -72,6 +78,9 @@ private:
     // send a message. The write is guaranteed to send the whole message or fail.
     ssize_t write(void const* vaddr, size_t size);
 
+    // send a message gathered from several buffers, with the same guarantee as write().
+    ssize_t writev(struct iovec const* iov, size_t iovcnt);
+
     // receive a message. the passed buffer must be at least as large as the
     // write call used to send the message, excess data is silently discarded.
     ssize_t read(void* vaddr, size_t size);
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <gtest/gtest.h>
+#include <utils/Errors.h>
+
+#include <sensor/BitTube.h>
+
+namespace android {
+
+class BitTubeTest : public ::testing::Test {
+protected:
+    virtual void SetUp() override {
+        mTube = new BitTube();
+        ASSERT_EQ(NO_ERROR, mTube->initCheck());
+    }
+
+    static struct iovec iov(int32_t* objects, size_t count) {
+        return {objects, count * sizeof(int32_t)};
+    }
+
+    sp<BitTube> mTube;
+};
+
+TEST_F(BitTubeTest, SendObjectsGathersBuffersIntoOneMessage) {
+    int32_t first[] = {1, 2};
+    int32_t second[] = {3};
+    int32_t third[] = {4, 5, 6};
+    struct iovec iovs[] = {iov(first, 2), iov(second, 1), iov(third, 3)};
+    ASSERT_EQ(6, BitTube::sendObjects(mTube, iovs, 3, sizeof(int32_t)));
+
+    int32_t received[16] = {};
+    ASSERT_EQ(6, BitTube::recvObjects(mTube, received, 16));
+    for (int32_t i = 0; i < 6; i++) {
+        EXPECT_EQ(i + 1, received[i]);
+    }
+    EXPECT_EQ(0, BitTube::recvObjects(mTube, received, 16));
+}
+
+TEST_F(BitTubeTest, SendObjectsKeepsBatchesApart) {
+    int32_t first[] = {1, 2};
+    int32_t second[] = {3};
+    struct iovec batch[] = {iov(first, 2), iov(second, 1)};
+    ASSERT_EQ(3, BitTube::sendObjects(mTube, batch, 2, sizeof(int32_t)));
+    ASSERT_EQ(3, BitTube::sendObjects(mTube, batch, 2, sizeof(int32_t)));
+
+    // Each batch is read back as its own message, even when more would fit.
+    int32_t received[16] = {};
+    EXPECT_EQ(3, BitTube::recvObjects(mTube, received, 16));
+    EXPECT_EQ(3, BitTube::recvObjects(mTube, received, 16));
+    EXPECT_EQ(0, BitTube::recvObjects(mTube, received, 16));
+}
+
+TEST_F(BitTubeTest, SendObjectsOfEmptyBuffers) {
+    int32_t objects[] = {1};
+    struct iovec iovs[] = {iov(objects, 0), iov(objects, 1), iov(objects, 0)};
+    ASSERT_EQ(1, BitTube::sendObjects(mTube, iovs, 3, sizeof(int32_t)));
+
+    int32_t received[4] = {};
+    ASSERT_EQ(1, BitTube::recvObjects(mTube, received, 4));
+    EXPECT_EQ(1, received[0]);
+}
+
+TEST_F(BitTubeTest, SendObjectsFailsWithoutPartialBatchesWhenFull) {
+    int32_t first[16] = {};
+    int32_t second[16] = {};
+    struct iovec batch[] = {iov(first, 16), iov(second, 16)};
+    size_t sent = 0;
+    ssize_t result;
+    while ((result = BitTube::sendObjects(mTube, batch, 2, sizeof(int32_t))) > 0) {
+        ASSERT_EQ(32, result);
+        sent++;
+    }
+    EXPECT_EQ(-EAGAIN, result);
+    ASSERT_GT(sent, 0u);
+
+    int32_t received[64];
+    for (size_t i = 0; i < sent; i++) {
+        ASSERT_EQ(32, BitTube::recvObjects(mTube, received, 64));
+    }
+    EXPECT_EQ(0, BitTube::recvObjects(mTube, received, 64));
+}
+
+} // namespace android
@@ -20,13 +20,24 @@
 
 #include <cutils/compiler.h>  // For CC_[UN]LIKELY
 #include <utils/Log.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 
 #include <memory>
 
 namespace android {
 
+namespace {
+
+std::atomic<uint64_t> sSignalTimeQueries{0};
+std::atomic<uint64_t> sQueriesAvoided{0};
+
+} // namespace
+
 // ============================================================================
 // FenceTime
 // ============================================================================
@@ -122,7 +133,14 @@ status_t FenceTime::wait(int timeout) {
     }
 
     // Make the system call without the lock held.
-    return fence->wait(timeout);
+    status_t err = fence->wait(timeout);
+
+    // Callers expect getSignalTime() to return the timestamp once the wait
+    // succeeds, so don't leave it to the watcher thread to catch up.
+    if (err == NO_ERROR && mWatched.load(std::memory_order_acquire)) {
+        querySignalTime();
+    }
+    return err;
 }
 
 nsecs_t FenceTime::getSignalTime() {
@@ -132,6 +150,21 @@ nsecs_t FenceTime::getSignalTime() {
         return signalTime;
     }
 
+    // The FenceWatcher will record the signal time as soon as the fence
+    // signals, so there is no need to ask the fence ourselves. This is the
+    // only case that saves a query: a cached signal time would have been
+    // returned without one anyway.
+    if (mWatched.load(std::memory_order_acquire)) {
+        sQueriesAvoided.fetch_add(1, std::memory_order_relaxed);
+        return Fence::SIGNAL_TIME_PENDING;
+    }
+
+    return querySignalTime();
+}
+
+nsecs_t FenceTime::querySignalTime() {
+    nsecs_t signalTime;
+
     // Hold a reference to the fence on the stack in case the class'
     // reference is removed by another thread. This prevents the
     // fence from being destroyed until the end of this method, where
@@ -150,6 +183,7 @@ nsecs_t FenceTime::getSignalTime() {
     }
 
     // Make the system call without the lock held.
+    sSignalTimeQueries.fetch_add(1, std::memory_order_relaxed);
     signalTime = fence->getSignalTime();
 
     // Allow tests to override SIGNAL_TIME_INVALID behavior, since tests
@@ -171,6 +205,13 @@ nsecs_t FenceTime::getSignalTime() {
     return signalTime;
 }
 
+FenceTime::Stats FenceTime::getStats() {
+    Stats stats;
+    stats.signalTimeQueries = sSignalTimeQueries.load(std::memory_order_relaxed);
+    stats.queriesAvoided = sQueriesAvoided.load(std::memory_order_relaxed);
+    return stats;
+}
+
 nsecs_t FenceTime::getCachedSignalTime() const {
     // memory_order_acquire since we don't have a lock fallback path
     // that will do an acquire.
@@ -304,6 +345,10 @@ void FenceTimeline::push(const std::shared_ptr<FenceTime>& fence) {
         mQueue.pop();
     }
     mQueue.push(fence);
+
+    if (FenceWatcher::isEnabled()) {
+        FenceWatcher::getInstance().watch(fence);
+    }
 }
 
 void FenceTimeline::updateSignalTimes() {
@@ -327,6 +372,135 @@ void FenceTimeline::updateSignalTimes() {
     }
 }
 
+// ============================================================================
+// FenceWatcher
+// ============================================================================
+std::atomic<bool> FenceWatcher::sEnabled{false};
+
+FenceWatcher& FenceWatcher::getInstance() {
+    // Never destroyed: the watcher thread may still be running at exit.
+    static FenceWatcher* const sInstance = new FenceWatcher();
+    return *sInstance;
+}
+
+void FenceWatcher::setEnabled(bool enabled) {
+    sEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool FenceWatcher::isEnabled() {
+    return sEnabled.load(std::memory_order_relaxed);
+}
+
+FenceWatcher::FenceWatcher() : mEpollFd(epoll_create1(EPOLL_CLOEXEC)) {
+    if (mEpollFd < 0) {
+        ALOGE("FenceWatcher: epoll_create1 failed: %s (%d)", strerror(errno), errno);
+        return;
+    }
+    mThread = std::thread(&FenceWatcher::threadMain, this);
+    pthread_setname_np(mThread.native_handle(), "FenceWatcher");
+}
+
+bool FenceWatcher::watch(const std::shared_ptr<FenceTime>& fenceTime) {
+    if (mEpollFd < 0 || !fenceTime || fenceTime->mState != FenceTime::State::VALID) {
+        return false;
+    }
+
+    // Only the first registration of a FenceTime counts; it may be pushed to
+    // several timelines.
+    if (fenceTime->mWatched.exchange(true, std::memory_order_acq_rel)) {
+        return true;
+    }
+
+    base::unique_fd fd;
+    {
+        std::lock_guard<std::mutex> lock(fenceTime->mMutex);
+        if (fenceTime->mFence.get() != nullptr) {
+            fd.reset(fenceTime->mFence->dup());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mStopped || fd < 0 || mEntries.size() >= MAX_WATCHED) {
+        fenceTime->mWatched.store(false, std::memory_order_release);
+        return false;
+    }
+
+    // The entry is added before the fd goes into the epoll set so the
+    // watcher thread always finds it, however quickly the fence signals.
+    const uint64_t id = mNextId++;
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = id;
+    const int epollFd = mEpollFd.get();
+    const int fenceFd = fd.get();
+    mEntries.emplace(id, Entry{fenceTime, std::move(fd)});
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fenceFd, &event) != 0) {
+        ALOGE("FenceWatcher: epoll_ctl failed: %s (%d)", strerror(errno), errno);
+        mEntries.erase(id);
+        fenceTime->mWatched.store(false, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+size_t FenceWatcher::getWatchedCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mEntries.size();
+}
+
+uint64_t FenceWatcher::getSignaledCount() const {
+    return mSignaledCount.load(std::memory_order_relaxed);
+}
+
+void FenceWatcher::threadMain() {
+    constexpr int kMaxEvents = 64;
+    epoll_event events[kMaxEvents];
+
+    while (true) {
+        const int count = epoll_wait(mEpollFd.get(), events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Anything else won't go away by retrying. Hand the fences back
+            // to their FenceTimes, which query them on their own again.
+            ALOGE("FenceWatcher: epoll_wait failed, stopping: %s (%d)", strerror(errno), errno);
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopped = true;
+            for (auto& [id, entry] : mEntries) {
+                if (std::shared_ptr<FenceTime> fenceTime = entry.fenceTime.lock()) {
+                    fenceTime->mWatched.store(false, std::memory_order_release);
+                }
+            }
+            mEntries.clear();
+            return;
+        }
+
+        for (int i = 0; i < count; i++) {
+            Entry entry;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                auto it = mEntries.find(events[i].data.u64);
+                if (it == mEntries.end()) {
+                    continue;
+                }
+                entry = std::move(it->second);
+                mEntries.erase(it);
+                epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, entry.fd.get(), nullptr);
+            }
+
+            std::shared_ptr<FenceTime> fenceTime = entry.fenceTime.lock();
+            if (fenceTime) {
+                // The fence has signaled (or errored), so this is the only
+                // query it will ever need.
+                fenceTime->querySignalTime();
+                fenceTime->mWatched.store(false, std::memory_order_release);
+                mSignaledCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
 // ============================================================================
 // FenceToFenceTimeMap
 // ============================================================================
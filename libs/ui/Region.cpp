@@ -19,6 +19,8 @@
 #include <inttypes.h>
 #include <limits.h>
 
+#include <algorithm>
+
 #include <android-base/stringprintf.h>
 
 #include <utils/Log.h>
@@ -377,6 +379,53 @@ Region& Region::scaleSelf(float sx, float sy) {
     return *this;
 }
 
+Region& Region::flipSelf(bool flipH, bool flipV, int w, int h) {
+    if ((!flipH && !flipV) || isEmpty()) {
+        return *this;
+    }
+#if defined(VALIDATE_REGIONS)
+    validate(*this, "flipSelf (before)");
+#endif
+    // the bounds (last element of mStorage) are mirrored along with the rects
+    for (Rect& rect : mStorage) {
+        if (flipH) {
+            const int32_t left = rect.left;
+            rect.left = w - rect.right;
+            rect.right = w - left;
+        }
+        if (flipV) {
+            const int32_t top = rect.top;
+            rect.top = h - rect.bottom;
+            rect.bottom = h - top;
+        }
+    }
+
+    if (mStorage.size() > 1) {
+        // Restore the Y-X ordering. Mirroring vertically reverses the order of
+        // the bands, mirroring horizontally reverses the spans within each band.
+        Rect* const begin = mStorage.data();
+        Rect* const end = begin + mStorage.size() - 1;
+        if (flipV) {
+            std::reverse(begin, end);
+        }
+        if (flipH != flipV) {
+            Rect* band = begin;
+            while (band != end) {
+                Rect* next = band + 1;
+                while (next != end && next->top == band->top) {
+                    next++;
+                }
+                std::reverse(band, next);
+                band = next;
+            }
+        }
+    }
+#if defined(VALIDATE_REGIONS)
+    validate(*this, "flipSelf (after)");
+#endif
+    return *this;
+}
+
 // ----------------------------------------------------------------------------
 
 const Region Region::merge(const Rect& rhs) const {
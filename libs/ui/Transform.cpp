@@ -19,6 +19,8 @@
 
 #include <math.h>
 
+#include <vector>
+
 #include <android-base/stringprintf.h>
 #include <cutils/compiler.h>
 #include <ui/Region.h>
@@ -247,8 +249,71 @@ Rect Transform::makeBounds(int w, int h) const {
     return transform( Rect(w, h) );
 }
 
+bool Transform::transformAxisAligned(float left, float top, float right, float bottom,
+                                     float* outLeft, float* outTop, float* outRight,
+                                     float* outBottom) const {
+    // The products and sums are kept in separate statements so that they round
+    // exactly like the general path in transform(vec2) where the zero terms drop
+    // out; this keeps the results bit-identical to mapping the four corners.
+    const uint32_t t = type();
+    const mat33& M(mMatrix);
+    float x0, x1, y0, y1;
+    if (t <= TRANSLATE) {
+        x0 = left + M[2][0];
+        x1 = right + M[2][0];
+        y0 = top + M[2][1];
+        y1 = bottom + M[2][1];
+    } else if (!((t >> 8) & (ROT_90 | ROT_INVALID))) {
+        // a 0
+        // 0 d
+        const float l = M[0][0] * left;
+        const float r = M[0][0] * right;
+        const float tp = M[1][1] * top;
+        const float b = M[1][1] * bottom;
+        x0 = l + M[2][0];
+        x1 = r + M[2][0];
+        y0 = tp + M[2][1];
+        y1 = b + M[2][1];
+    } else if (!((t >> 8) & ROT_INVALID)) {
+        // 0 c
+        // b 0
+        const float l = M[0][1] * left;
+        const float r = M[0][1] * right;
+        const float tp = M[1][0] * top;
+        const float b = M[1][0] * bottom;
+        x0 = tp + M[2][0];
+        x1 = b + M[2][0];
+        y0 = l + M[2][1];
+        y1 = r + M[2][1];
+    } else {
+        return false;
+    }
+    *outLeft = std::min(x0, x1);
+    *outRight = std::max(x0, x1);
+    *outTop = std::min(y0, y1);
+    *outBottom = std::max(y0, y1);
+    return true;
+}
+
 Rect Transform::transform(const Rect& bounds, bool roundOutwards) const {
     Rect r;
+    float left, top, right, bottom;
+    if (CC_LIKELY(transformAxisAligned(bounds.left, bounds.top, bounds.right, bounds.bottom,
+                                       &left, &top, &right, &bottom))) {
+        if (roundOutwards) {
+            r.left = static_cast<int32_t>(floorf(left));
+            r.top = static_cast<int32_t>(floorf(top));
+            r.right = static_cast<int32_t>(ceilf(right));
+            r.bottom = static_cast<int32_t>(ceilf(bottom));
+        } else {
+            r.left = static_cast<int32_t>(floorf(left + 0.5f));
+            r.top = static_cast<int32_t>(floorf(top + 0.5f));
+            r.right = static_cast<int32_t>(floorf(right + 0.5f));
+            r.bottom = static_cast<int32_t>(floorf(bottom + 0.5f));
+        }
+        return r;
+    }
+
     vec2 lt( bounds.left,  bounds.top    );
     vec2 rt( bounds.right, bounds.top    );
     vec2 lb( bounds.left,  bounds.bottom );
@@ -275,6 +340,12 @@ Rect Transform::transform(const Rect& bounds, bool roundOutwards) const {
 }
 
 FloatRect Transform::transform(const FloatRect& bounds) const {
+    FloatRect r;
+    if (CC_LIKELY(transformAxisAligned(bounds.left, bounds.top, bounds.right, bounds.bottom,
+                                       &r.left, &r.top, &r.right, &r.bottom))) {
+        return r;
+    }
+
     vec2 lt(bounds.left, bounds.top);
     vec2 rt(bounds.right, bounds.top);
     vec2 lb(bounds.left, bounds.bottom);
@@ -285,7 +356,6 @@ FloatRect Transform::transform(const FloatRect& bounds) const {
     lb = transform(lb);
     rb = transform(rb);
 
-    FloatRect r;
     r.left = std::min({lt[0], rt[0], lb[0], rb[0]});
     r.top = std::min({lt[1], rt[1], lb[1], rb[1]});
     r.right = std::max({lt[0], rt[0], lb[0], rb[0]});
@@ -297,11 +367,36 @@ FloatRect Transform::transform(const FloatRect& bounds) const {
 Region Transform::transform(const Region& reg) const {
     Region out;
     if (CC_UNLIKELY(type() > TRANSLATE)) {
-        if (CC_LIKELY(preserveRects())) {
-            Region::const_iterator it = reg.begin();
-            Region::const_iterator const end = reg.end();
-            while (it != end) {
-                out.orSelf(transform(*it++));
+        const uint32_t orient = getOrientation();
+        const mat33& M(mMatrix);
+        if (!(orient & (ROT_90 | ROT_INVALID)) && absIsOne(M[0][0]) && absIsOne(M[1][1]) &&
+            !reg.isEmpty()) {
+            // Pure flips keep the band structure of the region intact: mirroring
+            // only reverses the order of the bands and/or of the spans within a
+            // band, so the rects don't need to go through the rasterizer again.
+            const int xpos = static_cast<int>(floorf(tx() + 0.5f));
+            const int ypos = static_cast<int>(floorf(ty() + 0.5f));
+            const bool flipH = orient & FLIP_H;
+            const bool flipV = orient & FLIP_V;
+            out = reg;
+            out.flipSelf(flipH, flipV, xpos, ypos);
+            out.translateSelf(flipH ? 0 : xpos, flipV ? 0 : ypos);
+        } else if (CC_LIKELY(preserveRects())) {
+            // A 90 degree rotation turns bands into columns, so the rects have to
+            // be rasterized again. Merging them pairwise keeps the operands of
+            // each union balanced instead of growing one region rect by rect.
+            std::vector<Region> parts;
+            parts.reserve(reg.end() - reg.begin());
+            for (const Rect& rect : reg) {
+                parts.emplace_back(transform(rect));
+            }
+            for (size_t step = 1; step < parts.size(); step *= 2) {
+                for (size_t i = 0; i + step < parts.size(); i += 2 * step) {
+                    parts[i].orSelf(parts[i + step]);
+                }
+            }
+            if (!parts.empty()) {
+                out = parts[0];
             }
         } else {
             out.set(transform(reg.bounds()));
@@ -17,6 +17,7 @@
 #ifndef ANDROID_FENCE_TIME_H
 #define ANDROID_FENCE_TIME_H
 
+#include <android-base/unique_fd.h>
 #include <ui/Fence.h>
 #include <utils/Flattenable.h>
 #include <utils/Mutex.h>
@@ -25,17 +26,20 @@
 #include <atomic>
 #include <mutex>
 #include <queue>
+#include <thread>
 #include <unordered_map>
 
 namespace android {
 
 class FenceToFenceTimeMap;
+class FenceWatcher;
 
 // A wrapper around fence that only implements isValid and getSignalTime.
 // It automatically closes the fence in a thread-safe manner once the signal
 // time is known.
 class FenceTime {
 friend class FenceToFenceTimeMap;
+friend class FenceWatcher;
 public:
     // An atomic snapshot of the FenceTime that is flattenable.
     //
@@ -121,6 +125,20 @@ public:
 
     void signalForTest(nsecs_t signalTime);
 
+    // Process-wide counters for getSignalTime(). Sampling them once per frame
+    // shows how many sync_file_info calls the cached signal times (and the
+    // FenceWatcher) are saving.
+    struct Stats {
+        // Queries that reached the underlying Fence.
+        uint64_t signalTimeQueries = 0;
+        // Calls on a pending fence that were reported pending without a
+        // query, because the FenceWatcher has not seen the fence signal yet.
+        // Calls answered from a cached signal time are not counted, since
+        // they never needed a query.
+        uint64_t queriesAvoided = 0;
+    };
+    static Stats getStats();
+
 private:
     // For tests only. If forceValidForTest is true, then getSignalTime will
     // never return SIGNAL_TIME_INVALID and isValid will always return true.
@@ -134,12 +152,19 @@ private:
 
     const State mState{State::INVALID};
 
+    // Queries the underlying Fence and caches the result if it has signaled.
+    nsecs_t querySignalTime();
+
     // mMutex guards mFence and mSignalTime.
     // mSignalTime is also atomic since it is sometimes read outside the lock
     // for quick checks.
     mutable std::mutex mMutex;
     sp<Fence> mFence{Fence::NO_FENCE};
     std::atomic<nsecs_t> mSignalTime{Fence::SIGNAL_TIME_INVALID};
+
+    // Set while the FenceWatcher has the fence registered. In that case
+    // getSignalTime() leaves polling the fence to the watcher.
+    std::atomic<bool> mWatched{false};
 };
 
 // A queue of FenceTimes that are expected to signal in FIFO order.
@@ -170,6 +195,57 @@ private:
     std::queue<std::weak_ptr<FenceTime>> mQueue GUARDED_BY(mMutex);
 };
 
+// Watches the fences of pending FenceTimes from a single thread using one
+// epoll set, and records each signal time as soon as its fence signals.
+// SurfaceFlinger, FrameTimeline and TimeStats poll the same FenceTimes
+// repeatedly every frame; once a FenceTime is watched, those calls read the
+// cached value instead of calling sync_file_info on the fence each time.
+//
+// Watching is opt-in: FenceTimeline::push() registers its fences only after
+// setEnabled(true), and watch() may be called directly for other fences.
+// The watcher keeps a dup of the fence fd and a weak reference to the
+// FenceTime, so it never extends the lifetime of either.
+class FenceWatcher {
+public:
+    // Fences beyond this limit are not watched and are polled as before.
+    static constexpr size_t MAX_WATCHED = 1024;
+
+    static FenceWatcher& getInstance();
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    // Returns false if the fence could not be registered, in which case the
+    // FenceTime keeps querying its fence on its own.
+    bool watch(const std::shared_ptr<FenceTime>& fenceTime);
+
+    size_t getWatchedCount() const;
+    // Number of fences whose signal time was recorded by the watcher.
+    uint64_t getSignaledCount() const;
+
+private:
+    FenceWatcher();
+    ~FenceWatcher() = delete;
+
+    void threadMain();
+
+    struct Entry {
+        std::weak_ptr<FenceTime> fenceTime;
+        base::unique_fd fd;
+    };
+
+    static std::atomic<bool> sEnabled;
+
+    base::unique_fd mEpollFd;
+    mutable std::mutex mMutex;
+    std::unordered_map<uint64_t, Entry> mEntries GUARDED_BY(mMutex);
+    uint64_t mNextId GUARDED_BY(mMutex) = 0;
+    // Set once epoll_wait fails for good; nothing is watched after that.
+    bool mStopped GUARDED_BY(mMutex) = false;
+    std::atomic<uint64_t> mSignaledCount{0};
+    std::thread mThread;
+};
+
 // Used by test code to create or get FenceTimes for a given Fence.
 //
 // By design, Fences cannot be signaled from user space. However, this class
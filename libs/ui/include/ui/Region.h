@@ -91,6 +91,9 @@ public:
             // these translate rhs first
             Region&     translateSelf(int dx, int dy);
             Region&     scaleSelf(float sx, float sy);
+            // mirrors the region, mapping x to w - x when flipH is set
+            // and y to h - y when flipV is set
+            Region&     flipSelf(bool flipH, bool flipV, int w, int h);
             Region&     orSelf(const Region& rhs, int dx, int dy);
             Region&     xorSelf(const Region& rhs, int dx, int dy);
             Region&     andSelf(const Region& rhs, int dx, int dy);
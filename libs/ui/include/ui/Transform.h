@@ -127,6 +127,13 @@ private:
     static bool absIsOne(float f);
     static bool isZero(float f);
 
+    // maps a rectangle without going through the four corners when the transform
+    // is a translation, a scale+translation or a 90 degree rotation. Returns false
+    // if the general path must be used.
+    bool transformAxisAligned(float left, float top, float right, float bottom,
+                              float* outLeft, float* outTop, float* outRight,
+                              float* outBottom) const;
+
     mat33               mMatrix;
     mutable uint32_t    mType;
 };
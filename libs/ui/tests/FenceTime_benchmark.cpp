@@ -0,0 +1,106 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <ui/FenceTime.h>
+
+#include "SwSyncTimeline.h"
+
+namespace android {
+namespace {
+
+using namespace std::chrono_literals;
+
+// Number of places that poll each fence per frame; SurfaceFlinger's
+// timelines, FrameTimeline and TimeStats all look at the same present and
+// acquire fences.
+constexpr int kPollersPerFrame = 3;
+
+// Simulates |range(0)| outstanding fences, a frame's worth of which signal
+// per iteration, polled kPollersPerFrame times per frame. range(1) selects
+// whether the fences are registered with the FenceWatcher.
+void BM_PollOutstandingFences(benchmark::State& state) {
+    SwSyncTimeline timeline;
+    if (!timeline.isValid()) {
+        state.SkipWithError("sw_sync is not available");
+        return;
+    }
+
+    const size_t outstanding = static_cast<size_t>(state.range(0));
+    const bool watched = state.range(1) != 0;
+    constexpr uint32_t kSignaledPerFrame = 16;
+
+    uint32_t nextValue = 1;
+    std::vector<std::shared_ptr<FenceTime>> fences;
+    auto addFence = [&] {
+        auto fenceTime = std::make_shared<FenceTime>(timeline.createFence(nextValue++));
+        if (watched) {
+            FenceWatcher::getInstance().watch(fenceTime);
+        }
+        fences.push_back(std::move(fenceTime));
+    };
+    for (size_t i = 0; i < outstanding; i++) {
+        addFence();
+    }
+
+    const FenceTime::Stats before = FenceTime::getStats();
+    for (auto _ : state) {
+        state.PauseTiming();
+        timeline.inc(kSignaledPerFrame);
+        if (watched) {
+            // Give the watcher thread the chance it would have between
+            // vsyncs to record the fences that just signaled.
+            std::this_thread::sleep_for(1ms);
+        }
+        state.ResumeTiming();
+
+        for (int poller = 0; poller < kPollersPerFrame; poller++) {
+            for (const auto& fence : fences) {
+                benchmark::DoNotOptimize(fence->getSignalTime());
+            }
+        }
+
+        state.PauseTiming();
+        fences.erase(fences.begin(), fences.begin() + kSignaledPerFrame);
+        for (uint32_t i = 0; i < kSignaledPerFrame; i++) {
+            addFence();
+        }
+        state.ResumeTiming();
+    }
+    const FenceTime::Stats after = FenceTime::getStats();
+
+    const double frames = static_cast<double>(state.iterations());
+    state.counters["queries/frame"] =
+            static_cast<double>(after.signalTimeQueries - before.signalTimeQueries) / frames;
+    state.counters["avoided/frame"] =
+            static_cast<double>(after.queriesAvoided - before.queriesAvoided) / frames;
+
+    // Signal what's left so the watcher drops its references.
+    timeline.inc(static_cast<uint32_t>(outstanding));
+}
+BENCHMARK(BM_PollOutstandingFences)
+        ->ArgsProduct({{64, 256, 512}, {0, 1}})
+        ->ArgNames({"fences", "watched"})
+        ->Unit(benchmark::kMicrosecond);
+
+} // namespace
+} // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <thread>
+
+#include <ui/FenceTime.h>
+
+#include <gtest/gtest.h>
+
+#include "SwSyncTimeline.h"
+
+namespace android {
+
+using namespace std::chrono_literals;
+
+class FenceWatcherTest : public testing::Test {
+protected:
+    void SetUp() override {
+        if (!mTimeline.isValid()) {
+            GTEST_SKIP() << "sw_sync is not available";
+        }
+    }
+
+    // Waits for the watcher thread to pick up |fenceTime|.
+    static bool waitForCachedSignalTime(const std::shared_ptr<FenceTime>& fenceTime) {
+        for (int i = 0; i < 500; i++) {
+            if (fenceTime->getCachedSignalTime() != Fence::SIGNAL_TIME_PENDING) {
+                return true;
+            }
+            std::this_thread::sleep_for(1ms);
+        }
+        return false;
+    }
+
+    SwSyncTimeline mTimeline;
+};
+
+TEST_F(FenceWatcherTest, recordsSignalTime) {
+    auto fenceTime = std::make_shared<FenceTime>(mTimeline.createFence(1));
+    ASSERT_TRUE(FenceWatcher::getInstance().watch(fenceTime));
+
+    const FenceTime::Stats before = FenceTime::getStats();
+    EXPECT_EQ(Fence::SIGNAL_TIME_PENDING, fenceTime->getSignalTime());
+    const FenceTime::Stats pending = FenceTime::getStats();
+    EXPECT_EQ(before.signalTimeQueries, pending.signalTimeQueries);
+    EXPECT_EQ(before.queriesAvoided + 1, pending.queriesAvoided);
+
+    mTimeline.inc(1);
+    ASSERT_TRUE(waitForCachedSignalTime(fenceTime));
+    const FenceTime::Stats signaled = FenceTime::getStats();
+    EXPECT_TRUE(Fence::isValidTimestamp(fenceTime->getSignalTime()));
+    // Reading the cached signal time neither queries the fence nor avoids a query.
+    const FenceTime::Stats cached = FenceTime::getStats();
+    EXPECT_EQ(signaled.signalTimeQueries, cached.signalTimeQueries);
+    EXPECT_EQ(signaled.queriesAvoided, cached.queriesAvoided);
+}
+
+TEST_F(FenceWatcherTest, waitUpdatesSignalTime) {
+    auto fenceTime = std::make_shared<FenceTime>(mTimeline.createFence(1));
+    ASSERT_TRUE(FenceWatcher::getInstance().watch(fenceTime));
+
+    std::thread signaler([&] {
+        std::this_thread::sleep_for(5ms);
+        mTimeline.inc(1);
+    });
+    EXPECT_EQ(NO_ERROR, fenceTime->wait(Fence::TIMEOUT_NEVER));
+    EXPECT_TRUE(Fence::isValidTimestamp(fenceTime->getSignalTime()));
+    signaler.join();
+}
+
+TEST_F(FenceWatcherTest, toleratesExpiredFenceTimes) {
+    {
+        auto fenceTime = std::make_shared<FenceTime>(mTimeline.createFence(1));
+        ASSERT_TRUE(FenceWatcher::getInstance().watch(fenceTime));
+    }
+    mTimeline.inc(1);
+
+    auto fenceTime = std::make_shared<FenceTime>(mTimeline.createFence(2));
+    ASSERT_TRUE(FenceWatcher::getInstance().watch(fenceTime));
+    mTimeline.inc(1);
+    ASSERT_TRUE(waitForCachedSignalTime(fenceTime));
+}
+
+TEST_F(FenceWatcherTest, timelineRegistersWhenEnabled) {
+    FenceWatcher::setEnabled(true);
+    FenceTimeline timeline;
+    auto fenceTime = std::make_shared<FenceTime>(mTimeline.createFence(1));
+    timeline.push(fenceTime);
+    FenceWatcher::setEnabled(false);
+
+    mTimeline.inc(1);
+    ASSERT_TRUE(waitForCachedSignalTime(fenceTime));
+    timeline.updateSignalTimes();
+}
+
+TEST(FenceWatcherNoSyncTest, rejectsInvalidFences) {
+    EXPECT_FALSE(FenceWatcher::getInstance().watch(FenceTime::NO_FENCE));
+    EXPECT_FALSE(FenceWatcher::getInstance().watch(nullptr));
+    EXPECT_FALSE(FenceWatcher::getInstance().watch(std::make_shared<FenceTime>(123)));
+}
+
+} // namespace android
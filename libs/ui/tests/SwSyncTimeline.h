@@ -0,0 +1,69 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <linux/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <android-base/unique_fd.h>
+#include <ui/Fence.h>
+
+namespace android {
+
+// Minimal user space sync timeline for tests, using the sw_sync debug
+// interface directly (libsync keeps its sw_sync helpers private).
+class SwSyncTimeline {
+public:
+    SwSyncTimeline() {
+        mFd.reset(open("/sys/kernel/debug/sync/sw_sync", O_RDWR | O_CLOEXEC));
+        if (mFd < 0) {
+            mFd.reset(open("/dev/sw_sync", O_RDWR | O_CLOEXEC));
+        }
+    }
+
+    bool isValid() const { return mFd >= 0; }
+
+    // Creates a fence that signals once the timeline reaches |value|.
+    sp<Fence> createFence(uint32_t value) {
+        CreateFenceData data = {};
+        data.value = value;
+        snprintf(data.name, sizeof(data.name), "fence%u", value);
+        if (ioctl(mFd.get(), SW_SYNC_IOC_CREATE_FENCE, &data) != 0) {
+            return Fence::NO_FENCE;
+        }
+        return sp<Fence>(new Fence(data.fence));
+    }
+
+    // Advances the timeline, signaling the fences it passes.
+    void inc(uint32_t count) { ioctl(mFd.get(), SW_SYNC_IOC_INC, &count); }
+
+private:
+    struct CreateFenceData {
+        __u32 value;
+        char name[32];
+        __s32 fence;
+    };
+    static constexpr unsigned long SW_SYNC_IOC_CREATE_FENCE = _IOWR('W', 0, CreateFenceData);
+    static constexpr unsigned long SW_SYNC_IOC_INC = _IOW('W', 1, __u32);
+
+    base::unique_fd mFd;
+};
+
+} // namespace android
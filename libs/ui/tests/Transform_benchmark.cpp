@@ -0,0 +1,109 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+#include <ui/Transform.h>
+
+namespace android::ui {
+namespace {
+
+// Layer geometry as SurfaceFlinger sees it: a display-sized transform applied
+// to buffer crops and to visible/damage regions made of many small rects.
+Transform makeTransform(int64_t kind) {
+    switch (kind) {
+        case 0: {
+            Transform t;
+            t.set(120.f, 48.f);
+            return t;
+        }
+        case 1: {
+            Transform t;
+            t.set(0.5f, 0.f, 0.f, 0.5f);
+            t.set(120.f, 48.f);
+            return t;
+        }
+        case 2:
+            return Transform(Transform::ROT_90, 1080, 2340);
+        case 3:
+            return Transform(Transform::ROT_180, 1080, 2340);
+        default: {
+            Transform t;
+            t.set(0.9f, 0.1f, -0.1f, 0.9f);
+            return t;
+        }
+    }
+}
+
+const char* const kKindNames[] = {"translate", "scale", "rot90", "rot180", "skew"};
+
+Region makeRegion(int count) {
+    Region region;
+    for (int i = 0; i < count; i++) {
+        const int x = (i * 37) % 1000;
+        const int y = (i * 53) % 2200;
+        region.orSelf(Rect(x, y, x + 24, y + 16));
+    }
+    return region;
+}
+
+void BM_TransformRect(benchmark::State& state) {
+    const Transform t = makeTransform(state.range(0));
+    state.SetLabel(kKindNames[state.range(0)]);
+    Rect rect(10, 20, 1070, 2300);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(rect);
+        benchmark::DoNotOptimize(t.transform(rect));
+    }
+}
+BENCHMARK(BM_TransformRect)->DenseRange(0, 4);
+
+void BM_TransformFloatRect(benchmark::State& state) {
+    const Transform t = makeTransform(state.range(0));
+    state.SetLabel(kKindNames[state.range(0)]);
+    FloatRect rect(10.5f, 20.f, 1070.f, 2300.25f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(rect);
+        benchmark::DoNotOptimize(t.transform(rect));
+    }
+}
+BENCHMARK(BM_TransformFloatRect)->DenseRange(0, 4);
+
+void BM_TransformRegion(benchmark::State& state) {
+    const Transform t = makeTransform(state.range(0));
+    const Region region = makeRegion(static_cast<int>(state.range(1)));
+    state.SetLabel(kKindNames[state.range(0)]);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(t.transform(region));
+    }
+}
+BENCHMARK(BM_TransformRegion)->ArgsProduct({{0, 2, 3}, {1, 16, 128}});
+
+void BM_Inverse(benchmark::State& state) {
+    const Transform t = makeTransform(state.range(0));
+    state.SetLabel(kKindNames[state.range(0)]);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(t.inverse());
+    }
+}
+BENCHMARK(BM_Inverse)->DenseRange(0, 4);
+
+} // namespace
+} // namespace android::ui
+
+BENCHMARK_MAIN();
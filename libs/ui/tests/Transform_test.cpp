@@ -0,0 +1,196 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <ui/FloatRect.h>
+#include <ui/Rect.h>
+#include <ui/Region.h>
+#include <ui/Transform.h>
+
+#include <gtest/gtest.h>
+
+namespace android::ui {
+
+namespace {
+
+const uint32_t kOrientations[] = {
+        Transform::ROT_0,   Transform::FLIP_H,  Transform::FLIP_V,
+        Transform::ROT_90,  Transform::ROT_180, Transform::ROT_270,
+        Transform::ROT_90 | Transform::FLIP_H,  Transform::ROT_90 | Transform::FLIP_V,
+};
+
+// Maps the four corners through the matrix, which is what Transform did for
+// every rectangle before the axis-aligned kernels were added.
+FloatRect mapCorners(const Transform& t, const FloatRect& bounds) {
+    const vec2 lt = t.transform(vec2(bounds.left, bounds.top));
+    const vec2 rt = t.transform(vec2(bounds.right, bounds.top));
+    const vec2 lb = t.transform(vec2(bounds.left, bounds.bottom));
+    const vec2 rb = t.transform(vec2(bounds.right, bounds.bottom));
+    return FloatRect(std::min({lt[0], rt[0], lb[0], rb[0]}), std::min({lt[1], rt[1], lb[1], rb[1]}),
+                     std::max({lt[0], rt[0], lb[0], rb[0]}), std::max({lt[1], rt[1], lb[1], rb[1]}));
+}
+
+Rect mapCorners(const Transform& t, const Rect& bounds, bool roundOutwards) {
+    const FloatRect f = mapCorners(t, bounds.toFloatRect());
+    if (roundOutwards) {
+        return Rect(static_cast<int32_t>(floorf(f.left)), static_cast<int32_t>(floorf(f.top)),
+                    static_cast<int32_t>(ceilf(f.right)), static_cast<int32_t>(ceilf(f.bottom)));
+    }
+    return Rect(static_cast<int32_t>(floorf(f.left + 0.5f)),
+                static_cast<int32_t>(floorf(f.top + 0.5f)),
+                static_cast<int32_t>(floorf(f.right + 0.5f)),
+                static_cast<int32_t>(floorf(f.bottom + 0.5f)));
+}
+
+std::vector<Transform> makeTransforms() {
+    std::vector<Transform> transforms;
+    transforms.emplace_back();
+    for (uint32_t orientation : kOrientations) {
+        transforms.emplace_back(orientation, 1080, 2340);
+    }
+
+    Transform translate;
+    translate.set(-12.25f, 37.5f);
+    transforms.push_back(translate);
+
+    Transform scale;
+    scale.set(1.5f, 0.f, 0.f, 0.75f);
+    scale.set(3.f, -7.25f);
+    transforms.push_back(scale);
+
+    Transform flipScale;
+    flipScale.set(-0.5f, 0.f, 0.f, 2.f);
+    flipScale.set(100.f, 0.f);
+    transforms.push_back(flipScale);
+
+    Transform rotScale;
+    rotScale.set(0.f, -1.25f, 0.5f, 0.f);
+    rotScale.set(640.3f, 12.f);
+    transforms.push_back(rotScale);
+
+    Transform skew;
+    skew.set(1.f, 0.5f, 0.25f, 1.f);
+    transforms.push_back(skew);
+
+    for (const Transform& t : std::vector<Transform>(transforms)) {
+        transforms.push_back(t * Transform(Transform::ROT_90, 400, 300));
+    }
+    return transforms;
+}
+
+const Rect kRects[] = {
+        Rect(0, 0, 1080, 2340), Rect(10, 20, 30, 40),     Rect(-5, -7, 13, 900),
+        Rect(3, 3, 3, 3),       Rect(100, 200, 50, 20),   Rect::INVALID_RECT,
+        Rect(-2000, 17, 0, 18),
+};
+
+Region makeRegion() {
+    Region region;
+    region.orSelf(Rect(0, 0, 100, 10));
+    region.orSelf(Rect(10, 5, 40, 60));
+    region.orSelf(Rect(60, 20, 90, 80));
+    region.orSelf(Rect(0, 70, 5, 120));
+    region.orSelf(Rect(120, 70, 130, 75));
+    return region;
+}
+
+Region mapRectByRect(const Transform& t, const Region& region) {
+    Region out;
+    for (const Rect& rect : region) {
+        out.orSelf(t.transform(rect));
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(TransformTest, rectMatchesCornerMapping) {
+    for (const Transform& t : makeTransforms()) {
+        for (const Rect& rect : kRects) {
+            SCOPED_TRACE(testing::PrintToString(t));
+            EXPECT_EQ(mapCorners(t, rect, false), t.transform(rect, false));
+            EXPECT_EQ(mapCorners(t, rect, true), t.transform(rect, true));
+        }
+    }
+}
+
+TEST(TransformTest, floatRectMatchesCornerMapping) {
+    for (const Transform& t : makeTransforms()) {
+        for (const Rect& rect : kRects) {
+            SCOPED_TRACE(testing::PrintToString(t));
+            const FloatRect bounds = rect.toFloatRect();
+            EXPECT_EQ(mapCorners(t, bounds), t.transform(bounds));
+        }
+    }
+}
+
+TEST(TransformTest, inverseTracksModifications) {
+    Transform t(Transform::ROT_90, 1080, 2340);
+    const Transform inverse = t.inverse();
+    EXPECT_EQ(inverse, t.inverse());
+    EXPECT_EQ(Rect(0, 0, 1080, 2340), inverse.transform(t.transform(Rect(0, 0, 1080, 2340))));
+
+    t.set(5.f, 6.f);
+    EXPECT_EQ(vec2(1.f, 2.f), t.inverse().transform(t.transform(vec2(1.f, 2.f))));
+
+    t.set(2.f, 0.f, 0.f, 4.f);
+    EXPECT_EQ(vec2(1.f, 2.f), t.inverse().transform(t.transform(vec2(1.f, 2.f))));
+
+    t.reset();
+    EXPECT_EQ(Transform(), t.inverse());
+
+    // copies and products invert to their own matrix
+    Transform scaled(Transform::FLIP_H, 100, 100);
+    const Transform scaledInverse = scaled.inverse();
+    Transform copy(scaled);
+    EXPECT_EQ(scaledInverse, copy.inverse());
+    copy = scaled * 2.f;
+    EXPECT_FALSE(scaledInverse == copy.inverse());
+}
+
+TEST(TransformTest, regionMatchesRectByRect) {
+    const Region region = makeRegion();
+    for (uint32_t orientation : kOrientations) {
+        for (float tx : {0.f, 7.f, 640.4f, -3.6f}) {
+            Transform t(orientation, 1080, 2340);
+            t.set(t.tx() + tx, t.ty() - tx);
+            SCOPED_TRACE(testing::PrintToString(t));
+            const Region expected = mapRectByRect(t, region);
+            const Region actual = t.transform(region);
+            EXPECT_TRUE(expected.hasSameRects(actual));
+            EXPECT_EQ(expected.getBounds(), actual.getBounds());
+        }
+    }
+}
+
+TEST(TransformTest, regionFlipSingleRect) {
+    const Region region(Rect(10, 20, 30, 40));
+    const Transform t(Transform::ROT_180, 100, 200);
+    const Region out = t.transform(region);
+    EXPECT_TRUE(out.isRect());
+    EXPECT_EQ(Rect(70, 160, 90, 180), out.getBounds());
+}
+
+TEST(TransformTest, regionFlipEmpty) {
+    const Transform t(Transform::FLIP_V, 100, 200);
+    EXPECT_TRUE(t.transform(Region()).isEmpty());
+}
+
+} // namespace android::ui
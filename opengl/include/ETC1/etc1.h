@@ -67,6 +67,14 @@ etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height);
 int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut);
 
+// Same as etc1_encode_image, but splits the image into bands of block rows that
+// are encoded on up to threadCount threads. A threadCount of 0 uses one thread
+// per CPU. The output is identical to etc1_encode_image.
+
+int etc1_encode_image_threaded(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut,
+        etc1_uint32 threadCount);
+
 // Decode an entire image.
 // pIn - pointer to encoded data.
 // pOut - pointer to the image data. Will be written such that
@@ -79,6 +87,14 @@ int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
         etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride);
 
+// Same as etc1_decode_image, but decodes bands of block rows on up to
+// threadCount threads. A threadCount of 0 uses one thread per CPU.
+
+int etc1_decode_image_threaded(const etc1_byte* pIn, etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_uint32 threadCount);
+
 // Size of a PKM header, in bytes.
 
 #define ETC_PKM_HEADER_SIZE 16
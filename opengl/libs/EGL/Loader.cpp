@@ -28,6 +28,9 @@
 #include <utils/Timers.h>
 #include <vndksupport/linker.h>
 
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
 #include <string>
 
 #include "EGL/eglext_angle.h"
@@ -171,6 +174,8 @@ static void uninit_api(char const* const* api, __eglMustCastToProperFunctionPoin
     }
 }
 
+static void reset_lazy_api(int index);
+
 void Loader::unload_system_driver(egl_connection_t* cnx) {
     ATRACE_CALL();
 
@@ -183,6 +188,8 @@ void Loader::unload_system_driver(egl_connection_t* cnx) {
                        ->hooks[egl_connection_t::GLESv1_INDEX]
                        ->gl);
     uninit_api(egl_names, (__eglMustCastToProperFunctionPointerType*)&cnx->egl);
+    reset_lazy_api(egl_connection_t::GLESv2_INDEX);
+    reset_lazy_api(egl_connection_t::GLESv1_INDEX);
 
     if (cnx->dso) {
         ALOGD("Unload system gl driver.");
@@ -313,6 +320,56 @@ void Loader::close(egl_connection_t* cnx)
     cnx->useAngle = false;
 }
 
+static __eglMustCastToProperFunctionPointerType find_api_entry(
+        void* dso, char const* name, Loader::getProcAddressType getProcAddress) {
+    const ssize_t SIZE = 256;
+    char scrap[SIZE];
+
+    __eglMustCastToProperFunctionPointerType f =
+        (__eglMustCastToProperFunctionPointerType)dlsym(dso, name);
+    if (f == nullptr) {
+        // couldn't find the entry-point, use eglGetProcAddress()
+        f = getProcAddress(name);
+    }
+    if (f == nullptr) {
+        // Try without the OES postfix
+        ssize_t index = ssize_t(strlen(name)) - 3;
+        if ((index>0 && (index<SIZE-1)) && (!strcmp(name+index, "OES"))) {
+            strncpy(scrap, name, index);
+            scrap[index] = 0;
+            f = (__eglMustCastToProperFunctionPointerType)dlsym(dso, scrap);
+            //ALOGD_IF(f, "found <%s> instead", scrap);
+        }
+    }
+    if (f == nullptr) {
+        // Try with the OES postfix
+        ssize_t index = ssize_t(strlen(name)) - 3;
+        if (index>0 && strcmp(name+index, "OES")) {
+            snprintf(scrap, SIZE, "%sOES", name);
+            f = (__eglMustCastToProperFunctionPointerType)dlsym(dso, scrap);
+            //ALOGD_IF(f, "found <%s> instead", scrap);
+        }
+    }
+    if (f == nullptr) {
+        //ALOGD("%s", name);
+        f = (__eglMustCastToProperFunctionPointerType)gl_unimplemented;
+
+        /*
+         * GL_EXT_debug_marker is special, we always report it as
+         * supported, it's handled by GLES_trace. If GLES_trace is not
+         * enabled, then these are no-ops.
+         */
+        if (!strcmp(name, "glInsertEventMarkerEXT")) {
+            f = (__eglMustCastToProperFunctionPointerType)gl_noop;
+        } else if (!strcmp(name, "glPushGroupMarkerEXT")) {
+            f = (__eglMustCastToProperFunctionPointerType)gl_noop;
+        } else if (!strcmp(name, "glPopGroupMarkerEXT")) {
+            f = (__eglMustCastToProperFunctionPointerType)gl_noop;
+        }
+    }
+    return f;
+}
+
 void Loader::init_api(void* dso,
         char const * const * api,
         char const * const * ref_api,
@@ -321,8 +378,6 @@ void Loader::init_api(void* dso,
 {
     ATRACE_CALL();
 
-    const ssize_t SIZE = 256;
-    char scrap[SIZE];
     while (*api) {
         char const * name = *api;
         if (ref_api) {
@@ -334,54 +389,140 @@ void Loader::init_api(void* dso,
             }
         }
 
-        __eglMustCastToProperFunctionPointerType f =
-            (__eglMustCastToProperFunctionPointerType)dlsym(dso, name);
-        if (f == nullptr) {
-            // couldn't find the entry-point, use eglGetProcAddress()
-            f = getProcAddress(name);
-        }
-        if (f == nullptr) {
-            // Try without the OES postfix
-            ssize_t index = ssize_t(strlen(name)) - 3;
-            if ((index>0 && (index<SIZE-1)) && (!strcmp(name+index, "OES"))) {
-                strncpy(scrap, name, index);
-                scrap[index] = 0;
-                f = (__eglMustCastToProperFunctionPointerType)dlsym(dso, scrap);
-                //ALOGD_IF(f, "found <%s> instead", scrap);
-            }
-        }
-        if (f == nullptr) {
-            // Try with the OES postfix
-            ssize_t index = ssize_t(strlen(name)) - 3;
-            if (index>0 && strcmp(name+index, "OES")) {
-                snprintf(scrap, SIZE, "%sOES", name);
-                f = (__eglMustCastToProperFunctionPointerType)dlsym(dso, scrap);
-                //ALOGD_IF(f, "found <%s> instead", scrap);
-            }
-        }
-        if (f == nullptr) {
-            //ALOGD("%s", name);
-            f = (__eglMustCastToProperFunctionPointerType)gl_unimplemented;
-
-            /*
-             * GL_EXT_debug_marker is special, we always report it as
-             * supported, it's handled by GLES_trace. If GLES_trace is not
-             * enabled, then these are no-ops.
-             */
-            if (!strcmp(name, "glInsertEventMarkerEXT")) {
-                f = (__eglMustCastToProperFunctionPointerType)gl_noop;
-            } else if (!strcmp(name, "glPushGroupMarkerEXT")) {
-                f = (__eglMustCastToProperFunctionPointerType)gl_noop;
-            } else if (!strcmp(name, "glPopGroupMarkerEXT")) {
-                f = (__eglMustCastToProperFunctionPointerType)gl_noop;
-            }
-        }
-        *curr++ = f;
+        *curr++ = find_api_entry(dso, name, getProcAddress);
         api++;
         if (ref_api) ref_api++;
     }
 }
 
+// ----------------------------------------------------------------------------
+// Lazy binding of the GLES hook tables
+//
+// Resolving every entry point in entries.in with dlsym() takes a noticeable
+// part of the first eglInitialize() of each process, although most apps only
+// ever call a small fraction of the API. When ro.egl.lazy_binding is set, the
+// gl_hooks_t tables are instead filled with per-entry resolver thunks. The
+// first call through a thunk looks the entry point up, caches it and patches
+// the hook table so that later calls go straight to the driver.
+//
+// The slot of each entry point is computed at compile time from entries.in,
+// and slot N of gl_hooks_t::gl_t is always named gl_names[N], so resolving a
+// thunk never needs to search for its name.
+// ----------------------------------------------------------------------------
+
+static constexpr size_t NUM_GL_ENTRIES =
+        sizeof(gl_hooks_t::gl_t) / sizeof(__eglMustCastToProperFunctionPointerType);
+
+struct lazy_api_t {
+    void* dso = nullptr;
+    Loader::getProcAddressType getProcAddress = nullptr;
+    __eglMustCastToProperFunctionPointerType* hooks = nullptr;
+    std::atomic<__eglMustCastToProperFunctionPointerType> resolved[NUM_GL_ENTRIES] = {};
+};
+
+// Indexed by egl_connection_t::GLESv1_INDEX / GLESv2_INDEX
+static lazy_api_t sLazyApis[2];
+
+static __eglMustCastToProperFunctionPointerType const* get_lazy_thunks(int index);
+
+static __eglMustCastToProperFunctionPointerType resolve_lazy_entry(int index, size_t slot) {
+    lazy_api_t& state = sLazyApis[index];
+    __eglMustCastToProperFunctionPointerType f =
+            state.resolved[slot].load(std::memory_order_acquire);
+    if (f) {
+        return f;
+    }
+
+    // Two threads racing here resolve the same symbol, so either result is fine.
+    f = find_api_entry(state.dso, gl_names[slot], state.getProcAddress);
+    state.resolved[slot].store(f, std::memory_order_release);
+
+    // Only replace the thunk: layers and the GL_EXT_debug_marker fixup in
+    // egl_context_t::onMakeCurrent may already have installed something else.
+    __eglMustCastToProperFunctionPointerType thunk = get_lazy_thunks(index)[slot];
+    __atomic_compare_exchange_n(&state.hooks[slot], &thunk, f, false, __ATOMIC_RELEASE,
+                                __ATOMIC_RELAXED);
+    return f;
+}
+
+template <int Index, size_t Slot, typename Fn>
+struct lazy_thunk;
+
+template <int Index, size_t Slot, typename R, typename... Args>
+struct lazy_thunk<Index, Slot, R (*)(Args...)> {
+    static R call(Args... args) {
+        auto f = reinterpret_cast<R (*)(Args...)>(resolve_lazy_entry(Index, Slot));
+        return f(args...);
+    }
+};
+
+#undef GL_ENTRY
+#define GL_ENTRY(_r, _api, ...)                                                              \
+    reinterpret_cast<__eglMustCastToProperFunctionPointerType>(                              \
+            &lazy_thunk<Index,                                                               \
+                        offsetof(gl_hooks_t::gl_t, _api) /                                   \
+                                sizeof(__eglMustCastToProperFunctionPointerType),            \
+                        decltype(gl_hooks_t::gl_t::_api)>::call),
+
+template <int Index>
+static __eglMustCastToProperFunctionPointerType const sLazyThunks[] = {
+#include "../entries.in"
+};
+
+#undef GL_ENTRY
+
+static_assert(NELEM(sLazyThunks<egl_connection_t::GLESv2_INDEX>) == NUM_GL_ENTRIES,
+              "entries.in and gl_hooks_t::gl_t are out of sync");
+
+static __eglMustCastToProperFunctionPointerType const* get_lazy_thunks(int index) {
+    return index == egl_connection_t::GLESv1_INDEX
+            ? sLazyThunks<egl_connection_t::GLESv1_INDEX>
+            : sLazyThunks<egl_connection_t::GLESv2_INDEX>;
+}
+
+static void reset_lazy_api(int index) {
+    lazy_api_t& state = sLazyApis[index];
+    for (auto& entry : state.resolved) {
+        entry.store(nullptr, std::memory_order_relaxed);
+    }
+    state.dso = nullptr;
+    state.getProcAddress = nullptr;
+    state.hooks = nullptr;
+}
+
+static bool use_lazy_binding() {
+    static const bool lazy = base::GetBoolProperty("ro.egl.lazy_binding", false);
+    return lazy;
+}
+
+void Loader::init_api_lazy(void* dso,
+        char const * const * ref_api,
+        int index,
+        __eglMustCastToProperFunctionPointerType* curr,
+        getProcAddressType getProcAddress)
+{
+    ATRACE_CALL();
+
+    reset_lazy_api(index);
+    lazy_api_t& state = sLazyApis[index];
+    state.dso = dso;
+    state.getProcAddress = getProcAddress;
+    state.hooks = curr;
+
+    __eglMustCastToProperFunctionPointerType const* thunks = get_lazy_thunks(index);
+    char const * const * api = gl_names;
+    for (size_t slot = 0; *api; slot++, api++) {
+        if (ref_api) {
+            if (!*ref_api || std::strcmp(*api, *ref_api) != 0) {
+                curr[slot] = nullptr;
+                continue;
+            }
+            ref_api++;
+        }
+        curr[slot] = thunks[slot];
+    }
+}
+
 static void* load_system_driver(const char* kind, const char* suffix, const bool exact) {
     ATRACE_CALL();
     class MatchFile {
@@ -651,19 +792,34 @@ void Loader::initialize_api(void* dso, egl_connection_t* cnx, uint32_t mask) {
         }
     }
 
+    const nsecs_t bindTime = systemTime();
+    const bool lazy = use_lazy_binding();
+
     if (mask & GLESv1_CM) {
-        init_api(dso, gl_names_1, gl_names,
+        __eglMustCastToProperFunctionPointerType* curr =
             (__eglMustCastToProperFunctionPointerType*)
-                &cnx->hooks[egl_connection_t::GLESv1_INDEX]->gl,
-            getProcAddress);
+                &cnx->hooks[egl_connection_t::GLESv1_INDEX]->gl;
+        if (lazy) {
+            init_api_lazy(dso, gl_names_1, egl_connection_t::GLESv1_INDEX, curr,
+                    getProcAddress);
+        } else {
+            init_api(dso, gl_names_1, gl_names, curr, getProcAddress);
+        }
     }
 
     if (mask & GLESv2) {
-        init_api(dso, gl_names, nullptr,
+        __eglMustCastToProperFunctionPointerType* curr =
             (__eglMustCastToProperFunctionPointerType*)
-                &cnx->hooks[egl_connection_t::GLESv2_INDEX]->gl,
-            getProcAddress);
+                &cnx->hooks[egl_connection_t::GLESv2_INDEX]->gl;
+        if (lazy) {
+            init_api_lazy(dso, nullptr, egl_connection_t::GLESv2_INDEX, curr, getProcAddress);
+        } else {
+            init_api(dso, gl_names, nullptr, curr, getProcAddress);
+        }
     }
+
+    ALOGV("%s GLES entry points in %" PRId64 " us", lazy ? "installed lazy" : "resolved",
+          ns2us(systemTime() - bindTime));
 }
 
 } // namespace android
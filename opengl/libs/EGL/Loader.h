@@ -25,8 +25,10 @@ namespace android {
 struct egl_connection_t;
 
 class Loader {
+public:
     typedef __eglMustCastToProperFunctionPointerType (* getProcAddressType)(const char*);
 
+private:
     enum {
         EGL         = 0x01,
         GLESv1_CM   = 0x02,
@@ -63,6 +65,9 @@ private:
                                                    const char* const* ref_api,
                                                    __eglMustCastToProperFunctionPointerType* curr,
                                                    getProcAddressType getProcAddress);
+    static void init_api_lazy(void* dso, const char* const* ref_api, int index,
+                              __eglMustCastToProperFunctionPointerType* curr,
+                              getProcAddressType getProcAddress);
 };
 
 }; // namespace android
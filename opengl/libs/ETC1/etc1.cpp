@@ -16,6 +16,10 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <thread>
+#include <vector>
+
 /* From http://www.khronos.org/registry/gles/extensions/OES/OES_compressed_ETC1_RGB8_texture.txt
 
  The number of bits that represent a 4x4 texel block is 64 bits if
@@ -166,6 +170,15 @@ inline int convertDiff(int base, int diff) {
 static
 void decode_subblock(etc1_byte* pOut, int r, int g, int b, const int* table,
         etc1_uint32 low, bool second, bool flipped) {
+    // A sub-block can only decode to four distinct colors, so compute them
+    // once and copy them out by pixel index.
+    etc1_byte palette[4][3];
+    for (int i = 0; i < 4; i++) {
+        int delta = table[i];
+        palette[i][0] = clamp(r + delta);
+        palette[i][1] = clamp(g + delta);
+        palette[i][2] = clamp(b + delta);
+    }
     int baseX = 0;
     int baseY = 0;
     if (second) {
@@ -186,11 +199,10 @@ void decode_subblock(etc1_byte* pOut, int r, int g, int b, const int* table,
         }
         int k = y + (x * 4);
         int offset = ((low >> k) & 1) | ((low >> (k + 15)) & 2);
-        int delta = table[offset];
         etc1_byte* q = pOut + 3 * (x + 4 * y);
-        *q++ = clamp(r + delta);
-        *q++ = clamp(g + delta);
-        *q++ = clamp(b + delta);
+        q[0] = palette[offset][0];
+        q[1] = palette[offset][1];
+        q[2] = palette[offset][2];
     }
 }
 
@@ -295,47 +307,31 @@ inline int square(int x) {
     return x * x;
 }
 
-static etc1_uint32 chooseModifier(const etc1_byte* pBaseColors,
-        const etc1_byte* pIn, etc1_uint32 *pLow, int bitIndex,
-        const int* pModifierTable) {
-    etc1_uint32 bestScore = ~0;
-    int bestIndex = 0;
-    int pixelR = pIn[0];
-    int pixelG = pIn[1];
-    int pixelB = pIn[2];
-    int r = pBaseColors[0];
-    int g = pBaseColors[1];
-    int b = pBaseColors[2];
-    for (int i = 0; i < 4; i++) {
-        int modifier = pModifierTable[i];
-        int decodedG = clamp(g + modifier);
-        etc1_uint32 score = (etc1_uint32) (6 * square(decodedG - pixelG));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedR = clamp(r + modifier);
-        score += (etc1_uint32) (3 * square(decodedR - pixelR));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedB = clamp(b + modifier);
-        score += (etc1_uint32) square(decodedB - pixelB);
-        if (score < bestScore) {
-            bestScore = score;
-            bestIndex = i;
-        }
-    }
-    etc1_uint32 lowMask = (((bestIndex >> 1) << 16) | (bestIndex & 1))
-            << bitIndex;
-    *pLow |= lowMask;
-    return bestScore;
+// Four 32-bit lanes. This maps onto SSE2 and NEON registers, and the
+// compiler falls back to scalar code on targets that have neither.
+typedef int etc1_int32x4 __attribute__((vector_size(16)));
+
+static
+inline etc1_int32x4 splat(int x) {
+    etc1_int32x4 v = { x, x, x, x };
+    return v;
 }
 
+// The eight pixels of a 2x4 or 4x2 sub-block, gathered once per block so the
+// modifier search can score all of them in parallel for every table.
+typedef struct {
+    etc1_int32x4 r[2];
+    etc1_int32x4 g[2];
+    etc1_int32x4 b[2];
+    etc1_int32x4 valid[2]; // all ones for pixels set in inMask
+    int bitIndex[8];
+} etc_subblock;
+
 static
-void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
-        etc_compressed* pCompressed, bool flipped, bool second,
-        const etc1_byte* pBaseColors, const int* pModifierTable) {
-    int score = pCompressed->score;
+void etc_gather_subblock(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc_subblock* pSubblock, bool flipped, bool second) {
+    int r[8], g[8], b[8], valid[8];
+    int n = 0;
     if (flipped) {
         int by = 0;
         if (second) {
@@ -343,12 +339,13 @@ void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
         }
         for (int y = 0; y < 2; y++) {
             int yy = by + y;
-            for (int x = 0; x < 4; x++) {
+            for (int x = 0; x < 4; x++, n++) {
                 int i = x + 4 * yy;
-                if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, yy + x * 4, pModifierTable);
-                }
+                valid[n] = (inMask & (1 << i)) ? ~0 : 0;
+                pSubblock->bitIndex[n] = yy + x * 4;
+                r[n] = pIn[i * 3];
+                g[n] = pIn[i * 3 + 1];
+                b[n] = pIn[i * 3 + 2];
             }
         }
     } else {
@@ -357,17 +354,74 @@ void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
             bx = 2;
         }
         for (int y = 0; y < 4; y++) {
-            for (int x = 0; x < 2; x++) {
+            for (int x = 0; x < 2; x++, n++) {
                 int xx = bx + x;
                 int i = xx + 4 * y;
-                if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, y + xx * 4, pModifierTable);
-                }
+                valid[n] = (inMask & (1 << i)) ? ~0 : 0;
+                pSubblock->bitIndex[n] = y + xx * 4;
+                r[n] = pIn[i * 3];
+                g[n] = pIn[i * 3 + 1];
+                b[n] = pIn[i * 3 + 2];
             }
         }
     }
+    for (int h = 0; h < 2; h++) {
+        for (int lane = 0; lane < 4; lane++) {
+            pSubblock->r[h][lane] = r[h * 4 + lane];
+            pSubblock->g[h][lane] = g[h * 4 + lane];
+            pSubblock->b[h][lane] = b[h * 4 + lane];
+            pSubblock->valid[h][lane] = valid[h * 4 + lane];
+        }
+    }
+}
+
+// For each pixel of the sub-block, pick the modifier that decodes closest to
+// it, and accumulate the pixel indices and the error into pCompressed.
+// Ties go to the lowest modifier index.
+static
+void etc_encode_subblock_helper(const etc_subblock* pSubblock,
+        etc_compressed* pCompressed, const etc1_byte* pBaseColors,
+        const int* pModifierTable) {
+    etc1_int32x4 bestScore[2];
+    etc1_int32x4 bestIndex[2];
+    int r = pBaseColors[0];
+    int g = pBaseColors[1];
+    int b = pBaseColors[2];
+    for (int i = 0; i < 4; i++) {
+        int modifier = pModifierTable[i];
+        etc1_int32x4 decodedR = splat(clamp(r + modifier));
+        etc1_int32x4 decodedG = splat(clamp(g + modifier));
+        etc1_int32x4 decodedB = splat(clamp(b + modifier));
+        for (int h = 0; h < 2; h++) {
+            etc1_int32x4 dr = decodedR - pSubblock->r[h];
+            etc1_int32x4 dg = decodedG - pSubblock->g[h];
+            etc1_int32x4 db = decodedB - pSubblock->b[h];
+            etc1_int32x4 score = splat(6) * dg * dg + splat(3) * dr * dr + db * db;
+            if (i == 0) {
+                bestScore[h] = score;
+                bestIndex[h] = splat(0);
+            } else {
+                etc1_int32x4 better = score < bestScore[h];
+                bestScore[h] = (better & score) | (~better & bestScore[h]);
+                bestIndex[h] = (better & splat(i)) | (~better & bestIndex[h]);
+            }
+        }
+    }
+
+    etc1_uint32 score = pCompressed->score;
+    etc1_uint32 low = pCompressed->low;
+    for (int h = 0; h < 2; h++) {
+        etc1_int32x4 s = bestScore[h] & pSubblock->valid[h];
+        etc1_int32x4 index = bestIndex[h] & pSubblock->valid[h];
+        for (int lane = 0; lane < 4; lane++) {
+            int bestIndexLane = index[lane];
+            score += (etc1_uint32) s[lane];
+            low |= (((bestIndexLane >> 1) << 16) | (bestIndexLane & 1))
+                    << pSubblock->bitIndex[h * 4 + lane];
+        }
+    }
     pCompressed->score = score;
+    pCompressed->low = low;
 }
 
 static bool inRange4bitSigned(int color) {
@@ -436,6 +490,10 @@ void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
 
     etc_encodeBaseColors(pBaseColors, pColors, pCompressed);
 
+    etc_subblock subblocks[2];
+    etc_gather_subblock(pIn, inMask, &subblocks[0], flipped, false);
+    etc_gather_subblock(pIn, inMask, &subblocks[1], flipped, true);
+
     int originalHigh = pCompressed->high;
 
     const int* pModifierTable = kModifierTable;
@@ -444,8 +502,8 @@ void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
         temp.score = 0;
         temp.high = originalHigh | (i << 5);
         temp.low = 0;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, false,
-                pBaseColors, pModifierTable);
+        etc_encode_subblock_helper(&subblocks[0], &temp, pBaseColors,
+                pModifierTable);
         take_best(pCompressed, &temp);
     }
     pModifierTable = kModifierTable;
@@ -455,8 +513,8 @@ void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
         temp.score = firstHalf.score;
         temp.high = firstHalf.high | (i << 2);
         temp.low = firstHalf.low;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, true,
-                pBaseColors + 3, pModifierTable);
+        etc_encode_subblock_helper(&subblocks[1], &temp, pBaseColors + 3,
+                pModifierTable);
         if (i == 0) {
             *pCompressed = temp;
         } else {
@@ -500,16 +558,12 @@ etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height) {
     return (((width + 3) & ~3) * ((height + 3) & ~3)) >> 1;
 }
 
-// Encode an entire image.
-// pIn - pointer to the image data. Formatted such that the Red component of
-//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
-// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
+// Encode the block rows [firstRow, lastRow) of an image. pOut points at the
+// start of the encoded image.
 
-int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
-        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
-    if (pixelSize < 2 || pixelSize > 3) {
-        return -1;
-    }
+static void etc1_encode_rows(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut,
+        etc1_uint32 firstRow, etc1_uint32 lastRow) {
     static const unsigned short kYMask[] = { 0x0, 0xf, 0xff, 0xfff, 0xffff };
     static const unsigned short kXMask[] = { 0x0, 0x1111, 0x3333, 0x7777,
             0xffff };
@@ -517,9 +571,9 @@ int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 heigh
     etc1_byte encoded[ETC1_ENCODED_BLOCK_SIZE];
 
     etc1_uint32 encodedWidth = (width + 3) & ~3;
-    etc1_uint32 encodedHeight = (height + 3) & ~3;
 
-    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
+    pOut += (encodedWidth >> 2) * firstRow * ETC1_ENCODED_BLOCK_SIZE;
+    for (etc1_uint32 y = firstRow * 4; y < lastRow * 4; y += 4) {
         etc1_uint32 yEnd = height - y;
         if (yEnd > 4) {
             yEnd = 4;
@@ -551,28 +605,21 @@ int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 heigh
             pOut += sizeof(encoded);
         }
     }
-    return 0;
 }
 
-// Decode an entire image.
-// pIn - pointer to encoded data.
-// pOut - pointer to the image data. Will be written such that the Red component of
-//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset. Must be
-//        large enough to store entire image.
+// Decode the block rows [firstRow, lastRow) of an image. pIn points at the
+// start of the encoded image.
 
-
-int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
+static void etc1_decode_rows(const etc1_byte* pIn, etc1_byte* pOut,
         etc1_uint32 width, etc1_uint32 height,
-        etc1_uint32 pixelSize, etc1_uint32 stride) {
-    if (pixelSize < 2 || pixelSize > 3) {
-        return -1;
-    }
+        etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_uint32 firstRow, etc1_uint32 lastRow) {
     etc1_byte block[ETC1_DECODED_BLOCK_SIZE];
 
     etc1_uint32 encodedWidth = (width + 3) & ~3;
-    etc1_uint32 encodedHeight = (height + 3) & ~3;
 
-    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
+    pIn += (encodedWidth >> 2) * firstRow * ETC1_ENCODED_BLOCK_SIZE;
+    for (etc1_uint32 y = firstRow * 4; y < lastRow * 4; y += 4) {
         etc1_uint32 yEnd = height - y;
         if (yEnd > 4) {
             yEnd = 4;
@@ -602,6 +649,87 @@ int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
             }
         }
     }
+}
+
+// Split the block rows of an image into contiguous bands, one per thread,
+// and run fn(firstRow, lastRow) on each. The calling thread takes the first
+// band. Every block is independent, so the output does not depend on the
+// number of threads.
+
+template <typename Fn>
+static void etc1_for_each_band(etc1_uint32 height, etc1_uint32 threadCount, Fn fn) {
+    etc1_uint32 rows = (height + 3) >> 2;
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = std::min(threadCount, rows);
+    if (threadCount <= 1) {
+        fn(0, rows);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threadCount - 1);
+    etc1_uint32 bandRows = rows / threadCount;
+    etc1_uint32 extraRows = rows % threadCount;
+    etc1_uint32 firstBandEnd = bandRows + (extraRows > 0 ? 1 : 0);
+    etc1_uint32 start = firstBandEnd;
+    for (etc1_uint32 i = 1; i < threadCount; i++) {
+        etc1_uint32 end = start + bandRows + (i < extraRows ? 1 : 0);
+        workers.emplace_back(fn, start, end);
+        start = end;
+    }
+    fn(0, firstBandEnd);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Encode an entire image.
+// pIn - pointer to the image data. Formatted such that the Red component of
+//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
+// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
+
+int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
+    return etc1_encode_image_threaded(pIn, width, height, pixelSize, stride, pOut, 1);
+}
+
+int etc1_encode_image_threaded(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut,
+        etc1_uint32 threadCount) {
+    if (pixelSize < 2 || pixelSize > 3) {
+        return -1;
+    }
+    etc1_for_each_band(height, threadCount, [=](etc1_uint32 firstRow, etc1_uint32 lastRow) {
+        etc1_encode_rows(pIn, width, height, pixelSize, stride, pOut, firstRow, lastRow);
+    });
+    return 0;
+}
+
+// Decode an entire image.
+// pIn - pointer to encoded data.
+// pOut - pointer to the image data. Will be written such that the Red component of
+//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset. Must be
+//        large enough to store entire image.
+
+
+int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride) {
+    return etc1_decode_image_threaded(pIn, pOut, width, height, pixelSize, stride, 1);
+}
+
+int etc1_decode_image_threaded(const etc1_byte* pIn, etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_uint32 threadCount) {
+    if (pixelSize < 2 || pixelSize > 3) {
+        return -1;
+    }
+    etc1_for_each_band(height, threadCount, [=](etc1_uint32 firstRow, etc1_uint32 lastRow) {
+        etc1_decode_rows(pIn, pOut, width, height, pixelSize, stride, firstRow, lastRow);
+    });
     return 0;
 }
 
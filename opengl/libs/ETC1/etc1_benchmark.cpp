@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ETC1/etc1.h>
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr etc1_uint32 kPixelSize = 3;
+
+// A smooth gradient with some noise on top, which is closer to real texture
+// content than uniform noise and keeps the encoder's search representative.
+std::vector<etc1_byte> makeImage(etc1_uint32 width, etc1_uint32 height) {
+    std::vector<etc1_byte> image(width * height * kPixelSize);
+    std::mt19937 rng(width * 31 + height);
+    std::uniform_int_distribution<int> noise(-16, 16);
+    for (etc1_uint32 y = 0; y < height; y++) {
+        for (etc1_uint32 x = 0; x < width; x++) {
+            etc1_byte* p = image.data() + (y * width + x) * kPixelSize;
+            p[0] = static_cast<etc1_byte>(std::clamp<int>(x * 255 / width + noise(rng), 0, 255));
+            p[1] = static_cast<etc1_byte>(std::clamp<int>(y * 255 / height + noise(rng), 0, 255));
+            p[2] = static_cast<etc1_byte>(std::clamp<int>((x ^ y) & 0xff, 0, 255));
+        }
+    }
+    return image;
+}
+
+void setMegapixelsPerSecond(benchmark::State& state, etc1_uint32 width, etc1_uint32 height) {
+    state.counters["MP/s"] =
+            benchmark::Counter(static_cast<double>(width) * height / 1e6 * state.iterations(),
+                               benchmark::Counter::kIsRate);
+}
+
+// Args: {size, threads}. A thread count of 0 uses one thread per CPU.
+void BM_EncodeImage(benchmark::State& state) {
+    const etc1_uint32 size = state.range(0);
+    const etc1_uint32 threads = state.range(1);
+    const std::vector<etc1_byte> image = makeImage(size, size);
+    std::vector<etc1_byte> encoded(etc1_get_encoded_data_size(size, size));
+    for (auto _ : state) {
+        etc1_encode_image_threaded(image.data(), size, size, kPixelSize, size * kPixelSize,
+                                   encoded.data(), threads);
+        benchmark::DoNotOptimize(encoded.data());
+    }
+    setMegapixelsPerSecond(state, size, size);
+}
+
+void BM_DecodeImage(benchmark::State& state) {
+    const etc1_uint32 size = state.range(0);
+    const etc1_uint32 threads = state.range(1);
+    const std::vector<etc1_byte> image = makeImage(size, size);
+    std::vector<etc1_byte> encoded(etc1_get_encoded_data_size(size, size));
+    etc1_encode_image_threaded(image.data(), size, size, kPixelSize, size * kPixelSize,
+                               encoded.data(), 0);
+    std::vector<etc1_byte> decoded(image.size());
+    for (auto _ : state) {
+        etc1_decode_image_threaded(encoded.data(), decoded.data(), size, size, kPixelSize,
+                                   size * kPixelSize, threads);
+        benchmark::DoNotOptimize(decoded.data());
+    }
+    setMegapixelsPerSecond(state, size, size);
+}
+
+void imageArgs(benchmark::internal::Benchmark* b) {
+    for (int size : {256, 1024, 2048, 4096}) {
+        for (int threads : {1, 0}) {
+            b->Args({size, threads});
+        }
+    }
+    b->ArgNames({"size", "threads"})->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+BENCHMARK(BM_EncodeImage)->Apply(imageArgs);
+BENCHMARK(BM_DecodeImage)->Apply(imageArgs);
+
+} // namespace
+
+BENCHMARK_MAIN();
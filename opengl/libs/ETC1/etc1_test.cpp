@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ETC1/etc1.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+namespace android {
+
+class ETC1Test : public ::testing::TestWithParam<etc1_uint32> {
+protected:
+    static std::vector<etc1_byte> makeImage(etc1_uint32 width, etc1_uint32 height,
+                                            etc1_uint32 stride) {
+        std::vector<etc1_byte> image(stride * height);
+        srand(width * 7 + height);
+        for (auto& b : image) {
+            b = static_cast<etc1_byte>(rand());
+        }
+        return image;
+    }
+};
+
+TEST_P(ETC1Test, ThreadedEncodeMatchesSingleThreaded) {
+    const etc1_uint32 pixelSize = GetParam();
+    for (etc1_uint32 threads : {0u, 2u, 3u, 64u}) {
+        for (auto [width, height] : {std::pair{1u, 1u}, {5u, 3u}, {31u, 37u}, {128u, 64u}}) {
+            const etc1_uint32 stride = width * pixelSize + 1;
+            std::vector<etc1_byte> image = makeImage(width, height, stride);
+            std::vector<etc1_byte> expected(etc1_get_encoded_data_size(width, height));
+            std::vector<etc1_byte> actual(expected.size());
+            ASSERT_EQ(0,
+                      etc1_encode_image(image.data(), width, height, pixelSize, stride,
+                                        expected.data()));
+            ASSERT_EQ(0,
+                      etc1_encode_image_threaded(image.data(), width, height, pixelSize, stride,
+                                                 actual.data(), threads));
+            EXPECT_EQ(expected, actual) << width << "x" << height << " threads=" << threads;
+        }
+    }
+}
+
+TEST_P(ETC1Test, ThreadedDecodeMatchesSingleThreaded) {
+    const etc1_uint32 pixelSize = GetParam();
+    for (etc1_uint32 threads : {0u, 2u, 3u, 64u}) {
+        for (auto [width, height] : {std::pair{1u, 1u}, {5u, 3u}, {31u, 37u}, {128u, 64u}}) {
+            const etc1_uint32 stride = width * pixelSize + 1;
+            std::vector<etc1_byte> encoded(etc1_get_encoded_data_size(width, height));
+            ASSERT_EQ(0,
+                      etc1_encode_image(makeImage(width, height, stride).data(), width, height,
+                                        pixelSize, stride, encoded.data()));
+            std::vector<etc1_byte> expected(stride * height);
+            std::vector<etc1_byte> actual(stride * height);
+            ASSERT_EQ(0,
+                      etc1_decode_image(encoded.data(), expected.data(), width, height, pixelSize,
+                                        stride));
+            ASSERT_EQ(0,
+                      etc1_decode_image_threaded(encoded.data(), actual.data(), width, height,
+                                                 pixelSize, stride, threads));
+            EXPECT_EQ(expected, actual) << width << "x" << height << " threads=" << threads;
+        }
+    }
+}
+
+TEST_P(ETC1Test, SolidBlockRoundTrips) {
+    const etc1_uint32 pixelSize = GetParam();
+    // 0x7bef in RGB565 and its 8-bit expansion are representable exactly.
+    const etc1_byte pixel[] = {0xef, 0x7b, 0x7b};
+    std::vector<etc1_byte> image(16 * pixelSize);
+    for (size_t i = 0; i < image.size(); i++) {
+        image[i] = pixel[i % pixelSize];
+    }
+    etc1_byte encoded[ETC1_ENCODED_BLOCK_SIZE];
+    std::vector<etc1_byte> decoded(image.size());
+    ASSERT_EQ(0, etc1_encode_image(image.data(), 4, 4, pixelSize, 4 * pixelSize, encoded));
+    ASSERT_EQ(0, etc1_decode_image(encoded, decoded.data(), 4, 4, pixelSize, 4 * pixelSize));
+    for (size_t i = 0; i < image.size(); i++) {
+        EXPECT_NEAR(image[i], decoded[i], 8) << "byte " << i;
+    }
+}
+
+// Produced by the scalar encoder that the vectorized one replaced, which it must match bit for
+// bit. The images come from a fixed LCG rather than rand(), whose sequence differs between libcs.
+static std::vector<etc1_byte> makeGoldenImage(etc1_uint32 stride, etc1_uint32 height,
+                                              etc1_uint32 seed) {
+    std::vector<etc1_byte> image(stride * height);
+    for (auto& b : image) {
+        seed = seed * 1664525u + 1013904223u;
+        b = static_cast<etc1_byte>(seed >> 24);
+    }
+    return image;
+}
+
+static uint64_t fnv1a(const std::vector<etc1_byte>& data) {
+    uint64_t hash = 1469598103934665603ull;
+    for (etc1_byte b : data) {
+        hash = (hash ^ b) * 1099511628211ull;
+    }
+    return hash;
+}
+
+TEST(ETC1ImageTest, EncodeMatchesScalarEncoderBlocks) {
+    const std::vector<etc1_byte> expected[] = {
+            {0x78, 0x86, 0x95, 0xb1, 0x3e, 0xe8, 0x98, 0x4c,
+             0x6b, 0x89, 0x86, 0x59, 0xd5, 0x39, 0x1f, 0x12},
+            {0x87, 0x78, 0xc5, 0x90, 0x33, 0xcd, 0xe4, 0x68,
+             0x73, 0x86, 0x7a, 0xd0, 0x39, 0x3e, 0x48, 0x80},
+    };
+    for (etc1_uint32 pixelSize : {2u, 3u}) {
+        const std::vector<etc1_byte> image = makeGoldenImage(8 * pixelSize, 4, pixelSize);
+        std::vector<etc1_byte> encoded(etc1_get_encoded_data_size(8, 4));
+        ASSERT_EQ(0, etc1_encode_image(image.data(), 8, 4, pixelSize, 8 * pixelSize,
+                                       encoded.data()));
+        EXPECT_EQ(expected[pixelSize - 2], encoded) << "pixelSize=" << pixelSize;
+    }
+}
+
+TEST(ETC1ImageTest, EncodeMatchesScalarEncoderImages) {
+    struct Golden {
+        etc1_uint32 pixelSize;
+        etc1_uint32 width;
+        etc1_uint32 height;
+        uint64_t hash;
+    };
+    const Golden goldens[] = {
+            {2, 5, 3, 0xb4b5903149f00ff2ull},    {2, 31, 37, 0x8d20c793c2f1fdf6ull},
+            {2, 128, 64, 0x879647d774adf99full}, {3, 5, 3, 0x994d8e285fa94d85ull},
+            {3, 31, 37, 0xcc02ff3a49164716ull},  {3, 128, 64, 0x4a7c8dd75696a0e5ull},
+    };
+    for (const Golden& golden : goldens) {
+        const etc1_uint32 stride = golden.width * golden.pixelSize + 1;
+        const std::vector<etc1_byte> image =
+                makeGoldenImage(stride, golden.height, golden.width * 7 + golden.height);
+        std::vector<etc1_byte> encoded(etc1_get_encoded_data_size(golden.width, golden.height));
+        for (etc1_uint32 threads : {1u, 3u}) {
+            ASSERT_EQ(0,
+                      etc1_encode_image_threaded(image.data(), golden.width, golden.height,
+                                                 golden.pixelSize, stride, encoded.data(),
+                                                 threads));
+            EXPECT_EQ(golden.hash, fnv1a(encoded))
+                    << golden.width << "x" << golden.height << " pixelSize=" << golden.pixelSize
+                    << " threads=" << threads;
+        }
+    }
+}
+
+TEST(ETC1ImageTest, InvalidPixelSizeFails) {
+    etc1_byte buffer[ETC1_DECODED_BLOCK_SIZE] = {};
+    EXPECT_NE(0, etc1_encode_image_threaded(buffer, 4, 4, 4, 16, buffer, 2));
+    EXPECT_NE(0, etc1_decode_image_threaded(buffer, buffer, 4, 4, 1, 4, 2));
+}
+
+INSTANTIATE_TEST_SUITE_P(PixelSizes, ETC1Test, ::testing::Values(2u, 3u));
+
+} // namespace android
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BatchFusion.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+BatchFusion::BatchFusion()
+    : mGyroType(SENSOR_TYPE_GYROSCOPE),
+      mEstimatedGyroRate(200),
+      mGyroTime(0), mAccTime(0)
+{
+    for (int i = 0; i<NUM_FUSION_MODE; ++i) {
+        mFusions[i].init(i);
+        mEnabled[i] = false;
+        mAttitudes[i] = 0;
+    }
+    pushEstimate();
+}
+
+void BatchFusion::setEnabled(int mode, bool enabled) {
+    if (enabled != mEnabled[mode]) {
+        mEnabled[mode] = enabled;
+        if (enabled) {
+            mFusions[mode].init(mode);
+        }
+    }
+}
+
+void BatchFusion::processBatch(sensors_event_t const* events, size_t count) {
+    // Start from the last estimate of the previous batch.
+    mEstimates.front() = mEstimates.back();
+    mEstimates.resize(1);
+    mEventEstimates.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        if (process(events[i])) {
+            pushEstimate();
+        }
+        mEventEstimates[i] = mEstimates.size() - 1;
+    }
+}
+
+const BatchFusion::Estimate& BatchFusion::getEstimate(size_t index) const {
+    if (index >= mEventEstimates.size()) {
+        return getLatestEstimate();
+    }
+    return mEstimates[mEventEstimates[index]];
+}
+
+void BatchFusion::pushEstimate() {
+    Estimate estimate;
+    for (int i = 0; i<NUM_FUSION_MODE; ++i) {
+        estimate.hasEstimate[i] = mFusions[i].hasEstimate();
+        estimate.attitude[i] = mAttitudes[i];
+        estimate.rotationMatrix[i] = mFusions[i].getRotationMatrix();
+    }
+    estimate.gyroBias = mFusions[FUSION_9AXIS].getBias();
+    mEstimates.push_back(estimate);
+}
+
+bool BatchFusion::process(const sensors_event_t& event) {
+    if (event.type == mGyroType) {
+        float dT;
+        if ( event.timestamp - mGyroTime> 0 &&
+             event.timestamp - mGyroTime< (int64_t)(5e7) ) { //0.05sec
+
+            dT = (event.timestamp - mGyroTime) / 1000000000.0f;
+            // here we estimate the gyro rate (useful for debugging)
+            const float freq = 1 / dT;
+            if (freq >= 100 && freq<1000) { // filter values obviously wrong
+                const float alpha = 1 / (1 + dT); // 1s time-constant
+                mEstimatedGyroRate = freq + (mEstimatedGyroRate - freq)*alpha;
+            }
+
+            const vec3_t gyro(event.data);
+            for (int i = 0; i<NUM_FUSION_MODE; ++i) {
+                if (mEnabled[i]) {
+                    // fusion in no gyro mode will ignore
+                    mFusions[i].handleGyro(gyro, dT);
+                }
+            }
+        }
+        mGyroTime = event.timestamp;
+        return true;
+    } else if (event.type == SENSOR_TYPE_MAGNETIC_FIELD) {
+        const vec3_t mag(event.data);
+        for (int i = 0; i<NUM_FUSION_MODE; ++i) {
+            if (mEnabled[i]) {
+                mFusions[i].handleMag(mag);// fusion in no mag mode will ignore
+            }
+        }
+        return true;
+    } else if (event.type == SENSOR_TYPE_ACCELEROMETER) {
+        float dT;
+        if ( event.timestamp - mAccTime> 0 &&
+             event.timestamp - mAccTime< (int64_t)(1e8) ) { //0.1sec
+            dT = (event.timestamp - mAccTime) / 1000000000.0f;
+
+            const vec3_t acc(event.data);
+            for (int i = 0; i<NUM_FUSION_MODE; ++i) {
+                if (mEnabled[i]) {
+                    mFusions[i].handleAcc(acc, dT);
+                    mAttitudes[i] = mFusions[i].getAttitude();
+                }
+            }
+        }
+        mAccTime = event.timestamp;
+        return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BATCH_FUSION_H
+#define ANDROID_BATCH_FUSION_H
+
+#include <hardware/sensors.h>
+#include <utils/Timers.h>
+
+#include <vector>
+
+#include "Fusion.h"
+
+namespace android {
+
+/*
+ * Runs the enabled fusion modes over whole batches of accelerometer, magnetometer and gyroscope
+ * events. The estimate after every event of the batch is kept, so that all virtual sensors derive
+ * their output for an event from the estimate as of that event, computed once for all of them.
+ */
+class BatchFusion {
+public:
+    struct Estimate {
+        bool hasEstimate[NUM_FUSION_MODE];
+        // The attitude as of the last accelerometer event.
+        vec4_t attitude[NUM_FUSION_MODE];
+        mat33_t rotationMatrix[NUM_FUSION_MODE];
+        vec3_t gyroBias;
+    };
+
+    BatchFusion();
+
+    // The type of the gyroscope events to fuse, which may be the uncalibrated gyroscope.
+    void setGyroType(int type) { mGyroType = type; }
+    void setEnabled(int mode, bool enabled);
+    bool isEnabled(int mode) const { return mEnabled[mode]; }
+
+    // Runs the fusion over the events, replacing the estimates of the previous batch.
+    void processBatch(sensors_event_t const* events, size_t count);
+
+    // The estimate as of events[index] of the last batch, or the latest estimate if index is out
+    // of range. Valid until the next processBatch().
+    const Estimate& getEstimate(size_t index) const;
+    const Estimate& getLatestEstimate() const { return mEstimates.back(); }
+
+    const Fusion& getFusion(int mode) const { return mFusions[mode]; }
+    float getEstimatedGyroRate() const { return mEstimatedGyroRate; }
+
+private:
+    // Returns true if the event was fed to the fusion.
+    bool process(const sensors_event_t& event);
+    void pushEstimate();
+
+    int mGyroType;
+    Fusion mFusions[NUM_FUSION_MODE]; // normal, no_mag, no_gyro
+    bool mEnabled[NUM_FUSION_MODE];
+    vec4_t mAttitudes[NUM_FUSION_MODE];
+
+    float mEstimatedGyroRate;
+    nsecs_t mGyroTime;
+    nsecs_t mAccTime;
+
+    // The first estimate is the one the batch started from.
+    std::vector<Estimate> mEstimates;
+    // For every event of the batch, its index in mEstimates.
+    std::vector<uint32_t> mEventEstimates;
+};
+
+}; // namespace android
+
+#endif // ANDROID_BATCH_FUSION_H
@@ -487,11 +487,31 @@ void Fusion::predict(const vec3_t& w, float dT) {
     if (x0.w < 0)
         x0 = -x0;
 
-    P = Phi*P*transpose(Phi) + GQGt;
+    propagateCovariance(P, Phi, GQGt);
 
     checkState();
 }
 
+void Fusion::propagateCovariance(mat<mat33_t, 2, 2>& P, const mat<mat33_t, 2, 2>& Phi,
+                                 const mat<mat33_t, 2, 2>& GQGt) {
+    // Phi is block upper triangular with an identity bottom-right block, so Phi*P*Phi' reduces
+    // to 3x3 products of its top blocks, 8 of them instead of the 16 of the full product:
+    //
+    //  P00 = (Phi00*P00 + Phi10*P01)*Phi00' + (Phi00*P10 + Phi10*P11)*Phi10'
+    //  P10 =  Phi00*P10 + Phi10*P11
+    //  P01 =  P01*Phi00' + P11*Phi10'
+    //  P11 =  P11
+    const mat33_t& Phi00 = Phi[0][0];
+    const mat33_t& Phi10 = Phi[1][0];
+    const mat33_t Phi00t(transpose(Phi00));
+    const mat33_t Phi10t(transpose(Phi10));
+    const mat33_t P10(Phi00*P[1][0] + Phi10*P[1][1]);
+    P[0][0] = (Phi00*P[0][0] + Phi10*P[0][1])*Phi00t + P10*Phi10t + GQGt[0][0];
+    P[0][1] = P[0][1]*Phi00t + P[1][1]*Phi10t + GQGt[0][1];
+    P[1][0] = P10 + GQGt[1][0];
+    P[1][1] += GQGt[1][1];
+}
+
 void Fusion::update(const vec3_t& z, const vec3_t& Bi, float sigma) {
     vec4_t q(x0);
     // measured vector in body space: h(p) = A(p)*Bi
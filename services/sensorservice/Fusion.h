@@ -71,6 +71,11 @@ public:
     mat33_t getRotationMatrix() const;
     bool hasEstimate() const;
 
+    // P = Phi*P*transpose(Phi) + GQGt, for a Phi shaped like the one predict() uses: block upper
+    // triangular with an identity bottom-right block.
+    static void propagateCovariance(mat<mat33_t, 2, 2>& P, const mat<mat33_t, 2, 2>& Phi,
+                                    const mat<mat33_t, 2, 2>& GQGt);
+
 private:
     struct Parameter {
         float gyroVar;
@@ -22,6 +22,10 @@
 #include <utils/Timers.h>
 
 #include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
 
 namespace android {
 namespace SensorServiceUtil {
@@ -30,52 +34,139 @@ namespace {
     constexpr size_t LOG_SIZE = 10;
     constexpr size_t LOG_SIZE_MED = 30;  // debugging for slower sensors
     constexpr size_t LOG_SIZE_LARGE = 50;  // larger samples for debugging
+    // Readers give up rather than starve if events keep being added while they copy the records.
+    constexpr int MAX_READ_ATTEMPTS = 100;
 }// unnamed namespace
 
 RecentEventLogger::RecentEventLogger(int sensorType) :
         mSensorType(sensorType), mEventSize(eventSizeBySensorType(mSensorType)),
-        mRecentEvents(logSizeBySensorType(sensorType)), mMaskData(false),
-        mIsLastEventCurrent(false) {
+        mMaskData(false),
+        mDataWords(sensorType == SENSOR_TYPE_STEP_COUNTER
+                ? sizeof(uint64_t) / sizeof(uint32_t) : mEventSize),
+        mCapacity(logSizeBySensorType(sensorType)), mSequence(0),
+        mRecords(new std::atomic<uint32_t>[mCapacity * recordWords()]), mTotal(0),
+        mWallOffsetMs(0), mWallOffsetSince(0), mIsLastEventCurrent(false) {
     // blank
 }
 
 void RecentEventLogger::addEvent(const sensors_event_t& event) {
-    std::lock_guard<std::mutex> lk(mLock);
-    mRecentEvents.emplace(event);
-    mIsLastEventCurrent = true;
+    timespec wallTime;
+    clock_gettime(CLOCK_REALTIME, &wallTime);
+    const int64_t wallTimeMs = wallTime.tv_sec * 1000LL + ns2ms(wallTime.tv_nsec);
+    const uint64_t total = mTotal.load(std::memory_order_relaxed);
+
+    int64_t wallDeltaMs = wallTimeMs - ns2ms(event.timestamp)
+            - mWallOffsetMs.load(std::memory_order_relaxed);
+    const bool rebase = total == 0 || wallDeltaMs < INT32_MIN || wallDeltaMs > INT32_MAX;
+    if (rebase) {
+        wallDeltaMs = 0;
+    }
+
+    uint32_t words[kEventWords];
+    memcpy(words, &event, sizeof(event));
+    const uint32_t* data = words + offsetof(sensors_event_t, data) / sizeof(uint32_t);
+
+    const uint32_t sequence = mSequence.load(std::memory_order_relaxed);
+    mSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (rebase) {
+        mWallOffsetMs.store(wallTimeMs - ns2ms(event.timestamp), std::memory_order_relaxed);
+        mWallOffsetSince.store(total, std::memory_order_relaxed);
+    }
+    std::atomic<uint32_t>* record = &mRecords[(total % mCapacity) * recordWords()];
+    record[0].store(uint32_t(uint64_t(event.timestamp)), std::memory_order_relaxed);
+    record[1].store(uint32_t(uint64_t(event.timestamp) >> 32), std::memory_order_relaxed);
+    record[2].store(uint32_t(int32_t(wallDeltaMs)), std::memory_order_relaxed);
+    for (size_t i = 0; i < mDataWords; ++i) {
+        record[kHeaderWords + i].store(data[i], std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < kEventWords; ++i) {
+        mLastEvent[i].store(words[i], std::memory_order_relaxed);
+    }
+    mTotal.store(total + 1, std::memory_order_relaxed);
+
+    mSequence.store(sequence + 2, std::memory_order_release);
+    mIsLastEventCurrent.store(true, std::memory_order_relaxed);
 }
 
 bool RecentEventLogger::isEmpty() const {
-    return mRecentEvents.size() == 0;
+    return mTotal.load(std::memory_order_relaxed) == 0;
 }
 
 void RecentEventLogger::setLastEventStale() {
-    std::lock_guard<std::mutex> lk(mLock);
-    mIsLastEventCurrent = false;
+    mIsLastEventCurrent.store(false, std::memory_order_relaxed);
+}
+
+bool RecentEventLogger::readLogs(std::vector<SensorEventLog>* logs) const {
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+        const uint32_t sequence = mSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        const uint64_t total = mTotal.load(std::memory_order_relaxed);
+        const int64_t wallOffsetMs = mWallOffsetMs.load(std::memory_order_relaxed);
+        const uint64_t wallOffsetSince = mWallOffsetSince.load(std::memory_order_relaxed);
+        logs->resize(std::min<uint64_t>(total, mCapacity));
+        for (size_t i = 0; i < logs->size(); ++i) {
+            const uint64_t index = total - 1 - i;
+            const std::atomic<uint32_t>* record = &mRecords[(index % mCapacity) * recordWords()];
+            SensorEventLog& log = (*logs)[i];
+            log.mTimestamp = int64_t(record[0].load(std::memory_order_relaxed)
+                    | uint64_t(record[1].load(std::memory_order_relaxed)) << 32);
+            const int32_t wallDeltaMs = int32_t(record[2].load(std::memory_order_relaxed));
+            log.mWallTimeMs = index >= wallOffsetSince
+                    ? ns2ms(log.mTimestamp) + wallOffsetMs + wallDeltaMs : -1;
+            uint32_t data[kEventWords];
+            for (size_t k = 0; k < mDataWords; ++k) {
+                data[k] = record[kHeaderWords + k].load(std::memory_order_relaxed);
+            }
+            memcpy(log.mData, data, mDataWords * sizeof(uint32_t));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mSequence.load(std::memory_order_relaxed) == sequence) {
+            return true;
+        }
+    }
+    logs->clear();
+    return false;
 }
 
 std::string RecentEventLogger::dump() const {
-    std::lock_guard<std::mutex> lk(mLock);
+    std::vector<SensorEventLog> logs;
+    const bool read = readLogs(&logs);
 
     //TODO: replace String8 with std::string completely in this function
     String8 buffer;
 
-    buffer.appendFormat("last %zu events\n", mRecentEvents.size());
+    if (!read) {
+        buffer.append("events are being added too fast to be dumped\n");
+        return std::string(buffer.string());
+    }
+    buffer.appendFormat("last %zu events\n", logs.size());
     int j = 0;
-    for (int i = mRecentEvents.size() - 1; i >= 0; --i) {
-        const auto& ev = mRecentEvents[i];
-        struct tm * timeinfo = localtime(&(ev.mWallTime.tv_sec));
-        buffer.appendFormat("\t%2d (ts=%.9f, wall=%02d:%02d:%02d.%03d) ",
-                ++j, ev.mEvent.timestamp/1e9, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec,
-                (int) ns2ms(ev.mWallTime.tv_nsec));
+    for (const auto& ev : logs) {
+        buffer.appendFormat("\t%2d (ts=%.9f, ", ++j, ev.mTimestamp/1e9);
+        if (ev.mWallTimeMs >= 0) {
+            const time_t wallTimeS = ev.mWallTimeMs / 1000;
+            struct tm * timeinfo = localtime(&wallTimeS);
+            buffer.appendFormat("wall=%02d:%02d:%02d.%03d) ",
+                    timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec,
+                    int(ev.mWallTimeMs % 1000));
+        } else {
+            buffer.append("wall=unknown) ");
+        }
 
         // data
         if (!mMaskData) {
             if (mSensorType == SENSOR_TYPE_STEP_COUNTER) {
-                buffer.appendFormat("%" PRIu64 ", ", ev.mEvent.u64.step_counter);
+                buffer.appendFormat("%" PRIu64 ", ", ev.mStepCounter);
             } else {
                 for (size_t k = 0; k < mEventSize; ++k) {
-                    buffer.appendFormat("%.2f, ", ev.mEvent.data[k]);
+                    buffer.appendFormat("%.2f, ", ev.mData[k]);
                 }
             }
         } else {
@@ -95,24 +186,25 @@ std::string RecentEventLogger::dump() const {
  */
 void RecentEventLogger::dump(util::ProtoOutputStream* proto) const {
     using namespace service::SensorEventsProto;
-    std::lock_guard<std::mutex> lk(mLock);
+    std::vector<SensorEventLog> logs;
+    readLogs(&logs);
 
-    proto->write(RecentEventsLog::RECENT_EVENTS_COUNT, int(mRecentEvents.size()));
-    for (int i = mRecentEvents.size() - 1; i >= 0; --i) {
-        const auto& ev = mRecentEvents[i];
+    proto->write(RecentEventsLog::RECENT_EVENTS_COUNT, int(logs.size()));
+    for (const auto& ev : logs) {
         const uint64_t token = proto->start(RecentEventsLog::EVENTS);
-        proto->write(Event::TIMESTAMP_SEC, float(ev.mEvent.timestamp) / 1e9f);
-        proto->write(Event::WALL_TIMESTAMP_MS, ev.mWallTime.tv_sec * 1000LL
-                + ns2ms(ev.mWallTime.tv_nsec));
+        proto->write(Event::TIMESTAMP_SEC, float(ev.mTimestamp) / 1e9f);
+        if (ev.mWallTimeMs >= 0) {
+            proto->write(Event::WALL_TIMESTAMP_MS, ev.mWallTimeMs);
+        }
 
         if (mMaskData) {
             proto->write(Event::MASKED, true);
         } else {
             if (mSensorType == SENSOR_TYPE_STEP_COUNTER) {
-                proto->write(Event::INT64_DATA, int64_t(ev.mEvent.u64.step_counter));
+                proto->write(Event::INT64_DATA, int64_t(ev.mStepCounter));
             } else {
                 for (size_t k = 0; k < mEventSize; ++k) {
-                    proto->write(Event::FLOAT_ARRAY, ev.mEvent.data[k]);
+                    proto->write(Event::FLOAT_ARRAY, ev.mData[k]);
                 }
             }
         }
@@ -129,15 +221,30 @@ void RecentEventLogger::setFormat(std::string format) {
 }
 
 bool RecentEventLogger::populateLastEventIfCurrent(sensors_event_t *event) const {
-    std::lock_guard<std::mutex> lk(mLock);
-
-    if (mIsLastEventCurrent && mRecentEvents.size()) {
-        // Index 0 contains the latest event emplace()'ed
-        *event = mRecentEvents[0].mEvent;
-        return true;
-    } else {
+    if (!mIsLastEventCurrent.load(std::memory_order_relaxed)) {
         return false;
     }
+
+    uint32_t words[kEventWords];
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+        const uint32_t sequence = mSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < kEventWords; ++i) {
+            words[i] = mLastEvent[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mSequence.load(std::memory_order_relaxed) == sequence) {
+            if (sequence == 0) {
+                return false;
+            }
+            memcpy(event, words, sizeof(*event));
+            return true;
+        }
+    }
+    return false;
 }
 
 
@@ -154,9 +261,5 @@ size_t RecentEventLogger::logSizeBySensorType(int sensorType) {
     return LOG_SIZE;
 }
 
-RecentEventLogger::SensorEventLog::SensorEventLog(const sensors_event_t& e) : mEvent(e) {
-    clock_gettime(CLOCK_REALTIME, &mWallTime);
-}
-
 } // namespace SensorServiceUtil
 } // namespace android
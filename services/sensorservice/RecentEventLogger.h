@@ -17,13 +17,14 @@
 #ifndef ANDROID_SENSOR_SERVICE_UTIL_RECENT_EVENT_LOGGER_H
 #define ANDROID_SENSOR_SERVICE_UTIL_RECENT_EVENT_LOGGER_H
 
-#include "RingBuffer.h"
 #include "SensorServiceUtils.h"
 
 #include <hardware/sensors.h>
 #include <utils/String8.h>
 
-#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace android {
 namespace SensorServiceUtil {
@@ -33,6 +34,11 @@ namespace SensorServiceUtil {
 // generated from the sensor are stored in this buffer.  The buffer is NOT cleared when the sensor
 // unregisters and as a result very old data in the dumpsys output can be seen, which is an intended
 // behavior.
+//
+// Events are added from the poll thread only. They are encoded into a compact record holding only
+// the timestamp, the wall time as a delta from the timestamp and the data values meaningful for the
+// sensor type, and only decoded when dumped. Readers never block the poll thread: the records are
+// guarded by a sequence counter and readers retry if an event was added while they were copying.
 class RecentEventLogger : public Dumpable {
 public:
     explicit RecentEventLogger(int sensorType);
@@ -52,23 +58,50 @@ public:
     virtual void setFormat(std::string format) override;
 
 protected:
+    // A decoded record.
     struct SensorEventLog {
-        explicit SensorEventLog(const sensors_event_t& e);
-        timespec mWallTime;
-        sensors_event_t mEvent;
+        int64_t mTimestamp;
+        // Milliseconds since the epoch, or -1 if it was lost when the wall clock was changed.
+        int64_t mWallTimeMs;
+        union {
+            float mData[16];
+            uint64_t mStepCounter;
+        };
     };
 
+    // Copies the records, newest first, into logs. Returns false if the poll thread kept adding
+    // events while they were being copied.
+    bool readLogs(std::vector<SensorEventLog>* logs) const;
+
     const int mSensorType;
     const size_t mEventSize;
 
-    mutable std::mutex mLock;
-    RingBuffer<SensorEventLog> mRecentEvents;
-
     bool mMaskData;
-    bool mIsLastEventCurrent;
 
 private:
     static size_t logSizeBySensorType(int sensorType);
+
+    // Encoded records, each kHeaderWords followed by mDataWords words of data.
+    static constexpr size_t kHeaderWords = 3;
+    static constexpr size_t kEventWords = sizeof(sensors_event_t) / sizeof(uint32_t);
+    size_t recordWords() const { return kHeaderWords + mDataWords; }
+
+    const size_t mDataWords;
+    const size_t mCapacity;
+    // Odd while the poll thread is adding an event.
+    std::atomic<uint32_t> mSequence;
+    std::unique_ptr<std::atomic<uint32_t>[]> mRecords;
+    // The number of events ever added. The newest record is in slot (mTotal - 1) % mCapacity.
+    std::atomic<uint64_t> mTotal;
+    // Wall times are stored as a delta of mWallOffsetMs from the timestamp. The offset only
+    // changes when the wall clock does, and the records added before mWallOffsetSince lose their
+    // wall time when it does.
+    std::atomic<int64_t> mWallOffsetMs;
+    std::atomic<uint64_t> mWallOffsetSince;
+
+    // The last event, in full, for new connections to on-change sensors.
+    std::atomic<uint32_t> mLastEvent[kEventWords];
+    std::atomic<bool> mIsLastEventCurrent;
 };
 
 } // namespace SensorServiceUtil
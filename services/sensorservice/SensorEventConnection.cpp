@@ -289,15 +289,16 @@ bool SensorService::SensorEventConnection::incrementPendingFlushCountIfHasAccess
 
 status_t SensorService::SensorEventConnection::sendEvents(
         sensors_event_t const* buffer, size_t numEvents,
-        sensors_event_t* scratch,
         wp<const SensorEventConnection> const * mapFlushEventsToConnections) {
     // filter out events not for this connection
 
     std::unique_ptr<sensors_event_t[]> sanitizedBuffer;
 
-    int count = 0;
     Mutex::Autolock _l(mConnectionLock);
-    if (scratch) {
+    // The events are gathered from the caller's buffer rather than copied, see SensorEventSpans.
+    SensorEventSpans& events = mPendingEvents;
+    events.clear();
+    if (mapFlushEventsToConnections) {
         size_t i=0;
         while (i<numEvents) {
             int32_t sensor_handle = buffer[i].sensor;
@@ -336,19 +337,17 @@ status_t SensorService::SensorEventConnection::sendEvents(
             }
 
             do {
-                // Keep copying events into the scratch buffer as long as they are regular
-                // sensor_events are from the same sensor_handle OR they are flush_complete_events
-                // from the same sensor_handle AND the current connection is mapped to the
-                // corresponding flush_complete_event.
+                // Keep adding events as long as they are regular sensor_events are from the same
+                // sensor_handle OR they are flush_complete_events from the same sensor_handle AND
+                // the current connection is mapped to the corresponding flush_complete_event.
                 if (buffer[i].type == SENSOR_TYPE_META_DATA) {
                     if (mapFlushEventsToConnections[i] == this) {
-                        scratch[count++] = buffer[i];
+                        events.add(&buffer[i]);
                     }
                 } else {
-                    // Regular sensor event, just copy it to the scratch buffer after checking
-                    // the AppOp.
+                    // Regular sensor event, just add it after checking the AppOp.
                     if (hasSensorAccess() && noteOpIfRequired(buffer[i])) {
-                        scratch[count++] = buffer[i];
+                        events.add(&buffer[i]);
                     }
                 }
                 i++;
@@ -359,18 +358,19 @@ status_t SensorService::SensorEventConnection::sendEvents(
         }
     } else {
         if (hasSensorAccess()) {
-            scratch = const_cast<sensors_event_t *>(buffer);
-            count = numEvents;
+            events.add(buffer, numEvents);
         } else {
             sanitizedBuffer.reset(new sensors_event_t[numEvents]);
-            scratch = sanitizedBuffer.get();
+            size_t count = 0;
             for (size_t i = 0; i < numEvents; i++) {
                 if (buffer[i].type == SENSOR_TYPE_META_DATA) {
-                    scratch[count++] = buffer[i++];
+                    sanitizedBuffer[count++] = buffer[i++];
                 }
             }
+            events.add(sanitizedBuffer.get(), count);
         }
     }
+    const int count = events.count();
 
     sendPendingFlushEventsLocked();
     // Early return if there are no events for this connection.
@@ -384,15 +384,19 @@ status_t SensorService::SensorEventConnection::sendEvents(
     if (mCacheSize != 0) {
         // There are some events in the cache which need to be sent first. Copy this buffer to
         // the end of cache.
-        appendEventsToCacheLocked(scratch, count);
+        appendEventsToCacheLocked(events.flatten(), count);
         return status_t(NO_ERROR);
     }
 
-    int index_wake_up_event = -1;
+    // The flag is set on a copy of the event, since the buffer is shared with other connections.
+    sensors_event_t* wakeUpEvent = nullptr;
     if (hasSensorAccess()) {
-        index_wake_up_event = findWakeUpSensorEventLocked(scratch, count);
+        const int index_wake_up_event = events.find([this](const sensors_event_t& event) {
+            return mService->isWakeUpSensorEvent(event);
+        });
         if (index_wake_up_event >= 0) {
-            scratch[index_wake_up_event].flags |= WAKE_UP_SENSOR_EVENT_NEEDS_ACK;
+            wakeUpEvent = events.replaceWithCopy(index_wake_up_event);
+            wakeUpEvent->flags |= WAKE_UP_SENSOR_EVENT_NEEDS_ACK;
             ++mWakeLockRefCount;
 #if DEBUG_CONNECTIONS
             ++mTotalAcksNeeded;
@@ -400,14 +404,12 @@ status_t SensorService::SensorEventConnection::sendEvents(
         }
     }
 
-    // NOTE: ASensorEvent and sensors_event_t are the same type.
-    ssize_t size = SensorEventQueue::write(mChannel,
-                                    reinterpret_cast<ASensorEvent const*>(scratch), count);
+    ssize_t size = events.write(mChannel);
     if (size < 0) {
         // Write error, copy events to local cache.
-        if (index_wake_up_event >= 0) {
+        if (wakeUpEvent != nullptr) {
             // If there was a wake_up sensor_event, reset the flag.
-            scratch[index_wake_up_event].flags &= ~WAKE_UP_SENSOR_EVENT_NEEDS_ACK;
+            wakeUpEvent->flags &= ~WAKE_UP_SENSOR_EVENT_NEEDS_ACK;
             if (mWakeLockRefCount > 0) {
                 --mWakeLockRefCount;
             }
@@ -421,7 +423,7 @@ status_t SensorService::SensorEventConnection::sendEvents(
             mCacheSize = 0;
         }
         // Save the events so that they can be written later
-        appendEventsToCacheLocked(scratch, count);
+        appendEventsToCacheLocked(events.flatten(), count);
 
         // Add this file descriptor to the looper to get a callback when this fd is available for
         // writing.
@@ -37,6 +37,7 @@
 #include <sensor/ISensorServer.h>
 #include <sensor/ISensorEventConnection.h>
 
+#include "SensorEventSpans.h"
 #include "SensorService.h"
 
 namespace android {
@@ -53,8 +54,10 @@ public:
                           bool isDataInjectionMode, const String16& opPackageName,
                           const String16& attributionTag);
 
-    status_t sendEvents(sensors_event_t const* buffer, size_t count, sensors_event_t* scratch,
-                        wp<const SensorEventConnection> const * mapFlushEventsToConnections = nullptr);
+    // Sends the events of the registered sensors. If mapFlushEventsToConnections is null, the events
+    // are all sent without filtering.
+    status_t sendEvents(sensors_event_t const* buffer, size_t count,
+                        wp<const SensorEventConnection> const * mapFlushEventsToConnections);
     bool hasSensor(int32_t handle) const;
     bool hasAnySensor() const;
     bool hasOneShotSensors() const;
@@ -179,6 +182,9 @@ private:
     // protected by SensorService::mLock. Key for this map is the sensor handle.
     std::unordered_map<int32_t, FlushInfo> mSensorInfo;
 
+    // The events of the batch being sent, reused across batches.
+    SensorEventSpans mPendingEvents;
+
     sensors_event_t *mEventCache;
     int mCacheSize, mMaxCacheSize;
     int64_t mTimeOfLastEventDrop;
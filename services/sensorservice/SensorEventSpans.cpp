@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SensorEventSpans.h"
+
+#include <limits.h>
+#include <log/log.h>
+
+#include <algorithm>
+
+namespace android {
+
+void SensorEventSpans::clear() {
+    mSpans.clear();
+    mCount = 0;
+    mHasCopy = false;
+}
+
+void SensorEventSpans::add(sensors_event_t const* events, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (!mSpans.empty() && mSpans.back().events + mSpans.back().count == events) {
+        mSpans.back().count += count;
+    } else {
+        mSpans.push_back({events, count});
+    }
+    mCount += count;
+}
+
+sensors_event_t* SensorEventSpans::replaceWithCopy(size_t index) {
+    LOG_ALWAYS_FATAL_IF(mHasCopy, "only one event per batch can be replaced");
+    LOG_ALWAYS_FATAL_IF(index >= mCount, "event %zu out of range (%zu events)", index, mCount);
+
+    auto span = mSpans.begin();
+    while (index >= span->count) {
+        index -= span->count;
+        ++span;
+    }
+    mCopy = span->events[index];
+    mHasCopy = true;
+
+    // Split the span around the event: [before] [copy] [after], dropping empty parts.
+    const Span after = {span->events + index + 1, span->count - index - 1};
+    span->count = index;
+    if (span->count == 0) {
+        *span = {&mCopy, 1};
+    } else {
+        span = mSpans.insert(span + 1, {&mCopy, 1});
+    }
+    if (after.count > 0) {
+        mSpans.insert(span + 1, after);
+    }
+    return &mCopy;
+}
+
+sensors_event_t const* SensorEventSpans::flatten() {
+    if (mSpans.size() == 1) {
+        return mSpans.front().events;
+    }
+    mFlattened.resize(mCount);
+    auto out = mFlattened.begin();
+    for (const Span& span : mSpans) {
+        out = std::copy(span.events, span.events + span.count, out);
+    }
+    return mFlattened.data();
+}
+
+ssize_t SensorEventSpans::write(const sp<BitTube>& tube) {
+    // NOTE: ASensorEvent and sensors_event_t are the same type.
+    if (mSpans.size() == 1 || mSpans.size() > IOV_MAX) {
+        return BitTube::sendObjects(tube, flatten(), mCount);
+    }
+    mIovecs.clear();
+    for (const Span& span : mSpans) {
+        mIovecs.push_back({const_cast<sensors_event_t*>(span.events),
+                           span.count * sizeof(sensors_event_t)});
+    }
+    return BitTube::sendObjects(tube, mIovecs.data(), mIovecs.size(), sizeof(sensors_event_t));
+}
+
+} // namespace android
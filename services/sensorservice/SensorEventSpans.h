@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_EVENT_SPANS_H
+#define ANDROID_SENSOR_EVENT_SPANS_H
+
+#include <hardware/sensors.h>
+#include <sensor/BitTube.h>
+#include <sys/uio.h>
+#include <utils/RefBase.h>
+
+#include <vector>
+
+namespace android {
+
+/**
+ * The events of one SensorService::threadLoop batch that are meant for one connection, kept as
+ * spans of consecutive events in the shared poll buffer rather than copied into a buffer of their
+ * own. The spans are written to the connection's BitTube with a single gathered send, so fanning a
+ * batch out to many connections copies each event only into the sockets that receive it.
+ *
+ * The spans point into the buffers they were added from, which must outlive them until the next
+ * clear().
+ */
+class SensorEventSpans final {
+public:
+    SensorEventSpans() = default;
+    SensorEventSpans(const SensorEventSpans&) = delete;
+    SensorEventSpans& operator=(const SensorEventSpans&) = delete;
+
+    void clear();
+
+    // Appends count events, merging them into the last span if they directly follow it.
+    void add(sensors_event_t const* events, size_t count = 1);
+
+    size_t count() const { return mCount; }
+
+    // Number of spans, and so of buffers gathered by write().
+    size_t spanCount() const { return mSpans.size(); }
+
+    // Returns the index of the first event matching the predicate, or -1.
+    template <typename Predicate>
+    int find(Predicate predicate) const {
+        int index = 0;
+        for (const Span& span : mSpans) {
+            for (size_t i = 0; i < span.count; i++, index++) {
+                if (predicate(span.events[i])) {
+                    return index;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Swaps the event at the given index for a private copy and returns it, so that it can be
+    // modified without touching the shared buffer. Only one event per batch can be replaced.
+    sensors_event_t* replaceWithCopy(size_t index);
+
+    // Returns the events as one contiguous array, copying them if they span several buffers.
+    sensors_event_t const* flatten();
+
+    // Writes all events to the tube as one message. Returns the number of events written or a
+    // negative error.
+    ssize_t write(const sp<BitTube>& tube);
+
+private:
+    struct Span {
+        sensors_event_t const* events;
+        size_t count;
+    };
+
+    std::vector<Span> mSpans;
+    size_t mCount = 0;
+    sensors_event_t mCopy;
+    bool mHasCopy = false;
+    std::vector<sensors_event_t> mFlattened;
+    std::vector<struct iovec> mIovecs;
+};
+
+} // namespace android
+
+#endif // ANDROID_SENSOR_EVENT_SPANS_H
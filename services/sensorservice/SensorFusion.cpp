@@ -28,17 +28,12 @@ ANDROID_SINGLETON_STATIC_INSTANCE(SensorFusion)
 
 SensorFusion::SensorFusion()
     : mSensorDevice(SensorDevice::getInstance()),
-      mAttitude(mAttitudes[FUSION_9AXIS]),
-      mGyroTime(0), mAccTime(0)
+      mEstimate(&mFusion.getLatestEstimate())
 {
     sensor_t const* list;
     Sensor uncalibratedGyro;
     ssize_t count = mSensorDevice.getSensorList(&list);
 
-    mEnabled[FUSION_9AXIS] = false;
-    mEnabled[FUSION_NOMAG] = false;
-    mEnabled[FUSION_NOGYRO] = false;
-
     if (count > 0) {
         for (size_t i=0 ; i<size_t(count) ; i++) {
             if (list[i].type == SENSOR_TYPE_ACCELEROMETER) {
@@ -60,64 +55,17 @@ SensorFusion::SensorFusion()
             mGyro = uncalibratedGyro;
         }
 
+        mFusion.setGyroType(mGyro.getType());
+
         // 200 Hz for gyro events is a good compromise between precision
         // and power/cpu usage.
-        mEstimatedGyroRate = 200;
-        mTargetDelayNs = 1000000000LL/mEstimatedGyroRate;
-
-        for (int i = 0; i<NUM_FUSION_MODE; ++i) {
-            mFusions[i].init(i);
-        }
+        mTargetDelayNs = 1000000000LL/200;
     }
 }
 
-void SensorFusion::process(const sensors_event_t& event) {
-
-    if (event.type == mGyro.getType()) {
-        float dT;
-        if ( event.timestamp - mGyroTime> 0 &&
-             event.timestamp - mGyroTime< (int64_t)(5e7) ) { //0.05sec
-
-            dT = (event.timestamp - mGyroTime) / 1000000000.0f;
-            // here we estimate the gyro rate (useful for debugging)
-            const float freq = 1 / dT;
-            if (freq >= 100 && freq<1000) { // filter values obviously wrong
-                const float alpha = 1 / (1 + dT); // 1s time-constant
-                mEstimatedGyroRate = freq + (mEstimatedGyroRate - freq)*alpha;
-            }
-
-            const vec3_t gyro(event.data);
-            for (int i = 0; i<NUM_FUSION_MODE; ++i) {
-                if (mEnabled[i]) {
-                    // fusion in no gyro mode will ignore
-                    mFusions[i].handleGyro(gyro, dT);
-                }
-            }
-        }
-        mGyroTime = event.timestamp;
-    } else if (event.type == SENSOR_TYPE_MAGNETIC_FIELD) {
-        const vec3_t mag(event.data);
-        for (int i = 0; i<NUM_FUSION_MODE; ++i) {
-            if (mEnabled[i]) {
-                mFusions[i].handleMag(mag);// fusion in no mag mode will ignore
-            }
-        }
-    } else if (event.type == SENSOR_TYPE_ACCELEROMETER) {
-        float dT;
-        if ( event.timestamp - mAccTime> 0 &&
-             event.timestamp - mAccTime< (int64_t)(1e8) ) { //0.1sec
-            dT = (event.timestamp - mAccTime) / 1000000000.0f;
-
-            const vec3_t acc(event.data);
-            for (int i = 0; i<NUM_FUSION_MODE; ++i) {
-                if (mEnabled[i]) {
-                    mFusions[i].handleAcc(acc, dT);
-                    mAttitudes[i] = mFusions[i].getAttitude();
-                }
-            }
-        }
-        mAccTime = event.timestamp;
-    }
+void SensorFusion::processBatch(sensors_event_t const* events, size_t count) {
+    mFusion.processBatch(events, count);
+    mEstimate = &mFusion.getLatestEstimate();
 }
 
 template <typename T> inline T min(T a, T b) { return a<b ? a : b; }
@@ -140,13 +88,7 @@ status_t SensorFusion::activate(int mode, void* ident, bool enabled) {
         }
     }
 
-    const bool newState = mClients[mode].size() != 0;
-    if (newState != mEnabled[mode]) {
-        mEnabled[mode] = newState;
-        if (newState) {
-            mFusions[mode].init(mode);
-        }
-    }
+    mFusion.setEnabled(mode, mClients[mode].size() != 0);
 
     mSensorDevice.activate(ident, mAcc.getHandle(), enabled);
     if (mode != FUSION_NOMAG) {
@@ -187,13 +129,13 @@ int32_t SensorFusion::getMinDelay() const {
 }
 
 void SensorFusion::dump(String8& result) const {
-    const Fusion& fusion_9axis(mFusions[FUSION_9AXIS]);
+    const Fusion& fusion_9axis(mFusion.getFusion(FUSION_9AXIS));
     result.appendFormat("9-axis fusion %s (%zd clients), gyro-rate=%7.2fHz, "
             "q=< %g, %g, %g, %g > (%g), "
             "b=< %g, %g, %g >\n",
-            mEnabled[FUSION_9AXIS] ? "enabled" : "disabled",
+            mFusion.isEnabled(FUSION_9AXIS) ? "enabled" : "disabled",
             mClients[FUSION_9AXIS].size(),
-            mEstimatedGyroRate,
+            mFusion.getEstimatedGyroRate(),
             fusion_9axis.getAttitude().x,
             fusion_9axis.getAttitude().y,
             fusion_9axis.getAttitude().z,
@@ -203,14 +145,14 @@ void SensorFusion::dump(String8& result) const {
             fusion_9axis.getBias().y,
             fusion_9axis.getBias().z);
 
-    const Fusion& fusion_nomag(mFusions[FUSION_NOMAG]);
+    const Fusion& fusion_nomag(mFusion.getFusion(FUSION_NOMAG));
     result.appendFormat("game fusion(no mag) %s (%zd clients), "
             "gyro-rate=%7.2fHz, "
             "q=< %g, %g, %g, %g > (%g), "
             "b=< %g, %g, %g >\n",
-            mEnabled[FUSION_NOMAG] ? "enabled" : "disabled",
+            mFusion.isEnabled(FUSION_NOMAG) ? "enabled" : "disabled",
             mClients[FUSION_NOMAG].size(),
-            mEstimatedGyroRate,
+            mFusion.getEstimatedGyroRate(),
             fusion_nomag.getAttitude().x,
             fusion_nomag.getAttitude().y,
             fusion_nomag.getAttitude().z,
@@ -220,14 +162,14 @@ void SensorFusion::dump(String8& result) const {
             fusion_nomag.getBias().y,
             fusion_nomag.getBias().z);
 
-    const Fusion& fusion_nogyro(mFusions[FUSION_NOGYRO]);
+    const Fusion& fusion_nogyro(mFusion.getFusion(FUSION_NOGYRO));
     result.appendFormat("geomag fusion (no gyro) %s (%zd clients), "
             "gyro-rate=%7.2fHz, "
             "q=< %g, %g, %g, %g > (%g), "
             "b=< %g, %g, %g >\n",
-            mEnabled[FUSION_NOGYRO] ? "enabled" : "disabled",
+            mFusion.isEnabled(FUSION_NOGYRO) ? "enabled" : "disabled",
             mClients[FUSION_NOGYRO].size(),
-            mEstimatedGyroRate,
+            mFusion.getEstimatedGyroRate(),
             fusion_nogyro.getAttitude().x,
             fusion_nogyro.getAttitude().y,
             fusion_nogyro.getAttitude().z,
@@ -240,10 +182,10 @@ void SensorFusion::dump(String8& result) const {
 
 void SensorFusion::dumpFusion(FUSION_MODE mode, util::ProtoOutputStream* proto) const {
     using namespace service::SensorFusionProto::FusionProto;
-    const Fusion& fusion(mFusions[mode]);
-    proto->write(ENABLED, mEnabled[mode]);
+    const Fusion& fusion(mFusion.getFusion(mode));
+    proto->write(ENABLED, mFusion.isEnabled(mode));
     proto->write(NUM_CLIENTS, (int)mClients[mode].size());
-    proto->write(ESTIMATED_GYRO_RATE, mEstimatedGyroRate);
+    proto->write(ESTIMATED_GYRO_RATE, mFusion.getEstimatedGyroRate());
     proto->write(ATTITUDE_X, fusion.getAttitude().x);
     proto->write(ATTITUDE_Y, fusion.getAttitude().y);
     proto->write(ATTITUDE_Z, fusion.getAttitude().z);
@@ -26,7 +26,7 @@
 
 #include <sensor/Sensor.h>
 
-#include "Fusion.h"
+#include "BatchFusion.h"
 
 // ---------------------------------------------------------------------------
 
@@ -43,46 +43,44 @@ class SensorFusion : public Singleton<SensorFusion> {
     Sensor mMag;
     Sensor mGyro;
 
-    Fusion mFusions[NUM_FUSION_MODE]; // normal, no_mag, no_gyro
-
-    bool mEnabled[NUM_FUSION_MODE];
-
-    vec4_t &mAttitude;
-    vec4_t mAttitudes[NUM_FUSION_MODE];
+    BatchFusion mFusion;
+    // The estimate the getters return, see selectEvent().
+    const BatchFusion::Estimate* mEstimate;
 
     SortedVector<void*> mClients[3];
 
-    float mEstimatedGyroRate;
     nsecs_t mTargetDelayNs;
 
-    nsecs_t mGyroTime;
-    nsecs_t mAccTime;
-
     SensorFusion();
 
 public:
-    void process(const sensors_event_t& event);
+    // Runs the fusion over a batch of events and selects the estimate after the last one.
+    void processBatch(sensors_event_t const* events, size_t count);
+
+    // Makes the getters below return the estimate as of events[index] of the last batch, so that
+    // virtual sensors computed for that event use the estimate it produced.
+    void selectEvent(size_t index) { mEstimate = &mFusion.getEstimate(index); }
 
     bool isEnabled() const {
-        return mEnabled[FUSION_9AXIS] ||
-                mEnabled[FUSION_NOMAG] ||
-                mEnabled[FUSION_NOGYRO];
+        return mFusion.isEnabled(FUSION_9AXIS) ||
+                mFusion.isEnabled(FUSION_NOMAG) ||
+                mFusion.isEnabled(FUSION_NOGYRO);
     }
 
     bool hasEstimate(int mode = FUSION_9AXIS) const {
-        return mFusions[mode].hasEstimate();
+        return mEstimate->hasEstimate[mode];
     }
 
     mat33_t getRotationMatrix(int mode = FUSION_9AXIS) const {
-        return mFusions[mode].getRotationMatrix();
+        return mEstimate->rotationMatrix[mode];
     }
 
     vec4_t getAttitude(int mode = FUSION_9AXIS) const {
-        return mAttitudes[mode];
+        return mEstimate->attitude[mode];
     }
 
-    vec3_t getGyroBias() const { return mFusions[FUSION_9AXIS].getBias(); }
-    float getEstimatedRate() const { return mEstimatedGyroRate; }
+    vec3_t getGyroBias() const { return mEstimate->gyroBias; }
+    float getEstimatedRate() const { return mFusion.getEstimatedGyroRate(); }
 
     status_t activate(int mode, void* ident, bool enabled);
     status_t setDelay(int mode, void* ident, int64_t ns);
@@ -43,6 +43,9 @@ public:
 
     virtual const Sensor& getSensor() const = 0;
     virtual bool isVirtual() const = 0;
+    // Whether activate(), batch() and flush() update state guarded by SensorService's main lock,
+    // and so must be called with it held. Other sensors are called without it.
+    virtual bool needsServiceLock() const { return isVirtual(); }
     virtual void autoDisable(void* /*ident*/, int /*handle*/) = 0;
 
     virtual void willDisableAllSensors() = 0;
@@ -114,6 +117,8 @@ public:
     explicit ProximitySensor(const sensor_t& sensor, SensorService& service);
 
     status_t activate(void* ident, bool enabled) override;
+    // activate() updates the proximity active count.
+    bool needsServiceLock() const override { return true; }
 
     void willDisableAllSensors() override;
     void didEnableAllSensors() override;
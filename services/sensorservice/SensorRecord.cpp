@@ -66,6 +66,16 @@ void SensorService::SensorRecord::removeFirstPendingFlushConnection() {
     }
 }
 
+void SensorService::SensorRecord::removeLastPendingFlushConnection(
+        const wp<const SensorEventConnection>& connection) {
+    for (size_t i = mPendingFlushConnections.size(); i > 0; i--) {
+        if (mPendingFlushConnections[i - 1] == connection) {
+            mPendingFlushConnections.removeAt(i - 1);
+            return;
+        }
+    }
+}
+
 wp<const SensorService::SensorEventConnection>
         SensorService::SensorRecord::getFirstPendingFlushConnection() {
     if (mPendingFlushConnections.size() > 0) {
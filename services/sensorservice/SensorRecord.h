@@ -32,6 +32,8 @@ public:
 
     void addPendingFlushConnection(const sp<const SensorEventConnection>& connection);
     void removeFirstPendingFlushConnection();
+    // Removes the most recent flush() call of the connection, for a flush that failed.
+    void removeLastPendingFlushConnection(const wp<const SensorEventConnection>& connection);
     wp<const SensorEventConnection> getFirstPendingFlushConnection();
     void clearAllPendingFlushConnections();
 private:
@@ -288,7 +288,6 @@ void SensorService::onFirstRef() {
             mLooper = new Looper(false);
             const size_t minBufferSize = SensorEventQueue::MAX_RECEIVE_BUFFER_EVENT_COUNT;
             mSensorEventBuffer = new sensors_event_t[minBufferSize];
-            mSensorEventScratch = new sensors_event_t[minBufferSize];
             mMapFlushEventsToConnections = new wp<const SensorEventConnection> [minBufferSize];
             mCurrentOperatingMode = NORMAL;
 
@@ -395,6 +394,14 @@ status_t SensorService::dump(int fd, const Vector<String16>& args) {
         if (args.size() > 2) {
            return INVALID_OPERATION;
         }
+        // The mode changes below must not interleave with registrations.
+        std::unique_lock<std::recursive_mutex> registrationLock(mRegistrationLock,
+                                                                std::defer_lock);
+        if (args.size() > 0 && (args[0] == String16("restrict") ||
+                                args[0] == String16("enable") ||
+                                args[0] == String16("data_injection"))) {
+            registrationLock.lock();
+        }
         ConnectionSafeAutolock connLock = mConnectionHolder.lock(mLock);
         SensorDevice& dev(SensorDevice::getInstance());
         if (args.size() == 2 && args[0] == String16("restrict")) {
@@ -670,6 +677,7 @@ status_t SensorService::dumpProtoLocked(int fd, ConnectionSafeAutolock* connLock
 }
 
 void SensorService::disableAllSensors() {
+    std::lock_guard<std::recursive_mutex> registrationLock(mRegistrationLock);
     ConnectionSafeAutolock connLock = mConnectionHolder.lock(mLock);
     disableAllSensorsLocked(&connLock);
 }
@@ -694,6 +702,7 @@ void SensorService::disableAllSensorsLocked(ConnectionSafeAutolock* connLock) {
 }
 
 void SensorService::enableAllSensors() {
+    std::lock_guard<std::recursive_mutex> registrationLock(mRegistrationLock);
     ConnectionSafeAutolock connLock = mConnectionHolder.lock(mLock);
     enableAllSensorsLocked(&connLock);
 }
@@ -954,12 +963,15 @@ bool SensorService::threadLoop() {
             if (!mActiveVirtualSensors.empty()) {
                 size_t k = 0;
                 SensorFusion& fusion(SensorFusion::getInstance());
-                if (fusion.isEnabled()) {
-                    for (size_t i=0 ; i<size_t(count) ; i++) {
-                        fusion.process(event[i]);
-                    }
+                const bool fused = fusion.isEnabled();
+                if (fused) {
+                    fusion.processBatch(event, count);
                 }
                 for (size_t i=0 ; i<size_t(count) && k<minBufferSize ; i++) {
+                    if (fused) {
+                        // Virtual sensors use the estimate as of this event, not the last one.
+                        fusion.selectEvent(i);
+                    }
                     for (int handle : mActiveVirtualSensors) {
                         if (count + k >= minBufferSize) {
                             ALOGE("buffer too small to hold all events: "
@@ -1067,8 +1079,7 @@ bool SensorService::threadLoop() {
         // lock if none of the clients need it.
         bool needsWakeLock = false;
         for (const sp<SensorEventConnection>& connection : activeConnections) {
-            connection->sendEvents(mSensorEventBuffer, count, mSensorEventScratch,
-                    mMapFlushEventsToConnections);
+            connection->sendEvents(mSensorEventBuffer, count, mMapFlushEventsToConnections);
             needsWakeLock |= connection->needsWakeLock();
             // If the connection has one-shot sensors, it may be cleaned up after first trigger.
             // Early check for one-shot sensors.
@@ -1528,6 +1539,7 @@ int SensorService::setOperationParameter(
 }
 
 status_t SensorService::resetToNormalMode() {
+    std::lock_guard<std::recursive_mutex> registrationLock(mRegistrationLock);
     Mutex::Autolock _l(mLock);
     return resetToNormalModeLocked();
 }
@@ -1547,6 +1559,7 @@ status_t SensorService::resetToNormalModeLocked() {
 }
 
 void SensorService::cleanupConnection(SensorEventConnection* c) {
+    std::lock_guard<std::recursive_mutex> registrationLock(mRegistrationLock);
     ConnectionSafeAutolock connLock = mConnectionHolder.lock(mLock);
     const wp<SensorEventConnection> connection(c);
     size_t size = mActiveSensors.size();
@@ -1694,74 +1707,96 @@ status_t SensorService::enable(const sp<SensorEventConnection>& connection,
         return BAD_VALUE;
     }
 
-    ConnectionSafeAutolock connLock = mConnectionHolder.lock(mLock);
-    if (mCurrentOperatingMode != NORMAL
-           && !isWhiteListedPackage(connection->getPackageName())) {
-        return INVALID_OPERATION;
-    }
+    // The HAL calls below are made without mLock, so that the poll thread keeps delivering events
+    // while they run; mRegistrationLock keeps other registrations from interleaving with them.
+    std::lock_guard<std::recursive_mutex> registrationLock(mRegistrationLock);
+    bool needsFlush = false;
+    {
+        ConnectionSafeAutolock connLock = mConnectionHolder.lock(mLock);
+        if (mCurrentOperatingMode != NORMAL
+               && !isWhiteListedPackage(connection->getPackageName())) {
+            return INVALID_OPERATION;
+        }
 
-    SensorRecord* rec = mActiveSensors.valueFor(handle);
-    if (rec == nullptr) {
-        rec = new SensorRecord(connection);
-        mActiveSensors.add(handle, rec);
-        if (sensor->isVirtual()) {
-            mActiveVirtualSensors.emplace(handle);
-        }
-
-        // There was no SensorRecord for this sensor which means it was previously disabled. Mark
-        // the recent event as stale to ensure that the previous event is not sent to a client. This
-        // ensures on-change events that were generated during a previous sensor activation are not
-        // erroneously sent to newly connected clients, especially if a second client registers for
-        // an on-change sensor before the first client receives the updated event. Once an updated
-        // event is received, the recent events will be marked as current, and any new clients will
-        // immediately receive the most recent event.
-        if (sensor->getSensor().getReportingMode() == AREPORTING_MODE_ON_CHANGE) {
-            auto logger = mRecentEvent.find(handle);
-            if (logger != mRecentEvent.end()) {
-                logger->second->setLastEventStale();
+        SensorRecord* rec = mActiveSensors.valueFor(handle);
+        if (rec == nullptr) {
+            rec = new SensorRecord(connection);
+            mActiveSensors.add(handle, rec);
+            if (sensor->isVirtual()) {
+                mActiveVirtualSensors.emplace(handle);
             }
-        }
-    } else {
-        if (rec->addConnection(connection)) {
-            // this sensor is already activated, but we are adding a connection that uses it.
-            // Immediately send down the last known value of the requested sensor if it's not a
-            // "continuous" sensor.
-            if (sensor->getSensor().getReportingMode() == AREPORTING_MODE_ON_CHANGE) {
-                // NOTE: The wake_up flag of this event may get set to
-                // WAKE_UP_SENSOR_EVENT_NEEDS_ACK if this is a wake_up event.
 
+            // There was no SensorRecord for this sensor which means it was previously disabled.
+            // Mark the recent event as stale to ensure that the previous event is not sent to a
+            // client. This ensures on-change events that were generated during a previous sensor
+            // activation are not erroneously sent to newly connected clients, especially if a
+            // second client registers for an on-change sensor before the first client receives
+            // the updated event. Once an updated event is received, the recent events will be
+            // marked as current, and any new clients will immediately receive the most recent
+            // event.
+            if (sensor->getSensor().getReportingMode() == AREPORTING_MODE_ON_CHANGE) {
                 auto logger = mRecentEvent.find(handle);
                 if (logger != mRecentEvent.end()) {
-                    sensors_event_t event;
-                    // Verify that the last sensor event was generated from the current activation
-                    // of the sensor. If not, it is possible for an on-change sensor to receive a
-                    // sensor event that is stale if two clients re-activate the sensor
-                    // simultaneously.
-                    if(logger->second->populateLastEventIfCurrent(&event)) {
-                        event.sensor = handle;
-                        if (event.version == sizeof(sensors_event_t)) {
-                            if (isWakeUpSensorEvent(event) && !mWakeLockAcquired) {
-                                setWakeLockAcquiredLocked(true);
-                            }
-                            connection->sendEvents(&event, 1, nullptr);
-                            if (!connection->needsWakeLock() && mWakeLockAcquired) {
-                                checkWakeLockStateLocked(&connLock);
+                    logger->second->setLastEventStale();
+                }
+            }
+        } else {
+            if (rec->addConnection(connection)) {
+                // this sensor is already activated, but we are adding a connection that uses it.
+                // Immediately send down the last known value of the requested sensor if it's not a
+                // "continuous" sensor.
+                if (sensor->getSensor().getReportingMode() == AREPORTING_MODE_ON_CHANGE) {
+                    // NOTE: The wake_up flag of this event may get set to
+                    // WAKE_UP_SENSOR_EVENT_NEEDS_ACK if this is a wake_up event.
+
+                    auto logger = mRecentEvent.find(handle);
+                    if (logger != mRecentEvent.end()) {
+                        sensors_event_t event;
+                        // Verify that the last sensor event was generated from the current
+                        // activation of the sensor. If not, it is possible for an on-change sensor
+                        // to receive a sensor event that is stale if two clients re-activate the
+                        // sensor simultaneously.
+                        if(logger->second->populateLastEventIfCurrent(&event)) {
+                            event.sensor = handle;
+                            if (event.version == sizeof(sensors_event_t)) {
+                                if (isWakeUpSensorEvent(event) && !mWakeLockAcquired) {
+                                    setWakeLockAcquiredLocked(true);
+                                }
+                                connection->sendEvents(&event, 1, nullptr);
+                                if (!connection->needsWakeLock() && mWakeLockAcquired) {
+                                    checkWakeLockStateLocked(&connLock);
+                                }
                             }
                         }
                     }
                 }
             }
         }
-    }
 
-    if (connection->addSensor(handle)) {
-        BatteryService::enableSensor(connection->getUid(), handle);
-        // the sensor was added (which means it wasn't already there)
-        // so, see if this connection becomes active
-        mConnectionHolder.addEventConnectionIfNotPresent(connection);
-    } else {
-        ALOGW("sensor %08x already enabled in connection %p (ignoring)",
-            handle, connection.get());
+        if (connection->addSensor(handle)) {
+            BatteryService::enableSensor(connection->getUid(), handle);
+            // the sensor was added (which means it wasn't already there)
+            // so, see if this connection becomes active
+            mConnectionHolder.addEventConnectionIfNotPresent(connection);
+        } else {
+            ALOGW("sensor %08x already enabled in connection %p (ignoring)",
+                handle, connection.get());
+        }
+
+        // Call flush() before calling activate() on the sensor. Wait for a first
+        // flush complete event before sending events on this connection. Ignore
+        // one-shot sensors which don't support flush(). Ignore on-change sensors
+        // to maintain the on-change logic (any on-change events except the initial
+        // one should be trigger by a change in value). Also if this sensor isn't
+        // already active, don't call flush().
+        // The flush is queued before it is made, since the poll thread may receive the flush
+        // complete event before flush() returns.
+        if (sensor->getSensor().getReportingMode() == AREPORTING_MODE_CONTINUOUS &&
+                rec->getNumConnections() > 1) {
+            needsFlush = true;
+            connection->setFirstFlushPending(handle, true);
+            rec->addPendingFlushConnection(connection.get());
+        }
     }
 
     // Check maximum delay for the sensor.
@@ -1779,31 +1814,36 @@ status_t SensorService::enable(const sp<SensorEventConnection>& connection,
                                 "rate=%" PRId64 " timeout== %" PRId64"",
              handle, reservedFlags, samplingPeriodNs, maxBatchReportLatencyNs);
 
-    status_t err = sensor->batch(connection.get(), handle, 0, samplingPeriodNs,
-                                 maxBatchReportLatencyNs);
-
-    // Call flush() before calling activate() on the sensor. Wait for a first
-    // flush complete event before sending events on this connection. Ignore
-    // one-shot sensors which don't support flush(). Ignore on-change sensors
-    // to maintain the on-change logic (any on-change events except the initial
-    // one should be trigger by a change in value). Also if this sensor isn't
-    // already active, don't call flush().
-    if (err == NO_ERROR &&
-            sensor->getSensor().getReportingMode() == AREPORTING_MODE_CONTINUOUS &&
-            rec->getNumConnections() > 1) {
-        connection->setFirstFlushPending(handle, true);
-        status_t err_flush = sensor->flush(connection.get(), handle);
-        // Flush may return error if the underlying h/w sensor uses an older HAL.
-        if (err_flush == NO_ERROR) {
-            rec->addPendingFlushConnection(connection.get());
-        } else {
-            connection->setFirstFlushPending(handle, false);
+    bool flushFailed = false;
+    auto configureSensor = [&]() {
+        status_t err = sensor->batch(connection.get(), handle, 0, samplingPeriodNs,
+                                     maxBatchReportLatencyNs);
+        if (err == NO_ERROR && needsFlush) {
+            // Flush may return error if the underlying h/w sensor uses an older HAL.
+            flushFailed = sensor->flush(connection.get(), handle) != NO_ERROR;
         }
+        if (err == NO_ERROR) {
+            ALOGD_IF(DEBUG_CONNECTIONS, "Calling activate on %d", handle);
+            err = sensor->activate(connection.get(), true);
+        }
+        return err;
+    };
+
+    status_t err;
+    if (sensor->needsServiceLock()) {
+        Mutex::Autolock _l(mLock);
+        err = configureSensor();
+    } else {
+        err = configureSensor();
     }
 
-    if (err == NO_ERROR) {
-        ALOGD_IF(DEBUG_CONNECTIONS, "Calling activate on %d", handle);
-        err = sensor->activate(connection.get(), true);
+    ConnectionSafeAutolock connLock = mConnectionHolder.lock(mLock);
+    if (err == NO_ERROR && flushFailed) {
+        connection->setFirstFlushPending(handle, false);
+        SensorRecord* rec = mActiveSensors.valueFor(handle);
+        if (rec != nullptr) {
+            rec->removeLastPendingFlushConnection(connection.get());
+        }
     }
 
     if (err == NO_ERROR) {
@@ -1831,14 +1871,22 @@ status_t SensorService::disable(const sp<SensorEventConnection>& connection, int
     if (mInitCheck != NO_ERROR)
         return mInitCheck;
 
-    Mutex::Autolock _l(mLock);
-    status_t err = cleanupWithoutDisableLocked(connection, handle);
+    // As in enable(), the HAL is called without mLock.
+    std::lock_guard<std::recursive_mutex> registrationLock(mRegistrationLock);
+    status_t err = cleanupWithoutDisable(connection, handle);
     if (err == NO_ERROR) {
         sp<SensorInterface> sensor = getSensorInterfaceFromHandle(handle);
-        err = sensor != nullptr ? sensor->activate(connection.get(), false) : status_t(BAD_VALUE);
-
+        if (sensor == nullptr) {
+            err = BAD_VALUE;
+        } else if (sensor->needsServiceLock()) {
+            Mutex::Autolock _l(mLock);
+            err = sensor->activate(connection.get(), false);
+        } else {
+            err = sensor->activate(connection.get(), false);
+        }
     }
     if (err == NO_ERROR) {
+        Mutex::Autolock _l(mLock);
         mLastNSensorRegistrations.editItemAt(mNextSensorRegIndex) =
                 SensorRegistrationInfo(handle, connection->getPackageName(), 0, 0, false);
         mNextSensorRegIndex = (mNextSensorRegIndex + 1) % SENSOR_REGISTRATIONS_BUF_SIZE;
@@ -1903,7 +1951,8 @@ status_t SensorService::flushSensor(const sp<SensorEventConnection>& connection,
     SensorDevice& dev(SensorDevice::getInstance());
     const int halVersion = dev.getHalDeviceVersion();
     status_t err(NO_ERROR);
-    Mutex::Autolock _l(mLock);
+    // As in enable(), the HAL is called without mLock.
+    std::lock_guard<std::recursive_mutex> registrationLock(mRegistrationLock);
     // Loop through all sensors for this connection and call flush on each of them.
     for (int handle : connection->getActiveSensorHandles()) {
         sp<SensorInterface> sensor = getSensorInterfaceFromHandle(handle);
@@ -1927,10 +1976,22 @@ status_t SensorService::flushSensor(const sp<SensorEventConnection>& connection,
                 err = INVALID_OPERATION;
                 continue;
             }
+            // Queue the flush before making it, since the poll thread may receive the flush
+            // complete event before flush() returns.
+            bool queued = false;
+            {
+                Mutex::Autolock _l(mLock);
+                SensorRecord* rec = mActiveSensors.valueFor(handle);
+                if (rec != nullptr) {
+                    rec->addPendingFlushConnection(connection);
+                    queued = true;
+                }
+            }
             status_t err_flush = sensor->flush(connection.get(), handle);
-            if (err_flush == NO_ERROR) {
+            if (err_flush != NO_ERROR && queued) {
+                Mutex::Autolock _l(mLock);
                 SensorRecord* rec = mActiveSensors.valueFor(handle);
-                if (rec != nullptr) rec->addPendingFlushConnection(connection);
+                if (rec != nullptr) rec->removeLastPendingFlushConnection(connection.get());
             }
             err = (err_flush != NO_ERROR) ? err_flush : err;
         }
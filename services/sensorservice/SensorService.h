@@ -41,6 +41,7 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -461,13 +462,21 @@ private:
     sp<Looper> mLooper;
     sp<SensorEventAckReceiver> mAckReceiver;
 
+    // Serializes enable(), disable() and flushSensor(), so that they can call into the HAL without
+    // holding mLock, which the poll thread needs for every batch of events. Everything else that
+    // changes which sensors may be active (operating mode changes, sensor privacy, connection
+    // cleanup) takes it too, so that it can't slip in between their bookkeeping and their HAL
+    // calls. Acquired before mLock. Recursive, since dropping the last reference to a connection
+    // while it's held runs cleanupConnection() on the same thread.
+    std::recursive_mutex mRegistrationLock;
+
     // protected by mLock
     mutable Mutex mLock;
     DefaultKeyedVector<int, SensorRecord*> mActiveSensors;
     std::unordered_set<int> mActiveVirtualSensors;
     SensorConnectionHolder mConnectionHolder;
     bool mWakeLockAcquired;
-    sensors_event_t *mSensorEventBuffer, *mSensorEventScratch;
+    sensors_event_t *mSensorEventBuffer;
     // WARNING: these SensorEventConnection instances must not be promoted to sp, except via
     // modification to add support for them in ConnectionSafeAutolock
     wp<const SensorEventConnection> * mMapFlushEventsToConnections;
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SensorEventFanoutBenchmarks"
+
+#include <benchmark/benchmark.h>
+#include <hardware/sensors.h>
+#include <sensor/BitTube.h>
+
+#include <iterator>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "../SensorEventSpans.h"
+
+using ::benchmark::Counter;
+using ::benchmark::State;
+
+using namespace android;
+
+// Simulates SensorService::threadLoop sending each polled batch to 50 connections, every one of
+// which listens to a different subset of an accelerometer, gyroscope and magnetometer running at
+// 400Hz. The argument is the number of 400Hz sample periods per batch: 1 when the HAL reports
+// every sample, more when the sensors are batched in the FIFO.
+
+static constexpr size_t kConnections = 50;
+static constexpr int kRateHz = 400;
+static constexpr int32_t kSensorHandles[] = {1, 2, 3};
+static constexpr size_t kSocketBufferSize = 100 * 1024;
+
+struct Connection {
+    sp<BitTube> tube;
+    std::set<int32_t> sensors;
+    SensorEventSpans spans;
+};
+
+static std::vector<sensors_event_t> makeBatch(int samplePeriods) {
+    std::vector<sensors_event_t> batch;
+    for (int i = 0; i < samplePeriods; i++) {
+        for (int32_t handle : kSensorHandles) {
+            sensors_event_t event = {};
+            event.version = sizeof(sensors_event_t);
+            event.sensor = handle;
+            event.type = handle;
+            event.timestamp = int64_t(i) * 1000000000 / kRateHz;
+            batch.push_back(event);
+        }
+    }
+    return batch;
+}
+
+static std::vector<std::unique_ptr<Connection>> makeConnections(State& state) {
+    std::vector<std::unique_ptr<Connection>> connections;
+    for (size_t i = 0; i < kConnections; i++) {
+        auto connection = std::make_unique<Connection>();
+        connection->tube = new BitTube(kSocketBufferSize);
+        if (connection->tube->initCheck() != NO_ERROR) {
+            state.SkipWithError("Failed to create BitTube");
+            return {};
+        }
+        // Every connection gets a different non-empty subset of the sensors.
+        const size_t mask = i % 7 + 1;
+        for (size_t s = 0; s < std::size(kSensorHandles); s++) {
+            if (mask & (1 << s)) {
+                connection->sensors.insert(kSensorHandles[s]);
+            }
+        }
+        connections.push_back(std::move(connection));
+    }
+    return connections;
+}
+
+// Reads the events back as the app would, so that the socket buffers never fill up.
+static void drain(const Connection& connection, std::vector<sensors_event_t>& readBuffer) {
+    while (BitTube::recvObjects(connection.tube, readBuffer.data(), readBuffer.size()) > 0) {
+    }
+}
+
+static void setCounters(State& state, size_t eventsPerBatch) {
+    state.SetItemsProcessed(state.iterations() * eventsPerBatch);
+    state.counters["batches/s"] = Counter(state.iterations(), Counter::kIsRate);
+}
+
+// What sendEvents() did before SensorEventSpans: copy each connection's events into a scratch
+// buffer, then write the scratch buffer.
+static void BM_fanOutCopyPerConnection(State& state) {
+    const auto batch = makeBatch(state.range(0));
+    auto connections = makeConnections(state);
+    std::vector<sensors_event_t> scratch(batch.size());
+    std::vector<sensors_event_t> readBuffer(batch.size());
+
+    for (auto _ : state) {
+        for (const auto& connection : connections) {
+            size_t count = 0;
+            for (const sensors_event_t& event : batch) {
+                if (connection->sensors.count(event.sensor)) {
+                    scratch[count++] = event;
+                }
+            }
+            BitTube::sendObjects(connection->tube, scratch.data(), count);
+            drain(*connection, readBuffer);
+        }
+    }
+    setCounters(state, batch.size());
+}
+BENCHMARK(BM_fanOutCopyPerConnection)->Arg(1)->Arg(10)->Arg(40);
+
+static void BM_fanOutGatheredSpans(State& state) {
+    const auto batch = makeBatch(state.range(0));
+    auto connections = makeConnections(state);
+    std::vector<sensors_event_t> readBuffer(batch.size());
+
+    for (auto _ : state) {
+        for (const auto& connection : connections) {
+            connection->spans.clear();
+            for (const sensors_event_t& event : batch) {
+                if (connection->sensors.count(event.sensor)) {
+                    connection->spans.add(&event);
+                }
+            }
+            connection->spans.write(connection->tube);
+            drain(*connection, readBuffer);
+        }
+    }
+    setCounters(state, batch.size());
+}
+BENCHMARK(BM_fanOutGatheredSpans)->Arg(1)->Arg(10)->Arg(40);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SensorFusionBenchmarks"
+
+#include <benchmark/benchmark.h>
+#include <hardware/sensors.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../BatchFusion.h"
+
+using ::benchmark::Counter;
+using ::benchmark::State;
+
+using namespace android;
+
+// Replays an IMU log through the fusion the way SensorService::threadLoop does, deriving the
+// rotation vector and gravity virtual sensors for every accelerometer event.
+//
+// The log is read from the file named by $SENSOR_FUSION_IMU_LOG, one event per line as
+// "<timestamp ns> <sensor type> <x> <y> <z>". Without it, a 20s log of a device swaying at 400Hz
+// is synthesized along with its true orientation, so the accuracy of the estimate can be checked.
+//
+// Before timing, every benchmark checks that its outputs match those of replaying one event at a
+// time, and that the estimate stays close to the true orientation.
+
+static constexpr int kRateHz = 400;
+static constexpr int kMagRateHz = 100;
+static constexpr float kDurationS = 20;
+// The fusion needs a couple of seconds to converge before its accuracy is checked.
+static constexpr float kSettleS = 3;
+static constexpr float kMaxErrorDegrees = 2;
+static constexpr float kParityTolerance = 1e-6f;
+
+struct ImuLog {
+    std::vector<sensors_event_t> events;
+    // For synthesized logs, the true world-to-device rotation at every accelerometer event.
+    std::vector<mat33_t> truth;
+};
+
+// The outputs of the virtual sensors for one accelerometer event.
+struct VirtualOutputs {
+    bool valid;
+    vec4_t rotationVector;
+    vec3_t gravity;
+};
+
+static vec3_t vec3(float x, float y, float z) {
+    vec3_t v;
+    v.x = x;
+    v.y = y;
+    v.z = z;
+    return v;
+}
+
+static sensors_event_t makeEvent(int type, int64_t timestamp, const vec3_t& v) {
+    sensors_event_t event = {};
+    event.version = sizeof(sensors_event_t);
+    event.type = type;
+    event.timestamp = timestamp;
+    event.data[0] = v.x;
+    event.data[1] = v.y;
+    event.data[2] = v.z;
+    return event;
+}
+
+// Rotation by angle around the unit axis, from the device to the world.
+static mat33_t rotation(const vec3_t& axis, float angle) {
+    // Rodrigues' formula, with k the cross product matrix of the axis. Matrices are column-major.
+    mat33_t k(0.0f);
+    k[1][0] = -axis.z;
+    k[2][0] = axis.y;
+    k[0][1] = axis.z;
+    k[2][1] = -axis.x;
+    k[0][2] = -axis.y;
+    k[1][2] = axis.x;
+    const mat33_t I(1);
+    return I + k * sinf(angle) + k * k * (1 - cosf(angle));
+}
+
+static ImuLog synthesizeLog() {
+    ImuLog log;
+    std::mt19937 random(42);
+    std::normal_distribution<float> noise(0, 1);
+    const auto noisy = [&](const vec3_t& v, float sigma) {
+        return v + vec3(noise(random) * sigma, noise(random) * sigma, noise(random) * sigma);
+    };
+
+    const vec3_t axis = normalize(vec3(0.3f, -0.5f, 0.8f));
+    const vec3_t gravity = vec3(0, 0, GRAVITY_EARTH);
+    const vec3_t magneticField = vec3(0, 22, -40);
+    const vec3_t gyroBias = vec3(0.01f, -0.005f, 0.002f);
+    const float amplitude = 0.8f;
+    const float frequency = 0.5f;
+
+    const int64_t periodNs = 1000000000LL / kRateHz;
+    for (int i = 0; i < kDurationS * kRateHz; i++) {
+        const int64_t t = i * periodNs;
+        const float s = t / 1e9f;
+        const float phase = 2 * float(M_PI) * frequency * s;
+        const float angle = amplitude * sinf(phase);
+        const float angularRate = amplitude * 2 * float(M_PI) * frequency * cosf(phase);
+        const mat33_t worldToDevice = transpose(rotation(axis, angle));
+
+        log.events.push_back(
+                makeEvent(SENSOR_TYPE_GYROSCOPE, t, noisy(axis * angularRate + gyroBias, 0.002f)));
+        log.events.push_back(
+                makeEvent(SENSOR_TYPE_ACCELEROMETER, t + 1000, noisy(worldToDevice * gravity, 0.02f)));
+        log.truth.push_back(worldToDevice);
+        if (i % (kRateHz / kMagRateHz) == 0) {
+            log.events.push_back(makeEvent(SENSOR_TYPE_MAGNETIC_FIELD, t + 2000,
+                                           noisy(worldToDevice * magneticField, 0.3f)));
+        }
+    }
+    return log;
+}
+
+static ImuLog readLog(const char* path) {
+    ImuLog log;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return log;
+    }
+    long long timestamp;
+    int type;
+    vec3_t v;
+    while (fscanf(file, "%lld %d %f %f %f", &timestamp, &type, &v.x, &v.y, &v.z) == 5) {
+        log.events.push_back(makeEvent(type, timestamp, v));
+    }
+    fclose(file);
+    return log;
+}
+
+static const ImuLog& getLog() {
+    static const ImuLog log = [] {
+        const char* path = getenv("SENSOR_FUSION_IMU_LOG");
+        return path ? readLog(path) : synthesizeLog();
+    }();
+    return log;
+}
+
+static VirtualOutputs computeOutputs(const BatchFusion::Estimate& estimate) {
+    VirtualOutputs outputs = {};
+    outputs.valid = estimate.hasEstimate[FUSION_9AXIS] && estimate.hasEstimate[FUSION_NOMAG];
+    if (outputs.valid) {
+        // As RotationVectorSensor and GravitySensor compute them.
+        outputs.rotationVector = estimate.attitude[FUSION_9AXIS];
+        outputs.gravity = estimate.rotationMatrix[FUSION_NOMAG][2] * GRAVITY_EARTH;
+    }
+    return outputs;
+}
+
+// Replays the log in batches of batchSize events, appending the virtual sensor outputs of every
+// accelerometer event.
+static void replay(const ImuLog& log, size_t batchSize, std::vector<VirtualOutputs>* outputs) {
+    BatchFusion fusion;
+    fusion.setEnabled(FUSION_9AXIS, true);
+    fusion.setEnabled(FUSION_NOMAG, true);
+    outputs->clear();
+    for (size_t start = 0; start < log.events.size(); start += batchSize) {
+        const size_t count = std::min(batchSize, log.events.size() - start);
+        fusion.processBatch(&log.events[start], count);
+        for (size_t i = 0; i < count; i++) {
+            if (log.events[start + i].type == SENSOR_TYPE_ACCELEROMETER) {
+                outputs->push_back(computeOutputs(fusion.getEstimate(i)));
+            }
+        }
+    }
+}
+
+static float maxDifference(const std::vector<VirtualOutputs>& a,
+                           const std::vector<VirtualOutputs>& b) {
+    if (a.size() != b.size()) {
+        return INFINITY;
+    }
+    float difference = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].valid != b[i].valid) {
+            return INFINITY;
+        }
+        difference = std::max({difference, length(a[i].rotationVector - b[i].rotationVector),
+                               length(a[i].gravity - b[i].gravity) / GRAVITY_EARTH});
+    }
+    return difference;
+}
+
+// Returns the largest angle, in degrees, between the estimated and true gravity directions once
+// the fusion has settled.
+static float maxErrorDegrees(const ImuLog& log, const std::vector<VirtualOutputs>& outputs) {
+    float error = 0;
+    for (size_t i = kSettleS * kRateHz; i < outputs.size() && i < log.truth.size(); i++) {
+        if (!outputs[i].valid) {
+            return INFINITY;
+        }
+        const vec3_t expected = log.truth[i][2];
+        const float cosine = dot_product(normalize(outputs[i].gravity), expected);
+        error = std::max(error, acosf(std::min(1.0f, cosine)) * 180 / float(M_PI));
+    }
+    return error;
+}
+
+static bool checkAccuracy(State& state, size_t batchSize) {
+    const ImuLog& log = getLog();
+    if (log.events.empty()) {
+        state.SkipWithError("Failed to read the IMU log");
+        return false;
+    }
+
+    std::vector<VirtualOutputs> reference;
+    std::vector<VirtualOutputs> outputs;
+    replay(log, 1, &reference);
+    replay(log, batchSize, &outputs);
+
+    const float difference = maxDifference(reference, outputs);
+    state.counters["parity_diff"] = difference;
+    if (difference > kParityTolerance) {
+        state.SkipWithError("Batched replay differs from replaying one event at a time");
+        return false;
+    }
+    if (!log.truth.empty()) {
+        const float error = maxErrorDegrees(log, outputs);
+        state.counters["max_error_deg"] = error;
+        if (error > kMaxErrorDegrees) {
+            state.SkipWithError("Fusion estimate is too far from the true orientation");
+            return false;
+        }
+    }
+    return true;
+}
+
+// One event per call, as SensorService used to feed the fusion.
+static void BM_fusionReplayPerEvent(State& state) {
+    if (!checkAccuracy(state, 1)) {
+        return;
+    }
+    const ImuLog& log = getLog();
+    std::vector<VirtualOutputs> outputs;
+    for (auto _ : state) {
+        replay(log, 1, &outputs);
+        benchmark::DoNotOptimize(outputs.data());
+    }
+    state.SetItemsProcessed(state.iterations() * log.events.size());
+}
+BENCHMARK(BM_fusionReplayPerEvent)->Unit(benchmark::kMillisecond);
+
+// Whole poll batches per call; the argument is the number of events per batch.
+static void BM_fusionReplayBatch(State& state) {
+    const size_t batchSize = state.range(0);
+    if (!checkAccuracy(state, batchSize)) {
+        return;
+    }
+    const ImuLog& log = getLog();
+    std::vector<VirtualOutputs> outputs;
+    for (auto _ : state) {
+        replay(log, batchSize, &outputs);
+        benchmark::DoNotOptimize(outputs.data());
+    }
+    state.SetItemsProcessed(state.iterations() * log.events.size());
+}
+BENCHMARK(BM_fusionReplayBatch)->Arg(16)->Arg(128)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "../Fusion.h"
+
+namespace android {
+namespace {
+
+using mat66_t = mat<mat33_t, 2, 2>;
+
+// The covariance prediction as Fusion::predict computed it before it exploited Phi's structure.
+mat66_t referencePropagateCovariance(const mat66_t& P, const mat66_t& Phi, const mat66_t& GQGt) {
+    return Phi*P*transpose(Phi) + GQGt;
+}
+
+// Builds Phi the way Fusion::predict does, for a rotation rate w over dT.
+mat66_t makePhi(const vec3_t& w, float dT) {
+    const mat33_t I33(1);
+    const mat33_t I33dT(dT);
+    mat33_t wx(0);
+    wx[0].y = w.z;  wx[1].x = -w.z;
+    wx[0].z = -w.y; wx[2].x = w.y;
+    wx[1].z = w.x;  wx[2].y = -w.x;
+    const mat33_t wx2(wx*wx);
+    const float lwedT = length(w)*dT;
+    const float ilwe = 1.f/length(w);
+    const float k0 = (1-cosf(lwedT))*(ilwe*ilwe);
+    const float k1 = sinf(lwedT);
+
+    mat66_t Phi;
+    Phi[0][0] = I33 - wx*(k1*ilwe) + wx2*k0;
+    Phi[1][0] = wx*k0 - I33dT - wx2*(ilwe*ilwe*ilwe)*(lwedT-k1);
+    Phi[0][1] = 0;
+    Phi[1][1] = 1;
+    return Phi;
+}
+
+mat33_t randomMatrix(std::mt19937& random, float scale) {
+    std::uniform_real_distribution<float> distribution(-scale, scale);
+    mat33_t m;
+    for (size_t i = 0; i < 3; i++) {
+        for (size_t j = 0; j < 3; j++) {
+            m[i][j] = distribution(random);
+        }
+    }
+    return m;
+}
+
+// A random symmetric positive definite covariance.
+mat66_t randomCovariance(std::mt19937& random) {
+    mat66_t A;
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t j = 0; j < 2; j++) {
+            A[i][j] = randomMatrix(random, 1e-2f);
+        }
+    }
+    mat66_t P = A*transpose(A);
+    P[0][0] += mat33_t(1e-4f);
+    P[1][1] += mat33_t(1e-6f);
+    return P;
+}
+
+// The largest difference between two covariances, relative to the largest entry of |expected|.
+float relativeDifference(const mat66_t& expected, const mat66_t& actual) {
+    float scale = 0;
+    float difference = 0;
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t j = 0; j < 2; j++) {
+            for (size_t k = 0; k < 3; k++) {
+                for (size_t l = 0; l < 3; l++) {
+                    scale = std::max(scale, std::fabs(expected[i][j][k][l]));
+                    difference = std::max(difference,
+                                          std::fabs(expected[i][j][k][l] - actual[i][j][k][l]));
+                }
+            }
+        }
+    }
+    return difference / scale;
+}
+
+TEST(FusionTest, propagateCovarianceMatchesFullProduct) {
+    std::mt19937 random(42);
+    for (int i = 0; i < 1000; i++) {
+        const vec3_t w(randomMatrix(random, 10.f)[0]);
+        const mat66_t Phi = makePhi(w, 1.f / 400);
+        const mat66_t P = randomCovariance(random);
+        const mat66_t GQGt = randomCovariance(random);
+
+        mat66_t actual = P;
+        Fusion::propagateCovariance(actual, Phi, GQGt);
+        EXPECT_LT(relativeDifference(referencePropagateCovariance(P, Phi, GQGt), actual), 1e-5f)
+                << "iteration " << i;
+    }
+}
+
+// Propagates the same covariance for 10s of 400Hz gyro events both ways, so that rounding
+// differences get the chance to accumulate.
+TEST(FusionTest, propagateCovarianceTracksFullProductOverTime) {
+    std::mt19937 random(7);
+    mat66_t expected = randomCovariance(random);
+    mat66_t actual = expected;
+    mat66_t GQGt;
+    GQGt[0][0] = mat33_t(1e-7f / 400);
+    GQGt[1][0] = 0;
+    GQGt[0][1] = 0;
+    GQGt[1][1] = mat33_t(1e-12f / 400);
+
+    for (int i = 0; i < 4000; i++) {
+        const vec3_t w(randomMatrix(random, 3.f)[0]);
+        const mat66_t Phi = makePhi(w, 1.f / 400);
+        expected = referencePropagateCovariance(expected, Phi, GQGt);
+        Fusion::propagateCovariance(actual, Phi, GQGt);
+    }
+    EXPECT_LT(relativeDifference(expected, actual), 1e-4f);
+}
+
+} // namespace
+} // namespace android
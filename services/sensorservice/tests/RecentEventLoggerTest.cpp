@@ -0,0 +1,168 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <time.h>
+#include <utils/Timers.h>
+
+#include <vector>
+
+#include "../RecentEventLogger.h"
+
+namespace android {
+namespace SensorServiceUtil {
+namespace {
+
+constexpr int64_t kDayNs = 24 * 3600 * 1000000000LL;
+// Wall times are taken when the event is added, so the test allows for a slow machine.
+constexpr int64_t kWallToleranceMs = 5000;
+
+int64_t wallTimeMs() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000LL + ns2ms(now.tv_nsec);
+}
+
+sensors_event_t makeEvent(int type, int64_t timestamp, float value) {
+    sensors_event_t event = {};
+    event.type = type;
+    event.timestamp = timestamp;
+    for (size_t i = 0; i < 16; i++) {
+        event.data[i] = value + i;
+    }
+    return event;
+}
+
+// Exposes the decoded records.
+class TestLogger : public RecentEventLogger {
+public:
+    using RecentEventLogger::RecentEventLogger;
+    using RecentEventLogger::SensorEventLog;
+
+    std::vector<SensorEventLog> logs() const {
+        std::vector<SensorEventLog> logs;
+        EXPECT_TRUE(readLogs(&logs));
+        return logs;
+    }
+};
+
+TEST(RecentEventLoggerTest, decodesWhatWasEncoded) {
+    TestLogger logger(SENSOR_TYPE_ACCELEROMETER);
+    EXPECT_TRUE(logger.isEmpty());
+    EXPECT_TRUE(logger.logs().empty());
+
+    const int64_t wallBefore = wallTimeMs();
+    // Timestamps above 32 bits, negative and fractional data.
+    logger.addEvent(makeEvent(SENSOR_TYPE_ACCELEROMETER, 5 * kDayNs + 123456789, -9.81f));
+    logger.addEvent(makeEvent(SENSOR_TYPE_ACCELEROMETER, 5 * kDayNs + 223456789, 0.125f));
+    EXPECT_FALSE(logger.isEmpty());
+
+    const auto logs = logger.logs();
+    ASSERT_EQ(2u, logs.size());
+    EXPECT_EQ(5 * kDayNs + 223456789, logs[0].mTimestamp);
+    EXPECT_EQ(5 * kDayNs + 123456789, logs[1].mTimestamp);
+    for (size_t k = 0; k < 3; k++) {
+        EXPECT_EQ(0.125f + k, logs[0].mData[k]);
+        EXPECT_EQ(-9.81f + k, logs[1].mData[k]);
+    }
+    for (const auto& log : logs) {
+        EXPECT_GE(log.mWallTimeMs, wallBefore);
+        EXPECT_LE(log.mWallTimeMs, wallTimeMs() + kWallToleranceMs);
+    }
+}
+
+TEST(RecentEventLoggerTest, keepsNewestEventsWhenFull) {
+    // Keeps 10 events.
+    TestLogger logger(SENSOR_TYPE_GYROSCOPE);
+    for (int i = 0; i < 25; i++) {
+        logger.addEvent(makeEvent(SENSOR_TYPE_GYROSCOPE, (i + 1) * 1000000LL, i));
+    }
+
+    const auto logs = logger.logs();
+    ASSERT_EQ(10u, logs.size());
+    for (size_t i = 0; i < logs.size(); i++) {
+        EXPECT_EQ(int64_t(25 - i) * 1000000LL, logs[i].mTimestamp);
+        EXPECT_EQ(float(24 - i), logs[i].mData[0]);
+    }
+}
+
+TEST(RecentEventLoggerTest, keepsFullStepCounter) {
+    TestLogger logger(SENSOR_TYPE_STEP_COUNTER);
+    sensors_event_t event = {};
+    event.type = SENSOR_TYPE_STEP_COUNTER;
+    event.timestamp = 1000000;
+    event.u64.step_counter = (uint64_t(1) << 40) + 7;
+    logger.addEvent(event);
+
+    const auto logs = logger.logs();
+    ASSERT_EQ(1u, logs.size());
+    EXPECT_EQ((uint64_t(1) << 40) + 7, logs[0].mStepCounter);
+}
+
+TEST(RecentEventLoggerTest, populatesLastEventUntilStale) {
+    TestLogger logger(SENSOR_TYPE_LIGHT);
+    sensors_event_t last;
+    EXPECT_FALSE(logger.populateLastEventIfCurrent(&last));
+
+    const sensors_event_t event = makeEvent(SENSOR_TYPE_LIGHT, 42, 300.f);
+    logger.addEvent(event);
+    ASSERT_TRUE(logger.populateLastEventIfCurrent(&last));
+    EXPECT_EQ(0, memcmp(&event, &last, sizeof(event)));
+
+    logger.setLastEventStale();
+    EXPECT_FALSE(logger.populateLastEventIfCurrent(&last));
+    // Stale events are still dumped.
+    EXPECT_EQ(1u, logger.logs().size());
+}
+
+TEST(RecentEventLoggerTest, keepsWallTimeAcrossLongGaps) {
+    // An on-change sensor may report once and then not again for weeks, while the wall clock
+    // keeps its pace with the timestamps.
+    TestLogger logger(SENSOR_TYPE_PROXIMITY);
+    const int64_t wallBefore = wallTimeMs();
+    logger.addEvent(makeEvent(SENSOR_TYPE_PROXIMITY, kDayNs, 5.f));
+    // 20 days still fit the 32-bit millisecond delta to the first event's offset.
+    logger.addEvent(makeEvent(SENSOR_TYPE_PROXIMITY, 21 * kDayNs, 0.f));
+
+    auto logs = logger.logs();
+    ASSERT_EQ(2u, logs.size());
+    // Both were added now, so the wall time follows the wall clock, not the timestamp.
+    for (const auto& log : logs) {
+        EXPECT_GE(log.mWallTimeMs, wallBefore);
+        EXPECT_LE(log.mWallTimeMs, wallTimeMs() + kWallToleranceMs);
+    }
+
+    // 40 more days don't fit, so the offset is rebased. The earlier events can't be decoded
+    // against the new offset and lose their wall time, but keep everything else.
+    logger.addEvent(makeEvent(SENSOR_TYPE_PROXIMITY, 61 * kDayNs, 5.f));
+    logger.addEvent(makeEvent(SENSOR_TYPE_PROXIMITY, 61 * kDayNs + 1000000, 0.f));
+    logs = logger.logs();
+    ASSERT_EQ(4u, logs.size());
+    for (size_t i = 0; i < 2; i++) {
+        EXPECT_GE(logs[i].mWallTimeMs, wallBefore);
+        EXPECT_LE(logs[i].mWallTimeMs, wallTimeMs() + kWallToleranceMs);
+    }
+    EXPECT_EQ(-1, logs[2].mWallTimeMs);
+    EXPECT_EQ(-1, logs[3].mWallTimeMs);
+    EXPECT_EQ(21 * kDayNs, logs[2].mTimestamp);
+    EXPECT_EQ(kDayNs, logs[3].mTimestamp);
+    EXPECT_EQ(5.f, logs[3].mData[0]);
+}
+
+} // namespace
+} // namespace SensorServiceUtil
+} // namespace android
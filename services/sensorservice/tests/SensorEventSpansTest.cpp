@@ -0,0 +1,185 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <limits.h>
+
+#include <vector>
+
+#include "../SensorEventSpans.h"
+
+namespace android {
+namespace {
+
+constexpr uint32_t kAckFlag = 1;
+
+class SensorEventSpansTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mEvents.resize(8);
+        for (size_t i = 0; i < mEvents.size(); i++) {
+            mEvents[i] = {};
+            mEvents[i].sensor = static_cast<int32_t>(i);
+        }
+    }
+
+    // Checks that events holds the sensors in order, and that only the one at ackedIndex (if
+    // any) has the ack flag set.
+    static void expectSensors(sensors_event_t const* events, const std::vector<int32_t>& sensors,
+                              int ackedIndex = -1) {
+        for (size_t i = 0; i < sensors.size(); i++) {
+            EXPECT_EQ(sensors[i], events[i].sensor) << "at " << i;
+            EXPECT_EQ(static_cast<int>(i) == ackedIndex ? kAckFlag : 0, events[i].flags)
+                    << "at " << i;
+        }
+    }
+
+    std::vector<sensors_event_t> mEvents;
+    SensorEventSpans mSpans;
+};
+
+TEST_F(SensorEventSpansTest, addMergesAdjacentEvents) {
+    mSpans.add(&mEvents[0], 2);
+    mSpans.add(&mEvents[2]);
+    EXPECT_EQ(3u, mSpans.count());
+    EXPECT_EQ(1u, mSpans.spanCount());
+    // A single span is returned in place.
+    EXPECT_EQ(&mEvents[0], mSpans.flatten());
+}
+
+TEST_F(SensorEventSpansTest, addKeepsInterleavedEventsApart) {
+    // Events of one sensor interleaved with another's get a span each.
+    mSpans.add(&mEvents[0]);
+    mSpans.add(&mEvents[2]);
+    mSpans.add(&mEvents[4]);
+    EXPECT_EQ(3u, mSpans.count());
+    EXPECT_EQ(3u, mSpans.spanCount());
+    expectSensors(mSpans.flatten(), {0, 2, 4});
+}
+
+TEST_F(SensorEventSpansTest, clearDropsSpansAndCopy) {
+    mSpans.add(&mEvents[0], 3);
+    mSpans.replaceWithCopy(1);
+    mSpans.clear();
+    EXPECT_EQ(0u, mSpans.count());
+    EXPECT_EQ(0u, mSpans.spanCount());
+
+    // A new batch can replace an event again.
+    mSpans.add(&mEvents[0], 3);
+    mSpans.replaceWithCopy(1)->flags = kAckFlag;
+    expectSensors(mSpans.flatten(), {0, 1, 2}, 1);
+}
+
+TEST_F(SensorEventSpansTest, replaceWithCopySplitsSpanAroundCopy) {
+    mSpans.add(&mEvents[0], 5);
+    sensors_event_t* copy = mSpans.replaceWithCopy(2);
+    ASSERT_NE(&mEvents[2], copy);
+    copy->flags = kAckFlag;
+
+    EXPECT_EQ(5u, mSpans.count());
+    EXPECT_EQ(3u, mSpans.spanCount());
+    expectSensors(mSpans.flatten(), {0, 1, 2, 3, 4}, 2);
+    // The shared buffer is left alone.
+    EXPECT_EQ(0u, mEvents[2].flags);
+}
+
+TEST_F(SensorEventSpansTest, replaceWithCopyOfFirstEvent) {
+    mSpans.add(&mEvents[0], 3);
+    mSpans.replaceWithCopy(0)->flags = kAckFlag;
+
+    EXPECT_EQ(2u, mSpans.spanCount());
+    expectSensors(mSpans.flatten(), {0, 1, 2}, 0);
+}
+
+TEST_F(SensorEventSpansTest, replaceWithCopyOfLastEvent) {
+    mSpans.add(&mEvents[0], 3);
+    mSpans.replaceWithCopy(2)->flags = kAckFlag;
+
+    EXPECT_EQ(2u, mSpans.spanCount());
+    expectSensors(mSpans.flatten(), {0, 1, 2}, 2);
+}
+
+TEST_F(SensorEventSpansTest, replaceWithCopyOfSingleEventSpan) {
+    mSpans.add(&mEvents[0]);
+    mSpans.add(&mEvents[2]);
+    mSpans.add(&mEvents[4]);
+    mSpans.replaceWithCopy(1)->flags = kAckFlag;
+
+    // The copy takes the place of the span.
+    EXPECT_EQ(3u, mSpans.spanCount());
+    expectSensors(mSpans.flatten(), {0, 2, 4}, 1);
+}
+
+TEST_F(SensorEventSpansTest, replaceWithCopyInLaterSpan) {
+    mSpans.add(&mEvents[0], 2);
+    mSpans.add(&mEvents[3], 3);
+    mSpans.replaceWithCopy(3)->flags = kAckFlag;
+
+    EXPECT_EQ(5u, mSpans.count());
+    EXPECT_EQ(4u, mSpans.spanCount());
+    expectSensors(mSpans.flatten(), {0, 1, 3, 4, 5}, 3);
+}
+
+TEST_F(SensorEventSpansTest, replaceWithCopyOfOnlyEvent) {
+    mSpans.add(&mEvents[0]);
+    sensors_event_t* copy = mSpans.replaceWithCopy(0);
+    copy->flags = kAckFlag;
+
+    EXPECT_EQ(1u, mSpans.spanCount());
+    EXPECT_EQ(copy, mSpans.flatten());
+    expectSensors(copy, {0}, 0);
+}
+
+TEST_F(SensorEventSpansTest, writeSendsAllSpansAsOneMessage) {
+    sp<BitTube> tube = new BitTube();
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+
+    mSpans.add(&mEvents[0], 2);
+    mSpans.add(&mEvents[3]);
+    mSpans.add(&mEvents[5], 2);
+    mSpans.replaceWithCopy(2)->flags = kAckFlag;
+    ASSERT_EQ(5, mSpans.write(tube));
+
+    sensors_event_t received[8];
+    ASSERT_EQ(5, BitTube::recvObjects(tube, received, 8));
+    expectSensors(received, {0, 1, 3, 5, 6}, 2);
+    EXPECT_EQ(0, BitTube::recvObjects(tube, received, 8));
+}
+
+TEST_F(SensorEventSpansTest, writeFlattensMoreSpansThanIovMax) {
+    sp<BitTube> tube = new BitTube((IOV_MAX + 1) * 2 * sizeof(sensors_event_t));
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+
+    mEvents.resize(2 * (IOV_MAX + 1));
+    for (size_t i = 0; i < mEvents.size(); i++) {
+        mEvents[i] = {};
+        mEvents[i].sensor = static_cast<int32_t>(i);
+    }
+    for (size_t i = 0; i < mEvents.size(); i += 2) {
+        mSpans.add(&mEvents[i]);
+    }
+    ASSERT_EQ(static_cast<size_t>(IOV_MAX + 1), mSpans.spanCount());
+    ASSERT_EQ(IOV_MAX + 1, mSpans.write(tube));
+
+    std::vector<sensors_event_t> received(IOV_MAX + 1);
+    ASSERT_EQ(IOV_MAX + 1, BitTube::recvObjects(tube, received.data(), received.size()));
+    for (size_t i = 0; i < received.size(); i++) {
+        EXPECT_EQ(static_cast<int32_t>(2 * i), received[i].sensor);
+    }
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how long events take to reach an app while many other clients keep enabling and
+// disabling sensors. Registrations used to hold SensorService's main lock across the HAL calls,
+// stalling event delivery to every connection for as long as the HAL took to reconfigure.
+//
+// usage: test-sensorservice-stress [toggling threads] [seconds]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <android/sensor.h>
+#include <sensor/Sensor.h>
+#include <sensor/SensorEventQueue.h>
+#include <sensor/SensorManager.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+static constexpr int kDefaultThreads = 16;
+static constexpr int kDefaultSeconds = 30;
+static constexpr int32_t kListenerPeriodUs = 5000;
+
+static std::atomic<bool> sDone(false);
+static std::atomic<uint64_t> sToggles(0);
+static std::atomic<uint64_t> sToggleErrors(0);
+
+// Repeatedly enables and disables the sensors on its own connection, at varying rates so that
+// every registration reconfigures the HAL.
+static void toggle(SensorManager& mgr, const std::vector<Sensor const*>& sensors, int id) {
+    sp<SensorEventQueue> q = mgr.createEventQueue(String8::format("stress%d", id));
+    if (q == nullptr) {
+        sToggleErrors++;
+        return;
+    }
+    ASensorEvent buffer[16];
+    for (int i = 0; !sDone; i++) {
+        Sensor const* sensor = sensors[(id + i) % sensors.size()];
+        const int32_t periodUs = std::max(sensor->getMinDelay(), (1 + (id + i) % 4) * 10000);
+        if (q->enableSensor(sensor, periodUs) != NO_ERROR) {
+            sToggleErrors++;
+        }
+        // Throw away whatever was delivered to this connection.
+        while (q->read(buffer, 16) > 0) {
+        }
+        if (q->disableSensor(sensor) != NO_ERROR) {
+            sToggleErrors++;
+        }
+        sToggles++;
+    }
+}
+
+static nsecs_t percentile(const std::vector<nsecs_t>& sorted, int p) {
+    return sorted.empty() ? 0 : sorted[(sorted.size() - 1) * p / 100];
+}
+
+int main(int argc, char** argv) {
+    const int threads = argc > 1 ? atoi(argv[1]) : kDefaultThreads;
+    const int seconds = argc > 2 ? atoi(argv[2]) : kDefaultSeconds;
+
+    SensorManager& mgr = SensorManager::getInstanceForPackage(String16("Sensor Service Stress"));
+
+    std::vector<Sensor const*> sensors;
+    for (int type : {Sensor::TYPE_ACCELEROMETER, Sensor::TYPE_GYROSCOPE,
+                     Sensor::TYPE_MAGNETIC_FIELD}) {
+        Sensor const* sensor = mgr.getDefaultSensor(type);
+        if (sensor != nullptr) {
+            sensors.push_back(sensor);
+        }
+    }
+    if (sensors.empty()) {
+        printf("no accelerometer, gyroscope or magnetometer\n");
+        return 1;
+    }
+
+    // The listener stays registered to the first sensor for the whole run.
+    sp<SensorEventQueue> listener = mgr.createEventQueue(String8("listener"));
+    if (listener == nullptr || listener->enableSensor(sensors[0], kListenerPeriodUs) != NO_ERROR) {
+        printf("failed to enable %s\n", sensors[0]->getName().string());
+        return 1;
+    }
+
+    std::vector<std::thread> togglers;
+    for (int i = 0; i < threads; i++) {
+        togglers.emplace_back(toggle, std::ref(mgr), std::cref(sensors), i);
+    }
+
+    // Sensor timestamps are in the elapsedRealtimeNanos() time base.
+    std::vector<nsecs_t> latencies;
+    ASensorEvent buffer[16];
+    const nsecs_t end = systemTime(SYSTEM_TIME_BOOTTIME) + seconds_to_nanoseconds(seconds);
+    while (systemTime(SYSTEM_TIME_BOOTTIME) < end) {
+        listener->waitForEvent();
+        ssize_t n;
+        while ((n = listener->read(buffer, 16)) > 0) {
+            const nsecs_t now = systemTime(SYSTEM_TIME_BOOTTIME);
+            for (ssize_t i = 0; i < n; i++) {
+                if (buffer[i].type == sensors[0]->getType()) {
+                    latencies.push_back(now - buffer[i].timestamp);
+                }
+            }
+        }
+    }
+
+    sDone = true;
+    for (auto& t : togglers) {
+        t.join();
+    }
+    listener->disableSensor(sensors[0]);
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%d threads, %" PRIu64 " enable/disable cycles (%" PRIu64 " errors) in %ds\n", threads,
+           sToggles.load(), sToggleErrors.load(), seconds);
+    printf("%zu %s events, latency p50=%.2fms p99=%.2fms max=%.2fms\n", latencies.size(),
+           sensors[0]->getName().string(), percentile(latencies, 50) / 1e6,
+           percentile(latencies, 99) / 1e6,
+           latencies.empty() ? 0 : latencies.back() / 1e6);
+    return sToggleErrors == 0 && !latencies.empty() ? 0 : 1;
+}
@@ -484,6 +484,10 @@ SurfaceFlinger::SurfaceFlinger(Factory& factory) : SurfaceFlinger(factory, SkipI
     enableSdrDimming = property_get_bool("debug.sf.enable_sdr_dimming", enable_sdr_dimming(false));
 
     enableLatchUnsignaled = base::GetBoolProperty("debug.sf.latch_unsignaled"s, false);
+
+    // Record fence signal times from a single epoll thread instead of polling
+    // every fence from the timelines, FrameTimeline and TimeStats.
+    FenceWatcher::setEnabled(base::GetBoolProperty("debug.sf.enable_fence_watcher"s, false));
 }
 
 SurfaceFlinger::~SurfaceFlinger() = default;
@@ -2436,6 +2440,13 @@ void SurfaceFlinger::postComposition() {
     if (ATRACE_ENABLED()) {
         // getTotalSize returns the total number of buffers that were allocated by SurfaceFlinger
         ATRACE_INT64("Total Buffer Size", GraphicBufferAllocator::get().getTotalSize());
+
+        const FenceTime::Stats fenceStats = FenceTime::getStats();
+        ATRACE_INT64("FenceTime queries",
+                     fenceStats.signalTimeQueries - mLastFenceTimeStats.signalTimeQueries);
+        ATRACE_INT64("FenceTime queries avoided",
+                     fenceStats.queriesAvoided - mLastFenceTimeStats.queriesAvoided);
+        mLastFenceTimeStats = fenceStats;
     }
 }
 
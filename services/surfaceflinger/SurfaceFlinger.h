@@ -1264,6 +1264,8 @@ private:
     // Tracks layers that need to update a display's dirty region.
     std::vector<sp<Layer>> mLayersPendingRefresh;
     std::array<FenceWithFenceTime, 2> mPreviousPresentFences;
+    // FenceTime counters at the end of the previous composition, for per-frame tracing.
+    FenceTime::Stats mLastFenceTimeStats;
     // True if in the previous frame at least one layer was composed via the GPU.
     bool mHadClientComposition = false;
     // True if in the previous frame at least one layer was composed via HW Composer.